@@ -0,0 +1,424 @@
+#include <string.h>
+#include <algorithm>
+
+#include "gmqcc.h"
+
+/*
+ * Writes the final code as portable C for qcrt.h.  Each function with code
+ * becomes a C function whose statements work on the globals directly, the
+ * jumps turn into gotos between labels, and everything needing the state
+ * of the program (entities, strings, calls) goes through the runtime.
+ */
+
+static void cgen_string(FILE *fp, const char *str, size_t len) {
+    size_t i, column = 0;
+    fputc('"', fp);
+    for (i = 0; i < len; ++i) {
+        unsigned char c = str[i];
+        if (column >= 72) {
+            fputs("\"\n    \"", fp);
+            column = 0;
+        }
+        if (c == '"' || c == '\\') {
+            fprintf(fp, "\\%c", c);
+            column += 2;
+        } else if (c < 32 || c >= 127 || c == '?') {
+            /* always three digits so the next character can't extend it */
+            fprintf(fp, "\\%03o", c);
+            column += 4;
+        } else {
+            fputc(c, fp);
+            column++;
+        }
+    }
+    fputc('"', fp);
+}
+
+static void cgen_int(FILE *fp, int32_t value) {
+    if (value == INT32_MIN)
+        fprintf(fp, "-2147483647-1");
+    else
+        fprintf(fp, "%d", (int)value);
+}
+
+static const char *cgen_getstring(code_t *code, uint32_t str) {
+    if (str >= code->chars.size())
+        return "";
+    return &code->chars[0] + str;
+}
+
+/* the C function for the statements starting at `entry` */
+static void cgen_name(FILE *fp, int32_t entry) {
+    fprintf(fp, "qc_code_%d", (int)entry);
+}
+
+#define A(n) "qc_globals[%u]" n
+#define OPA  (unsigned)st.o1.u1
+#define OPB  (unsigned)st.o2.u1
+#define OPC  (unsigned)st.o3.u1
+
+static bool cgen_function(FILE *fp, code_t *code, const char *name, int32_t entry, size_t end) {
+    std::vector<bool> targets(end - entry, false);
+    size_t i;
+
+    /* find the statements jumped to so only those get a label */
+    for (i = entry; i < end; ++i) {
+        const prog_section_statement_t &st = code->statements[i];
+        int64_t to;
+        if (st.opcode == INSTR_IF || st.opcode == INSTR_IFNOT)
+            to = (int64_t)i + st.o2.s1;
+        else if (st.opcode == INSTR_GOTO)
+            to = (int64_t)i + st.o1.s1;
+        else
+            continue;
+        if (to >= entry && to < (int64_t)end)
+            targets[to - entry] = true;
+    }
+
+    fprintf(fp, "/* %s */\nstatic int ", name);
+    cgen_name(fp, entry);
+    fprintf(fp, "(qcrt_t *vm) {\n");
+
+    for (i = entry; i < end; ++i) {
+        const prog_section_statement_t &st = code->statements[i];
+        int64_t to = 0;
+
+        if (targets[i - entry])
+            fprintf(fp, "s%zu:\n", i);
+
+        if (st.opcode == INSTR_IF || st.opcode == INSTR_IFNOT || st.opcode == INSTR_GOTO) {
+            to = (int64_t)i + (st.opcode == INSTR_GOTO ? st.o1.s1 : st.o2.s1);
+            if (to < entry || to >= (int64_t)end) {
+                con_err("cannot emit C for `%s`: statement %zu jumps out of the function\n", name, i);
+                return false;
+            }
+        }
+
+        fprintf(fp, "    ");
+        switch (st.opcode) {
+            case INSTR_DONE:
+            case INSTR_RETURN:
+                fprintf(fp, "qc_globals[1].i = " A(".i; ") "qc_globals[2].i = " A(".i; ") "qc_globals[3].i = " A(".i;\n"),
+                        OPA, OPA+1, OPA+2);
+                fprintf(fp, "    return 0;\n");
+                break;
+
+            case INSTR_MUL_F:
+                fprintf(fp, A(".f = ") A(".f * ") A(".f;\n"), OPC, OPA, OPB);
+                break;
+            case INSTR_MUL_V:
+                fprintf(fp, A(".f = ") A(".f*") A(".f + ") A(".f*") A(".f + ") A(".f*") A(".f;\n"),
+                        OPC, OPA, OPB, OPA+1, OPB+1, OPA+2, OPB+2);
+                break;
+            case INSTR_MUL_FV:
+                fprintf(fp, "{ float f = " A(".f; ") A(".f = f * ") A(".f; ") A(".f = f * ") A(".f; ") A(".f = f * ") A(".f; }\n"),
+                        OPA, OPC, OPB, OPC+1, OPB+1, OPC+2, OPB+2);
+                break;
+            case INSTR_MUL_VF:
+                fprintf(fp, "{ float f = " A(".f; ") A(".f = f * ") A(".f; ") A(".f = f * ") A(".f; ") A(".f = f * ") A(".f; }\n"),
+                        OPB, OPC, OPA, OPC+1, OPA+1, OPC+2, OPA+2);
+                break;
+            case INSTR_DIV_F:
+                fprintf(fp, A(".f = ") A(".f != 0.0f ? ") A(".f / ") A(".f : 0;\n"), OPC, OPB, OPA, OPB);
+                break;
+
+            case INSTR_ADD_F:
+                fprintf(fp, A(".f = ") A(".f + ") A(".f;\n"), OPC, OPA, OPB);
+                break;
+            case INSTR_ADD_V:
+                fprintf(fp, A(".f = ") A(".f + ") A(".f; ") A(".f = ") A(".f + ") A(".f; ") A(".f = ") A(".f + ") A(".f;\n"),
+                        OPC, OPA, OPB, OPC+1, OPA+1, OPB+1, OPC+2, OPA+2, OPB+2);
+                break;
+            case INSTR_SUB_F:
+                fprintf(fp, A(".f = ") A(".f - ") A(".f;\n"), OPC, OPA, OPB);
+                break;
+            case INSTR_SUB_V:
+                fprintf(fp, A(".f = ") A(".f - ") A(".f; ") A(".f = ") A(".f - ") A(".f; ") A(".f = ") A(".f - ") A(".f;\n"),
+                        OPC, OPA, OPB, OPC+1, OPA+1, OPB+1, OPC+2, OPA+2, OPB+2);
+                break;
+
+            case INSTR_EQ_F:
+                fprintf(fp, A(".f = (") A(".f == ") A(".f);\n"), OPC, OPA, OPB);
+                break;
+            case INSTR_NE_F:
+                fprintf(fp, A(".f = (") A(".f != ") A(".f);\n"), OPC, OPA, OPB);
+                break;
+            case INSTR_LE:
+                fprintf(fp, A(".f = (") A(".f <= ") A(".f);\n"), OPC, OPA, OPB);
+                break;
+            case INSTR_GE:
+                fprintf(fp, A(".f = (") A(".f >= ") A(".f);\n"), OPC, OPA, OPB);
+                break;
+            case INSTR_LT:
+                fprintf(fp, A(".f = (") A(".f < ") A(".f);\n"), OPC, OPA, OPB);
+                break;
+            case INSTR_GT:
+                fprintf(fp, A(".f = (") A(".f > ") A(".f);\n"), OPC, OPA, OPB);
+                break;
+            case INSTR_EQ_V:
+                fprintf(fp, A(".f = (") A(".f == ") A(".f && ") A(".f == ") A(".f && ") A(".f == ") A(".f);\n"),
+                        OPC, OPA, OPB, OPA+1, OPB+1, OPA+2, OPB+2);
+                break;
+            case INSTR_NE_V:
+                fprintf(fp, A(".f = (") A(".f != ") A(".f || ") A(".f != ") A(".f || ") A(".f != ") A(".f);\n"),
+                        OPC, OPA, OPB, OPA+1, OPB+1, OPA+2, OPB+2);
+                break;
+            case INSTR_EQ_S:
+                fprintf(fp, A(".f = !strcmp(qcrt_getstring(vm, ") A(".i), qcrt_getstring(vm, ") A(".i));\n"), OPC, OPA, OPB);
+                break;
+            case INSTR_NE_S:
+                fprintf(fp, A(".f = !!strcmp(qcrt_getstring(vm, ") A(".i), qcrt_getstring(vm, ") A(".i));\n"), OPC, OPA, OPB);
+                break;
+            case INSTR_EQ_E:
+            case INSTR_EQ_FNC:
+                fprintf(fp, A(".f = (") A(".i == ") A(".i);\n"), OPC, OPA, OPB);
+                break;
+            case INSTR_NE_E:
+            case INSTR_NE_FNC:
+                fprintf(fp, A(".f = (") A(".i != ") A(".i);\n"), OPC, OPA, OPB);
+                break;
+
+            case INSTR_LOAD_F:
+            case INSTR_LOAD_S:
+            case INSTR_LOAD_ENT:
+            case INSTR_LOAD_FLD:
+            case INSTR_LOAD_FNC:
+                fprintf(fp, "if (qcrt_load(vm, " A(".i, ") A(".i, &") A(")) return 1;\n"), OPA, OPB, OPC);
+                break;
+            case INSTR_LOAD_V:
+                fprintf(fp, "if (qcrt_load_v(vm, " A(".i, ") A(".i, &") A(")) return 1;\n"), OPA, OPB, OPC);
+                break;
+            case INSTR_ADDRESS:
+                fprintf(fp, "if (qcrt_address(vm, " A(".i, ") A(".i, &") A(")) return 1;\n"), OPA, OPB, OPC);
+                break;
+
+            case INSTR_STORE_F:
+            case INSTR_STORE_S:
+            case INSTR_STORE_ENT:
+            case INSTR_STORE_FLD:
+            case INSTR_STORE_FNC:
+                fprintf(fp, A(".i = ") A(".i;\n"), OPB, OPA);
+                break;
+            case INSTR_STORE_V:
+                fprintf(fp, A(".i = ") A(".i; ") A(".i = ") A(".i; ") A(".i = ") A(".i;\n"),
+                        OPB, OPA, OPB+1, OPA+1, OPB+2, OPA+2);
+                break;
+            case INSTR_STOREP_F:
+            case INSTR_STOREP_S:
+            case INSTR_STOREP_ENT:
+            case INSTR_STOREP_FLD:
+            case INSTR_STOREP_FNC:
+                fprintf(fp, "if (qcrt_storep(vm, " A(".i, &") A(")) return 1;\n"), OPB, OPA);
+                break;
+            case INSTR_STOREP_V:
+                fprintf(fp, "if (qcrt_storep_v(vm, " A(".i, &") A(")) return 1;\n"), OPB, OPA);
+                break;
+
+            case INSTR_NOT_F:
+                fprintf(fp, A(".f = !QCRT_IS_TRUE(") A(".i);\n"), OPC, OPA);
+                break;
+            case INSTR_NOT_V:
+                fprintf(fp, A(".f = !") A(".f && !") A(".f && !") A(".f;\n"), OPC, OPA, OPA+1, OPA+2);
+                break;
+            case INSTR_NOT_S:
+                fprintf(fp, A(".f = !") A(".i || !*qcrt_getstring(vm, ") A(".i);\n"), OPC, OPA, OPA);
+                break;
+            case INSTR_NOT_ENT:
+            case INSTR_NOT_FNC:
+                fprintf(fp, A(".f = !") A(".i;\n"), OPC, OPA);
+                break;
+
+            case INSTR_IF:
+            case INSTR_IFNOT:
+                fprintf(fp, "if (%sQCRT_IS_TRUE(" A(".i)) {\n"), st.opcode == INSTR_IF ? "" : "!", OPA);
+                fprintf(fp, "        if (++vm->jumps >= vm->maxjumps) return qcrt_runaway(vm);\n");
+                fprintf(fp, "        goto s%d;\n    }\n", (int)to);
+                break;
+            case INSTR_GOTO:
+                fprintf(fp, "if (++vm->jumps == QCRT_GOTO_JUMPS) return qcrt_runaway(vm);\n");
+                fprintf(fp, "    goto s%d;\n", (int)to);
+                break;
+
+            case INSTR_CALL0:
+            case INSTR_CALL1:
+            case INSTR_CALL2:
+            case INSTR_CALL3:
+            case INSTR_CALL4:
+            case INSTR_CALL5:
+            case INSTR_CALL6:
+            case INSTR_CALL7:
+            case INSTR_CALL8:
+                fprintf(fp, "if (qcrt_call(vm, " A(".i, %d)) return 1;\n"), OPA, st.opcode - INSTR_CALL0);
+                break;
+
+            case INSTR_STATE:
+                fprintf(fp, "if (qcrt_state(vm, " A(".f, ") A(".i)) return 1;\n"), OPA, OPB);
+                break;
+
+            case INSTR_AND:
+                fprintf(fp, A(".f = QCRT_IS_TRUE(") A(".i) && QCRT_IS_TRUE(") A(".i);\n"), OPC, OPA, OPB);
+                break;
+            case INSTR_OR:
+                fprintf(fp, A(".f = QCRT_IS_TRUE(") A(".i) || QCRT_IS_TRUE(") A(".i);\n"), OPC, OPA, OPB);
+                break;
+            case INSTR_BITAND:
+                fprintf(fp, A(".f = ((int)") A(".f) & ((int)") A(".f);\n"), OPC, OPA, OPB);
+                break;
+            case INSTR_BITOR:
+                fprintf(fp, A(".f = ((int)") A(".f) | ((int)") A(".f);\n"), OPC, OPA, OPB);
+                break;
+
+            default:
+                con_err("cannot emit C for `%s`: unknown instruction %u\n", name, (unsigned int)st.opcode);
+                return false;
+        }
+    }
+
+    /* the interpreter would run on into the next function here */
+    switch (code->statements[end-1].opcode) {
+        case INSTR_DONE:
+        case INSTR_RETURN:
+        case INSTR_GOTO:
+            fprintf(fp, "}\n\n");
+            return true;
+    }
+    fprintf(fp, "    qcrt_error(vm, \"`%%s` ran off the end of %%s\", vm->prog->filename, ");
+    cgen_string(fp, name, strlen(name));
+    fprintf(fp, ");\n    return 1;\n}\n\n");
+    return true;
+}
+
+#undef A
+#undef OPA
+#undef OPB
+#undef OPC
+
+/*
+ * The program stays what code_write writes, `progname` is only used for
+ * the diagnostics of the runtime so they read like the ones of qcvm.
+ */
+bool code_write_c(code_t *code, const char *filename, const char *progname) {
+    std::vector<int32_t> entries;
+    int32_t self = -1, time = -1, think = -1, nextthink = -1, frame = -1;
+    FILE *fp;
+    size_t i;
+
+    if (!(fp = fopen(filename, "w"))) {
+        con_err("failed to open `%s` for writing\n", filename);
+        return false;
+    }
+
+    if (!OPTS_OPTION_BOOL(OPTION_QUIET))
+        con_out("writing '%s'\n", filename);
+
+    /* each function spans from its entry up to the next one */
+    for (auto &it : code->functions)
+        if (it.entry >= 0 && (size_t)it.entry < code->statements.size())
+            entries.push_back(it.entry);
+    std::sort(entries.begin(), entries.end());
+    entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+
+    fprintf(fp, "/* generated by gmqcc from %s, do not edit */\n", progname);
+    fprintf(fp, "#include \"qcrt.h\"\n\n");
+
+    /* the globals get two more for a RETURN of the one at the end */
+    fprintf(fp, "static qcrt_slot_t qc_globals[%zu] = {", code->globals.size() + 2);
+    for (i = 0; i < code->globals.size(); ++i) {
+        fprintf(fp, !i ? "\n    " : i % 8 ? ", " : ",\n    ");
+        fputc('{', fp);
+        cgen_int(fp, code->globals[i]);
+        fputc('}', fp);
+    }
+    fprintf(fp, "\n};\n\n");
+
+    fprintf(fp, "static const char qc_strings[] =\n    ");
+    cgen_string(fp, code->chars.data(), code->chars.size());
+    fprintf(fp, ";\n\n");
+
+    for (auto &it : entries) {
+        fprintf(fp, "static int ");
+        cgen_name(fp, it);
+        fprintf(fp, "(qcrt_t *vm);\n");
+    }
+    fprintf(fp, "\n");
+
+    for (i = 0; i < entries.size(); ++i) {
+        size_t end = i + 1 < entries.size() ? entries[i+1] : code->statements.size();
+        const char *name = "<unknown>";
+        for (auto &it : code->functions) {
+            if (it.entry == entries[i]) {
+                name = cgen_getstring(code, it.name);
+                break;
+            }
+        }
+        if (!cgen_function(fp, code, name, entries[i], end)) {
+            fclose(fp);
+            return false;
+        }
+    }
+
+    fprintf(fp, "static const qcrt_function_t qc_functions[] = {\n");
+    for (auto &it : code->functions) {
+        const char *name = cgen_getstring(code, it.name);
+        fprintf(fp, "    { ");
+        cgen_string(fp, name, strlen(name));
+        fprintf(fp, ", %d, %u, %u, %d, { %u, %u, %u, %u, %u, %u, %u, %u }, ",
+                (int)it.entry, (unsigned)it.firstlocal, (unsigned)it.locals, (int)it.nargs,
+                it.argsize[0], it.argsize[1], it.argsize[2], it.argsize[3],
+                it.argsize[4], it.argsize[5], it.argsize[6], it.argsize[7]);
+        if (it.entry >= 0 && (size_t)it.entry < code->statements.size())
+            cgen_name(fp, it.entry);
+        else
+            fprintf(fp, "NULL");
+        fprintf(fp, " },\n");
+    }
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp, "static const qcrt_field_t qc_fields[] = {\n");
+    for (auto &it : code->fields) {
+        const char *name = cgen_getstring(code, it.name);
+        fprintf(fp, "    { %u, ", (unsigned)it.offset);
+        cgen_string(fp, name, strlen(name));
+        fprintf(fp, " },\n");
+        if      (!strcmp(name, "think"))     think     = it.offset;
+        else if (!strcmp(name, "nextthink")) nextthink = it.offset;
+        else if (!strcmp(name, "frame"))     frame     = it.offset;
+    }
+    fprintf(fp, "    { -1, NULL }\n};\n\n");
+
+    for (auto &it : code->defs) {
+        const char *name = cgen_getstring(code, it.name);
+        if      (!strcmp(name, "self")) self = it.offset;
+        else if (!strcmp(name, "time")) time = it.offset;
+    }
+
+    fprintf(fp, "static const qcrt_program_t qc_program = {\n    ");
+    cgen_string(fp, progname, strlen(progname));
+    fprintf(fp, ",\n"
+                "    qc_globals,\n"
+                "    qc_strings, %zu,\n"
+                "    qc_functions, %zu,\n"
+                "    qc_fields, %zu,\n"
+                "    %u,\n"
+                "    %d, %d, %d, %d, %d\n"
+                "};\n\n",
+                code->chars.size(),
+                code->functions.size(),
+                code->fields.size(),
+                (unsigned)code->entfields,
+                (int)self, (int)time, (int)think, (int)nextthink, (int)frame);
+
+    fprintf(fp, "#ifndef QCRT_NO_MAIN\n"
+                "int main(int argc, char **argv) {\n"
+                "    return qcrt_main(&qc_program, argc, argv);\n"
+                "}\n"
+                "#endif\n");
+
+    if (ferror(fp)) {
+        con_err("failed to write `%s`\n", filename);
+        fclose(fp);
+        return false;
+    }
+    fclose(fp);
+    return true;
+}
@@ -4,40 +4,228 @@
 #include <string.h>
 #include <stdio.h>
 
+#include <algorithm>
+
 #include "gmqcc.h"
+#include "jit.h"
+#include "vecmath.h"
+
+/*
+ * The sections of a program are used right from the file where it needs
+ * no byte swapping.
+ */
+#if PLATFORM_BYTE_ORDER == GMQCC_BYTE_ORDER_LITTLE && !defined(_WIN32)
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   define QCVM_MMAP 1
+#else
+#   define QCVM_MMAP 0
+#endif
+
+/*
+ * Use computed goto for the dispatch in the execution loop when the
+ * compiler supports it.  Define QCVM_NO_THREADED to build the plain
+ * switch instead.
+ */
+#if defined(__GNUC__) && !defined(QCVM_NO_THREADED)
+#   define QCVM_THREADED 1
+#else
+#   define QCVM_THREADED 0
+#endif
+
+/*
+ * VM internal opcodes, these only ever appear in the predecoded form of
+ * the statements. The fused ones run their own statement and then the
+ * one following it without going through the dispatch in between.
+ */
+enum {
+    VMOP_ILLEGAL = VINSTR_END,
+    VMOP_LT_IFNOT,
+    VMOP_GT_IFNOT,
+    VMOP_LE_IFNOT,
+    VMOP_GE_IFNOT,
+    VMOP_EQ_F_IFNOT,
+    VMOP_NE_F_IFNOT,
+    VMOP_LOAD_STORE,
+    VMOP_LOAD_STORE_V,
+    VMOP_ADDRESS_STOREP,
+    VMOP_ADDRESS_STOREP_V,
+    VMOP_CALL_STORE,
+    VMOP_END
+};
 
-static void loaderror(const char *fmt, ...)
+/*
+ * Passes a message to the error callback, or prints it to stderr if there
+ * is none.  Trailing newlines are cut off the message.
+ */
+static void prog_report(prog_error_t error, void *user, qc_program_t *prog, char *message)
+{
+    size_t len = strlen(message);
+    while (len && message[len-1] == '\n')
+        message[--len] = 0;
+
+    if (error)
+        error(prog, message, user);
+    else
+        fprintf(stderr, "%s\n", message);
+}
+
+static void prog_verror(qc_program_t *prog, const char *fmt, va_list ap)
 {
+    char message[1024];
+    vsnprintf(message, sizeof(message), fmt, ap);
+    prog_report(prog->error, prog->user, prog, message);
+}
+
+static void loaderror(prog_error_t error, void *user, const char *fmt, ...)
+{
+    char    message[1024];
     int     err = errno;
+    size_t  len;
     va_list ap;
     va_start(ap, fmt);
-    vprintf(fmt, ap);
+    vsnprintf(message, sizeof(message), fmt, ap);
     va_end(ap);
-    printf(": %s\n", util_strerror(err));
+    len = strlen(message);
+    util_snprintf(message + len, sizeof(message) - len, ": %s", util_strerror(err));
+    prog_report(error, user, nullptr, message);
 }
 
-static void qcvmerror(qc_program_t *prog, const char *fmt, ...)
+void prog_message(qc_program_t *prog, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    prog_verror(prog, fmt, ap);
+    va_end(ap);
+}
+
+static void prog_record_dump(qc_program_t *prog, size_t count);
+
+void prog_error(qc_program_t *prog, const char *fmt, ...)
 {
     va_list ap;
 
     prog->vmerror++;
 
     va_start(ap, fmt);
-    vprintf(fmt, ap);
+    prog_verror(prog, fmt, ap);
     va_end(ap);
-    putchar('\n');
+
+    if (prog->vmerror == 1 && (prog->xflags & VMXF_RECORD) && !prog->records.empty())
+        prog_record_dump(prog, VM_RECORD_DUMP);
 }
 
+static bool prog_verify(qc_program_t *prog);
+
 qc_program::qc_program(const char *name, uint16_t crc, size_t entfields)
     : filename(name)
+    , entitystride(entfields)
     , crc16(crc)
     , entityfields(entfields)
 {}
 
-qc_program_t* prog_load(const char *filename, bool skipversion)
+/* whether the `length` items of `section` lie within `size` bytes of file */
+static bool prog_section_fits(const prog_section_t &section, size_t item, size_t size) {
+    return section.offset <= size && section.length <= (size - section.offset) / item;
+}
+
+#if QCVM_MMAP
+/*
+ * Maps the file read-only and points the sections which never change into
+ * it, so all processes running the same program share their pages. Only
+ * the functions, for their profile counters, and the globals are copied.
+ * Anything unusual about the file, like misaligned sections, leaves it to
+ * the read path.
+ */
+static bool prog_map(qc_program_t *prog, FILE *file, const prog_header_t &header) {
+    struct stat st;
+    const char *data;
+    void *map;
+    size_t size;
+
+    if (fstat(fileno(file), &st) != 0 || st.st_size <= 0)
+        return false;
+    size = st.st_size;
+
+    if (!prog_section_fits(header.statements, sizeof(prog_section_statement_t), size) ||
+        !prog_section_fits(header.defs,       sizeof(prog_section_def_t),       size) ||
+        !prog_section_fits(header.fields,     sizeof(prog_section_def_t),       size) ||
+        !prog_section_fits(header.functions,  sizeof(prog_section_function_t),  size) ||
+        !prog_section_fits(header.strings,    1,                                size) ||
+        !prog_section_fits(header.globals,    sizeof(qcint_t),                  size))
+        return false;
+
+    if (header.statements.offset % alignof(prog_section_statement_t) ||
+        header.defs.offset       % alignof(prog_section_def_t)       ||
+        header.fields.offset     % alignof(prog_section_def_t))
+        return false;
+
+    if ((map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileno(file), 0)) == MAP_FAILED)
+        return false;
+    data = (const char*)map;
+
+    /* nothing may run off the end of the mapping */
+    if (header.strings.length && data[header.strings.offset + header.strings.length - 1]) {
+        munmap(map, size);
+        return false;
+    }
+
+    prog->code.view   (data + header.statements.offset, header.statements.length);
+    prog->defs.view   (data + header.defs.offset,       header.defs.length);
+    prog->fields.view (data + header.fields.offset,     header.fields.length);
+    prog->strings.view(data + header.strings.offset,    header.strings.length);
+
+    prog->functions.resize(header.functions.length);
+    if (header.functions.length)
+        memcpy(&prog->functions[0], data + header.functions.offset, header.functions.length * sizeof(prog->functions[0]));
+    prog->globals.resize(header.globals.length + 2, 0); /* for a RETURN of the last global */
+    if (header.globals.length)
+        memcpy(&prog->globals[0], data + header.globals.offset, header.globals.length * sizeof(prog->globals[0]));
+
+    prog->map     = map;
+    prog->mapsize = size;
+    return true;
+}
+#else
+static bool prog_map(qc_program_t *, FILE *, const prog_header_t &) {
+    return false;
+}
+#endif
+
+/*
+ * Indexes the defs and fields by offset and name. Where several share one,
+ * like a vector and its _x component, the first of them is found as it
+ * was when they were searched from the start.
+ */
+static void prog_index(qc_program_t *prog) {
+    prog->defs_at.assign(prog->globals.size(), 0);
+    prog->fields_at.assign(prog->entityfields, 0);
+    prog->defs_named   = util_htnew(prog->defs.size() + 1);
+    prog->fields_named = util_htnew(prog->fields.size() + 1);
+
+    for (size_t i = 0; i < prog->defs.size(); ++i) {
+        const prog_section_def_t &it = prog->defs[i];
+        const char *name = prog_getstring(prog, it.name);
+        if (it.offset < prog->defs_at.size() && !prog->defs_at[it.offset])
+            prog->defs_at[it.offset] = i + 1;
+        if (!util_htget(prog->defs_named, name))
+            util_htset(prog->defs_named, name, (void*)&it);
+    }
+    for (size_t i = 0; i < prog->fields.size(); ++i) {
+        const prog_section_def_t &it = prog->fields[i];
+        const char *name = prog_getstring(prog, it.name);
+        if (it.offset < prog->fields_at.size() && !prog->fields_at[it.offset])
+            prog->fields_at[it.offset] = i + 1;
+        if (!util_htget(prog->fields_named, name))
+            util_htset(prog->fields_named, name, (void*)&it);
+    }
+}
+
+qc_program_t* prog_load(const char *filename, bool skipversion, prog_error_t error, void *user)
 {
     prog_header_t header;
     qc_program_t *prog;
+    const prog_section_def_t *def;
     FILE *file = fopen(filename, "rb");
 
     /* we need all those in order to support INSTR_STATE: */
@@ -47,11 +235,13 @@ qc_program_t* prog_load(const char *filename, bool skipversion)
                     has_nextthink = false,
                     has_frame     = false;
 
-    if (!file)
+    if (!file) {
+        loaderror(error, user, "failed to open '%s'", filename);
         return nullptr;
+    }
 
     if (fread(&header, sizeof(header), 1, file) != 1) {
-        loaderror("failed to read header from '%s'", filename);
+        loaderror(error, user, "failed to read header from '%s'", filename);
         fclose(file);
         return nullptr;
     }
@@ -59,44 +249,62 @@ qc_program_t* prog_load(const char *filename, bool skipversion)
     util_swap_header(header);
 
     if (!skipversion && header.version != 6) {
-        loaderror("header says this is a version %i progs, we need version 6\n", header.version);
+        loaderror(error, user, "header says this is a version %i progs, we need version 6", header.version);
         fclose(file);
         return nullptr;
     }
 
     prog = new qc_program(filename, header.crc16, header.entfield);
+    prog->error = error;
+    prog->user  = user;
+
+    if (!prog_map(prog, file, header)) {
+        std::vector<prog_section_statement_t> code;
+        std::vector<prog_section_def_t>       defs;
+        std::vector<prog_section_def_t>       fields;
+        std::vector<char>                     strings;
+
+#define read_data(hdrvar, data, reserved)                              \
+        if (fseek(file, header.hdrvar.offset, SEEK_SET) != 0) {        \
+            loaderror(error, user, "seek failed");                     \
+            goto error;                                                \
+        }                                                              \
+        data.resize(header.hdrvar.length + reserved);                  \
+        if (fread(                                                     \
+                &data[0],                                              \
+                sizeof(data[0]),                                       \
+                header.hdrvar.length,                                  \
+                file                                                   \
+            )!= header.hdrvar.length                                   \
+        ) {                                                            \
+            loaderror(error, user, "read failed");                     \
+            goto error;                                                \
+        }
 
-#define read_data(hdrvar, progvar, reserved)                           \
-    if (fseek(file, header.hdrvar.offset, SEEK_SET) != 0) {            \
-        loaderror("seek failed");                                      \
-        goto error;                                                    \
-    }                                                                  \
-    prog->progvar.resize(header.hdrvar.length + reserved);             \
-    if (fread(                                                         \
-            &prog->progvar[0],                                         \
-            sizeof(prog->progvar[0]),                                  \
-            header.hdrvar.length,                                      \
-            file                                                       \
-        )!= header.hdrvar.length                                       \
-    ) {                                                                \
-        loaderror("read failed");                                      \
-        goto error;                                                    \
-    }
-#define read_data1(x)    read_data(x, x, 0)
-#define read_data2(x, y) read_data(x, x, y)
-
-    read_data (statements, code, 0);
-    read_data1(defs);
-    read_data1(fields);
-    read_data1(functions);
-    read_data1(strings);
-    read_data2(globals, 2); /* reserve more in case a RETURN using with the global at "the end" exists */
-
-    util_swap_statements(prog->code);
-    util_swap_defs_fields(prog->defs);
-    util_swap_defs_fields(prog->fields);
-    util_swap_functions(prog->functions);
-    util_swap_globals(prog->globals);
+        read_data(statements, code,            0);
+        read_data(defs,       defs,            0);
+        read_data(fields,     fields,          0);
+        read_data(functions,  prog->functions, 0);
+        read_data(strings,    strings,         0);
+        read_data(globals,    prog->globals,   2); /* reserve more in case a RETURN using with the global at "the end" exists */
+
+#undef read_data
+
+        util_swap_statements(code);
+        util_swap_defs_fields(defs);
+        util_swap_defs_fields(fields);
+        util_swap_functions(prog->functions);
+        util_swap_globals(prog->globals);
+
+        /* the tempstrings no longer follow to terminate a last string missing it */
+        if (!strings.empty() && strings.back())
+            strings.push_back('\0');
+
+        prog->code.own(std::move(code));
+        prog->defs.own(std::move(defs));
+        prog->fields.own(std::move(fields));
+        prog->strings.own(std::move(strings));
+    }
 
     fclose(file);
 
@@ -104,49 +312,41 @@ qc_program_t* prog_load(const char *filename, bool skipversion)
     prog->profile.resize(prog->code.size());
     memset(&prog->profile[0], 0, sizeof(prog->profile[0]) * prog->profile.size());
 
-    /* Add tempstring area */
+    /* the tempstrings are numbered after the others */
     prog->tempstring_start = prog->strings.size();
-    prog->tempstring_at = prog->strings.size();
-
-    prog->strings.resize(prog->strings.size() + 16*1024, '\0');
 
     /* spawn the world entity */
-    prog->entitypool.emplace_back(true);
-    prog->entitydata.resize(prog->entityfields);
-    if (prog->entitydata.size())
-        memset(prog->entitydata.data(), 0, sizeof(prog->entitydata[0]) * prog->entityfields);
-    prog->entities = 1;
+    prog->entities = 0;
+    prog_spawn_entity(prog);
+
+    prog_index(prog);
 
     /* cache some globals and fields from names */
-    for (auto &it : prog->defs) {
-        const char *name = prog_getstring(prog, it.name);
-        if (!strcmp(name, "self")) {
-            prog->cached_globals.self = it.offset;
-            has_self = true;
-        }
-        else if (!strcmp(name, "time")) {
-            prog->cached_globals.time = it.offset;
-            has_time = true;
-        }
+    if ((def = prog_finddef(prog, "self"))) {
+        prog->cached_globals.self = def->offset;
+        has_self = true;
     }
-    for (auto &it : prog->fields) {
-        const char *name = prog_getstring(prog, it.name);
-        if (!strcmp(name, "think")) {
-            prog->cached_fields.think = it.offset;
-            has_think = true;
-        }
-        else if (!strcmp(name, "nextthink")) {
-            prog->cached_fields.nextthink = it.offset;
-            has_nextthink = true;
-        }
-        else if (!strcmp(name, "frame")) {
-            prog->cached_fields.frame  = it.offset;
-            has_frame = true;
-        }
+    if ((def = prog_finddef(prog, "time"))) {
+        prog->cached_globals.time = def->offset;
+        has_time = true;
+    }
+    if ((def = prog_findfield(prog, "think"))) {
+        prog->cached_fields.think = def->offset;
+        has_think = true;
+    }
+    if ((def = prog_findfield(prog, "nextthink"))) {
+        prog->cached_fields.nextthink = def->offset;
+        has_nextthink = true;
+    }
+    if ((def = prog_findfield(prog, "frame"))) {
+        prog->cached_fields.frame = def->offset;
+        has_frame = true;
     }
     if (has_self && has_time && has_think && has_nextthink && has_frame)
         prog->supports_state = true;
 
+    prog->verified = prog_verify(prog);
+
     return prog;
 
 error:
@@ -156,109 +356,886 @@ error:
     return nullptr;
 }
 
+/*
+ * A program sharing the code, defs, fields and strings of another one,
+ * which has to outlive it, with copies of its globals, functions,
+ * builtins and entities. The copy runs on its own, for example on another
+ * thread.
+ */
+qc_program_t *prog_clone(qc_program_t *prog) {
+    qc_program_t *clone = new qc_program_t(prog->filename.c_str(), prog->crc16, prog->entityfields);
+
+    clone->code.view(prog->code.data(), prog->code.size());
+    clone->defs.view(prog->defs.data(), prog->defs.size());
+    clone->fields.view(prog->fields.data(), prog->fields.size());
+    clone->strings.view(prog->strings.data(), prog->strings.size());
+    clone->functions = prog->functions;
+    clone->globals = prog->globals;
+    clone->profile.assign(prog->code.size(), 0);
+    clone->tempstring_start = prog->tempstring_start;
+
+    for (auto &it : prog->entitychunks) {
+        clone->entitychunks.emplace_back(new qcint_t[VM_ENTITY_CHUNK * prog->entityfields]);
+        memcpy(clone->entitychunks.back().get(), it.get(), VM_ENTITY_CHUNK * prog->entityfields * sizeof(qcint_t));
+    }
+    clone->entitystride = prog->entitystride;
+    clone->fieldstride = prog->fieldstride;
+    clone->entities = prog->entities;
+    clone->entityfree = prog->entityfree;
+    clone->entityfree_from = prog->entityfree_from;
+    clone->entitydirty.assign(prog->entityfree.size(), 0);
+
+    clone->builtins = prog->builtins;
+    clone->error = prog->error;
+    clone->user = prog->user;
+    clone->allowworldwrites = prog->allowworldwrites;
+    clone->cached_fields = prog->cached_fields;
+    clone->cached_globals = prog->cached_globals;
+    clone->supports_state = prog->supports_state;
+    clone->verified = prog->verified;
+    clone->unverified = prog->unverified;
+
+    prog_index(clone);
+    return clone;
+}
+
 void prog_delete(qc_program_t *prog)
 {
+    if (prog->defs_named)
+        util_htdel(prog->defs_named);
+    if (prog->fields_named)
+        util_htdel(prog->fields_named);
+    if (prog->jit)
+        jit_destroy(prog->jit);
+#if QCVM_MMAP
+    if (prog->map)
+        munmap(prog->map, prog->mapsize);
+#endif
     delete prog;
 }
 
+/*
+ * Marks the globals a statement may write to. Vector results are assumed
+ * for every operation, so this errs on the side of too many.
+ */
+static void predecode_mark_written(qc_program_t *prog, std::vector<bool> &written, size_t at) {
+    for (size_t i = at; i < at + 3 && i < prog->globals.size(); ++i)
+        written[i] = true;
+}
+
+/*
+ * Function globals nothing ever stores to are constant, the calls through
+ * them can be bound to the function at load time. Anything in the reserved
+ * area or the locals of a function is written when calling.
+ */
+static void prog_written(qc_program_t *prog, std::vector<bool> &written) {
+    written.assign(prog->globals.size(), false);
+    for (size_t i = 0; i < OFS_PARM7 + 3 && i < written.size(); ++i)
+        written[i] = true;
+    for (auto &it : prog->functions) {
+        for (size_t i = it.firstlocal; i < it.firstlocal + it.locals && i < written.size(); ++i)
+            written[i] = true;
+    }
+    for (auto &it : prog->code) {
+        if (it.opcode >= INSTR_STORE_F && it.opcode <= INSTR_STORE_FNC)
+            predecode_mark_written(prog, written, it.o2.u1);
+        else if (it.opcode <  INSTR_STOREP_F   ||
+                 (it.opcode >= INSTR_NOT_F     && it.opcode <= INSTR_NOT_FNC) ||
+                 (it.opcode >= INSTR_AND       && it.opcode <= INSTR_BITOR))
+            predecode_mark_written(prog, written, it.o3.u1);
+    }
+}
+
+/* the function a CALL always calls, 0 if it goes through a variable */
+static qcint_t prog_calltarget(qc_program_t *prog, const std::vector<bool> &written,
+                               const prog_section_statement_t &st)
+{
+    qcint_t fn;
+    if (st.o1.u1 >= written.size() || written[st.o1.u1])
+        return 0;
+    fn = prog->globals[st.o1.u1];
+    if (fn > 0 && fn < (qcint_t)prog->functions.size())
+        return fn;
+    return 0;
+}
+
+#define VERIFY(cond, ...)                                                       \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            char reason[256];                                                   \
+            util_snprintf(reason, sizeof(reason), __VA_ARGS__);                 \
+            prog->unverified = reason;                                          \
+            return false;                                                       \
+        }                                                                       \
+    } while (0)
+
+/*
+ * How many words of the globals the operand of a statement reads or writes:
+ * three for a vector, none where the operand is a jump and one otherwise.
+ */
+static size_t prog_operand_words(uint16_t opcode, int operand) {
+    switch (opcode) {
+        case INSTR_DONE:
+        case INSTR_RETURN:
+        case INSTR_NOT_V:
+        case INSTR_STOREP_V:
+            return operand == 0 ? 3 : 1;
+        case INSTR_MUL_V:
+        case INSTR_EQ_V:
+        case INSTR_NE_V:
+        case INSTR_STORE_V:
+            return operand == 2 ? 1 : 3;
+        case INSTR_MUL_FV:
+            return operand == 0 ? 1 : 3;
+        case INSTR_MUL_VF:
+            return operand == 1 ? 1 : 3;
+        case INSTR_ADD_V:
+        case INSTR_SUB_V:
+            return 3;
+        case INSTR_LOAD_V:
+            return operand == 2 ? 3 : 1;
+        case INSTR_IF:
+        case INSTR_IFNOT:
+            return operand == 1 ? 0 : 1;
+        case INSTR_GOTO:
+            return operand == 0 ? 0 : 1;
+        default:
+            return 1;
+    }
+}
+
+static bool prog_operands_fit(const prog_section_statement_t &st, size_t globals) {
+    const uint16_t operands[3] = { st.o1.u1, st.o2.u1, st.o3.u1 };
+    for (int i = 0; i < 3; ++i) {
+        size_t words = prog_operand_words(st.opcode, i);
+        if (words && (size_t)operands[i] + words > globals)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Checks once what the loop would otherwise check on every statement or
+ * not at all: the opcodes are known, the operands lie within the globals,
+ * the jumps and functions within the code and constant calls within the
+ * functions.  The loop built for VMXF_VERIFIED relies on all of that, the
+ * first problem found is kept in prog->unverified.
+ */
+static bool prog_verify(qc_program_t *prog) {
+    const size_t code    = prog->code.size();
+    const size_t globals = prog->globals.size();
+    std::vector<bool> written;
+
+    prog_written(prog, written);
+
+    VERIFY(code, "there is no code");
+    for (size_t i = 0; i < code; ++i) {
+        const prog_section_statement_t &st = prog->code[i];
+        long target;
+
+        VERIFY(st.opcode < VINSTR_END, "statement %zu has the unknown opcode %u", i, st.opcode);
+
+        VERIFY(prog_operands_fit(st, globals), "statement %zu uses a global past the end", i);
+        if (st.opcode == INSTR_GOTO || st.opcode == INSTR_IF || st.opcode == INSTR_IFNOT) {
+            target = (long)i + (st.opcode == INSTR_GOTO ? st.o1.s1 : st.o2.s1);
+            VERIFY(target >= 0 && target < (long)code, "statement %zu jumps out of the code", i);
+            continue;
+        }
+
+        if (st.opcode >= INSTR_CALL0 && st.opcode <= INSTR_CALL8 && !written[st.o1.u1]) {
+            qcint_t fn = prog->globals[st.o1.u1];
+            VERIFY(fn > 0 && fn < (qcint_t)prog->functions.size(),
+                   "statement %zu calls the invalid function %d", i, (int)fn);
+        }
+        VERIFY(st.opcode != INSTR_STATE || prog->supports_state,
+               "statement %zu is a STATE without the defs it needs", i);
+    }
+    VERIFY(prog->code[code-1].opcode == INSTR_DONE   ||
+           prog->code[code-1].opcode == INSTR_RETURN ||
+           prog->code[code-1].opcode == INSTR_GOTO,
+           "the last statement runs off the end of the code");
+
+    for (size_t i = 1; i < prog->functions.size(); ++i) {
+        const prog_section_function_t &it = prog->functions[i];
+        VERIFY(it.entry < (qcint_t)code, "function %zu starts past the end of the code", i);
+        VERIFY((size_t)it.firstlocal + it.locals <= globals, "the locals of function %zu lie past the end", i);
+        VERIFY(it.nargs >= 0 && it.nargs <= 8, "function %zu takes %d parameters", i, (int)it.nargs);
+        for (int32_t p = 0; p < it.nargs; ++p)
+            VERIFY(it.argsize[p] <= 3, "parameter %d of function %zu is too large", (int)p, i);
+    }
+
+    return true;
+}
+
+#undef VERIFY
+
+void prog_predecode(qc_program_t *prog) {
+    const size_t count = prog->code.size();
+    std::vector<bool> written;
+
+    prog_written(prog, written);
+
+    /*
+     * One more statement than there is code, jumps leaving the code land
+     * on it and raise an illegal instruction instead of running off.
+     */
+    prog->decoded.resize(count + 1);
+    qcany_t *globals = (qcany_t*)&prog->globals[0];
+    for (size_t i = 0; i < count; ++i) {
+        const prog_section_statement_t &st  = prog->code[i];
+        qc_decoded_statement_t         &out = prog->decoded[i];
+
+        out.opcode   = st.opcode < VINSTR_END ? st.opcode : (uint16_t)VMOP_ILLEGAL;
+        out.argc     = st.opcode - INSTR_CALL0;
+        out.a        = (qcany_t*)((qcint_t*)globals + st.o1.u1);
+        out.b        = (qcany_t*)((qcint_t*)globals + st.o2.u1);
+        out.c        = (qcany_t*)((qcint_t*)globals + st.o3.u1);
+        out.function = nullptr;
+
+        if (st.opcode == INSTR_GOTO || st.opcode == INSTR_IF || st.opcode == INSTR_IFNOT) {
+            long target = (long)i + (st.opcode == INSTR_GOTO ? st.o1.s1 : st.o2.s1);
+            if (target < 0 || target >= (long)count)
+                target = count;
+            out.target = &prog->decoded[target];
+        }
+        else if (st.opcode >= INSTR_CALL0 && st.opcode <= INSTR_CALL8) {
+            qcint_t fn = prog_calltarget(prog, written, st);
+            if (fn)
+                out.function = &prog->functions[fn];
+        }
+    }
+
+    prog->decoded[count].opcode   = VMOP_ILLEGAL;
+    prog->decoded[count].a        = globals;
+    prog->decoded[count].b        = globals;
+    prog->decoded[count].c        = globals;
+    prog->decoded[count].function = nullptr;
+}
+
+/*
+ * Returns the fused opcode running the pair of statements, or 0 if they
+ * don't make one.  The first of the pair must always fall through to the
+ * second, the second keeps its own statement in the stream.
+ */
+uint16_t prog_fuse_pair(uint16_t first, uint16_t second) {
+    switch (first) {
+        case INSTR_LT:   return second == INSTR_IFNOT ? VMOP_LT_IFNOT   : 0;
+        case INSTR_GT:   return second == INSTR_IFNOT ? VMOP_GT_IFNOT   : 0;
+        case INSTR_LE:   return second == INSTR_IFNOT ? VMOP_LE_IFNOT   : 0;
+        case INSTR_GE:   return second == INSTR_IFNOT ? VMOP_GE_IFNOT   : 0;
+        case INSTR_EQ_F: return second == INSTR_IFNOT ? VMOP_EQ_F_IFNOT : 0;
+        case INSTR_NE_F: return second == INSTR_IFNOT ? VMOP_NE_F_IFNOT : 0;
+
+        case INSTR_LOAD_F:
+        case INSTR_LOAD_S:
+        case INSTR_LOAD_ENT:
+        case INSTR_LOAD_FLD:
+        case INSTR_LOAD_FNC:
+            if (second >= INSTR_STORE_F && second <= INSTR_STORE_FNC && second != INSTR_STORE_V)
+                return VMOP_LOAD_STORE;
+            return 0;
+        case INSTR_LOAD_V:
+            return second == INSTR_STORE_V ? VMOP_LOAD_STORE_V : 0;
+
+        case INSTR_ADDRESS:
+            if (second == INSTR_STOREP_V)
+                return VMOP_ADDRESS_STOREP_V;
+            if (second >= INSTR_STOREP_F && second <= INSTR_STOREP_FNC)
+                return VMOP_ADDRESS_STOREP;
+            return 0;
+
+        case INSTR_CALL0:
+        case INSTR_CALL1:
+        case INSTR_CALL2:
+        case INSTR_CALL3:
+        case INSTR_CALL4:
+        case INSTR_CALL5:
+        case INSTR_CALL6:
+        case INSTR_CALL7:
+        case INSTR_CALL8:
+            if (second >= INSTR_STORE_F && second <= INSTR_STORE_FNC)
+                return VMOP_CALL_STORE;
+            return 0;
+    }
+    return 0;
+}
+
+/*
+ * Fuses the pairs of statements in the predecoded stream for which there
+ * is a VM internal opcode.  With a threshold only those pairs whose first
+ * statement was executed at least that often according to the profile
+ * counters are fused, so embedders can profile a while and then fuse
+ * what's hot.
+ */
+void prog_fuse(qc_program_t *prog, size_t threshold) {
+    if (prog->decoded.empty())
+        prog_predecode(prog);
+
+    for (size_t i = 0; i + 1 < prog->code.size(); ++i) {
+        uint16_t fused;
+        if (threshold && prog->profile[i] < threshold)
+            continue;
+        /* a CALL keeps its argument count for the fused statement */
+        if ((fused = prog_fuse_pair(prog->code[i].opcode, prog->code[i+1].opcode)))
+            prog->decoded[i].opcode = fused;
+    }
+}
+
+/* Tarjan's strongly connected components over the direct calls */
+struct qc_frames_scc_t {
+    const std::vector<std::vector<qcint_t>> &calls;
+    std::vector<uint8_t> &reentrant;
+    std::vector<size_t> index, low;
+    std::vector<bool> onstack;
+    std::vector<qcint_t> stack;
+    size_t next;
+};
+
+static void prog_frames_scc(qc_frames_scc_t &scc, qcint_t f) {
+    scc.index[f] = scc.low[f] = ++scc.next;
+    scc.stack.push_back(f);
+    scc.onstack[f] = true;
+
+    for (qcint_t to : scc.calls[f]) {
+        if (to == f)
+            scc.reentrant[f] = 1;
+        if (!scc.index[to]) {
+            prog_frames_scc(scc, to);
+            scc.low[f] = std::min(scc.low[f], scc.low[to]);
+        }
+        else if (scc.onstack[to])
+            scc.low[f] = std::min(scc.low[f], scc.index[to]);
+    }
+
+    if (scc.low[f] == scc.index[f]) {
+        bool cycle = scc.stack.back() != f;
+        qcint_t it;
+        do {
+            it = scc.stack.back();
+            scc.stack.pop_back();
+            scc.onstack[it] = false;
+            if (cycle)
+                scc.reentrant[it] = 1;
+        } while (it != f);
+    }
+}
+
+/* whether from may call to while it is active, directly or not */
+static bool prog_frames_reaches(const std::vector<std::vector<qcint_t>> &calls, qcint_t from, qcint_t to) {
+    std::vector<bool> seen;
+    std::vector<qcint_t> todo(calls[from]);
+
+    if (todo.empty())
+        return false;
+    seen.assign(calls.size(), false);
+
+    while (!todo.empty()) {
+        qcint_t f = todo.back();
+        todo.pop_back();
+        if (f == to)
+            return true;
+        if (seen[f])
+            continue;
+        seen[f] = true;
+        todo.insert(todo.end(), calls[f].begin(), calls[f].end());
+    }
+    return false;
+}
+
+/*
+ * Finds the functions whose locals have to be backed up on entry with
+ * VMXF_FRAMES.  That's the ones which may be entered while a function
+ * sharing their locals is active: themselves when recursive, or another
+ * one the locals of which overlap theirs.  A call through a variable may
+ * call anything, so every function reaching one is re-entrant as well as
+ * anything overlapping it.  Builtins are assumed not to run QC code, the
+ * functions they run through prog_exec always back up their locals.
+ */
+void prog_frames(qc_program_t *prog) {
+    const size_t count = prog->functions.size();
+    std::vector<std::vector<qcint_t>> calls(count), callers(count);
+    std::vector<uint8_t> indirect(count, 0);
+    std::vector<qcint_t> order, todo;
+    std::vector<bool> written;
+    size_t saved = 0;
+
+    prog_written(prog, written);
+    prog->reentrant.assign(count, 0);
+
+    /* the code of a function runs up to the entry of the next one */
+    for (size_t i = 1; i < count; ++i) {
+        if (prog->functions[i].entry >= 0)
+            order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(), [prog](qcint_t a, qcint_t b) {
+        return prog->functions[a].entry < prog->functions[b].entry;
+    });
+    for (size_t k = 0; k < order.size(); ++k) {
+        qcint_t f   = order[k];
+        size_t  end = k + 1 < order.size() ? prog->functions[order[k+1]].entry : prog->code.size();
+        for (size_t i = prog->functions[f].entry; i < end && i < prog->code.size(); ++i) {
+            const prog_section_statement_t &st = prog->code[i];
+            qcint_t to;
+            if (st.opcode < INSTR_CALL0 || st.opcode > INSTR_CALL8)
+                continue;
+            if (!(to = prog_calltarget(prog, written, st)))
+                indirect[f] = 1;
+            else if (prog->functions[to].entry >= 0) {
+                calls[f].push_back(to);
+                callers[to].push_back(f);
+            }
+        }
+    }
+
+    /* everything reaching a call through a variable may re-enter itself */
+    for (size_t i = 1; i < count; ++i) {
+        if (indirect[i])
+            todo.push_back(i);
+    }
+    while (!todo.empty()) {
+        qcint_t f = todo.back();
+        todo.pop_back();
+        prog->reentrant[f] = 1;
+        for (qcint_t from : callers[f]) {
+            if (!indirect[from]) {
+                indirect[from] = 1;
+                todo.push_back(from);
+            }
+        }
+    }
+
+    {
+        qc_frames_scc_t scc = { calls, prog->reentrant, {}, {}, {}, {}, 0 };
+        scc.index.assign(count, 0);
+        scc.low.assign(count, 0);
+        scc.onstack.assign(count, false);
+        for (qcint_t f : order) {
+            if (!scc.index[f])
+                prog_frames_scc(scc, f);
+        }
+    }
+
+    /* the pairs of functions with overlapping locals, by where they start */
+    std::sort(order.begin(), order.end(), [prog](qcint_t a, qcint_t b) {
+        return prog->functions[a].firstlocal < prog->functions[b].firstlocal;
+    });
+    for (size_t k = 0; k < order.size(); ++k) {
+        const prog_section_function_t &a = prog->functions[order[k]];
+        for (size_t j = k + 1; j < order.size(); ++j) {
+            const prog_section_function_t &b = prog->functions[order[j]];
+            if (b.firstlocal >= a.firstlocal + a.locals)
+                break;
+            if (!b.locals)
+                continue;
+            if (indirect[order[k]] || prog_frames_reaches(calls, order[k], order[j]))
+                prog->reentrant[order[j]] = 1;
+            if (indirect[order[j]] || prog_frames_reaches(calls, order[j], order[k]))
+                prog->reentrant[order[k]] = 1;
+        }
+    }
+
+    /* room for the recursion to get going without reallocating */
+    for (size_t i = 1; i < count; ++i) {
+        if (prog->reentrant[i])
+            saved += prog->functions[i].locals;
+    }
+    prog->localstack.reserve(std::max(prog->localstack.capacity(), saved * VM_FRAMES_RESERVE));
+}
+
 /***********************************************************************
  * VM code
  */
 
 const char* prog_getstring(qc_program_t *prog, qcint_t str) {
-    /* cast for return required for C++ */
-    if (str < 0 || str >= (qcint_t)prog->strings.size())
-        return  "<<<invalid string>>>";
-
-    return &prog->strings[0] + str;
+    if (str >= 0 && (size_t)str < prog->strings.size())
+        return prog->strings.data() + str;
+    if (str >= 0 && (size_t)str - prog->tempstring_start < prog->tempstring_at) {
+        size_t at = str - prog->tempstring_start;
+        const qc_tempstring_block_t &block = prog->tempstrings[at / VM_TEMPSTRING_BLOCK];
+        if (at % VM_TEMPSTRING_BLOCK < block.size)
+            return block.data.get() + at % VM_TEMPSTRING_BLOCK;
+    }
+    return  "<<<invalid string>>>";
 }
 
-prog_section_def_t* prog_entfield(qc_program_t *prog, qcint_t off) {
-    for (auto &it : prog->fields)
-        if (it.offset == off)
-            return &it;
-    return nullptr;
+const prog_section_def_t* prog_entfield(qc_program_t *prog, qcint_t off) {
+    if (off < 0 || (size_t)off >= prog->fields_at.size() || !prog->fields_at[off])
+        return nullptr;
+    return &prog->fields[prog->fields_at[off] - 1];
 }
 
-prog_section_def_t* prog_getdef(qc_program_t *prog, qcint_t off)
+const prog_section_def_t* prog_getdef(qc_program_t *prog, qcint_t off)
 {
-    for (auto &it : prog->defs)
-        if (it.offset == off)
-            return &it;
-    return nullptr;
+    if (off < 0 || (size_t)off >= prog->defs_at.size() || !prog->defs_at[off])
+        return nullptr;
+    return &prog->defs[prog->defs_at[off] - 1];
+}
+
+const prog_section_def_t* prog_findfield(qc_program_t *prog, const char *name) {
+    return (const prog_section_def_t*)util_htget(prog->fields_named, name);
 }
 
+const prog_section_def_t* prog_finddef(qc_program_t *prog, const char *name) {
+    return (const prog_section_def_t*)util_htget(prog->defs_named, name);
+}
+
+prog_section_function_t* prog_findfunction(qc_program_t *prog, const char *name) {
+    const prog_section_def_t *def = prog_finddef(prog, name);
+    qcint_t function;
+    if (!def || (def->type & DEF_TYPEMASK) != TYPE_FUNCTION || def->offset >= prog->globals.size())
+        return nullptr;
+    function = prog->globals[def->offset];
+    if (function <= 0 || (size_t)function >= prog->functions.size())
+        return nullptr;
+    return &prog->functions[function];
+}
+
+static GMQCC_INLINE void prog_entitytouch(qc_program_t *prog, size_t e) {
+    prog->entitydirty[e / 64] |= uint64_t(1) << (e % 64);
+}
+
+static GMQCC_INLINE void prog_entityread(qc_program_t *prog, size_t e) {
+    if (!prog->entityread.empty())
+        prog->entityread[e / 64] |= uint64_t(1) << (e % 64);
+}
+
+/* a chunk of entities, all zero */
+static qcint_t *prog_entitychunk(qc_program_t *prog) {
+    return new qcint_t[VM_ENTITY_CHUNK * prog->entityfields]();
+}
+
+/* copies entity i of a chunk into another one laid out the same */
+static void prog_copy_entity(qc_program_t *prog, qcint_t *to, const qcint_t *from, size_t i) {
+    size_t at = i * prog->entitystride;
+    if (prog->fieldstride == 1) {
+        memcpy(to + at, from + at, prog->entityfields * sizeof(qcint_t));
+        return;
+    }
+    for (size_t f = 0; f < prog->entityfields; ++f, at += prog->fieldstride)
+        to[at] = from[at];
+}
+
+static void prog_clear_entity(qc_program_t *prog, size_t e) {
+    qcint_t *word = prog_entityword(prog, e, 0);
+    if (prog->fieldstride == 1) {
+        memset(word, 0, prog->entityfields * sizeof(qcint_t));
+        return;
+    }
+    for (size_t f = 0; f < prog->entityfields; ++f)
+        word[f * prog->fieldstride] = 0;
+}
+
+/*
+ * The caller may write to what it gets, so the entity counts as written.
+ * There is no entity to point at when they are laid out by field.
+ */
 qcany_t* prog_getedict(qc_program_t *prog, qcint_t e) {
-    if (e >= (qcint_t)prog->entitypool.size()) {
-        prog->vmerror++;
-        fprintf(stderr, "Accessing out of bounds edict %i\n", (int)e);
+    if (prog->fieldstride != 1) {
+        prog_error(prog, "the entities of `%s` are laid out by field, use prog_getfield", prog->filename.c_str());
+        return nullptr;
+    }
+    if (e >= prog->entities) {
+        prog_error(prog, "Accessing out of bounds edict %i", (int)e);
+        e = 0;
+    }
+    prog_entitytouch(prog, e);
+    return (qcany_t*)prog_entityword(prog, e, 0);
+}
+
+/* a field of an entity in either layout, which counts as written */
+qcany_t* prog_getfield(qc_program_t *prog, qcint_t e, qcint_t field) {
+    if (e < 0 || e >= prog->entities) {
+        prog_error(prog, "Accessing out of bounds edict %i", (int)e);
         e = 0;
     }
-    return (qcany_t*)&prog->entitydata[prog->entityfields * e];
+    if (field < 0 || (size_t)field >= prog->entityfields) {
+        prog_error(prog, "Accessing invalid field %i", (int)field);
+        field = 0;
+    }
+    prog_entitytouch(prog, e);
+    return (qcany_t*)prog_entityword(prog, e, field);
 }
 
-static qcint_t prog_spawn_entity(qc_program_t *prog) {
-    char  *data;
-    qcint_t  e;
-    for (e = 0; e < (qcint_t)prog->entitypool.size(); ++e) {
-        if (!prog->entitypool[e]) {
-            data = (char*)&prog->entitydata[prog->entityfields * e];
-            memset(data, 0, prog->entityfields * sizeof(qcint_t));
+/* copies the fields of an entity out, one after another */
+void prog_read_entity(qc_program_t *prog, qcint_t e, qcint_t *fields) {
+    const qcint_t *word = prog_entityword(prog, e, 0);
+    prog_entityread(prog, e);
+    for (size_t f = 0; f < prog->entityfields; ++f)
+        fields[f] = word[f * prog->fieldstride];
+}
+
+void prog_write_entity(qc_program_t *prog, qcint_t e, const qcint_t *fields) {
+    qcint_t *word = prog_entityword(prog, e, 0);
+    prog_entitytouch(prog, e);
+    for (size_t f = 0; f < prog->entityfields; ++f)
+        word[f * prog->fieldstride] = fields[f];
+}
+
+/*
+ * Lays the entities out by field, so code looking at one field of many
+ * entities reads it from consecutive words. Every chunk is rearranged, it
+ * has to be called outside of prog_exec.
+ */
+void prog_soa(qc_program_t *prog) {
+    size_t fields = prog->entityfields;
+
+    if (prog->fieldstride != 1 || fields <= 1)
+        return;
+    for (auto &it : prog->entitychunks) {
+        qcint_t *chunk = prog_entitychunk(prog);
+        for (size_t i = 0; i < VM_ENTITY_CHUNK; ++i)
+            for (size_t f = 0; f < fields; ++f)
+                chunk[f * VM_ENTITY_CHUNK + i] = it[i * fields + f];
+        it.reset(chunk);
+    }
+    prog->entitystride = 1;
+    prog->fieldstride = VM_ENTITY_CHUNK;
+}
+
+/*
+ * The word at an address made by INSTR_ADDRESS, which is in bounds, to
+ * store to. Addresses count the fields of the entities one after
+ * another in either layout.
+ */
+static GMQCC_INLINE qcint_t *prog_entitystore(qc_program_t *prog, qcint_t address) {
+    prog_entitytouch(prog, address / prog->entityfields);
+    return prog_entityword(prog, address / prog->entityfields, address % prog->entityfields);
+}
+
+/* a vector may be addressed to run into the next entity */
+static GMQCC_INLINE void prog_entitystore_v(qc_program_t *prog, qcint_t address, const qcany_t *value) {
+    size_t e = address / prog->entityfields;
+    size_t field = address % prog->entityfields;
+    qcint_t *word;
+
+    if (field + 2 >= prog->entityfields) {
+        for (int i = 0; i < 3; ++i)
+            *prog_entitystore(prog, address + i) = value->ivector[i];
+        return;
+    }
+    prog_entitytouch(prog, e);
+    word = prog_entityword(prog, e, field);
+    word[0] = value->ivector[0];
+    word[prog->fieldstride] = value->ivector[1];
+    word[prog->fieldstride * 2] = value->ivector[2];
+}
+
+/* loads a vector field, which lies within the entity */
+static GMQCC_INLINE void prog_entityload_v(qc_program_t *prog, qcint_t e, qcint_t field, qcany_t *value) {
+    const qcint_t *word = prog_entityword(prog, e, field);
+    value->ivector[0] = word[0];
+    value->ivector[1] = word[prog->fieldstride];
+    value->ivector[2] = word[prog->fieldstride * 2];
+}
+
+/* the lowest killed entity is spawned again before the pool grows */
+qcint_t prog_spawn_entity(qc_program_t *prog) {
+    qcint_t e;
+
+    prog->entities_spawned++;
+    for (; prog->entityfree_from < prog->entityfree.size(); ++prog->entityfree_from) {
+        uint64_t &word = prog->entityfree[prog->entityfree_from];
+        if (word) {
+            e = prog->entityfree_from * 64 + prog_ctz64(word);
+            word &= word - 1;
+            prog_clear_entity(prog, e);
+            prog_entitytouch(prog, e);
             return e;
         }
     }
-    prog->entitypool.emplace_back(true);
-    prog->entities++;
-    size_t sz = prog->entitydata.size();
-    prog->entitydata.resize(sz + prog->entityfields);
-    data = (char*)&prog->entitydata[sz];
-    memset(data, 0, prog->entityfields * sizeof(qcint_t));
+
+    /* a chunk kept by prog_restore still holds what was spawned after the snapshot */
+    e = prog->entities++;
+    if (e % VM_ENTITY_CHUNK == 0)
+        prog->entitychunks.emplace_back(prog_entitychunk(prog));
+    else
+        prog_clear_entity(prog, e);
+    if (e % 64 == 0) {
+        prog->entityfree.push_back(0);
+        prog->entitydirty.push_back(0);
+        if (!prog->entityread.empty())
+            prog->entityread.push_back(0);
+    }
+    prog_entitytouch(prog, e);
 
     return e;
 }
 
-static void prog_free_entity(qc_program_t *prog, qcint_t e) {
+void prog_free_entity(qc_program_t *prog, qcint_t e) {
     if (!e) {
-        prog->vmerror++;
-        fprintf(stderr, "Trying to free world entity\n");
+        prog_error(prog, "Trying to free world entity");
         return;
     }
-    if (e >= (qcint_t)prog->entitypool.size()) {
-        prog->vmerror++;
-        fprintf(stderr, "Trying to free out of bounds entity\n");
+    if (e >= prog->entities) {
+        prog_error(prog, "Trying to free out of bounds entity");
         return;
     }
-    if (!prog->entitypool[e]) {
-        prog->vmerror++;
-        fprintf(stderr, "Double free on entity\n");
+    if (prog->entityfree[e / 64] & (uint64_t(1) << (e % 64))) {
+        prog_error(prog, "Double free on entity");
         return;
     }
-    prog->entitypool[e] = false;
+    prog->entityfree[e / 64] |= uint64_t(1) << (e % 64);
+    prog->entityfree_from = std::min(prog->entityfree_from, (size_t)e / 64);
 }
 
 qcint_t prog_tempstring(qc_program_t *prog, const char *str) {
-    size_t len = strlen(str);
-    size_t at = prog->tempstring_at;
+    size_t len = strlen(str) + 1;
+    size_t at, index, offset, span;
+
+    /* the strings of the last outermost prog_exec are no longer needed */
+    if (prog->tempstring_expired) {
+        prog->tempstring_at = 0;
+        prog->tempstring_expired = false;
+        prog->tempstring_generation++;
+    }
 
-    /* when we reach the end we start over */
-    if (at + len >= prog->strings.size())
-        at = prog->tempstring_start;
+    /* a string does not cross blocks, it starts the next one instead */
+    at = prog->tempstring_at;
+    offset = at % VM_TEMPSTRING_BLOCK;
+    if (offset && offset + len > VM_TEMPSTRING_BLOCK) {
+        at += VM_TEMPSTRING_BLOCK - offset;
+        offset = 0;
+    }
+    index = at / VM_TEMPSTRING_BLOCK;
+    span = (offset + len + VM_TEMPSTRING_BLOCK - 1) / VM_TEMPSTRING_BLOCK;
+
+    if (prog->tempstrings.size() < index + span)
+        prog->tempstrings.resize(index + span);
+    qc_tempstring_block_t &block = prog->tempstrings[index];
+    if (block.size < offset + len) {
+        /* nothing lives in the block yet when it is too small */
+        block.size = span * VM_TEMPSTRING_BLOCK;
+        block.data.reset(new char[block.size]);
+    }
+    memcpy(block.data.get() + offset, str, len);
+
+    /* a long string takes the numbers of the blocks it spans */
+    prog->tempstring_at = span > 1 ? (index + span) * VM_TEMPSTRING_BLOCK : at + len;
+
+    prog->tempstrings_made++;
+    prog->tempstring_bytes += len;
+    if (prog->tempstring_peak < prog->tempstring_at)
+        prog->tempstring_peak = prog->tempstring_at;
+    return (qcint_t)(prog->tempstring_start + at);
+}
 
-    /* when it doesn't fit, reallocate */
-    if (at + len >= prog->strings.size())
+/*
+ * Snapshots copy the globals and entities, and the tempstrings while they
+ * may still be in use. Entities written to afterwards are marked in
+ * entitydirty, so restoring the latest snapshot only copies those back,
+ * and the tempstrings are only copied back after their numbers were
+ * reused. Restoring another snapshot copies everything.
+ */
+qc_snapshot_t *prog_snapshot(qc_program_t *prog) {
+    qc_snapshot_t *snapshot = new qc_snapshot_t;
+    size_t         fields   = prog->entityfields;
+
+    snapshot->serial = ++prog->snapshots_taken;
+    snapshot->globals = prog->globals;
+    snapshot->entitydata.resize(prog->entitychunks.size() * VM_ENTITY_CHUNK * fields);
+    for (size_t i = 0; i < prog->entitychunks.size(); ++i)
+        memcpy(&snapshot->entitydata[i * VM_ENTITY_CHUNK * fields], prog->entitychunks[i].get(),
+               VM_ENTITY_CHUNK * fields * sizeof(qcint_t));
+    snapshot->fieldstride = prog->fieldstride;
+    snapshot->entities = prog->entities;
+    snapshot->entityfree = prog->entityfree;
+    snapshot->entityfree_from = prog->entityfree_from;
+
+    if (!prog->tempstring_expired) {
+        for (size_t at = 0; at < prog->tempstring_at; at += VM_TEMPSTRING_BLOCK) {
+            const qc_tempstring_block_t &block = prog->tempstrings[at / VM_TEMPSTRING_BLOCK];
+            size_t used = std::min(block.size, prog->tempstring_at - at);
+            snapshot->tempstrings.emplace_back(block.data.get(), block.data.get() + used);
+        }
+    }
+    snapshot->tempstring_at = prog->tempstring_at;
+    snapshot->tempstring_expired = prog->tempstring_expired;
+    snapshot->tempstring_generation = prog->tempstring_generation;
+
+    prog->snapshot_serial = snapshot->serial;
+    std::fill(prog->entitydirty.begin(), prog->entitydirty.end(), 0);
+    return snapshot;
+}
+
+bool prog_restore(qc_program_t *prog, qc_snapshot_t *snapshot) {
+    size_t fields = prog->entityfields;
+    size_t words  = ((size_t)snapshot->entities + 63) / 64;
+    size_t chunks = ((size_t)snapshot->entities + VM_ENTITY_CHUNK - 1) / VM_ENTITY_CHUNK;
+
+    if (!prog->stack.empty()) {
+        prog_error(prog, "cannot restore a snapshot of `%s` while it is running", prog->filename.c_str());
+        return false;
+    }
+    if (snapshot->globals.size() != prog->globals.size() ||
+        snapshot->entitydata.size() != chunks * VM_ENTITY_CHUNK * fields ||
+        snapshot->fieldstride != prog->fieldstride)
+    {
+        prog_error(prog, "the snapshot is not one of `%s`", prog->filename.c_str());
+        return false;
+    }
+
+    memcpy(prog->globals.data(), snapshot->globals.data(), prog->globals.size() * sizeof(qcint_t));
+
+    /* entities spawned since are dropped, their chunks freed */
+    prog->entitychunks.resize(chunks);
+    prog->entityfree  = snapshot->entityfree;
+    prog->entityfree_from = snapshot->entityfree_from;
+    prog->entitydirty.resize(words);
+    prog->entities = snapshot->entities;
+
+    if (prog->snapshot_serial == snapshot->serial) {
+        for (size_t word = 0; word < words; ++word) {
+            for (uint64_t dirty = prog->entitydirty[word]; dirty; dirty &= dirty - 1) {
+                size_t e = word * 64 + prog_ctz64(dirty);
+                if (e >= (size_t)snapshot->entities)
+                    break;
+                prog_copy_entity(prog, prog->entitychunks[e / VM_ENTITY_CHUNK].get(),
+                                 &snapshot->entitydata[e / VM_ENTITY_CHUNK * VM_ENTITY_CHUNK * fields],
+                                 e % VM_ENTITY_CHUNK);
+                prog->restored_entities++;
+            }
+        }
+    } else {
+        for (size_t i = 0; i < chunks; ++i) {
+            if (!prog->entitychunks[i])
+                prog->entitychunks[i].reset(prog_entitychunk(prog));
+            memcpy(prog->entitychunks[i].get(), &snapshot->entitydata[i * VM_ENTITY_CHUNK * fields],
+                   VM_ENTITY_CHUNK * fields * sizeof(qcint_t));
+        }
+        prog->restored_entities += snapshot->entities;
+    }
+    std::fill(prog->entitydirty.begin(), prog->entitydirty.end(), 0);
+
+    /* strings are never changed, only their numbers reused */
+    if (prog->snapshot_serial != snapshot->serial ||
+        prog->tempstring_generation != snapshot->tempstring_generation)
     {
-        prog->strings.resize(prog->strings.size() + len+1);
-        memcpy(&prog->strings[0] + at, str, len+1);
-        return at;
+        for (size_t i = 0; i < snapshot->tempstrings.size(); ++i) {
+            const std::vector<char> &used = snapshot->tempstrings[i];
+            if (prog->tempstrings.size() <= i)
+                prog->tempstrings.resize(i + 1);
+            qc_tempstring_block_t &block = prog->tempstrings[i];
+            if (block.size < used.size()) {
+                block.size = (used.size() + VM_TEMPSTRING_BLOCK - 1) / VM_TEMPSTRING_BLOCK * VM_TEMPSTRING_BLOCK;
+                block.data.reset(new char[block.size]);
+            }
+            memcpy(block.data.get(), used.data(), used.size());
+        }
     }
+    prog->tempstring_at = snapshot->tempstring_at;
+    prog->tempstring_expired = snapshot->tempstring_expired;
+    /* the strings made after the snapshot are overwritten from now on */
+    snapshot->tempstring_generation = ++prog->tempstring_generation;
 
-    /* when it fits, just copy */
-    memcpy(&prog->strings[0] + at, str, len+1);
-    prog->tempstring_at += len+1;
-    return at;
+    prog->snapshot_serial = snapshot->serial;
+    return true;
+}
+
+void prog_snapshot_delete(qc_snapshot_t *snapshot) {
+    delete snapshot;
 }
 
-static size_t print_escaped_string(const char *str, size_t maxlen) {
+size_t prog_print_string(const char *str, size_t maxlen) {
     size_t len = 2;
     putchar('"');
     --maxlen; /* because we're lazy and have escape sequences */
@@ -293,7 +1270,7 @@ static size_t print_escaped_string(const char *str, size_t maxlen) {
 
 static void trace_print_global(qc_program_t *prog, unsigned int glob, int vtype) {
     static char spaces[28+1] = "                            ";
-    prog_section_def_t *def;
+    const prog_section_def_t *def;
     qcany_t    *value;
     int       len;
 
@@ -321,130 +1298,433 @@ static void trace_print_global(qc_program_t *prog, unsigned int glob, int vtype)
         case TYPE_VOID:
         case TYPE_ENTITY:
         case TYPE_FIELD:
-        case TYPE_FUNCTION:
+        case TYPE_FUNCTION:
+        case TYPE_POINTER:
+            len += printf("(%i),", value->_int);
+            break;
+        case TYPE_VECTOR:
+            len += printf("'%g %g %g',", value->vector[0],
+                                         value->vector[1],
+                                         value->vector[2]);
+            break;
+        case TYPE_STRING:
+            if (value->string)
+                len += prog_print_string(prog_getstring(prog, value->string), sizeof(spaces)-len-5);
+            else
+                len += printf("(null)");
+            len += printf(",");
+            /* len += printf("\"%s\",", prog_getstring(prog, value->string)); */
+            break;
+        case TYPE_FLOAT:
+        default:
+            len += printf("%g,", value->_float);
+            break;
+    }
+done:
+    if (len < (int)sizeof(spaces)-1) {
+        spaces[sizeof(spaces)-1-len] = 0;
+        fputs(spaces, stdout);
+        spaces[sizeof(spaces)-1-len] = ' ';
+    }
+}
+
+/* the types of the operands of an opcode, -1 for an unused one */
+static void trace_types(uint16_t opcode, int t[3]) {
+    t[0] = t[1] = t[2] = TYPE_FLOAT;
+    switch (opcode)
+    {
+        case INSTR_MUL_FV:
+            t[1] = t[2] = TYPE_VECTOR;
+            break;
+        case INSTR_MUL_VF:
+            t[0] = t[2] = TYPE_VECTOR;
+            break;
+        case INSTR_MUL_V:
+            t[0] = t[1] = TYPE_VECTOR;
+            break;
+        case INSTR_ADD_V:
+        case INSTR_SUB_V:
+        case INSTR_EQ_V:
+        case INSTR_NE_V:
+            t[0] = t[1] = t[2] = TYPE_VECTOR;
+            break;
+        case INSTR_EQ_S:
+        case INSTR_NE_S:
+            t[0] = t[1] = TYPE_STRING;
+            break;
+        case INSTR_STORE_F:
+        case INSTR_STOREP_F:
+            t[2] = -1;
+            break;
+        case INSTR_STORE_V:
+            t[0] = t[1] = TYPE_VECTOR; t[2] = -1;
+            break;
+        case INSTR_STORE_S:
+            t[0] = t[1] = TYPE_STRING; t[2] = -1;
+            break;
+        case INSTR_STORE_ENT:
+            t[0] = t[1] = TYPE_ENTITY; t[2] = -1;
+            break;
+        case INSTR_STORE_FLD:
+            t[0] = t[1] = TYPE_FIELD; t[2] = -1;
+            break;
+        case INSTR_STORE_FNC:
+            t[0] = t[1] = TYPE_FUNCTION; t[2] = -1;
+            break;
+        case INSTR_STOREP_V:
+            t[0] = TYPE_VECTOR; t[1] = TYPE_ENTITY; t[2] = -1;
+            break;
+        case INSTR_STOREP_S:
+            t[0] = TYPE_STRING; t[1] = TYPE_ENTITY; t[2] = -1;
+            break;
+        case INSTR_STOREP_ENT:
+            t[0] = TYPE_ENTITY; t[1] = TYPE_ENTITY; t[2] = -1;
+            break;
+        case INSTR_STOREP_FLD:
+            t[0] = TYPE_FIELD; t[1] = TYPE_ENTITY; t[2] = -1;
+            break;
+        case INSTR_STOREP_FNC:
+            t[0] = TYPE_FUNCTION; t[1] = TYPE_ENTITY; t[2] = -1;
+            break;
+    }
+}
+
+static void prog_print_statement(qc_program_t *prog, const prog_section_statement_t *st) {
+    if (st->opcode >= VINSTR_END) {
+        printf("<illegal instruction %d>\n", st->opcode);
+        return;
+    }
+    if ((prog->xflags & VMXF_TRACE) && !prog->function_stack.empty()) {
+        size_t i;
+        for (i = 0; i < prog->function_stack.size(); ++i)
+            printf("->");
+        printf("%s:", prog->function_stack.back());
+    }
+    printf(" <> %-12s", util_instr_str[st->opcode]);
+    if (st->opcode >= INSTR_IF &&
+        st->opcode <= INSTR_IFNOT)
+    {
+        trace_print_global(prog, st->o1.u1, TYPE_FLOAT);
+        printf("%d\n", st->o2.s1);
+    }
+    else if (st->opcode >= INSTR_CALL0 &&
+             st->opcode <= INSTR_CALL8)
+    {
+        trace_print_global(prog, st->o1.u1, TYPE_FUNCTION);
+        printf("\n");
+    }
+    else if (st->opcode == INSTR_GOTO)
+    {
+        printf("%i\n", st->o1.s1);
+    }
+    else
+    {
+        int t[3];
+        trace_types(st->opcode, t);
+        if (t[0] >= 0) trace_print_global(prog, st->o1.u1, t[0]);
+        else           printf("(none),          ");
+        if (t[1] >= 0) trace_print_global(prog, st->o2.u1, t[1]);
+        else           printf("(none),          ");
+        if (t[2] >= 0) trace_print_global(prog, st->o3.u1, t[2]);
+        else           printf("(none)");
+        printf("\n");
+    }
+}
+
+/*
+ * Keeps the last statements run with VMXF_RECORD in a ring, its size
+ * rounded up to a power of two.  Recording one is a handful of stores
+ * where tracing it prints a line, so it can stay on while reproducing
+ * problems which only show up under load.
+ */
+void prog_record(qc_program_t *prog, size_t size) {
+    size_t ring = 1;
+    while (ring < size)
+        ring <<= 1;
+    prog->records.assign(ring, qc_record_t());
+    prog->records_at = 0;
+}
+
+static GMQCC_INLINE void record_operand(qc_program_t *prog, uint16_t glob, qcint_t *value) {
+    /* jump offsets and unused operands name anything */
+    if ((size_t)glob + 3 <= prog->globals.size())
+        memcpy(value, &prog->globals[glob], 3 * sizeof(*value));
+    else
+        value[0] = value[1] = value[2] = 0;
+}
+
+static GMQCC_INLINE void prog_record_statement(qc_program_t *prog, size_t at) {
+    const prog_section_statement_t *st = &prog->code[at];
+    qc_record_t *record = &prog->records[prog->records_at++ & (prog->records.size() - 1)];
+
+    record->statement = (uint32_t)at;
+    record->depth     = (uint32_t)prog->stack.size();
+    record_operand(prog, st->o1.u1, record->a);
+    record_operand(prog, st->o2.u1, record->b);
+}
+
+/* the function a statement belongs to, 0 for none */
+static size_t record_owner(qc_program_t *prog, uint32_t statement) {
+    size_t owner = 0;
+    for (size_t i = 1; i < prog->functions.size(); ++i) {
+        qcint_t entry = prog->functions[i].entry;
+        if (entry > 0 && (uint32_t)entry <= statement &&
+            (!owner || entry > prog->functions[owner].entry))
+            owner = i;
+    }
+    return owner;
+}
+
+/* an operand like trace_print_global does, with the value recorded for it */
+static void record_format_operand(qc_program_t *prog, std::string &line, uint16_t glob,
+                                  const qcint_t *value, int vtype)
+{
+    const prog_section_def_t *def = prog_getdef(prog, glob);
+    const qcany_t *any = (const qcany_t*)value;
+    char buffer[128];
+
+    if (!glob) {
+        line += "<null>";
+        return;
+    }
+
+    if (def) {
+        const char *name = prog_getstring(prog, def->name);
+        line += name[0] == '#' ? "$" : name;
+        vtype = def->type & DEF_TYPEMASK;
+    } else {
+        util_snprintf(buffer, sizeof(buffer), "@%u", (unsigned int)glob);
+        line += buffer;
+    }
+
+    switch (vtype) {
+        case TYPE_VECTOR:
+            util_snprintf(buffer, sizeof(buffer), " '%g %g %g'", any->vector[0], any->vector[1], any->vector[2]);
+            break;
+        case TYPE_STRING: {
+            /* temporary strings are gone when decoding a file */
+            const char *str = prog_getstring(prog, any->string);
+            size_t      len = 0;
+            line += " \"";
+            for (; *str && len < 24; ++str, ++len) {
+                if (*str == '\n')
+                    line += "\\n";
+                else
+                    line += *str;
+            }
+            util_snprintf(buffer, sizeof(buffer), "%s\"", *str ? "..." : "");
+            break;
+        }
+        case TYPE_FUNCTION:
+            if (any->function > 0 && (size_t)any->function < prog->functions.size()) {
+                util_snprintf(buffer, sizeof(buffer), " %s",
+                              prog_getstring(prog, prog->functions[any->function].name));
+                break;
+            }
+            /* fall through */
+        case TYPE_VOID:
+        case TYPE_ENTITY:
+        case TYPE_FIELD:
         case TYPE_POINTER:
-            len += printf("(%i),", value->_int);
-            break;
-        case TYPE_VECTOR:
-            len += printf("'%g %g %g',", value->vector[0],
-                                         value->vector[1],
-                                         value->vector[2]);
-            break;
-        case TYPE_STRING:
-            if (value->string)
-                len += print_escaped_string(prog_getstring(prog, value->string), sizeof(spaces)-len-5);
-            else
-                len += printf("(null)");
-            len += printf(",");
-            /* len += printf("\"%s\",", prog_getstring(prog, value->string)); */
+            util_snprintf(buffer, sizeof(buffer), " (%i)", any->_int);
             break;
         case TYPE_FLOAT:
         default:
-            len += printf("%g,", value->_float);
+            util_snprintf(buffer, sizeof(buffer), " %g", any->_float);
             break;
     }
-done:
-    if (len < (int)sizeof(spaces)-1) {
-        spaces[sizeof(spaces)-1-len] = 0;
-        fputs(spaces, stdout);
-        spaces[sizeof(spaces)-1-len] = ' ';
-    }
+    line += buffer;
 }
 
-static void prog_print_statement(qc_program_t *prog, prog_section_statement_t *st) {
+/* a recorded statement like prog_print_statement does, lines may be empty */
+static std::string record_format(qc_program_t *prog, const qc_record_t &record,
+                                 const std::vector<int32_t> &lines)
+{
+    const prog_section_statement_t *st;
+    std::string line;
+    char        buffer[64];
+    size_t      owner;
+
+    if (record.statement >= prog->code.size())
+        return "<statement out of range>";
+    st = &prog->code[record.statement];
+
+    for (uint32_t i = 0; i < record.depth; ++i)
+        line += "->";
+    owner = record_owner(prog, record.statement);
+    line += owner ? prog_getstring(prog, prog->functions[owner].name) : "<none>";
+    if (record.statement < lines.size()) {
+        util_snprintf(buffer, sizeof(buffer), ":%d", (int)lines[record.statement]);
+        line += buffer;
+    }
+
     if (st->opcode >= VINSTR_END) {
-        printf("<illegal instruction %d>\n", st->opcode);
-        return;
+        util_snprintf(buffer, sizeof(buffer), " <illegal instruction %d>", st->opcode);
+        return line + buffer;
     }
-    if ((prog->xflags & VMXF_TRACE) && !prog->function_stack.empty()) {
-        size_t i;
-        for (i = 0; i < prog->function_stack.size(); ++i)
-            printf("->");
-        printf("%s:", prog->function_stack.back());
+    util_snprintf(buffer, sizeof(buffer), " <> %-12s", util_instr_str[st->opcode]);
+    line += buffer;
+
+    if (st->opcode >= INSTR_IF && st->opcode <= INSTR_IFNOT) {
+        record_format_operand(prog, line, st->o1.u1, record.a, TYPE_FLOAT);
+        util_snprintf(buffer, sizeof(buffer), ", %d", st->o2.s1);
+        line += buffer;
+    } else if (st->opcode >= INSTR_CALL0 && st->opcode <= INSTR_CALL8) {
+        record_format_operand(prog, line, st->o1.u1, record.a, TYPE_FUNCTION);
+    } else if (st->opcode == INSTR_GOTO) {
+        util_snprintf(buffer, sizeof(buffer), "%d", st->o1.s1);
+        line += buffer;
+    } else {
+        int t[3];
+        trace_types(st->opcode, t);
+        if (t[0] >= 0)
+            record_format_operand(prog, line, st->o1.u1, record.a, t[0]);
+        if (t[1] >= 0) {
+            line += ", ";
+            record_format_operand(prog, line, st->o2.u1, record.b, t[1]);
+        }
     }
-    printf(" <> %-12s", util_instr_str[st->opcode]);
-    if (st->opcode >= INSTR_IF &&
-        st->opcode <= INSTR_IFNOT)
-    {
-        trace_print_global(prog, st->o1.u1, TYPE_FLOAT);
-        printf("%d\n", st->o2.s1);
+    return line;
+}
+
+/* the recorded statements from the oldest on */
+static std::vector<qc_record_t> record_ring(qc_program_t *prog, size_t count) {
+    std::vector<qc_record_t> ring;
+    size_t                   at;
+
+    if (count > prog->records.size())
+        count = prog->records.size();
+    if (count > prog->records_at)
+        count = prog->records_at;
+    for (at = prog->records_at - count; at != prog->records_at; ++at)
+        ring.push_back(prog->records[at & (prog->records.size() - 1)]);
+    return ring;
+}
+
+/* passes the last statements to the error callback, called on the first error */
+static void prog_record_dump(qc_program_t *prog, size_t count) {
+    std::vector<int32_t> lines;
+    std::vector<qc_record_t> ring = record_ring(prog, count);
+
+    prog_message(prog, "the last %zu of %zu statements executed:", ring.size(), prog->records_at);
+    for (auto &it : ring)
+        prog_message(prog, "    %s", record_format(prog, it, lines).c_str());
+}
+
+/*
+ * Writes the ring for prog_record_decode, or prints it decoded when the
+ * file is "-". The file holds "QCTR", the version, the crc and number of
+ * statements of the program, the number of records and how many came
+ * before the first of them, followed by the records, all little endian.
+ */
+bool prog_record_write(qc_program_t *prog, const char *filename) {
+    std::vector<qc_record_t> ring = record_ring(prog, prog->records.size());
+    uint32_t header[5];
+    FILE    *fp;
+
+    if (!strcmp(filename, "-")) {
+        std::vector<int32_t> lines;
+        prog_load_lno(prog, nullptr, lines);
+        printf("the last %zu of %zu statements executed:\n", ring.size(), prog->records_at);
+        for (auto &it : ring)
+            printf("%s\n", record_format(prog, it, lines).c_str());
+        return true;
     }
-    else if (st->opcode >= INSTR_CALL0 &&
-             st->opcode <= INSTR_CALL8)
-    {
-        trace_print_global(prog, st->o1.u1, TYPE_FUNCTION);
-        printf("\n");
+
+    if (!(fp = fopen(filename, "wb"))) {
+        prog_message(prog, "failed to open `%s` for writing", filename);
+        return false;
     }
-    else if (st->opcode == INSTR_GOTO)
+
+    header[0] = 1;
+    header[1] = prog->crc16;
+    header[2] = (uint32_t)prog->code.size();
+    header[3] = (uint32_t)ring.size();
+    header[4] = (uint32_t)(prog->records_at - ring.size());
+    util_endianswap(header, 5, sizeof(header[0]));
+    util_endianswap(ring.data(), ring.size() * sizeof(qc_record_t) / sizeof(uint32_t), sizeof(uint32_t));
+
+    if (fwrite("QCTR", 4, 1, fp) != 1 ||
+        fwrite(header, sizeof(header), 1, fp) != 1 ||
+        (!ring.empty() && fwrite(ring.data(), sizeof(qc_record_t), ring.size(), fp) != ring.size()))
     {
-        printf("%i\n", st->o1.s1);
+        prog_message(prog, "failed to write `%s`", filename);
+        fclose(fp);
+        return false;
+    }
+    fclose(fp);
+    return true;
+}
+
+/* prints a file written by prog_record_write, with the lines from the .lno file */
+bool prog_record_decode(qc_program_t *prog, const char *filename, const char *lnofile) {
+    std::vector<qc_record_t> ring;
+    std::vector<int32_t>     lines;
+    uint32_t header[5];
+    char     magic[4];
+    long     size;
+    FILE    *fp;
+
+    if (!(fp = fopen(filename, "rb"))) {
+        prog_message(prog, "failed to open `%s`", filename);
+        return false;
+    }
+
+    /* the number of records has to agree with the file before it is trusted */
+    if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0)
+        goto invalid;
+
+    if (fread(magic, sizeof(magic), 1, fp) != 1 || memcmp(magic, "QCTR", 4) ||
+        fread(header, sizeof(header), 1, fp) != 1)
+        goto invalid;
+
+    util_endianswap(header, 5, sizeof(header[0]));
+    if (header[0] != 1 || header[1] != prog->crc16 || header[2] != prog->code.size())
+        goto invalid;
+
+    if ((uint64_t)header[3] * sizeof(qc_record_t) != (uint64_t)size - 4 - sizeof(header))
+        goto invalid;
+    ring.resize(header[3]);
+    if (!ring.empty() && fread(ring.data(), sizeof(qc_record_t), ring.size(), fp) != ring.size())
+        goto invalid;
+    util_endianswap(ring.data(), ring.size() * sizeof(qc_record_t) / sizeof(uint32_t), sizeof(uint32_t));
+    fclose(fp);
+
+    prog_load_lno(prog, lnofile, lines);
+    printf("the last %zu of %zu statements executed:\n", ring.size(), (size_t)header[3] + header[4]);
+    for (auto &it : ring)
+        printf("%s\n", record_format(prog, it, lines).c_str());
+    return true;
+
+invalid:
+    prog_message(prog, "`%s` was not recorded running `%s`", filename, prog->filename.c_str());
+    fclose(fp);
+    return false;
+}
+
+/* the tracing loop also runs for VMXF_RECORD, either or both may be set */
+static GMQCC_INLINE void prog_trace_step(qc_program_t *prog, size_t at) {
+    if (prog->xflags & VMXF_RECORD)
+        prog_record_statement(prog, at);
+    if (prog->xflags & VMXF_TRACE)
+        prog_print_statement(prog, &prog->code[0] + at);
+}
+
+void prog_disasm_function(qc_program_t *prog, size_t id) {
+    prog_section_function_t *fdef = &prog->functions[0] + id;
+    const prog_section_statement_t *st;
+
+    if (fdef->entry < 0) {
+        printf("FUNCTION \"%s\" = builtin #%i\n", prog_getstring(prog, fdef->name), (int)-fdef->entry);
+        return;
     }
     else
-    {
-        int t[3] = { TYPE_FLOAT, TYPE_FLOAT, TYPE_FLOAT };
-        switch (st->opcode)
-        {
-            case INSTR_MUL_FV:
-                t[1] = t[2] = TYPE_VECTOR;
-                break;
-            case INSTR_MUL_VF:
-                t[0] = t[2] = TYPE_VECTOR;
-                break;
-            case INSTR_MUL_V:
-                t[0] = t[1] = TYPE_VECTOR;
-                break;
-            case INSTR_ADD_V:
-            case INSTR_SUB_V:
-            case INSTR_EQ_V:
-            case INSTR_NE_V:
-                t[0] = t[1] = t[2] = TYPE_VECTOR;
-                break;
-            case INSTR_EQ_S:
-            case INSTR_NE_S:
-                t[0] = t[1] = TYPE_STRING;
-                break;
-            case INSTR_STORE_F:
-            case INSTR_STOREP_F:
-                t[2] = -1;
-                break;
-            case INSTR_STORE_V:
-                t[0] = t[1] = TYPE_VECTOR; t[2] = -1;
-                break;
-            case INSTR_STORE_S:
-                t[0] = t[1] = TYPE_STRING; t[2] = -1;
-                break;
-            case INSTR_STORE_ENT:
-                t[0] = t[1] = TYPE_ENTITY; t[2] = -1;
-                break;
-            case INSTR_STORE_FLD:
-                t[0] = t[1] = TYPE_FIELD; t[2] = -1;
-                break;
-            case INSTR_STORE_FNC:
-                t[0] = t[1] = TYPE_FUNCTION; t[2] = -1;
-                break;
-            case INSTR_STOREP_V:
-                t[0] = TYPE_VECTOR; t[1] = TYPE_ENTITY; t[2] = -1;
-                break;
-            case INSTR_STOREP_S:
-                t[0] = TYPE_STRING; t[1] = TYPE_ENTITY; t[2] = -1;
-                break;
-            case INSTR_STOREP_ENT:
-                t[0] = TYPE_ENTITY; t[1] = TYPE_ENTITY; t[2] = -1;
-                break;
-            case INSTR_STOREP_FLD:
-                t[0] = TYPE_FIELD; t[1] = TYPE_ENTITY; t[2] = -1;
-                break;
-            case INSTR_STOREP_FNC:
-                t[0] = TYPE_FUNCTION; t[1] = TYPE_ENTITY; t[2] = -1;
-                break;
-        }
-        if (t[0] >= 0) trace_print_global(prog, st->o1.u1, t[0]);
-        else           printf("(none),          ");
-        if (t[1] >= 0) trace_print_global(prog, st->o2.u1, t[1]);
-        else           printf("(none),          ");
-        if (t[2] >= 0) trace_print_global(prog, st->o3.u1, t[2]);
-        else           printf("(none)");
-        printf("\n");
+        printf("FUNCTION \"%s\"\n", prog_getstring(prog, fdef->name));
+
+    st = &prog->code[0] + fdef->entry;
+    while (st->opcode != INSTR_DONE) {
+        prog_print_statement(prog, st);
+        ++st;
     }
 }
 
@@ -463,6 +1743,13 @@ static qcint_t prog_enterfunction(qc_program_t *prog, prog_section_function_t *f
         prog->function_stack.emplace_back(str);
     }
 
+    if (prog->xflags & VMXF_PROFILE)
+        prog_profile_enter(prog, func - &prog->functions[0],
+                           prog->stack.empty() ? -1 : (qcint_t)prog->statement - 1);
+    if (prog->xflags & VMXF_TIMING)
+        prog_timing_enter(prog, func - &prog->functions[0],
+                          prog->stack.empty() ? -1 : (qcint_t)prog->statement - 1);
+
 #ifdef QCVM_BACKUP_STRATEGY_CALLER_VARS
     if (prog->stack.size())
     {
@@ -475,9 +1762,16 @@ static qcint_t prog_enterfunction(qc_program_t *prog, prog_section_function_t *f
         }
     }
 #else
-    {
+    if (!(prog->xflags & VMXF_FRAMES)) {
+        qcint_t *globals = &prog->globals[0] + func->firstlocal;
+        prog->localstack.insert(prog->localstack.end(), globals, globals + func->locals);
+    }
+    else if (!prog->frames_builtins && !prog->reentrant[func - &prog->functions[0]])
+        prog->frames_fast++;
+    else {
         qcint_t *globals = &prog->globals[0] + func->firstlocal;
         prog->localstack.insert(prog->localstack.end(), globals, globals + func->locals);
+        prog->frames_saved++;
     }
 #endif
 
@@ -508,6 +1802,11 @@ static qcint_t prog_leavefunction(qc_program_t *prog) {
             prog->function_stack.pop_back();
     }
 
+    if (prog->xflags & VMXF_PROFILE)
+        prog_profile_leave(prog);
+    if ((prog->xflags & VMXF_TIMING) && !prog->timing_stack.empty())
+        prog_timing_leave(prog, prog->timing_stack.size() - 1);
+
 #ifdef QCVM_BACKUP_STRATEGY_CALLER_VARS
     if (prog->stack.size() > 1) {
         prev  = prog->stack[prog->stack.size()-2].function;
@@ -517,11 +1816,10 @@ static qcint_t prog_leavefunction(qc_program_t *prog) {
     prev  = prog->stack[prog->stack.size()-1].function;
     oldsp = prog->stack[prog->stack.size()-1].localsp;
 #endif
-    if (prev) {
-        if (prev->locals) {
-            qcint_t *globals = &prog->globals[0] + prev->firstlocal;
-            memcpy(globals, &prog->localstack[oldsp], prev->locals * sizeof(prog->localstack[0]));
-        }
+    /* nothing was backed up for VMXF_FRAMES */
+    if (prev && prog->localstack.size() > oldsp) {
+        qcint_t *globals = &prog->globals[0] + prev->firstlocal;
+        memcpy(globals, &prog->localstack[oldsp], prev->locals * sizeof(prog->localstack[0]));
         prog->localstack.resize(oldsp);
     }
 
@@ -530,722 +1828,362 @@ static qcint_t prog_leavefunction(qc_program_t *prog) {
     return st.stmt - 1; /* offset the ++st */
 }
 
-bool prog_exec(qc_program_t *prog, prog_section_function_t *func, size_t flags, long maxjumps) {
-    long jumpcount = 0;
-    size_t oldxflags = prog->xflags;
-    prog_section_statement_t *st;
+/*
+ * Runs the builtin newf for the call before prog->statement, and times it
+ * with VMXF_TIMING.
+ */
+static void prog_callbuiltin(qc_program_t *prog, prog_section_function_t *newf) {
+    qcint_t builtinnumber = -newf->entry;
 
-    prog->vmerror = 0;
-    prog->xflags = flags;
+    if ((size_t)builtinnumber >= prog->builtins.size() || !prog->builtins[builtinnumber]) {
+        prog_error(prog, "No such builtin #%i in %s! Try updating your gmqcc sources",
+                  builtinnumber, prog->filename.c_str());
+        return;
+    }
 
-    st = &prog->code[0] + prog_enterfunction(prog, func);
-    --st;
-    switch (flags)
-    {
-        default:
-        case 0:
-        {
-#define QCVM_LOOP    1
-#define QCVM_PROFILE 0
-#define QCVM_TRACE   0
-#           include __FILE__
-        }
-        case (VMXF_TRACE):
-        {
-#define QCVM_PROFILE 0
-#define QCVM_TRACE   1
-#           include __FILE__
-        }
-        case (VMXF_PROFILE):
-        {
-#define QCVM_PROFILE 1
-#define QCVM_TRACE   0
-#           include __FILE__
-        }
-        case (VMXF_TRACE|VMXF_PROFILE):
-        {
-#define QCVM_PROFILE 1
-#define QCVM_TRACE   1
-#           include __FILE__
-        }
-    };
+    /* any function it runs through prog_exec backs up its locals */
+    prog->frames_builtins++;
+    if (prog->xflags & VMXF_TIMING) {
+        size_t depth = prog->timing_stack.size();
+        prog_timing_enter(prog, newf - &prog->functions[0], (qcint_t)prog->statement - 1);
+        prog->builtins[builtinnumber](prog);
+        prog_timing_leave(prog, depth);
+    }
+    else
+        prog->builtins[builtinnumber](prog);
+    prog->frames_builtins--;
+}
 
-cleanup:
-    prog->xflags = oldxflags;
-    prog->localstack.clear();
-    prog->stack.clear();
-    if (prog->vmerror)
+void prog_setbuiltin(qc_program_t *prog, size_t number, prog_builtin_t builtin) {
+    if (number >= prog->builtins.size())
+        prog->builtins.resize(number + 1, nullptr);
+    prog->builtins[number] = builtin;
+}
+
+bool prog_jit(qc_program_t *prog, size_t threshold) {
+    if (!jit_supported())
         return false;
+    if (!prog->jit)
+        prog->jit = jit_create(prog);
+    prog->jit_threshold = threshold;
     return true;
 }
 
-/***********************************************************************
- * main for when building the standalone executor
+/*
+ * Runs a function as native code when it is compiled or due to be. The
+ * caller handles errors through vmerror like after any other call.
  */
+static bool prog_jit_call(qc_program_t *prog, prog_section_function_t *func) {
+    jit_native_t native;
 
-#include <math.h>
-
-const char *type_name[TYPE_COUNT] = {
-    "void",
-    "string",
-    "float",
-    "vector",
-    "entity",
-    "field",
-    "function",
-    "pointer",
-    "integer",
+    if (!prog->jit || (prog->xflags & (VMXF_TRACE|VMXF_PROFILE|VMXF_RECORD)))
+        return false;
+    if (!(native = jit_lookup(prog, func)))
+        return false;
 
-    "variant",
+    prog_enterfunction(prog, func);
+    if (!native(prog, &prog->globals[0], &prog->jumps))
+        prog_leavefunction(prog);
+    return true;
+}
 
-    "struct",
-    "union",
-    "array",
+/*
+ * Runtime support for native code, these do what the loop below does for
+ * the statements the JIT does not inline.
+ */
+#define JIT_OPERAND(x) ( (qcany_t*) (&prog->globals[0] + st->x.u1) )
 
-    "nil",
-    "noexpr"
-};
+int jit_rt_call(qc_program_t *prog, qcint_t statement) {
+    const prog_section_statement_t *st = &prog->code[statement];
+    prog_section_function_t  *newf;
+    qcany_t                  *a = JIT_OPERAND(o1);
 
-struct qcvm_parameter {
-    int         vtype;
-    const char *value;
-};
+    prog->argc = st->opcode - INSTR_CALL0;
+    if (!a->function)
+        prog_error(prog, "nullptr function in `%s`", prog->filename.c_str());
 
-static std::vector<qcvm_parameter> main_params;
-
-#define CheckArgs(num) do {                                                    \
-    if (prog->argc != (num)) {                                                 \
-        prog->vmerror++;                                                       \
-        fprintf(stderr, "ERROR: invalid number of arguments for %s: %i, expected %i\n", \
-        __func__, prog->argc, (num));                                      \
-        return -1;                                                             \
-    }                                                                          \
-} while (0)
-
-#define GetGlobal(idx) ((qcany_t*)(&prog->globals[0] + (idx)))
-#define GetArg(num) GetGlobal(OFS_PARM0 + 3*(num))
-#define Return(any) *(GetGlobal(OFS_RETURN)) = (any)
-
-static int qc_print(qc_program_t *prog) {
-    size_t i;
-    const char *laststr = nullptr;
-    for (i = 0; i < (size_t)prog->argc; ++i) {
-        qcany_t *str = (qcany_t*)(&prog->globals[0] + OFS_PARM0 + 3*i);
-        laststr = prog_getstring(prog, str->string);
-        printf("%s", laststr);
-    }
-    if (laststr && (prog->xflags & VMXF_TRACE)) {
-        size_t len = strlen(laststr);
-        if (!len || laststr[len-1] != '\n')
-            printf("\n");
+    if (!a->function || a->function >= (qcint_t)prog->functions.size()) {
+        prog_error(prog, "CALL outside the program in `%s`", prog->filename.c_str());
+        return 1;
     }
-    return 0;
-}
-
-static int qc_error(qc_program_t *prog) {
-    fprintf(stderr, "*** VM raised an error:\n");
-    qc_print(prog);
-    prog->vmerror++;
-    return -1;
-}
-
-static int qc_ftos(qc_program_t *prog) {
-    char buffer[512];
-    qcany_t *num;
-    qcany_t str;
-    CheckArgs(1);
-    num = GetArg(0);
-    util_snprintf(buffer, sizeof(buffer), "%g", num->_float);
-    str.string = prog_tempstring(prog, buffer);
-    Return(str);
-    return 0;
-}
-
-static int qc_stof(qc_program_t *prog) {
-    qcany_t *str;
-    qcany_t num;
-    CheckArgs(1);
-    str = GetArg(0);
-    num._float = (float)strtod(prog_getstring(prog, str->string), nullptr);
-    Return(num);
-    return 0;
-}
 
-static int qc_stov(qc_program_t *prog) {
-    qcany_t *str;
-    qcany_t num;
-    CheckArgs(1);
-    str = GetArg(0);
-    (void)util_sscanf(prog_getstring(prog, str->string), " ' %f %f %f ' ",
-                      &num.vector[0],
-                      &num.vector[1],
-                      &num.vector[2]);
-    Return(num);
-    return 0;
-}
-
-static int qc_vtos(qc_program_t *prog) {
-    char buffer[512];
-    qcany_t *num;
-    qcany_t str;
-    CheckArgs(1);
-    num = GetArg(0);
-    util_snprintf(buffer, sizeof(buffer), "'%g %g %g'", num->vector[0], num->vector[1], num->vector[2]);
-    str.string = prog_tempstring(prog, buffer);
-    Return(str);
-    return 0;
-}
+    newf = &prog->functions[a->function];
+    newf->profile++;
 
-static int qc_etos(qc_program_t *prog) {
-    char buffer[512];
-    qcany_t *num;
-    qcany_t str;
-    CheckArgs(1);
-    num = GetArg(0);
-    util_snprintf(buffer, sizeof(buffer), "%i", num->_int);
-    str.string = prog_tempstring(prog, buffer);
-    Return(str);
-    return 0;
-}
+    prog->statement = statement + 1;
 
-static int qc_spawn(qc_program_t *prog) {
-    qcany_t ent;
-    CheckArgs(0);
-    ent.edict = prog_spawn_entity(prog);
-    Return(ent);
-    return (ent.edict ? 0 : -1);
-}
+    if (newf->entry < 0)
+        prog_callbuiltin(prog, newf);
+    else if (!prog_jit_call(prog, newf))
+        prog_exec(prog, newf, prog->xflags, prog->jumps.limit);
 
-static int qc_kill(qc_program_t *prog) {
-    qcany_t *ent;
-    CheckArgs(1);
-    ent = GetArg(0);
-    prog_free_entity(prog, ent->edict);
-    return 0;
+    return prog->vmerror != 0;
 }
 
-static int qc_sqrt(qc_program_t *prog) {
-    qcany_t *num, out;
-    CheckArgs(1);
-    num = GetArg(0);
-    out._float = sqrt(num->_float);
-    Return(out);
-    return 0;
-}
+int jit_rt_load(qc_program_t *prog, qcint_t statement) {
+    const prog_section_statement_t *st = &prog->code[statement];
+    qcany_t *a = JIT_OPERAND(o1);
+    qcany_t *b = JIT_OPERAND(o2);
 
-static int qc_vlen(qc_program_t *prog) {
-    qcany_t *vec, len;
-    CheckArgs(1);
-    vec = GetArg(0);
-    len._float = sqrt(vec->vector[0] * vec->vector[0] +
-                      vec->vector[1] * vec->vector[1] +
-                      vec->vector[2] * vec->vector[2]);
-    Return(len);
+    if (a->edict < 0 || a->edict >= prog->entities) {
+        prog_error(prog, "progs `%s` attempted to read an out of bounds entity", prog->filename.c_str());
+        return 1;
+    }
+    if ((unsigned int)(b->_int) >= (unsigned int)(prog->entityfields)) {
+        prog_error(prog, "prog `%s` attempted to read an invalid field from entity (%i)",
+                  prog->filename.c_str(), b->_int);
+        return 1;
+    }
+    prog_entityread(prog, a->edict);
+    JIT_OPERAND(o3)->_int = *prog_entityword(prog, a->edict, b->_int);
     return 0;
 }
 
-static int qc_normalize(qc_program_t *prog) {
-    double len;
-    qcany_t *vec;
-    qcany_t out;
-    CheckArgs(1);
-    vec = GetArg(0);
-    len = sqrt(vec->vector[0] * vec->vector[0] +
-               vec->vector[1] * vec->vector[1] +
-               vec->vector[2] * vec->vector[2]);
-    if (len)
-        len = 1.0 / len;
-    else
-        len = 0;
-    out.vector[0] = len * vec->vector[0];
-    out.vector[1] = len * vec->vector[1];
-    out.vector[2] = len * vec->vector[2];
-    Return(out);
-    return 0;
-}
+int jit_rt_load_v(qc_program_t *prog, qcint_t statement) {
+    const prog_section_statement_t *st = &prog->code[statement];
+    qcany_t *a = JIT_OPERAND(o1);
+    qcany_t *b = JIT_OPERAND(o2);
+    qcany_t *c = JIT_OPERAND(o3);
 
-static int qc_strcat(qc_program_t *prog) {
-    char  *buffer;
-    size_t len1,   len2;
-    qcany_t *str1,  *str2;
-    qcany_t  out;
-
-    const char *cstr1;
-    const char *cstr2;
-
-    CheckArgs(2);
-    str1 = GetArg(0);
-    str2 = GetArg(1);
-    cstr1 = prog_getstring(prog, str1->string);
-    cstr2 = prog_getstring(prog, str2->string);
-    len1 = strlen(cstr1);
-    len2 = strlen(cstr2);
-    buffer = (char*)mem_a(len1 + len2 + 1);
-    memcpy(buffer, cstr1, len1);
-    memcpy(buffer+len1, cstr2, len2+1);
-    out.string = prog_tempstring(prog, buffer);
-    mem_d(buffer);
-    Return(out);
+    if (a->edict < 0 || a->edict >= prog->entities) {
+        prog_error(prog, "progs `%s` attempted to read an out of bounds entity", prog->filename.c_str());
+        return 1;
+    }
+    if (b->_int < 0 || b->_int + 3 > (qcint_t)prog->entityfields) {
+        prog_error(prog, "prog `%s` attempted to read an invalid field from entity (%i)",
+                  prog->filename.c_str(), b->_int + 2);
+        return 1;
+    }
+    prog_entityread(prog, a->edict);
+    prog_entityload_v(prog, a->edict, b->_int, c);
     return 0;
 }
 
-static int qc_strcmp(qc_program_t *prog) {
-    qcany_t *str1,  *str2;
-    qcany_t out;
+int jit_rt_address(qc_program_t *prog, qcint_t statement) {
+    const prog_section_statement_t *st = &prog->code[statement];
+    qcany_t *a = JIT_OPERAND(o1);
+    qcany_t *b = JIT_OPERAND(o2);
 
-    const char *cstr1;
-    const char *cstr2;
-
-    if (prog->argc != 2 && prog->argc != 3) {
-        fprintf(stderr, "ERROR: invalid number of arguments for strcmp/strncmp: %i, expected 2 or 3\n",
-               prog->argc);
-        return -1;
+    if (a->edict < 0 || a->edict >= prog->entities) {
+        prog_error(prog, "prog `%s` attempted to address an out of bounds entity %i", prog->filename.c_str(), a->edict);
+        return 1;
     }
-
-    str1 = GetArg(0);
-    str2 = GetArg(1);
-    cstr1 = prog_getstring(prog, str1->string);
-    cstr2 = prog_getstring(prog, str2->string);
-    if (prog->argc == 3)
-        out._float = strncmp(cstr1, cstr2, GetArg(2)->_float);
-    else
-        out._float = strcmp(cstr1, cstr2);
-    Return(out);
+    if ((unsigned int)(b->_int) >= (unsigned int)(prog->entityfields)) {
+        prog_error(prog, "prog `%s` attempted to read an invalid field from entity (%i)",
+                  prog->filename.c_str(), b->_int);
+        return 1;
+    }
+    JIT_OPERAND(o3)->_int = a->edict * (qcint_t)prog->entityfields + b->_int;
     return 0;
 }
 
-static int qc_floor(qc_program_t *prog) {
-    qcany_t *num, out;
-    CheckArgs(1);
-    num = GetArg(0);
-    out._float = floor(num->_float);
-    Return(out);
-    return 0;
-}
+int jit_rt_storep(qc_program_t *prog, qcint_t statement) {
+    const prog_section_statement_t *st = &prog->code[statement];
+    qcany_t *a = JIT_OPERAND(o1);
+    qcany_t *b = JIT_OPERAND(o2);
 
-static int qc_pow(qc_program_t *prog) {
-    qcany_t *base, *exp, out;
-    CheckArgs(2);
-    base = GetArg(0);
-    exp = GetArg(1);
-    out._float = powf(base->_float, exp->_float);
-    Return(out);
-    return 0;
+    if (b->_int < 0 || b->_int >= prog->entities * (qcint_t)prog->entityfields) {
+        prog_error(prog, "`%s` attempted to write to an out of bounds edict (%i)", prog->filename.c_str(), b->_int);
+        return 1;
+    }
+    if (b->_int < (qcint_t)prog->entityfields && !prog->allowworldwrites)
+        prog_error(prog, "`%s` tried to assign to world.%s (field %i)\n",
+                  prog->filename.c_str(),
+                  prog_getstring(prog, prog_entfield(prog, b->_int)->name),
+                  b->_int);
+    *prog_entitystore(prog, b->_int) = a->_int;
+    return prog->vmerror != 0;
 }
 
-static prog_builtin_t qc_builtins[] = {
-    nullptr,
-    &qc_print,       /*   1   */
-    &qc_ftos,        /*   2   */
-    &qc_spawn,       /*   3   */
-    &qc_kill,        /*   4   */
-    &qc_vtos,        /*   5   */
-    &qc_error,       /*   6   */
-    &qc_vlen,        /*   7   */
-    &qc_etos,        /*   8   */
-    &qc_stof,        /*   9   */
-    &qc_strcat,      /*   10  */
-    &qc_strcmp,      /*   11  */
-    &qc_normalize,   /*   12  */
-    &qc_sqrt,        /*   13  */
-    &qc_floor,       /*   14  */
-    &qc_pow,         /*   15  */
-    &qc_stov         /*   16  */
-};
+int jit_rt_storep_v(qc_program_t *prog, qcint_t statement) {
+    const prog_section_statement_t *st = &prog->code[statement];
+    qcany_t *a = JIT_OPERAND(o1);
+    qcany_t *b = JIT_OPERAND(o2);
 
-static const char *arg0 = nullptr;
-
-static void version(void) {
-    printf("GMQCC-QCVM %d.%d.%d Built %s %s\n",
-           GMQCC_VERSION_MAJOR,
-           GMQCC_VERSION_MINOR,
-           GMQCC_VERSION_PATCH,
-           __DATE__,
-           __TIME__
-    );
-}
-
-static void usage(void) {
-    printf("usage: %s [options] [parameters] file\n", arg0);
-    printf("options:\n");
-    printf("  -h, --help         print this message\n"
-           "  -trace             trace the execution\n"
-           "  -profile           perform profiling during execution\n"
-           "  -info              print information from the prog's header\n"
-           "  -disasm            disassemble and exit\n"
-           "  -disasm-func func  disassemble and exit\n"
-           "  -printdefs         list the defs section\n"
-           "  -printfields       list the field section\n"
-           "  -printfuns         list functions information\n"
-           "  -v                 be verbose\n"
-           "  -vv                be even more verbose\n");
-    printf("parameters:\n");
-    printf("  -vector <V>   pass a vector parameter to main()\n"
-           "  -float  <f>   pass a float parameter to main()\n"
-           "  -string <s>   pass a string parameter to main() \n");
-}
-
-static void prog_main_setparams(qc_program_t *prog) {
-    size_t i;
-    qcany_t *arg;
-
-    for (i = 0; i < main_params.size(); ++i) {
-        arg = GetGlobal(OFS_PARM0 + 3*i);
-        arg->vector[0] = 0;
-        arg->vector[1] = 0;
-        arg->vector[2] = 0;
-        switch (main_params[i].vtype) {
-            case TYPE_VECTOR:
-                (void)util_sscanf(main_params[i].value, " %f %f %f ",
-                                       &arg->vector[0],
-                                       &arg->vector[1],
-                                       &arg->vector[2]);
-                break;
-            case TYPE_FLOAT:
-                arg->_float = atof(main_params[i].value);
-                break;
-            case TYPE_STRING:
-                arg->string = prog_tempstring(prog, main_params[i].value);
-                break;
-            default:
-                fprintf(stderr, "error: unhandled parameter type: %i\n", main_params[i].vtype);
-                break;
-        }
+    if (b->_int < 0 || b->_int + 2 >= prog->entities * (qcint_t)prog->entityfields) {
+        prog_error(prog, "`%s` attempted to write to an out of bounds edict (%i)", prog->filename.c_str(), b->_int);
+        return 1;
     }
+    if (b->_int < (qcint_t)prog->entityfields && !prog->allowworldwrites)
+        prog_error(prog, "`%s` tried to assign to world.%s (field %i)\n",
+                  prog->filename.c_str(),
+                  prog_getstring(prog, prog_entfield(prog, b->_int)->name),
+                  b->_int);
+    prog_entitystore_v(prog, b->_int, a);
+    return prog->vmerror != 0;
 }
 
-static void prog_disasm_function(qc_program_t *prog, size_t id);
-
-int main(int argc, char **argv) {
-    size_t      i;
-    qcint_t       fnmain = -1;
-    qc_program_t *prog;
-    size_t      xflags = VMXF_DEFAULT;
-    bool        opts_printfields = false;
-    bool        opts_printdefs   = false;
-    bool        opts_printfuns   = false;
-    bool        opts_disasm      = false;
-    bool        opts_info        = false;
-    bool        noexec           = false;
-    const char *progsfile        = nullptr;
-    int         opts_v           = 0;
-    std::vector<const char*> dis_list;
-
-    arg0 = argv[0];
-
-    if (argc < 2) {
-        usage();
-        exit(EXIT_FAILURE);
-    }
-
-    while (argc > 1) {
-        if (!strcmp(argv[1], "-h") ||
-            !strcmp(argv[1], "-help") ||
-            !strcmp(argv[1], "--help"))
-        {
-            usage();
-            exit(EXIT_SUCCESS);
-        }
-        else if (!strcmp(argv[1], "-v")) {
-            ++opts_v;
-            --argc;
-            ++argv;
-        }
-        else if (!strncmp(argv[1], "-vv", 3)) {
-            const char *av = argv[1]+1;
-            for (; *av; ++av) {
-                if (*av == 'v')
-                    ++opts_v;
-                else {
-                    usage();
-                    exit(EXIT_FAILURE);
-                }
-            }
-            --argc;
-            ++argv;
-        }
-        else if (!strcmp(argv[1], "-version") ||
-                 !strcmp(argv[1], "--version"))
-        {
-            version();
-            exit(EXIT_SUCCESS);
-        }
-        else if (!strcmp(argv[1], "-trace")) {
-            --argc;
-            ++argv;
-            xflags |= VMXF_TRACE;
-        }
-        else if (!strcmp(argv[1], "-profile")) {
-            --argc;
-            ++argv;
-            xflags |= VMXF_PROFILE;
-        }
-        else if (!strcmp(argv[1], "-info")) {
-            --argc;
-            ++argv;
-            opts_info = true;
-            noexec = true;
-        }
-        else if (!strcmp(argv[1], "-disasm")) {
-            --argc;
-            ++argv;
-            opts_disasm = true;
-            noexec = true;
-        }
-        else if (!strcmp(argv[1], "-disasm-func")) {
-            --argc;
-            ++argv;
-            if (argc <= 1) {
-                usage();
-                exit(EXIT_FAILURE);
-            }
-            dis_list.emplace_back(argv[1]);
-            --argc;
-            ++argv;
-            noexec = true;
-        }
-        else if (!strcmp(argv[1], "-printdefs")) {
-            --argc;
-            ++argv;
-            opts_printdefs = true;
-            noexec = true;
-        }
-        else if (!strcmp(argv[1], "-printfuns")) {
-            --argc;
-            ++argv;
-            opts_printfuns = true;
-            noexec = true;
-        }
-        else if (!strcmp(argv[1], "-printfields")) {
-            --argc;
-            ++argv;
-            opts_printfields = true;
-            noexec = true;
-        }
-        else if (!strcmp(argv[1], "-vector") ||
-                 !strcmp(argv[1], "-string") ||
-                 !strcmp(argv[1], "-float") )
-        {
-            qcvm_parameter p;
-            if (argv[1][1] == 'f')
-                p.vtype = TYPE_FLOAT;
-            else if (argv[1][1] == 's')
-                p.vtype = TYPE_STRING;
-            else if (argv[1][1] == 'v')
-                p.vtype = TYPE_VECTOR;
-            else
-                p.vtype = TYPE_VOID;
-
-            --argc;
-            ++argv;
-            if (argc < 2) {
-                usage();
-                exit(EXIT_FAILURE);
-            }
-            p.value = argv[1];
+int jit_rt_strings(qc_program_t *prog, qcint_t statement) {
+    const prog_section_statement_t *st = &prog->code[statement];
+    qcany_t *a = JIT_OPERAND(o1);
+    qcany_t *b = JIT_OPERAND(o2);
+    qcany_t *c = JIT_OPERAND(o3);
 
-            main_params.emplace_back(p);
-            --argc;
-            ++argv;
-        }
-        else if (!strcmp(argv[1], "--")) {
-            --argc;
-            ++argv;
+    switch (st->opcode) {
+        case INSTR_EQ_S:
+            c->_float = !strcmp(prog_getstring(prog, a->string),
+                                prog_getstring(prog, b->string));
+            break;
+        case INSTR_NE_S:
+            c->_float = !!strcmp(prog_getstring(prog, a->string),
+                                 prog_getstring(prog, b->string));
+            break;
+        default: /* INSTR_NOT_S */
+            c->_float = !a->string ||
+                        !*prog_getstring(prog, a->string);
             break;
-        }
-        else if (argv[1][0] != '-') {
-            if (progsfile) {
-                fprintf(stderr, "only 1 program file may be specified\n");
-                usage();
-                exit(EXIT_FAILURE);
-            }
-            progsfile = argv[1];
-            --argc;
-            ++argv;
-        }
-        else
-        {
-            fprintf(stderr, "unknown parameter: %s\n", argv[1]);
-            usage();
-            exit(EXIT_FAILURE);
-        }
-    }
-
-    if (argc == 2 && !progsfile) {
-        progsfile = argv[1];
-        --argc;
-        ++argv;
     }
+    return 0;
+}
 
-    if (!progsfile) {
-        fprintf(stderr, "must specify a program to execute\n");
-        usage();
-        exit(EXIT_FAILURE);
-    }
+int jit_rt_runaway(qc_program_t *prog, qcint_t) {
+    prog_error(prog, "`%s` hit the runaway loop counter limit of %li jumps", prog->filename.c_str(), prog->jumps.count);
+    return 1;
+}
 
-    prog = prog_load(progsfile, noexec);
-    if (!prog) {
-        fprintf(stderr, "failed to load program '%s'\n", progsfile);
-        exit(EXIT_FAILURE);
-    }
+#undef JIT_OPERAND
 
-    prog->builtins       = qc_builtins;
-    prog->builtins_count = GMQCC_ARRAY_COUNT(qc_builtins);
+bool prog_exec(qc_program_t *prog, prog_section_function_t *func, size_t flags, long maxjumps) {
+    /* native code calls back in here for functions it did not compile */
+    size_t stackbase = prog->stack.size();
+    long jumpcount = stackbase ? prog->jumps.count : 0;
+    size_t oldxflags = prog->xflags;
+    const prog_section_statement_t *code_st = nullptr;
+    qc_decoded_statement_t *decoded_st = nullptr;
+    qcint_t entry;
 
-    if (opts_info) {
-        printf("Program's system-checksum = 0x%04x\n", (unsigned int)prog->crc16);
-        printf("Entity field space: %u\n", (unsigned int)prog->entityfields);
-        printf("Globals: %zu\n", prog->globals.size());
-        printf("Counts:\n"
-               "      code: %zu\n"
-               "      defs: %zu\n"
-               "    fields: %zu\n"
-               " functions: %zu\n"
-               "   strings: %zu\n",
-               prog->code.size(),
-               prog->defs.size(),
-               prog->fields.size(),
-               prog->functions.size(),
-               prog->strings.size());
-    }
+    /* the checks can only be left out for code that passed the verifier */
+    if (!prog->verified || (flags & (VMXF_TRACE|VMXF_PROFILE|VMXF_RECORD)))
+        flags &= ~VMXF_VERIFIED;
+    /* verified code runs predecoded, where constant calls are bound once */
+    if (flags & VMXF_VERIFIED)
+        flags |= VMXF_PREDECODE;
 
-    if (opts_info) {
-        prog_delete(prog);
-        return 0;
-    }
-    for (i = 0; i < dis_list.size(); ++i) {
-        size_t k;
-        printf("Looking for `%s`\n", dis_list[i]);
-        for (k = 1; k < prog->functions.size(); ++k) {
-            const char *name = prog_getstring(prog, prog->functions[k].name);
-            if (!strcmp(name, dis_list[i])) {
-                prog_disasm_function(prog, k);
-                break;
-            }
+    prog->vmerror = 0;
+    prog->xflags = flags;
+    prog->jumps.limit = maxjumps;
+
+    if ((flags & VMXF_PREDECODE) && prog->decoded.empty())
+        prog_predecode(prog);
+    if ((flags & VMXF_FRAMES) && prog->reentrant.empty())
+        prog_frames(prog);
+    if ((flags & VMXF_RECORD) && prog->records.empty())
+        prog_record(prog, VM_RECORD_DEFAULT);
+
+    if (flags & VMXF_JIT) {
+        prog->jumps.count = jumpcount;
+        if (prog_jit_call(prog, func)) {
+            jumpcount = prog->jumps.count;
+            goto cleanup;
         }
     }
-    if (opts_disasm) {
-        for (i = 1; i < prog->functions.size(); ++i)
-            prog_disasm_function(prog, i);
-        return 0;
-    }
-    if (opts_printdefs) {
-        const char *getstring = nullptr;
-        for (auto &it : prog->defs) {
-            printf("Global: %8s %-16s at %u%s",
-                   type_name[it.type & DEF_TYPEMASK],
-                   prog_getstring(prog, it.name),
-                   (unsigned int)it.offset,
-                   ((it.type & DEF_SAVEGLOBAL) ? " [SAVE]" : ""));
-            if (opts_v) {
-                switch (it.type & DEF_TYPEMASK) {
-                    case TYPE_FLOAT:
-                        printf(" [init: %g]", ((qcany_t*)(&prog->globals[0] + it.offset))->_float);
-                        break;
-                    case TYPE_INTEGER:
-                        printf(" [init: %i]", (int)( ((qcany_t*)(&prog->globals[0] + it.offset))->_int ));
-                        break;
-                    case TYPE_ENTITY:
-                    case TYPE_FUNCTION:
-                    case TYPE_FIELD:
-                    case TYPE_POINTER:
-                        printf(" [init: %u]", (unsigned)( ((qcany_t*)(&prog->globals[0] + it.offset))->_int ));
-                        break;
-                    case TYPE_STRING:
-                        getstring = prog_getstring(prog, ((qcany_t*)(&prog->globals[0] + it.offset))->string);
-                        printf(" [init: `");
-                        print_escaped_string(getstring, strlen(getstring));
-                        printf("`]\n");
-                        break;
-                    default:
-                        break;
-                }
-            }
-            printf("\n");
+
+    /*
+     * The specialisations below bind `st` to one of these, both live for
+     * the whole function since a computed goto may leave any of the blocks
+     * as far as the compiler is concerned.
+     */
+    entry = prog_enterfunction(prog, func);
+    code_st = &prog->code[0] + entry - 1;
+    if (flags & VMXF_PREDECODE)
+        decoded_st = &prog->decoded[0] + entry - 1;
+    /* recording runs in the tracing loop */
+    switch ((flags & VMXF_RECORD ? flags | VMXF_TRACE : flags) & (VMXF_PREDECODE|VMXF_TRACE|VMXF_PROFILE|VMXF_VERIFIED))
+    {
+        default:
+        case 0:
+        {
+            const prog_section_statement_t *&st = code_st;
+#define QCVM_LOOP      1
+#define QCVM_PREDECODE 0
+#define QCVM_PROFILE   0
+#define QCVM_TRACE     0
+#           include __FILE__
         }
-    }
-    if (opts_printfields) {
-        for (auto &it : prog->fields) {
-            printf("Field: %8s %-16s at %d%s\n",
-                   type_name[it.type],
-                   prog_getstring(prog, it.name),
-                   it.offset,
-                   ((it.type & DEF_SAVEGLOBAL) ? " [SAVE]" : ""));
+        case (VMXF_PREDECODE|VMXF_VERIFIED):
+        {
+            qc_decoded_statement_t *&st = decoded_st;
+#define QCVM_PREDECODE 1
+#define QCVM_PROFILE   0
+#define QCVM_TRACE     0
+#define QCVM_VERIFIED  1
+#           include __FILE__
         }
-    }
-    if (opts_printfuns) {
-        for (auto &it : prog->functions) {
-            int32_t a;
-            printf("Function: %-16s taking %u parameters:(",
-                   prog_getstring(prog, it.name),
-                   (unsigned int)it.nargs);
-            for (a = 0; a < it.nargs; ++a) {
-                printf(" %i", it.argsize[a]);
-            }
-            if (opts_v > 1) {
-                int32_t start = it.entry;
-                if (start < 0)
-                    printf(") builtin %i\n", (int)-start);
-                else {
-                    size_t funsize = 0;
-                    prog_section_statement_t *st = &prog->code[0] + start;
-                    for (;st->opcode != INSTR_DONE; ++st)
-                        ++funsize;
-                    printf(") - %zu instructions", funsize);
-                    if (opts_v > 2) {
-                        printf(" - locals: %i + %i\n",
-                               it.firstlocal,
-                               it.locals);
-                    }
-                    else
-                        printf("\n");
-                }
-            }
-            else if (opts_v) {
-                printf(") locals: %i + %i\n",
-                       it.firstlocal,
-                       it.locals);
-            }
-            else
-                printf(")\n");
+        case (VMXF_TRACE):
+        {
+            const prog_section_statement_t *&st = code_st;
+#define QCVM_PREDECODE 0
+#define QCVM_PROFILE   0
+#define QCVM_TRACE     1
+#           include __FILE__
         }
-    }
-    if (!noexec) {
-        for (i = 1; i < prog->functions.size(); ++i) {
-            const char *name = prog_getstring(prog, prog->functions[i].name);
-            if (!strcmp(name, "main"))
-                fnmain = (qcint_t)i;
+        case (VMXF_PROFILE):
+        {
+            const prog_section_statement_t *&st = code_st;
+#define QCVM_PREDECODE 0
+#define QCVM_PROFILE   1
+#define QCVM_TRACE     0
+#           include __FILE__
         }
-        if (fnmain > 0)
+        case (VMXF_TRACE|VMXF_PROFILE):
         {
-            prog_main_setparams(prog);
-            prog_exec(prog, &prog->functions[fnmain], xflags, VM_JUMPS_DEFAULT);
+            const prog_section_statement_t *&st = code_st;
+#define QCVM_PREDECODE 0
+#define QCVM_PROFILE   1
+#define QCVM_TRACE     1
+#           include __FILE__
         }
-        else
-            fprintf(stderr, "No main function found\n");
-    }
-
-    prog_delete(prog);
-    return 0;
-}
-
-static void prog_disasm_function(qc_program_t *prog, size_t id) {
-    prog_section_function_t *fdef = &prog->functions[0] + id;
-    prog_section_statement_t *st;
-
-    if (fdef->entry < 0) {
-        printf("FUNCTION \"%s\" = builtin #%i\n", prog_getstring(prog, fdef->name), (int)-fdef->entry);
-        return;
-    }
-    else
-        printf("FUNCTION \"%s\"\n", prog_getstring(prog, fdef->name));
+        case (VMXF_PREDECODE):
+        {
+            qc_decoded_statement_t *&st = decoded_st;
+#define QCVM_PREDECODE 1
+#define QCVM_PROFILE   0
+#define QCVM_TRACE     0
+#           include __FILE__
+        }
+        case (VMXF_PREDECODE|VMXF_TRACE):
+        {
+            qc_decoded_statement_t *&st = decoded_st;
+#define QCVM_PREDECODE 1
+#define QCVM_PROFILE   0
+#define QCVM_TRACE     1
+#           include __FILE__
+        }
+        case (VMXF_PREDECODE|VMXF_PROFILE):
+        {
+            qc_decoded_statement_t *&st = decoded_st;
+#define QCVM_PREDECODE 1
+#define QCVM_PROFILE   1
+#define QCVM_TRACE     0
+#           include __FILE__
+        }
+        case (VMXF_PREDECODE|VMXF_TRACE|VMXF_PROFILE):
+        {
+            qc_decoded_statement_t *&st = decoded_st;
+#define QCVM_PREDECODE 1
+#define QCVM_PROFILE   1
+#define QCVM_TRACE     1
+#           include __FILE__
+        }
+    };
 
-    st = &prog->code[0] + fdef->entry;
-    while (st->opcode != INSTR_DONE) {
-        prog_print_statement(prog, st);
-        ++st;
+cleanup:
+    prog->xflags = oldxflags;
+    prog->jumps.count = jumpcount;
+    if (!stackbase) {
+        prog->tempstring_expired = true;
+        if (flags & VMXF_PROFILE)
+            prog_profile_unwind(prog);
+        if (flags & VMXF_TIMING)
+            prog_timing_leave(prog, 0);
+        prog->localstack.clear();
+        prog->stack.clear();
     }
+    if (prog->vmerror)
+        return false;
+    return true;
 }
+
 #else /* !QCVM_LOOP */
 /*
  * Everything from here on is not including into the compilation of the
@@ -1255,9 +2193,42 @@ static void prog_disasm_function(qc_program_t *prog, size_t id) {
  * sort of isn't, which makes it nicer looking.
  */
 
-#define OPA ( (qcany_t*) (&prog->globals[0] + st->o1.u1) )
-#define OPB ( (qcany_t*) (&prog->globals[0] + st->o2.u1) )
-#define OPC ( (qcany_t*) (&prog->globals[0] + st->o3.u1) )
+#if !defined(QCVM_VERIFIED)
+#   define QCVM_VERIFIED 0
+#endif
+
+#if QCVM_PREDECODE
+#   define OPA (st->a)
+#   define OPB (st->b)
+#   define OPC (st->c)
+
+#   define QCVM_CODE (&prog->decoded[0])
+
+    /* the statement was sanitized when predecoding */
+#   define QCVM_OPCODE() (st->opcode)
+#   define QCVM_ARGC() (st->argc)
+#   define QCVM_JUMP(offset) (st = st->target - 1)  /* offset the s++ */
+#else
+#   define OPA ( (qcany_t*) (&prog->globals[0] + st->o1.u1) )
+#   define OPB ( (qcany_t*) (&prog->globals[0] + st->o2.u1) )
+#   define OPC ( (qcany_t*) (&prog->globals[0] + st->o3.u1) )
+
+#   define QCVM_CODE (&prog->code[0])
+
+#   define QCVM_OPCODE() (st->opcode < VINSTR_END ? st->opcode : (int)VINSTR_END)
+#   define QCVM_ARGC() (st->opcode - INSTR_CALL0)
+#   define QCVM_JUMP(offset) (st += (offset) - 1)   /* offset the s++ */
+#endif
+
+/*
+ * Whether a jump counts against the runaway loop limit.  Verified code
+ * stays within the program, where only jumping backwards can loop.
+ */
+#if !QCVM_VERIFIED
+#   define QCVM_LOOPS(offset) 1
+#else
+#   define QCVM_LOOPS(offset) (st->target <= st)
+#endif
 
 #define GLOBAL(x) ( (qcany_t*) (&prog->globals[0] + (x)) )
 
@@ -1266,359 +2237,579 @@ static void prog_disasm_function(qc_program_t *prog, size_t id) {
 #   define FLOAT_IS_TRUE_FOR_INT(x) ( (x) & 0x7FFFFFFF )
 #endif
 
-while (prog->vmerror == 0) {
-    prog_section_function_t  *newf;
-    qcany_t          *ed;
-    qcany_t          *ptr;
+/*
+ * The bodies of the statements which are also the first half of a fused
+ * statement.
+ */
+#define QCVM_DO_LOAD()                                                          \
+    do {                                                                        \
+        if (OPA->edict < 0 || OPA->edict >= prog->entities) {                   \
+            prog_error(prog, "progs `%s` attempted to read an out of bounds entity", prog->filename.c_str()); \
+            goto cleanup;                                                       \
+        }                                                                       \
+        if ((unsigned int)(OPB->_int) >= (unsigned int)(prog->entityfields)) {  \
+            prog_error(prog, "prog `%s` attempted to read an invalid field from entity (%i)", \
+                      prog->filename.c_str(),                                   \
+                      OPB->_int);                                               \
+            goto cleanup;                                                       \
+        }                                                                       \
+        prog_entityread(prog, OPA->edict);                                      \
+        OPC->_int = *prog_entityword(prog, OPA->edict, OPB->_int);              \
+    } while (0)
+
+#define QCVM_DO_LOAD_V()                                                        \
+    do {                                                                        \
+        if (OPA->edict < 0 || OPA->edict >= prog->entities) {                   \
+            prog_error(prog, "progs `%s` attempted to read an out of bounds entity", prog->filename.c_str()); \
+            goto cleanup;                                                       \
+        }                                                                       \
+        if (OPB->_int < 0 || OPB->_int + 3 > (qcint_t)prog->entityfields)       \
+        {                                                                       \
+            prog_error(prog, "prog `%s` attempted to read an invalid field from entity (%i)", \
+                      prog->filename.c_str(),                                   \
+                      OPB->_int + 2);                                           \
+            goto cleanup;                                                       \
+        }                                                                       \
+        prog_entityread(prog, OPA->edict);                                      \
+        prog_entityload_v(prog, OPA->edict, OPB->_int, OPC);                    \
+    } while (0)
+
+#define QCVM_DO_ADDRESS()                                                       \
+    do {                                                                        \
+        if (OPA->edict < 0 || OPA->edict >= prog->entities) {                   \
+            prog_error(prog, "prog `%s` attempted to address an out of bounds entity %i", prog->filename.c_str(), OPA->edict); \
+            goto cleanup;                                                       \
+        }                                                                       \
+        if ((unsigned int)(OPB->_int) >= (unsigned int)(prog->entityfields))    \
+        {                                                                       \
+            prog_error(prog, "prog `%s` attempted to read an invalid field from entity (%i)", \
+                      prog->filename.c_str(),                                   \
+                      OPB->_int);                                               \
+            goto cleanup;                                                       \
+        }                                                                       \
+        OPC->_int = OPA->edict * (qcint_t)prog->entityfields + OPB->_int;       \
+    } while (0)
 
-    ++st;
+/*
+ * Every specialisation of the loop lives in the same function, so the
+ * labels used for threaded dispatch need a suffix unique to it.
+ */
+#define QCVM_CAT_(a, b, c, d) a##b##c##d
+#define QCVM_CAT(a, b, c, d)  QCVM_CAT_(a, b, c, d)
+#define QCVM_SUFFIX           QCVM_CAT(QCVM_PREDECODE, QCVM_PROFILE, QCVM_TRACE, QCVM_VERIFIED)
+#define QCVM_LABEL(op)        QCVM_CAT(op, _, QCVM_SUFFIX, )
 
 #if QCVM_PROFILE
-    prog->profile[st - &prog->code[0]]++;
+#   define QCVM_PROFILE_STEP() (prog->profile[st - QCVM_CODE]++, prog->executed++)
+#else
+#   define QCVM_PROFILE_STEP() (void)0
 #endif
 
 #if QCVM_TRACE
-    prog_print_statement(prog, st);
+#   define QCVM_TRACE_STEP() prog_trace_step(prog, st - QCVM_CODE)
+#else
+#   define QCVM_TRACE_STEP() (void)0
+#endif
+
+#if QCVM_THREADED
+/*
+ * Each handler ends in its own indirect jump through the label table,
+ * which gives the branch predictor one site per opcode to learn from
+ * instead of the single jump of the switch.  Handlers which may raise
+ * a non-fatal vmerror use the checked variant, everything else leaves
+ * the loop through `goto cleanup` directly.
+ */
+#   define QCVM_CASE(op) QCVM_LABEL(op):
+#   define QCVM_DISPATCH()                                                      \
+    do {                                                                        \
+        ++st;                                                                   \
+        QCVM_PROFILE_STEP();                                                    \
+        QCVM_TRACE_STEP();                                                      \
+        goto *dispatch[QCVM_OPCODE()];                                          \
+    } while (0)
+#   define QCVM_DISPATCH_CHECKED()                                              \
+    do {                                                                        \
+        if (prog->vmerror)                                                      \
+            goto cleanup;                                                       \
+        QCVM_DISPATCH();                                                        \
+    } while (0)
+#else
+#   define QCVM_CASE(op)            case op:
+#   define QCVM_DISPATCH()          break
+#   define QCVM_DISPATCH_CHECKED()  if (prog->vmerror) goto cleanup; else break
+#endif
+
+/*
+ * A fused statement runs its first half, steps onto the statement after
+ * it, which is left untouched in the stream, and jumps straight into the
+ * handler of that.  The switch needs explicit labels for these.
+ */
+#define QCVM_FUSED_STEP()                                                       \
+    do {                                                                        \
+        ++st;                                                                   \
+        QCVM_PROFILE_STEP();                                                    \
+        QCVM_TRACE_STEP();                                                      \
+    } while (0)
+
+#if QCVM_PREDECODE && !QCVM_THREADED
+#   define QCVM_FUSE_TARGET(op) QCVM_LABEL(op):
+#else
+#   define QCVM_FUSE_TARGET(op)
 #endif
 
+#if QCVM_THREADED
+{
+    static const void *const dispatch[] = {
+        &&QCVM_LABEL(INSTR_DONE),       &&QCVM_LABEL(INSTR_MUL_F),
+        &&QCVM_LABEL(INSTR_MUL_V),      &&QCVM_LABEL(INSTR_MUL_FV),
+        &&QCVM_LABEL(INSTR_MUL_VF),     &&QCVM_LABEL(INSTR_DIV_F),
+        &&QCVM_LABEL(INSTR_ADD_F),      &&QCVM_LABEL(INSTR_ADD_V),
+        &&QCVM_LABEL(INSTR_SUB_F),      &&QCVM_LABEL(INSTR_SUB_V),
+        &&QCVM_LABEL(INSTR_EQ_F),       &&QCVM_LABEL(INSTR_EQ_V),
+        &&QCVM_LABEL(INSTR_EQ_S),       &&QCVM_LABEL(INSTR_EQ_E),
+        &&QCVM_LABEL(INSTR_EQ_FNC),     &&QCVM_LABEL(INSTR_NE_F),
+        &&QCVM_LABEL(INSTR_NE_V),       &&QCVM_LABEL(INSTR_NE_S),
+        &&QCVM_LABEL(INSTR_NE_E),       &&QCVM_LABEL(INSTR_NE_FNC),
+        &&QCVM_LABEL(INSTR_LE),         &&QCVM_LABEL(INSTR_GE),
+        &&QCVM_LABEL(INSTR_LT),         &&QCVM_LABEL(INSTR_GT),
+        &&QCVM_LABEL(INSTR_LOAD_F),     &&QCVM_LABEL(INSTR_LOAD_V),
+        &&QCVM_LABEL(INSTR_LOAD_S),     &&QCVM_LABEL(INSTR_LOAD_ENT),
+        &&QCVM_LABEL(INSTR_LOAD_FLD),   &&QCVM_LABEL(INSTR_LOAD_FNC),
+        &&QCVM_LABEL(INSTR_ADDRESS),    &&QCVM_LABEL(INSTR_STORE_F),
+        &&QCVM_LABEL(INSTR_STORE_V),    &&QCVM_LABEL(INSTR_STORE_S),
+        &&QCVM_LABEL(INSTR_STORE_ENT),  &&QCVM_LABEL(INSTR_STORE_FLD),
+        &&QCVM_LABEL(INSTR_STORE_FNC),  &&QCVM_LABEL(INSTR_STOREP_F),
+        &&QCVM_LABEL(INSTR_STOREP_V),   &&QCVM_LABEL(INSTR_STOREP_S),
+        &&QCVM_LABEL(INSTR_STOREP_ENT), &&QCVM_LABEL(INSTR_STOREP_FLD),
+        &&QCVM_LABEL(INSTR_STOREP_FNC), &&QCVM_LABEL(INSTR_RETURN),
+        &&QCVM_LABEL(INSTR_NOT_F),      &&QCVM_LABEL(INSTR_NOT_V),
+        &&QCVM_LABEL(INSTR_NOT_S),      &&QCVM_LABEL(INSTR_NOT_ENT),
+        &&QCVM_LABEL(INSTR_NOT_FNC),    &&QCVM_LABEL(INSTR_IF),
+        &&QCVM_LABEL(INSTR_IFNOT),      &&QCVM_LABEL(INSTR_CALL0),
+        &&QCVM_LABEL(INSTR_CALL1),      &&QCVM_LABEL(INSTR_CALL2),
+        &&QCVM_LABEL(INSTR_CALL3),      &&QCVM_LABEL(INSTR_CALL4),
+        &&QCVM_LABEL(INSTR_CALL5),      &&QCVM_LABEL(INSTR_CALL6),
+        &&QCVM_LABEL(INSTR_CALL7),      &&QCVM_LABEL(INSTR_CALL8),
+        &&QCVM_LABEL(INSTR_STATE),      &&QCVM_LABEL(INSTR_GOTO),
+        &&QCVM_LABEL(INSTR_AND),        &&QCVM_LABEL(INSTR_OR),
+        &&QCVM_LABEL(INSTR_BITAND),     &&QCVM_LABEL(INSTR_BITOR),
+
+        /* anything at or past VINSTR_END is illegal */
+        &&QCVM_LABEL(illegal),
+
+#if QCVM_PREDECODE
+        &&QCVM_LABEL(VMOP_LT_IFNOT),    &&QCVM_LABEL(VMOP_GT_IFNOT),
+        &&QCVM_LABEL(VMOP_LE_IFNOT),    &&QCVM_LABEL(VMOP_GE_IFNOT),
+        &&QCVM_LABEL(VMOP_EQ_F_IFNOT),  &&QCVM_LABEL(VMOP_NE_F_IFNOT),
+        &&QCVM_LABEL(VMOP_LOAD_STORE),  &&QCVM_LABEL(VMOP_LOAD_STORE_V),
+        &&QCVM_LABEL(VMOP_ADDRESS_STOREP),
+        &&QCVM_LABEL(VMOP_ADDRESS_STOREP_V),
+        &&QCVM_LABEL(VMOP_CALL_STORE)
+#endif
+    };
+
+    prog_section_function_t  *newf;
+
+    QCVM_DISPATCH();
+#else
+for (;;) {
+    prog_section_function_t  *newf;
+
+    ++st;
+
+    QCVM_PROFILE_STEP();
+    QCVM_TRACE_STEP();
+
     switch (st->opcode)
     {
+#endif
+
+#if QCVM_THREADED
+        QCVM_LABEL(illegal):
+#else
         default:
-            qcvmerror(prog, "Illegal instruction in %s\n", prog->filename.c_str());
+#endif
+            prog_error(prog, "Illegal instruction in %s\n", prog->filename.c_str());
             goto cleanup;
 
-        case INSTR_DONE:
-        case INSTR_RETURN:
+        QCVM_CASE(INSTR_DONE)
+        QCVM_CASE(INSTR_RETURN)
             /* TODO: add instruction count to function profile count */
             GLOBAL(OFS_RETURN)->ivector[0] = OPA->ivector[0];
             GLOBAL(OFS_RETURN)->ivector[1] = OPA->ivector[1];
             GLOBAL(OFS_RETURN)->ivector[2] = OPA->ivector[2];
 
-            st = &prog->code[0] + prog_leavefunction(prog);
-            if (prog->stack.empty())
+            st = QCVM_CODE + prog_leavefunction(prog);
+            if (prog->stack.size() == stackbase)
                 goto cleanup;
 
-            break;
+            QCVM_DISPATCH();
 
-        case INSTR_MUL_F:
+        QCVM_CASE(INSTR_MUL_F)
             OPC->_float = OPA->_float * OPB->_float;
-            break;
-        case INSTR_MUL_V:
-            OPC->_float = OPA->vector[0]*OPB->vector[0] +
-                          OPA->vector[1]*OPB->vector[1] +
-                          OPA->vector[2]*OPB->vector[2];
-            break;
-        case INSTR_MUL_FV:
-        {
-            qcfloat_t f = OPA->_float;
-            OPC->vector[0] = f * OPB->vector[0];
-            OPC->vector[1] = f * OPB->vector[1];
-            OPC->vector[2] = f * OPB->vector[2];
-            break;
-        }
-        case INSTR_MUL_VF:
-        {
-            qcfloat_t f = OPB->_float;
-            OPC->vector[0] = f * OPA->vector[0];
-            OPC->vector[1] = f * OPA->vector[1];
-            OPC->vector[2] = f * OPA->vector[2];
-            break;
-        }
-        case INSTR_DIV_F:
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_MUL_V)
+            OPC->_float = qcvec_dot(OPA, OPB);
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_MUL_FV)
+            qcvec_scale(OPC, OPB, OPA->_float);
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_MUL_VF)
+            qcvec_scale(OPC, OPA, OPB->_float);
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_DIV_F)
             if (OPB->_float != 0.0f)
                 OPC->_float = OPA->_float / OPB->_float;
             else
                 OPC->_float = 0;
-            break;
+            QCVM_DISPATCH();
 
-        case INSTR_ADD_F:
+        QCVM_CASE(INSTR_ADD_F)
             OPC->_float = OPA->_float + OPB->_float;
-            break;
-        case INSTR_ADD_V:
-            OPC->vector[0] = OPA->vector[0] + OPB->vector[0];
-            OPC->vector[1] = OPA->vector[1] + OPB->vector[1];
-            OPC->vector[2] = OPA->vector[2] + OPB->vector[2];
-            break;
-        case INSTR_SUB_F:
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_ADD_V)
+            qcvec_add(OPC, OPA, OPB);
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_SUB_F)
             OPC->_float = OPA->_float - OPB->_float;
-            break;
-        case INSTR_SUB_V:
-            OPC->vector[0] = OPA->vector[0] - OPB->vector[0];
-            OPC->vector[1] = OPA->vector[1] - OPB->vector[1];
-            OPC->vector[2] = OPA->vector[2] - OPB->vector[2];
-            break;
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_SUB_V)
+            qcvec_sub(OPC, OPA, OPB);
+            QCVM_DISPATCH();
 
-        case INSTR_EQ_F:
+        QCVM_CASE(INSTR_EQ_F)
             OPC->_float = (OPA->_float == OPB->_float);
-            break;
-        case INSTR_EQ_V:
-            OPC->_float = ((OPA->vector[0] == OPB->vector[0]) &&
-                           (OPA->vector[1] == OPB->vector[1]) &&
-                           (OPA->vector[2] == OPB->vector[2]) );
-            break;
-        case INSTR_EQ_S:
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_EQ_V)
+            OPC->_float = qcvec_eq(OPA, OPB);
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_EQ_S)
             OPC->_float = !strcmp(prog_getstring(prog, OPA->string),
                                   prog_getstring(prog, OPB->string));
-            break;
-        case INSTR_EQ_E:
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_EQ_E)
             OPC->_float = (OPA->_int == OPB->_int);
-            break;
-        case INSTR_EQ_FNC:
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_EQ_FNC)
             OPC->_float = (OPA->function == OPB->function);
-            break;
-        case INSTR_NE_F:
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_NE_F)
             OPC->_float = (OPA->_float != OPB->_float);
-            break;
-        case INSTR_NE_V:
-            OPC->_float = ((OPA->vector[0] != OPB->vector[0]) ||
-                           (OPA->vector[1] != OPB->vector[1]) ||
-                           (OPA->vector[2] != OPB->vector[2]) );
-            break;
-        case INSTR_NE_S:
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_NE_V)
+            OPC->_float = !qcvec_eq(OPA, OPB);
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_NE_S)
             OPC->_float = !!strcmp(prog_getstring(prog, OPA->string),
                                    prog_getstring(prog, OPB->string));
-            break;
-        case INSTR_NE_E:
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_NE_E)
             OPC->_float = (OPA->_int != OPB->_int);
-            break;
-        case INSTR_NE_FNC:
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_NE_FNC)
             OPC->_float = (OPA->function != OPB->function);
-            break;
+            QCVM_DISPATCH();
 
-        case INSTR_LE:
+        QCVM_CASE(INSTR_LE)
             OPC->_float = (OPA->_float <= OPB->_float);
-            break;
-        case INSTR_GE:
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_GE)
             OPC->_float = (OPA->_float >= OPB->_float);
-            break;
-        case INSTR_LT:
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_LT)
             OPC->_float = (OPA->_float < OPB->_float);
-            break;
-        case INSTR_GT:
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_GT)
             OPC->_float = (OPA->_float > OPB->_float);
-            break;
-
-        case INSTR_LOAD_F:
-        case INSTR_LOAD_S:
-        case INSTR_LOAD_FLD:
-        case INSTR_LOAD_ENT:
-        case INSTR_LOAD_FNC:
-            if (OPA->edict < 0 || OPA->edict >= prog->entities) {
-                qcvmerror(prog, "progs `%s` attempted to read an out of bounds entity", prog->filename.c_str());
-                goto cleanup;
-            }
-            if ((unsigned int)(OPB->_int) >= (unsigned int)(prog->entityfields)) {
-                qcvmerror(prog, "prog `%s` attempted to read an invalid field from entity (%i)",
-                          prog->filename.c_str(),
-                          OPB->_int);
-                goto cleanup;
-            }
-            ed = prog_getedict(prog, OPA->edict);
-            OPC->_int = ((qcany_t*)( ((qcint_t*)ed) + OPB->_int ))->_int;
-            break;
-        case INSTR_LOAD_V:
-            if (OPA->edict < 0 || OPA->edict >= prog->entities) {
-                qcvmerror(prog, "progs `%s` attempted to read an out of bounds entity", prog->filename.c_str());
-                goto cleanup;
-            }
-            if (OPB->_int < 0 || OPB->_int + 3 > (qcint_t)prog->entityfields)
-            {
-                qcvmerror(prog, "prog `%s` attempted to read an invalid field from entity (%i)",
-                          prog->filename.c_str(),
-                          OPB->_int + 2);
-                goto cleanup;
-            }
-            ed = prog_getedict(prog, OPA->edict);
-            ptr = (qcany_t*)( ((qcint_t*)ed) + OPB->_int );
-            OPC->ivector[0] = ptr->ivector[0];
-            OPC->ivector[1] = ptr->ivector[1];
-            OPC->ivector[2] = ptr->ivector[2];
-            break;
-
-        case INSTR_ADDRESS:
-            if (OPA->edict < 0 || OPA->edict >= prog->entities) {
-                qcvmerror(prog, "prog `%s` attempted to address an out of bounds entity %i", prog->filename.c_str(), OPA->edict);
-                goto cleanup;
-            }
-            if ((unsigned int)(OPB->_int) >= (unsigned int)(prog->entityfields))
-            {
-                qcvmerror(prog, "prog `%s` attempted to read an invalid field from entity (%i)",
-                          prog->filename.c_str(),
-                          OPB->_int);
-                goto cleanup;
-            }
-
-            ed = prog_getedict(prog, OPA->edict);
-            OPC->_int = ((qcint_t*)ed) - prog->entitydata.data() + OPB->_int;
-            break;
-
-        case INSTR_STORE_F:
-        case INSTR_STORE_S:
-        case INSTR_STORE_ENT:
-        case INSTR_STORE_FLD:
-        case INSTR_STORE_FNC:
+            QCVM_DISPATCH();
+
+        QCVM_CASE(INSTR_LOAD_F)
+        QCVM_CASE(INSTR_LOAD_S)
+        QCVM_CASE(INSTR_LOAD_FLD)
+        QCVM_CASE(INSTR_LOAD_ENT)
+        QCVM_CASE(INSTR_LOAD_FNC)
+            QCVM_DO_LOAD();
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_LOAD_V)
+            QCVM_DO_LOAD_V();
+            QCVM_DISPATCH();
+
+        QCVM_CASE(INSTR_ADDRESS)
+            QCVM_DO_ADDRESS();
+            QCVM_DISPATCH();
+
+        QCVM_CASE(INSTR_STORE_F)
+        QCVM_CASE(INSTR_STORE_S)
+        QCVM_CASE(INSTR_STORE_ENT)
+        QCVM_CASE(INSTR_STORE_FLD)
+        QCVM_CASE(INSTR_STORE_FNC)
+        QCVM_FUSE_TARGET(INSTR_STORE_F)
             OPB->_int = OPA->_int;
-            break;
-        case INSTR_STORE_V:
-            OPB->ivector[0] = OPA->ivector[0];
-            OPB->ivector[1] = OPA->ivector[1];
-            OPB->ivector[2] = OPA->ivector[2];
-            break;
-
-        case INSTR_STOREP_F:
-        case INSTR_STOREP_S:
-        case INSTR_STOREP_ENT:
-        case INSTR_STOREP_FLD:
-        case INSTR_STOREP_FNC:
-            if (OPB->_int < 0 || OPB->_int >= (qcint_t)prog->entitydata.size()) {
-                qcvmerror(prog, "`%s` attempted to write to an out of bounds edict (%i)", prog->filename.c_str(), OPB->_int);
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_STORE_V)
+        QCVM_FUSE_TARGET(INSTR_STORE_V)
+            qcvec_copy(OPB, OPA);
+            QCVM_DISPATCH();
+
+        QCVM_CASE(INSTR_STOREP_F)
+        QCVM_CASE(INSTR_STOREP_S)
+        QCVM_CASE(INSTR_STOREP_ENT)
+        QCVM_CASE(INSTR_STOREP_FLD)
+        QCVM_CASE(INSTR_STOREP_FNC)
+        QCVM_FUSE_TARGET(INSTR_STOREP_F)
+            if (OPB->_int < 0 || OPB->_int >= prog->entities * (qcint_t)prog->entityfields) {
+                prog_error(prog, "`%s` attempted to write to an out of bounds edict (%i)", prog->filename.c_str(), OPB->_int);
                 goto cleanup;
             }
             if (OPB->_int < (qcint_t)prog->entityfields && !prog->allowworldwrites)
-                qcvmerror(prog, "`%s` tried to assign to world.%s (field %i)\n",
+                prog_error(prog, "`%s` tried to assign to world.%s (field %i)\n",
                           prog->filename.c_str(),
                           prog_getstring(prog, prog_entfield(prog, OPB->_int)->name),
                           OPB->_int);
-            ptr = (qcany_t*)&prog->entitydata[OPB->_int];
-            ptr->_int = OPA->_int;
-            break;
-        case INSTR_STOREP_V:
-            if (OPB->_int < 0 || OPB->_int + 2 >= (qcint_t)prog->entitydata.size()) {
-                qcvmerror(prog, "`%s` attempted to write to an out of bounds edict (%i)", prog->filename.c_str(), OPB->_int);
+            *prog_entitystore(prog, OPB->_int) = OPA->_int;
+            QCVM_DISPATCH_CHECKED();
+        QCVM_CASE(INSTR_STOREP_V)
+        QCVM_FUSE_TARGET(INSTR_STOREP_V)
+            if (OPB->_int < 0 || OPB->_int + 2 >= prog->entities * (qcint_t)prog->entityfields) {
+                prog_error(prog, "`%s` attempted to write to an out of bounds edict (%i)", prog->filename.c_str(), OPB->_int);
                 goto cleanup;
             }
             if (OPB->_int < (qcint_t)prog->entityfields && !prog->allowworldwrites)
-                qcvmerror(prog, "`%s` tried to assign to world.%s (field %i)\n",
+                prog_error(prog, "`%s` tried to assign to world.%s (field %i)\n",
                           prog->filename.c_str(),
                           prog_getstring(prog, prog_entfield(prog, OPB->_int)->name),
                           OPB->_int);
-            ptr = (qcany_t*)&prog->entitydata[OPB->_int];
-            ptr->ivector[0] = OPA->ivector[0];
-            ptr->ivector[1] = OPA->ivector[1];
-            ptr->ivector[2] = OPA->ivector[2];
-            break;
+            prog_entitystore_v(prog, OPB->_int, OPA);
+            QCVM_DISPATCH_CHECKED();
 
-        case INSTR_NOT_F:
+        QCVM_CASE(INSTR_NOT_F)
             OPC->_float = !FLOAT_IS_TRUE_FOR_INT(OPA->_int);
-            break;
-        case INSTR_NOT_V:
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_NOT_V)
             OPC->_float = !OPA->vector[0] &&
                           !OPA->vector[1] &&
                           !OPA->vector[2];
-            break;
-        case INSTR_NOT_S:
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_NOT_S)
             OPC->_float = !OPA->string ||
                           !*prog_getstring(prog, OPA->string);
-            break;
-        case INSTR_NOT_ENT:
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_NOT_ENT)
             OPC->_float = (OPA->edict == 0);
-            break;
-        case INSTR_NOT_FNC:
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_NOT_FNC)
             OPC->_float = !OPA->function;
-            break;
+            QCVM_DISPATCH();
 
-        case INSTR_IF:
+        QCVM_CASE(INSTR_IF)
             /* this is consistent with darkplaces' behaviour */
             if(FLOAT_IS_TRUE_FOR_INT(OPA->_int))
             {
-                st += st->o2.s1 - 1;    /* offset the s++ */
-                if (++jumpcount >= maxjumps)
-                    qcvmerror(prog, "`%s` hit the runaway loop counter limit of %li jumps", prog->filename.c_str(), jumpcount);
+                if (QCVM_LOOPS(st->o2.s1) && ++jumpcount >= maxjumps) {
+                    prog_error(prog, "`%s` hit the runaway loop counter limit of %li jumps", prog->filename.c_str(), jumpcount);
+                    goto cleanup;
+                }
+                QCVM_JUMP(st->o2.s1);
             }
-            break;
-        case INSTR_IFNOT:
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_IFNOT)
+        QCVM_FUSE_TARGET(INSTR_IFNOT)
             if(!FLOAT_IS_TRUE_FOR_INT(OPA->_int))
             {
-                st += st->o2.s1 - 1;    /* offset the s++ */
-                if (++jumpcount >= maxjumps)
-                    qcvmerror(prog, "`%s` hit the runaway loop counter limit of %li jumps", prog->filename.c_str(), jumpcount);
+                if (QCVM_LOOPS(st->o2.s1) && ++jumpcount >= maxjumps) {
+                    prog_error(prog, "`%s` hit the runaway loop counter limit of %li jumps", prog->filename.c_str(), jumpcount);
+                    goto cleanup;
+                }
+                QCVM_JUMP(st->o2.s1);
             }
-            break;
+            QCVM_DISPATCH();
+
+        QCVM_CASE(INSTR_CALL0)
+        QCVM_CASE(INSTR_CALL1)
+        QCVM_CASE(INSTR_CALL2)
+        QCVM_CASE(INSTR_CALL3)
+        QCVM_CASE(INSTR_CALL4)
+        QCVM_CASE(INSTR_CALL5)
+        QCVM_CASE(INSTR_CALL6)
+        QCVM_CASE(INSTR_CALL7)
+        QCVM_CASE(INSTR_CALL8)
+#if QCVM_PREDECODE
+        QCVM_CASE(VMOP_CALL_STORE)
+#endif
+            prog->argc = QCVM_ARGC();
+#if QCVM_PREDECODE
+            /* calls through constant globals are already resolved */
+            if (!(newf = st->function))
+#endif
+            {
+                if (!OPA->function)
+                    prog_error(prog, "nullptr function in `%s`", prog->filename.c_str());
 
-        case INSTR_CALL0:
-        case INSTR_CALL1:
-        case INSTR_CALL2:
-        case INSTR_CALL3:
-        case INSTR_CALL4:
-        case INSTR_CALL5:
-        case INSTR_CALL6:
-        case INSTR_CALL7:
-        case INSTR_CALL8:
-            prog->argc = st->opcode - INSTR_CALL0;
-            if (!OPA->function)
-                qcvmerror(prog, "nullptr function in `%s`", prog->filename.c_str());
+                if(!OPA->function || OPA->function >= (qcint_t)prog->functions.size())
+                {
+                    prog_error(prog, "CALL outside the program in `%s`", prog->filename.c_str());
+                    goto cleanup;
+                }
 
-            if(!OPA->function || OPA->function >= (qcint_t)prog->functions.size())
-            {
-                qcvmerror(prog, "CALL outside the program in `%s`", prog->filename.c_str());
-                goto cleanup;
+                newf = &prog->functions[OPA->function];
             }
-
-            newf = &prog->functions[OPA->function];
             newf->profile++;
 
-            prog->statement = (st - &prog->code[0]) + 1;
+            prog->statement = (st - QCVM_CODE) + 1;
 
             if (newf->entry < 0)
             {
                 /* negative statements are built in functions */
-                qcint_t builtinnumber = -newf->entry;
-                if (builtinnumber < (qcint_t)prog->builtins_count && prog->builtins[builtinnumber])
-                    prog->builtins[builtinnumber](prog);
-                else
-                    qcvmerror(prog, "No such builtin #%i in %s! Try updating your gmqcc sources",
-                              builtinnumber, prog->filename.c_str());
+                prog_callbuiltin(prog, newf);
+#if QCVM_PREDECODE
+                /* a function returns onto the store, a builtin can run it right away */
+                if (st->opcode == VMOP_CALL_STORE) {
+                    if (prog->vmerror)
+                        goto cleanup;
+                    QCVM_FUSED_STEP();
+                    if (st->opcode == INSTR_STORE_V)
+                        goto QCVM_LABEL(INSTR_STORE_V);
+                    goto QCVM_LABEL(INSTR_STORE_F);
+                }
+#endif
             }
+#if !QCVM_TRACE && !QCVM_PROFILE
+            else if (prog->xflags & VMXF_JIT) {
+                /* native code counts its jumps along with ours */
+                prog->jumps.count = jumpcount;
+                if (!prog_jit_call(prog, newf))
+                    st = QCVM_CODE + prog_enterfunction(prog, newf) - 1; /* offset st++ */
+                jumpcount = prog->jumps.count;
+            }
+#endif
             else
-                st = &prog->code[0] + prog_enterfunction(prog, newf) - 1; /* offset st++ */
+                st = QCVM_CODE + prog_enterfunction(prog, newf) - 1; /* offset st++ */
             if (prog->vmerror)
                 goto cleanup;
-            break;
+            QCVM_DISPATCH();
 
-        case INSTR_STATE:
+        QCVM_CASE(INSTR_STATE)
         {
             qcfloat_t *nextthink;
             qcfloat_t *time;
             qcfloat_t *frame;
+            qcint_t    self;
+#if !QCVM_VERIFIED
             if (!prog->supports_state) {
-                qcvmerror(prog, "`%s` tried to execute a STATE operation but misses its defs!", prog->filename.c_str());
+                prog_error(prog, "`%s` tried to execute a STATE operation but misses its defs!", prog->filename.c_str());
                 goto cleanup;
             }
-            ed = prog_getedict(prog, prog->globals[prog->cached_globals.self]);
-            ((qcint_t*)ed)[prog->cached_fields.think] = OPB->function;
+#endif
+            self = prog->globals[prog->cached_globals.self];
+            if (self < 0 || self >= prog->entities) {
+                prog_error(prog, "Accessing out of bounds edict %i", (int)self);
+                self = 0;
+            }
+            prog_entitytouch(prog, self);
+            *prog_entityword(prog, self, prog->cached_fields.think) = OPB->function;
 
-            frame     = (qcfloat_t*)&((qcint_t*)ed)[prog->cached_fields.frame];
+            frame     = (qcfloat_t*)prog_entityword(prog, self, prog->cached_fields.frame);
             *frame    = OPA->_float;
-            nextthink = (qcfloat_t*)&((qcint_t*)ed)[prog->cached_fields.nextthink];
+            nextthink = (qcfloat_t*)prog_entityword(prog, self, prog->cached_fields.nextthink);
             time      = (qcfloat_t*)(&prog->globals[0] + prog->cached_globals.time);
             *nextthink = *time + 0.1;
-            break;
+            QCVM_DISPATCH_CHECKED();
         }
 
-        case INSTR_GOTO:
-            st += st->o1.s1 - 1;    /* offset the s++ */
-            if (++jumpcount == 10000000)
-                qcvmerror(prog, "`%s` hit the runaway loop counter limit of %li jumps", prog->filename.c_str(), jumpcount);
-            break;
+        QCVM_CASE(INSTR_GOTO)
+            if (QCVM_LOOPS(st->o1.s1) && ++jumpcount == 10000000) {
+                prog_error(prog, "`%s` hit the runaway loop counter limit of %li jumps", prog->filename.c_str(), jumpcount);
+                goto cleanup;
+            }
+            QCVM_JUMP(st->o1.s1);
+            QCVM_DISPATCH();
 
-        case INSTR_AND:
+        QCVM_CASE(INSTR_AND)
             OPC->_float = FLOAT_IS_TRUE_FOR_INT(OPA->_int) &&
                           FLOAT_IS_TRUE_FOR_INT(OPB->_int);
-            break;
-        case INSTR_OR:
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_OR)
             OPC->_float = FLOAT_IS_TRUE_FOR_INT(OPA->_int) ||
                           FLOAT_IS_TRUE_FOR_INT(OPB->_int);
-            break;
+            QCVM_DISPATCH();
 
-        case INSTR_BITAND:
+        QCVM_CASE(INSTR_BITAND)
             OPC->_float = ((int)OPA->_float) & ((int)OPB->_float);
-            break;
-        case INSTR_BITOR:
+            QCVM_DISPATCH();
+        QCVM_CASE(INSTR_BITOR)
             OPC->_float = ((int)OPA->_float) | ((int)OPB->_float);
-            break;
+            QCVM_DISPATCH();
+
+#if QCVM_PREDECODE
+        QCVM_CASE(VMOP_LT_IFNOT)
+            OPC->_float = (OPA->_float < OPB->_float);
+            QCVM_FUSED_STEP();
+            goto QCVM_LABEL(INSTR_IFNOT);
+        QCVM_CASE(VMOP_GT_IFNOT)
+            OPC->_float = (OPA->_float > OPB->_float);
+            QCVM_FUSED_STEP();
+            goto QCVM_LABEL(INSTR_IFNOT);
+        QCVM_CASE(VMOP_LE_IFNOT)
+            OPC->_float = (OPA->_float <= OPB->_float);
+            QCVM_FUSED_STEP();
+            goto QCVM_LABEL(INSTR_IFNOT);
+        QCVM_CASE(VMOP_GE_IFNOT)
+            OPC->_float = (OPA->_float >= OPB->_float);
+            QCVM_FUSED_STEP();
+            goto QCVM_LABEL(INSTR_IFNOT);
+        QCVM_CASE(VMOP_EQ_F_IFNOT)
+            OPC->_float = (OPA->_float == OPB->_float);
+            QCVM_FUSED_STEP();
+            goto QCVM_LABEL(INSTR_IFNOT);
+        QCVM_CASE(VMOP_NE_F_IFNOT)
+            OPC->_float = (OPA->_float != OPB->_float);
+            QCVM_FUSED_STEP();
+            goto QCVM_LABEL(INSTR_IFNOT);
+
+        QCVM_CASE(VMOP_LOAD_STORE)
+            QCVM_DO_LOAD();
+            QCVM_FUSED_STEP();
+            goto QCVM_LABEL(INSTR_STORE_F);
+        QCVM_CASE(VMOP_LOAD_STORE_V)
+            QCVM_DO_LOAD_V();
+            QCVM_FUSED_STEP();
+            goto QCVM_LABEL(INSTR_STORE_V);
+
+        QCVM_CASE(VMOP_ADDRESS_STOREP)
+            QCVM_DO_ADDRESS();
+            QCVM_FUSED_STEP();
+            goto QCVM_LABEL(INSTR_STOREP_F);
+        QCVM_CASE(VMOP_ADDRESS_STOREP_V)
+            QCVM_DO_ADDRESS();
+            QCVM_FUSED_STEP();
+            goto QCVM_LABEL(INSTR_STOREP_V);
+#endif
+#if !QCVM_THREADED
     }
+#endif
 }
+#if !QCVM_THREADED
+goto cleanup;
+#endif
 
+#undef OPA
+#undef OPB
+#undef OPC
+#undef QCVM_CODE
+#undef QCVM_OPCODE
+#undef QCVM_ARGC
+#undef QCVM_FUSED_STEP
+#undef QCVM_FUSE_TARGET
+#undef QCVM_JUMP
+#undef QCVM_LOOPS
+#undef QCVM_PROFILE_STEP
+#undef QCVM_TRACE_STEP
+#undef QCVM_CASE
+#undef QCVM_DISPATCH
+#undef QCVM_DISPATCH_CHECKED
+
+#undef QCVM_PREDECODE
 #undef QCVM_PROFILE
 #undef QCVM_TRACE
+#undef QCVM_VERIFIED
 #endif /* !QCVM_LOOP */
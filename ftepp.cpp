@@ -1,11 +1,13 @@
 #include <string.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <algorithm>
 
 #include "gmqcc.h"
 #include "lexer.h"
 
 #define HT_MACROS 1024
+#define HT_INCLUDES 64
 
 struct ppcondition {
     bool on;
@@ -35,6 +37,38 @@ struct ppmacro {
     pptoken **output;
 };
 
+/* a file looked for by #include, by the path it was looked for at */
+struct ppinclude {
+    bool         found;
+    lex_filedata file;  /* its contents as loaded the first time */
+    bool         once;  /* it had a #pragma once */
+    char        *guard; /* the macro of an #ifndef around all of it */
+};
+
+/* how far a file being preprocessed looks like an include guard */
+enum {
+    GUARD_START,  /* nothing but whitespace so far */
+    GUARD_OPEN,   /* within the #ifndef */
+    GUARD_CLOSED, /* after its #endif */
+    GUARD_NONE
+};
+
+struct ppguard {
+    int    state;
+    size_t depth; /* of the conditions around the #include */
+    char  *name;
+};
+
+/*
+ * The lines the parser's lexer would count in the text written for -E,
+ * where #pragma line and push(line) change them, see lex_try_pragma.
+ */
+struct pplines {
+    long   offset; /* from the lines of the source */
+    size_t push;   /* push(line) without its pop(line) */
+    size_t line;   /* all of them have while pushed */
+};
+
 struct ftepp_t {
     lex_file *lex;
     int token;
@@ -42,9 +76,16 @@ struct ftepp_t {
     bool output_on;
     ppcondition *conditions;
     ht macros;  /* hashtable<string, ppmacro*> */
-    char *output_string;
+    char *output_string;        /* the text for -E */
+    lex_tokens *output_tokens;  /* or the tokens for the parser */
+    const char *tokenfile;      /* the file they are in, as #include and #pragma file have it */
+    pplines lines;
+    lex_ctx_t expansion;        /* of the macro being expanded, where its tokens are */
     char *itemname;
     char *includename;
+    ht includes;        /* hashtable<string, ppinclude*> */
+    ppinclude *include; /* the one being preprocessed */
+    ppguard *guard;
     bool in_macro;
     uint32_t predef_countval;
     uint32_t predef_randval;
@@ -256,6 +297,14 @@ static void ppmacro_delete(ppmacro *self)
     mem_d(self);
 }
 
+static void ppinclude_delete(ppinclude *self)
+{
+    lex_file_free(&self->file);
+    if (self->guard)
+        mem_d(self->guard);
+    mem_d(self);
+}
+
 static ftepp_t* ftepp_new(void)
 {
     ftepp_t *ftepp;
@@ -264,6 +313,7 @@ static ftepp_t* ftepp_new(void)
     memset(ftepp, 0, sizeof(*ftepp));
 
     ftepp->macros          = util_htnew(HT_MACROS);
+    ftepp->includes        = util_htnew(HT_INCLUDES);
     ftepp->output_on       = true;
     ftepp->predef_countval = 0;
     ftepp->predef_randval  = 0;
@@ -274,6 +324,10 @@ static ftepp_t* ftepp_new(void)
 static GMQCC_INLINE void ftepp_flush_do(ftepp_t *self)
 {
     vec_free(self->output_string);
+    if (self->output_tokens) {
+        self->output_tokens->tokens.clear();
+        self->output_tokens->spellings.clear();
+    }
 }
 
 static void ftepp_delete(ftepp_t *self)
@@ -285,25 +339,121 @@ static void ftepp_delete(ftepp_t *self)
         vec_free(self->includename);
 
     util_htrem(self->macros, (void (*)(void*))&ppmacro_delete);
+    util_htrem(self->includes, (void (*)(void*))&ppinclude_delete);
 
     vec_free(self->conditions);
     if (self->lex)
         lex_close(self->lex);
+    delete self->output_tokens;
     mem_d(self);
 }
 
+/* the line the parser's lexer would have for a line of the source */
+static GMQCC_INLINE size_t ftepp_lines_at(ftepp_t *ftepp, size_t line)
+{
+    return ftepp->lines.push ? ftepp->lines.line : line + ftepp->lines.offset;
+}
+
+/* as after #pragma line(to) with the source going on at the line next */
+static void ftepp_lines_set(ftepp_t *ftepp, size_t next, size_t to)
+{
+    if (ftepp->lines.push)
+        ftepp->lines.line = to - 1;
+    else
+        ftepp->lines.offset = (long)to - (long)next;
+}
+
+/* where the tokens put out now are, those of a macro are where it was used */
+static lex_ctx_t ftepp_tokctx(ftepp_t *ftepp)
+{
+    lex_ctx_t ctx;
+
+    if (ftepp->in_macro)
+        return ftepp->expansion;
+    ctx      = ftepp->lex->tok.ctx;
+    ctx.file = ftepp->tokenfile;
+    ctx.line = ftepp_lines_at(ftepp, ctx.line);
+    return ctx;
+}
+
+static void ftepp_push(ftepp_t *ftepp, int ttype, const char *value, const lex_constval *constval)
+{
+    if (ttype == TOKEN_EOL)
+        value = "\n";
+    lex_tokens_push(ftepp->output_tokens, ttype, value, strlen(value), constval, ftepp_tokctx(ftepp));
+}
+
+static void ftepp_push_eol(ftepp_t *ftepp)
+{
+    lex_constval none;
+    memset(&none, 0, sizeof(none));
+    ftepp_push(ftepp, TOKEN_EOL, nullptr, &none);
+}
+
+/* text the preprocessor makes up, such as the value of __LINE__ */
+static void ftepp_push_text(ftepp_t *ftepp, const char *str)
+{
+    lex_file *lex;
+
+    if (!strcmp(str, "\n")) {
+        ftepp_push_eol(ftepp);
+        return;
+    }
+
+    lex = lex_open_string(str, strlen(str), ftepp->lex->name);
+    if (!lex)
+        return;
+    lex->flags.preprocessing = true;
+    lex->flags.noops         = true;
+    while (lex_do(lex) < TOKEN_EOF)
+        ftepp_push(ftepp, lex->tok.ttype, lex->tok.value ? lex->tok.value : "", &lex->tok.constval);
+    lex_close(lex);
+}
+
+static GMQCC_INLINE size_t ftepp_out_size(ftepp_t *ftepp)
+{
+    return ftepp->output_tokens ? ftepp->output_tokens->tokens.size() : vec_size(ftepp->output_string);
+}
+
+/* output taken back, as for a #pragma once */
+static void ftepp_out_shrink(ftepp_t *ftepp, size_t size)
+{
+    if (ftepp->output_tokens) {
+        lex_tokens *tokens = ftepp->output_tokens;
+        if (tokens->tokens.size() > size) {
+            tokens->spellings.resize(tokens->tokens[size].spelling);
+            tokens->tokens.resize(size);
+        }
+    }
+    else if (vec_size(ftepp->output_string) > size)
+        vec_shrinkto(ftepp->output_string, size);
+}
+
 static void ftepp_out(ftepp_t *ftepp, const char *str, bool ignore_cond)
 {
     if (ignore_cond || ftepp->output_on)
     {
         size_t len;
         char  *data;
+        if (ftepp->output_tokens) {
+            ftepp_push_text(ftepp, str);
+            return;
+        }
         len = strlen(str);
         data = vec_add(ftepp->output_string, len);
         memcpy(data, str, len);
     }
 }
 
+/* the current token as it is */
+static void ftepp_out_token(ftepp_t *ftepp, bool ignore_cond)
+{
+    if (!ftepp->output_tokens)
+        ftepp_out(ftepp, ftepp->token == TOKEN_EOL ? "\n" : ftepp_tokval(ftepp), ignore_cond);
+    else if (ignore_cond || ftepp->output_on)
+        ftepp_push(ftepp, ftepp->token, ftepp_tokval(ftepp), &ftepp->lex->tok.constval);
+}
+
 static GMQCC_INLINE void ftepp_update_output_condition(ftepp_t *ftepp)
 {
     size_t i;
@@ -355,6 +505,46 @@ static bool ftepp_skipallwhite(ftepp_t *ftepp)
     return true;
 }
 
+/*
+ * A file is taken for guarded when all of it is within an #ifndef, so that
+ * it leaves nothing when included again while the macro is defined. This
+ * follows the directives of the file being included, the #ifndef itself
+ * is taken by ftepp_hash.
+ */
+static void ftepp_guard_directive(ftepp_t *ftepp, const char *directive)
+{
+    ppguard *guard = ftepp->guard;
+    size_t   depth = vec_size(ftepp->conditions);
+
+    if (!guard || ftepp->in_macro)
+        return;
+
+    switch (guard->state) {
+        case GUARD_START:
+            if (strcmp(directive, "ifndef") || depth != guard->depth)
+                guard->state = GUARD_NONE;
+            break;
+        case GUARD_OPEN:
+            if (depth != guard->depth + 1)
+                break;
+            if (!strcmp(directive, "endif"))
+                guard->state = GUARD_CLOSED;
+            else if (!strncmp(directive, "el", 2))
+                guard->state = GUARD_NONE;
+            break;
+        case GUARD_CLOSED:
+            guard->state = GUARD_NONE;
+            break;
+    }
+}
+
+/* and anything else outside of the #ifndef */
+static GMQCC_INLINE void ftepp_guard_text(ftepp_t *ftepp)
+{
+    if (ftepp->guard && !ftepp->in_macro && ftepp->guard->state != GUARD_OPEN)
+        ftepp->guard->state = GUARD_NONE;
+}
+
 /**
  * The huge macro parsing code...
  */
@@ -724,6 +914,8 @@ static bool ftepp_macro_expand(ftepp_t *ftepp, ppmacro *macro, macroparam *param
     char     *buffer       = nullptr;
     char     *old_string   = ftepp->output_string;
     char     *inner_string;
+    lex_tokens *tokens     = ftepp->output_tokens;
+    size_t    first;
     lex_file *old_lexer    = ftepp->lex;
     size_t    vararg_start = vec_size(macro->params);
     bool      retval       = true;
@@ -747,7 +939,9 @@ static bool ftepp_macro_expand(ftepp_t *ftepp, ppmacro *macro, macroparam *param
     if (!vec_size(macro->output))
         return true;
 
+    /* the body is put together as text and preprocessed again */
     ftepp->output_string = nullptr;
+    ftepp->output_tokens = nullptr;
     for (o = 0; o < vec_size(macro->output); ++o) {
         pptoken *out = macro->output[o];
         switch (out->token) {
@@ -755,6 +949,7 @@ static bool ftepp_macro_expand(ftepp_t *ftepp, ppmacro *macro, macroparam *param
                 if (!macro->variadic) {
                     ftepp_error(ftepp, "internal preprocessor error: TOKEN_VA_ARGS in non-variadic macro");
                     vec_free(old_string);
+                    ftepp->output_tokens = tokens;
                     return false;
                 }
                 if (!varargs)
@@ -772,6 +967,7 @@ static bool ftepp_macro_expand(ftepp_t *ftepp, ppmacro *macro, macroparam *param
                 if ((size_t)out->constval.i >= varargs) {
                     ftepp_error(ftepp, "subscript of `[%u]` is out of bounds for `__VA_ARGS__`", out->constval.i);
                     vec_free(old_string);
+                    ftepp->output_tokens = tokens;
                     return false;
                 }
 
@@ -850,6 +1046,8 @@ static bool ftepp_macro_expand(ftepp_t *ftepp, ppmacro *macro, macroparam *param
     old_inmacro     = ftepp->in_macro;
     ftepp->in_macro = true;
     ftepp->output_string = nullptr;
+    ftepp->output_tokens = tokens;
+    first = tokens ? tokens->tokens.size() : 0;
     if (!ftepp_preprocess(ftepp)) {
         ftepp->in_macro = old_inmacro;
         vec_free(ftepp->lex->open_string);
@@ -861,6 +1059,24 @@ static bool ftepp_macro_expand(ftepp_t *ftepp, ppmacro *macro, macroparam *param
     ftepp->in_macro = old_inmacro;
     vec_free(ftepp->lex->open_string);
     lex_close(ftepp->lex);
+    ftepp->lex = old_lexer;
+
+    if (tokens) {
+        /* the newlines of the pragmas below, which are only about lines here */
+        has_newlines = first < tokens->tokens.size() &&
+                       memchr(&tokens->spellings[tokens->tokens[first].spelling], '\n',
+                              tokens->spellings.size() - tokens->tokens[first].spelling);
+        if (has_newlines && !old_inmacro) {
+            ftepp_push_eol(ftepp);
+            std::rotate(tokens->tokens.begin() + first, tokens->tokens.end() - 1, tokens->tokens.end());
+            ftepp_push_eol(ftepp);
+        }
+        if (resetline && !ftepp->in_macro) {
+            ftepp_push_eol(ftepp);
+            ftepp_lines_set(ftepp, old_lexer->sline, old_lexer->sline);
+        }
+        goto cleanup;
+    }
 
     inner_string = ftepp->output_string;
     ftepp->output_string = old_string;
@@ -886,6 +1102,7 @@ static bool ftepp_macro_expand(ftepp_t *ftepp, ppmacro *macro, macroparam *param
 cleanup:
     ftepp->lex           = old_lexer;
     ftepp->output_string = old_string;
+    ftepp->output_tokens = tokens;
     return retval;
 }
 
@@ -896,6 +1113,9 @@ static bool ftepp_macro_call(ftepp_t *ftepp, ppmacro *macro)
     bool        retval = true;
     size_t      paramline;
 
+    if (!ftepp->in_macro && ftepp->output_tokens)
+        ftepp->expansion = ftepp_tokctx(ftepp);
+
     if (!macro->has_params) {
         if (!ftepp_macro_expand(ftepp, macro, nullptr, false))
             return false;
@@ -1188,7 +1408,7 @@ static bool ftepp_if(ftepp_t *ftepp, ppcondition *cond)
 /**
  * ifdef is rather simple
  */
-static bool ftepp_ifdef(ftepp_t *ftepp, ppcondition *cond)
+static bool ftepp_ifdef(ftepp_t *ftepp, ppcondition *cond, char **name)
 {
     ppmacro *macro;
     memset(cond, 0, sizeof(*cond));
@@ -1201,6 +1421,8 @@ static bool ftepp_ifdef(ftepp_t *ftepp, ppcondition *cond)
         case TOKEN_TYPENAME:
         case TOKEN_KEYWORD:
             macro = ftepp_macro_find(ftepp, ftepp_tokval(ftepp));
+            if (name)
+                *name = util_strdup(ftepp_tokval(ftepp));
             break;
         default:
             ftepp_error(ftepp, "expected macro name");
@@ -1286,9 +1508,26 @@ static void unescape(const char *str, char *out) {
     *out = 0;
 }
 
-static char *ftepp_include_find_path(const char *file, const char *pathfile)
+/* the contents of a file, it is not found when they cannot be loaded */
+static bool ftepp_include_load(ppinclude *include, const char *filename)
+{
+    bool  loaded;
+    FILE *fp = fopen(filename, "rb");
+
+    if (!fp)
+        return false;
+    loaded = lex_file_load(&include->file, fp);
+    fclose(fp);
+    return loaded;
+}
+
+/*
+ * The paths looked at are remembered with what was found there, so every
+ * one is opened and read only once however often it is included.
+ */
+static ppinclude *ftepp_include_find_path(ftepp_t *ftepp, const char *file, const char *pathfile, char **out)
 {
-    FILE *fp;
+    ppinclude  *include;
     char       *filename = nullptr;
     const char *last_slash;
     size_t      len;
@@ -1308,23 +1547,29 @@ static char *ftepp_include_find_path(const char *file, const char *pathfile)
     memcpy(vec_add(filename, len+1), file, len);
     vec_last(filename) = 0;
 
-    fp = fopen(filename, "rb");
-    if (fp) {
-        fclose(fp);
-        return filename;
+    include = (ppinclude*)util_htget(ftepp->includes, filename);
+    if (!include) {
+        include = (ppinclude*)mem_a(sizeof(*include));
+        memset(include, 0, sizeof(*include));
+        include->found = ftepp_include_load(include, filename);
+        util_htset(ftepp->includes, filename, include);
+    }
+    if (include->found) {
+        *out = filename;
+        return include;
     }
     vec_free(filename);
     return nullptr;
 }
 
-static char *ftepp_include_find(ftepp_t *ftepp, const char *file)
+static ppinclude *ftepp_include_find(ftepp_t *ftepp, const char *file, char **filename)
 {
-    char *filename = nullptr;
+    ppinclude *include;
 
-    filename = ftepp_include_find_path(file, ftepp->includename);
-    if (!filename)
-        filename = ftepp_include_find_path(file, ftepp->itemname);
-    return filename;
+    include = ftepp_include_find_path(ftepp, file, ftepp->includename, filename);
+    if (!include)
+        include = ftepp_include_find_path(ftepp, file, ftepp->itemname, filename);
+    return include;
 }
 
 static bool ftepp_directive_warning(ftepp_t *ftepp) {
@@ -1425,9 +1670,17 @@ static bool ftepp_include(ftepp_t *ftepp)
     lex_file *inlex;
     lex_ctx_t ctx;
     char     lineno[128];
-    char     *filename;
+    char     *filename = nullptr;
     char     *parsename = nullptr;
     char     *old_includename;
+    ppinclude *include;
+    ppinclude *old_include;
+    ppguard  guard;
+    ppguard  *old_guard;
+    pplines  old_lines;
+    const char *data;
+    size_t   len;
+    bool     success;
 
     (void)ftepp_next(ftepp);
     if (!ftepp_skipspace(ftepp))
@@ -1436,14 +1689,18 @@ static bool ftepp_include(ftepp_t *ftepp)
     if (ftepp->token != TOKEN_STRINGCONST) {
         ppmacro *macro = ftepp_macro_find(ftepp, ftepp_tokval(ftepp));
         if (macro) {
-            char *backup = ftepp->output_string;
+            char       *backup = ftepp->output_string;
+            lex_tokens *tokens = ftepp->output_tokens;
             ftepp->output_string = nullptr;
+            ftepp->output_tokens = nullptr;
             if (ftepp_macro_expand(ftepp, macro, nullptr, true)) {
                 parsename = util_strdup(ftepp->output_string);
                 vec_free(ftepp->output_string);
                 ftepp->output_string = backup;
+                ftepp->output_tokens = tokens;
             } else {
                 ftepp->output_string = backup;
+                ftepp->output_tokens = tokens;
                 ftepp_error(ftepp, "expected filename to include");
                 return false;
             }
@@ -1473,42 +1730,84 @@ static bool ftepp_include(ftepp_t *ftepp)
     }
 
     ctx = ftepp_ctx(ftepp);
-    ftepp_out(ftepp, "\n#pragma file(", false);
-    ftepp_out(ftepp, parsename, false);
-    ftepp_out(ftepp, ")\n#pragma line(1)\n", false);
+    old_lines = ftepp->lines;
+    if (ftepp->output_tokens) {
+        ftepp_push_eol(ftepp);
+        ftepp->tokenfile = lex_filename(parsename);
+        memset(&ftepp->lines, 0, sizeof(ftepp->lines));
+    } else {
+        ftepp_out(ftepp, "\n#pragma file(", false);
+        ftepp_out(ftepp, parsename, false);
+        ftepp_out(ftepp, ")\n#pragma line(1)\n", false);
+    }
 
-    filename = ftepp_include_find(ftepp, parsename);
-    if (!filename) {
+    include = ftepp_include_find(ftepp, parsename, &filename);
+    if (!include) {
         ftepp_error(ftepp, "failed to open include file `%s`", parsename);
         mem_d(parsename);
         return false;
     }
     mem_d(parsename);
-    inlex = lex_open(filename);
-    if (!inlex) {
-        ftepp_error(ftepp, "open failed on include file `%s`", filename);
+
+    /*
+     * A file with #pragma once, or one whose guard is still defined, would
+     * leave nothing but its lines. It is not read again, the pragmas above
+     * and below still go out so the parser sees the same files and lines.
+     */
+    if (include->once || (include->guard && ftepp_macro_find(ftepp, include->guard))) {
         vec_free(filename);
-        return false;
-    }
-    ftepp->lex = inlex;
-    old_includename = ftepp->includename;
-    ftepp->includename = filename;
-    if (!ftepp_preprocess(ftepp)) {
+    } else {
+        /* skip the BOM */
+        data = include->file.data;
+        len  = include->file.length;
+        if (len >= 3 && !memcmp(data, "\xEF\xBB\xBF", 3))
+            data += 3, len -= 3;
+        inlex = lex_open_string(data, len, filename);
+        if (!inlex) {
+            ftepp_error(ftepp, "open failed on include file `%s`", filename);
+            vec_free(filename);
+            return false;
+        }
+        ftepp->lex = inlex;
+        old_includename = ftepp->includename;
+        old_include = ftepp->include;
+        old_guard = ftepp->guard;
+        ftepp->includename = filename;
+        ftepp->include = include;
+        ftepp->guard = &guard;
+        guard.state = GUARD_START;
+        guard.depth = vec_size(ftepp->conditions);
+        guard.name = nullptr;
+        success = ftepp_preprocess(ftepp);
         vec_free(ftepp->includename);
         ftepp->includename = old_includename;
+        ftepp->include = old_include;
+        ftepp->guard = old_guard;
         lex_close(ftepp->lex);
         ftepp->lex = old_lexer;
-        return false;
+
+        if (include->guard)
+            mem_d(include->guard);
+        include->guard = nullptr;
+        if (success && guard.state == GUARD_CLOSED)
+            include->guard = guard.name;
+        else if (guard.name)
+            mem_d(guard.name);
+        if (!success)
+            return false;
     }
-    vec_free(ftepp->includename);
-    ftepp->includename = old_includename;
-    lex_close(ftepp->lex);
-    ftepp->lex = old_lexer;
 
-    ftepp_out(ftepp, "\n#pragma file(", false);
-    ftepp_out(ftepp, ctx.file, false);
-    util_snprintf(lineno, sizeof(lineno), ")\n#pragma line(%lu)\n", (unsigned long)(ctx.line+1));
-    ftepp_out(ftepp, lineno, false);
+    if (ftepp->output_tokens) {
+        ftepp->tokenfile = ctx.file;
+        ftepp->lines     = old_lines;
+        ftepp_lines_set(ftepp, ctx.line + 1, ctx.line + 1);
+        ftepp_push_eol(ftepp);
+    } else {
+        ftepp_out(ftepp, "\n#pragma file(", false);
+        ftepp_out(ftepp, ctx.file, false);
+        util_snprintf(lineno, sizeof(lineno), ")\n#pragma line(%lu)\n", (unsigned long)(ctx.line+1));
+        ftepp_out(ftepp, lineno, false);
+    }
 
     /* skip the line */
     (void)ftepp_next(ftepp);
@@ -1542,16 +1841,115 @@ static GMQCC_INLINE void ftepp_inmacro(ftepp_t *ftepp, const char *hash) {
         (void)!ftepp_warn(ftepp, WARN_DIRECTIVE_INMACRO, "`#%s` directive in macro", hash);
 }
 
+/*
+ * #pragma file, line, push(line) and pop(line) at the start of a line
+ * belong to the parser's lexer, see lex_try_pragma, which finds them in
+ * the text written for -E. The tokens carry the files and lines they set
+ * instead, and leave them out.
+ */
+static void ftepp_pragma_lines(ftepp_t *ftepp, size_t out)
+{
+    size_t      line    = ftepp_ctx(ftepp).line;
+    size_t      at      = ftepp_lines_at(ftepp, line);
+    char       *command = util_strdup(ftepp_tokval(ftepp));
+    char       *param   = nullptr;
+    const char *ch;
+
+    for (ch = command; *ch >= 'a' && *ch <= 'z'; ++ch) {}
+    if (*ch)
+        goto unroll;
+
+    ftepp_out_token(ftepp, false);
+    if (ftepp_next(ftepp) != '(')
+        goto unroll;
+    ftepp_out_token(ftepp, false);
+    for (ftepp_next(ftepp); ftepp->token != ')' && ftepp->token != TOKEN_EOL && ftepp->token < TOKEN_EOF; ftepp_next(ftepp)) {
+        vec_append(param, strlen(ftepp_tokval(ftepp)), ftepp_tokval(ftepp));
+        ftepp_out_token(ftepp, false);
+    }
+    vec_push(param, 0);
+    if (ftepp->token != ')')
+        goto unroll;
+
+    if (!strcmp(command, "push") && !strcmp(param, "line")) {
+        if (!ftepp->lines.push++)
+            ftepp->lines.line = at - 1;
+    }
+    else if (!strcmp(command, "pop") && !strcmp(param, "line")) {
+        if (ftepp->lines.push)
+            ftepp->lines.push--;
+        if (!ftepp->lines.push)
+            ftepp_lines_set(ftepp, line + 1, at);
+    }
+    else if (!strcmp(command, "file"))
+        ftepp->tokenfile = lex_filename(param);
+    else if (!strcmp(command, "line"))
+        ftepp_lines_set(ftepp, line + 1, strtol(param, nullptr, 0));
+    else
+        goto unroll;
+
+    while (ftepp->token != TOKEN_EOL && ftepp->token < TOKEN_EOF)
+        ftepp_next(ftepp);
+    ftepp_out_shrink(ftepp, out);
+
+unroll:
+    mem_d(command);
+    vec_free(param);
+}
+
+/*
+ * #pragma once is the preprocessor's own, the other pragmas are passed on
+ * to the parser.
+ */
+static bool ftepp_pragma(ftepp_t *ftepp)
+{
+    size_t out   = ftepp_out_size(ftepp);
+    bool   lines = ftepp->output_tokens && ftepp->output_on && !ftepp->in_macro &&
+                   out && ftepp->output_tokens->tokens.back().ttype == TOKEN_EOL;
+
+    ftepp_out(ftepp, "#", false);
+    ftepp_out_token(ftepp, false);
+    ftepp_next(ftepp);
+    if (ftepp->token != TOKEN_WHITE || strcmp(ftepp_tokval(ftepp), " "))
+        lines = false;
+    while (ftepp->token == TOKEN_WHITE) {
+        ftepp_out_token(ftepp, false);
+        ftepp_next(ftepp);
+    }
+    if (ftepp->token != TOKEN_IDENT)
+        return true;
+    if (strcmp(ftepp_tokval(ftepp), "once")) {
+        if (lines)
+            ftepp_pragma_lines(ftepp, out);
+        return true;
+    }
+
+    (void)ftepp_next(ftepp);
+    if (!ftepp_skipspace(ftepp))
+        return false;
+    if (ftepp->token != TOKEN_EOL) {
+        ftepp_error(ftepp, "stray tokens after #pragma once");
+        return false;
+    }
+    ftepp_out_shrink(ftepp, out);
+    if (ftepp->output_on && ftepp->include)
+        ftepp->include->once = true;
+    return true;
+}
+
 static bool ftepp_hash(ftepp_t *ftepp)
 {
     ppcondition cond;
     ppcondition *pc;
+    bool guard;
 
     lex_ctx_t ctx = ftepp_ctx(ftepp);
 
     if (!ftepp_skipspace(ftepp))
         return false;
 
+    ftepp_guard_directive(ftepp, ftepp_tokval(ftepp));
+
     switch (ftepp->token) {
         case TOKEN_KEYWORD:
         case TOKEN_IDENT:
@@ -1566,7 +1964,7 @@ static bool ftepp_hash(ftepp_t *ftepp)
             }
             else if (!strcmp(ftepp_tokval(ftepp), "ifdef")) {
                 ftepp_inmacro(ftepp, "ifdef");
-                if (!ftepp_ifdef(ftepp, &cond))
+                if (!ftepp_ifdef(ftepp, &cond, nullptr))
                     return false;
                 cond.was_on = cond.on;
                 vec_push(ftepp->conditions, cond);
@@ -1575,8 +1973,11 @@ static bool ftepp_hash(ftepp_t *ftepp)
             }
             else if (!strcmp(ftepp_tokval(ftepp), "ifndef")) {
                 ftepp_inmacro(ftepp, "ifndef");
-                if (!ftepp_ifdef(ftepp, &cond))
+                guard = ftepp->guard && !ftepp->in_macro && ftepp->guard->state == GUARD_START;
+                if (!ftepp_ifdef(ftepp, &cond, guard ? &ftepp->guard->name : nullptr))
                     return false;
+                if (guard)
+                    ftepp->guard->state = GUARD_OPEN;
                 cond.on = !cond.on;
                 cond.was_on = cond.on;
                 vec_push(ftepp->conditions, cond);
@@ -1587,7 +1988,7 @@ static bool ftepp_hash(ftepp_t *ftepp)
                 ftepp_inmacro(ftepp, "elifdef");
                 if (!ftepp_else_allowed(ftepp))
                     return false;
-                if (!ftepp_ifdef(ftepp, &cond))
+                if (!ftepp_ifdef(ftepp, &cond, nullptr))
                     return false;
                 pc = &vec_last(ftepp->conditions);
                 pc->on     = !pc->was_on && cond.on;
@@ -1599,7 +2000,7 @@ static bool ftepp_hash(ftepp_t *ftepp)
                 ftepp_inmacro(ftepp, "elifndef");
                 if (!ftepp_else_allowed(ftepp))
                     return false;
-                if (!ftepp_ifdef(ftepp, &cond))
+                if (!ftepp_ifdef(ftepp, &cond, nullptr))
                     return false;
                 cond.on = !cond.on;
                 pc = &vec_last(ftepp->conditions);
@@ -1656,7 +2057,8 @@ static bool ftepp_hash(ftepp_t *ftepp)
                 return ftepp_include(ftepp);
             }
             else if (!strcmp(ftepp_tokval(ftepp), "pragma")) {
-                ftepp_out(ftepp, "#", false);
+                if (!ftepp_pragma(ftepp))
+                    return false;
                 break;
             }
             else if (!strcmp(ftepp_tokval(ftepp), "warning")) {
@@ -1723,6 +2125,7 @@ static bool ftepp_preprocess(ftepp_t *ftepp)
             case TOKEN_KEYWORD:
             case TOKEN_IDENT:
             case TOKEN_TYPENAME:
+                ftepp_guard_text(ftepp);
                 /* is it a predef? */
                 if (OPTS_FLAG(FTEPP_PREDEFS)) {
                     char *(*predef)(ftepp_t*) = ftepp_predef(ftepp_tokval(ftepp));
@@ -1742,7 +2145,7 @@ static bool ftepp_preprocess(ftepp_t *ftepp)
                     macro = nullptr;
 
                 if (!macro) {
-                    ftepp_out(ftepp, ftepp_tokval(ftepp), false);
+                    ftepp_out_token(ftepp, false);
                     ftepp_next(ftepp);
                     break;
                 }
@@ -1751,7 +2154,8 @@ static bool ftepp_preprocess(ftepp_t *ftepp)
                 break;
             case '#':
                 if (!newline) {
-                    ftepp_out(ftepp, ftepp_tokval(ftepp), false);
+                    ftepp_guard_text(ftepp);
+                    ftepp_out_token(ftepp, false);
                     ftepp_next(ftepp);
                     break;
                 }
@@ -1767,25 +2171,28 @@ static bool ftepp_preprocess(ftepp_t *ftepp)
                 break;
             case TOKEN_EOL:
                 newline = true;
-                ftepp_out(ftepp, "\n", true);
+                ftepp_out_token(ftepp, true);
                 ftepp_next(ftepp);
                 break;
             case TOKEN_WHITE:
                 /* same as default but don't set newline=false */
-                ftepp_out(ftepp, ftepp_tokval(ftepp), true);
+                ftepp_out_token(ftepp, true);
                 ftepp_next(ftepp);
                 break;
             default:
                 newline = false;
-                ftepp_out(ftepp, ftepp_tokval(ftepp), false);
+                ftepp_guard_text(ftepp);
+                ftepp_out_token(ftepp, false);
                 ftepp_next(ftepp);
                 break;
         }
     } while (!ftepp->errors && ftepp->token < TOKEN_EOF);
 
     /* force a 0 at the end but don't count it as added to the output */
-    vec_push(ftepp->output_string, 0);
-    vec_shrinkby(ftepp->output_string, 1);
+    if (!ftepp->output_tokens) {
+        vec_push(ftepp->output_string, 0);
+        vec_shrinkby(ftepp->output_string, 1);
+    }
 
     return (ftepp->token == TOKEN_EOF);
 }
@@ -1809,6 +2216,13 @@ static bool ftepp_preprocess_done(ftepp_t *ftepp)
     return retval;
 }
 
+/* the tokens of a file are where its lexer is */
+static void ftepp_start(ftepp_t *ftepp)
+{
+    ftepp->tokenfile = ftepp->lex->name;
+    memset(&ftepp->lines, 0, sizeof(ftepp->lines));
+}
+
 bool ftepp_preprocess_file(ftepp_t *ftepp, const char *filename)
 {
     ftepp->lex = lex_open(filename);
@@ -1817,6 +2231,7 @@ bool ftepp_preprocess_file(ftepp_t *ftepp, const char *filename)
         con_out("failed to open file \"%s\"\n", filename);
         return false;
     }
+    ftepp_start(ftepp);
     if (!ftepp_preprocess(ftepp))
         return false;
     return ftepp_preprocess_done(ftepp);
@@ -1830,6 +2245,7 @@ bool ftepp_preprocess_string(ftepp_t *ftepp, const char *name, const char *str)
         con_out("failed to create lexer for string \"%s\"\n", name);
         return false;
     }
+    ftepp_start(ftepp);
     if (!ftepp_preprocess(ftepp))
         return false;
     return ftepp_preprocess_done(ftepp);
@@ -1866,6 +2282,10 @@ ftepp_t *ftepp_create()
     if (!ftepp)
         return nullptr;
 
+    /* -E writes the text, the parser takes the tokens */
+    if (!OPTS_OPTION_BOOL(OPTION_PP_ONLY))
+        ftepp->output_tokens = new lex_tokens;
+
     memset(minor, 0, sizeof(minor));
     memset(major, 0, sizeof(major));
 
@@ -1934,6 +2354,11 @@ const char *ftepp_get(ftepp_t *ftepp)
     return ftepp->output_string;
 }
 
+const lex_tokens *ftepp_tokens(ftepp_t *ftepp)
+{
+    return ftepp->output_tokens;
+}
+
 void ftepp_flush(ftepp_t *ftepp)
 {
     ftepp_flush_do(ftepp);
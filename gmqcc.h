@@ -533,6 +533,7 @@ struct lex_ctx_t {
 
 /*
  * code_write          -- writes out the compiled file
+ * code_write_c        -- writes out the compiled file as C source
  * code_init           -- prepares the code file
  * code_genstrin       -- generates string for code
  * code_alloc_field    -- allocated a field
@@ -540,6 +541,7 @@ struct lex_ctx_t {
  * code_pop_statement  -- keeps statements and linenumbers together
  */
 bool      code_write         (code_t *, const char *filename, const char *lno);
+bool      code_write_c       (code_t *, const char *filename, const char *progname);
 GMQCC_WARN
 code_t   *code_init          (void);
 void      code_cleanup       (code_t *);
@@ -655,14 +657,58 @@ enum {
 };
 
 #define VM_JUMPS_DEFAULT 1000000
+#define VM_ENTITY_CHUNK  128     /* entities allocated at once */
+#define VM_TEMPSTRING_BLOCK (16*1024) /* bytes of the tempstring arena allocated at once */
+#define VM_FRAMES_RESERVE 64     /* activations of each re-entrant function reserved for */
+#define VM_RECORD_DEFAULT 4096   /* statements kept by VMXF_RECORD */
+#define VM_RECORD_DUMP    16     /* of which an error prints the last */
 
 /* execute-flags */
 #define VMXF_DEFAULT 0x0000     /* default flags - nothing */
 #define VMXF_TRACE   0x0001     /* trace: print statements before executing */
 #define VMXF_PROFILE 0x0002     /* profile: increment the profile counters */
+#define VMXF_PREDECODE 0x0004   /* predecode: run the predecoded statements */
+#define VMXF_JIT     0x0008     /* jit: run functions as native code where possible */
+#define VMXF_TIMING  0x0010     /* timing: time the calls of functions and builtins */
+#define VMXF_FRAMES  0x0020     /* frames: back up the locals of re-entrant functions only */
+#define VMXF_VERIFIED 0x0040    /* verified: leave out the checks the verifier in prog_load made, implies VMXF_PREDECODE */
+#define VMXF_RECORD  0x0080     /* record: keep the last statements in a ring, see prog_record */
 
 typedef struct qc_program qc_program_t;
 typedef int (*prog_builtin_t)(qc_program_t *prog);
+/*
+ * Receives the errors of a program, prog is nullptr while it is still being
+ * loaded.  Without one they are printed to stderr.
+ */
+typedef void (*prog_error_t)(qc_program_t *prog, const char *message, void *user);
+
+/*
+ * The VM private form of a statement built by prog_predecode. There is
+ * one for each statement in the code so indices are interchangeable.
+ * Operands are resolved into pointers into the globals, jumps point at
+ * their target statement and calls to a constant function global point
+ * at the function directly. prog_fuse may replace the opcode with a VM
+ * internal one running the statement and the one after it.
+ */
+struct qc_decoded_statement_t {
+    uint16_t opcode;
+    uint16_t argc;
+    qcany_t *a;
+    qcany_t *b;
+    qcany_t *c;
+    union {
+        qc_decoded_statement_t  *target;
+        prog_section_function_t *function;
+    };
+};
+
+/* runaway loop counter, shared by nested prog_exec and native code */
+struct qc_jumps_t {
+    long count;
+    long limit;
+};
+
+struct qc_jit_t;
 
 struct qc_exec_stack_t {
     qcint_t stmt;
@@ -670,47 +716,232 @@ struct qc_exec_stack_t {
     prog_section_function_t *function;
 };
 
+/*
+ * A path of calls seen while profiling. Together they form the tree of
+ * calling contexts, node 0 being its root outside of any function.
+ */
+struct qc_callpath_t {
+    size_t  parent;
+    qcint_t function;
+    qcint_t statement;  /* of the call, -1 for the entry point */
+    size_t  calls;
+    size_t  self;       /* statements executed on exactly this path */
+    std::vector<size_t> children;
+};
+
+/*
+ * A call site with VMXF_TIMING, the times are in ticks of the timer. The
+ * sites of one statement calling different functions are chained.
+ */
+struct qc_callsite_t {
+    qcint_t  caller;
+    qcint_t  statement;  /* of the call, -1 for the entry point */
+    qcint_t  callee;
+    size_t   next;       /* 0 for the last */
+    size_t   calls;
+    uint64_t inclusive;
+    uint64_t exclusive;
+};
+
+/* a call still running with VMXF_TIMING */
+struct qc_timing_frame_t {
+    size_t   site;
+    uint64_t start;
+    uint64_t children;   /* the time spent in its callees */
+};
+
+/* a block of the tempstring arena, a long string may get a larger one */
+struct qc_tempstring_block_t {
+    std::unique_ptr<char[]> data;
+    size_t size = 0;
+};
+
+/*
+ * A statement executed with VMXF_RECORD, with the first three words of
+ * the globals its a and b operands named before it ran.
+ */
+struct qc_record_t {
+    uint32_t statement;
+    uint32_t depth;     /* of the stack of calls */
+    qcint_t  a[3];
+    qcint_t  b[3];
+};
+
+/*
+ * A section of a loaded program which never changes. It points either
+ * into the mapping of the file or at a private copy of it, the latter
+ * when the file had to be read in and byte swapped.
+ */
+template <typename T>
+struct qc_section {
+    const T *begin() const { return m_data; }
+    const T *end() const { return m_data + m_size; }
+    const T *data() const { return m_data; }
+    const T &operator[](size_t i) const { return m_data[i]; }
+    size_t size() const { return m_size; }
+    bool empty() const { return !m_size; }
+
+    void view(const void *data, size_t size) {
+        m_copy.clear();
+        m_data = (const T*)data;
+        m_size = size;
+    }
+    void own(std::vector<T> &&copy) {
+        m_copy = std::move(copy);
+        m_data = m_copy.data();
+        m_size = m_copy.size();
+    }
+
+private:
+    std::vector<T> m_copy;
+    const T *m_data = nullptr;
+    size_t m_size = 0;
+};
+
+/*
+ * The state of a program between two prog_exec, made by prog_snapshot.
+ * The tempstrings are only kept when they may still be used, that is
+ * before the arena expired.
+ */
+struct qc_snapshot_t {
+    size_t serial;
+    std::vector<qcint_t> globals;
+    std::vector<qcint_t> entitydata; /* whole chunks, laid out as they were */
+    size_t fieldstride;
+    qcint_t entities;
+    std::vector<uint64_t> entityfree;
+    size_t entityfree_from;
+    std::vector<std::vector<char>> tempstrings; /* the used part of each block */
+    size_t tempstring_at;
+    bool   tempstring_expired;
+    size_t tempstring_generation; /* of the arena when it last matched them */
+};
+
 struct qc_program {
     qc_program() = delete;
     qc_program(const char *name, uint16_t crc, size_t entfields);
 
     std::string filename;
-    std::vector<prog_section_statement_t> code;
-    std::vector<prog_section_def_t> defs;
-    std::vector<prog_section_def_t> fields;
+    qc_section<prog_section_statement_t> code;
+    qc_section<prog_section_def_t> defs;
+    qc_section<prog_section_def_t> fields;
     std::vector<prog_section_function_t> functions;
-    std::vector<char> strings;
+    qc_section<char> strings;
     std::vector<qcint_t> globals;
-    std::vector<qcint_t> entitydata;
-    std::vector<bool> entitypool;
+    /*
+     * Entities live in chunks of VM_ENTITY_CHUNK which never move. A set
+     * bit in entityfree marks a killed entity that can be spawned again.
+     * In a chunk the fields of an entity follow each other, or after
+     * prog_soa each field has a column of VM_ENTITY_CHUNK words: field f
+     * of entity e is the word (e % VM_ENTITY_CHUNK) * entitystride +
+     * f * fieldstride of its chunk, see prog_entityword.
+     */
+    std::vector<std::unique_ptr<qcint_t[]>> entitychunks;
+    size_t entitystride;
+    size_t fieldstride = 1;
+    std::vector<uint64_t> entityfree;
+    size_t entityfree_from = 0; /* the words before have no bit set */
+    /*
+     * A set bit in entitydirty marks an entity written since the last
+     * snapshot taken or restored, numbered snapshot_serial.
+     */
+    std::vector<uint64_t> entitydirty;
+    /*
+     * Only while entityread is as long as entitydirty, a set bit marks an
+     * entity loaded from since it was cleared, see think.cpp.
+     */
+    std::vector<uint64_t> entityread;
+    size_t snapshot_serial = 0;
+    size_t snapshots_taken = 0;
+    size_t restored_entities = 0; /* copied back by prog_restore so far */
+    std::vector<qc_decoded_statement_t> decoded;
 
     std::vector<const char*> function_stack;
 
     uint16_t crc16;
 
+    /* the file, when the sections above point into it */
+    void  *map = nullptr;
+    size_t mapsize = 0;
+
+    /*
+     * The tempstring arena. Its strings are numbered after the static ones
+     * from tempstring_start on, VM_TEMPSTRING_BLOCK numbers to each block,
+     * so a string never moves once made. A string longer than a block gets
+     * a block large enough for it and the numbers of as many blocks. The
+     * arena is emptied by the first string made after the outermost
+     * prog_exec returned, so the host can still read what it returned.
+     */
+    std::vector<qc_tempstring_block_t> tempstrings;
     size_t tempstring_start;
-    size_t tempstring_at;
+    size_t tempstring_at = 0;         /* the next free number after tempstring_start */
+    bool   tempstring_expired = false;
+    size_t tempstring_generation = 0; /* changes whenever old numbers get reused */
+
+    /* allocations so far, qcvm -bench reports them */
+    size_t tempstrings_made = 0;
+    size_t tempstring_bytes = 0;      /* of the strings made */
+    size_t tempstring_peak = 0;       /* of the arena in use at once */
+    size_t entities_spawned = 0;
 
-    qcint_t  vmerror;
+    qcint_t  vmerror = 0;
 
     std::vector<size_t> profile;
 
-    prog_builtin_t *builtins;
-    size_t          builtins_count;
+    /* the calling contexts with VMXF_PROFILE */
+    std::vector<qc_callpath_t> callpaths;
+    size_t callpath = 0;
+    size_t executed = 0;      /* statements so far */
+    size_t executed_mark = 0; /* when callpath was last entered or left */
+
+    /* the call sites with VMXF_TIMING, site 0 being unused */
+    std::vector<qc_callsite_t> callsites;
+    std::vector<size_t> callsite_of;        /* the first site of each statement */
+    std::vector<qc_timing_frame_t> timing_stack;
+    std::vector<uint64_t> timing_inclusive; /* of each function, once per recursion */
+    std::vector<uint32_t> timing_depth;
+    uint64_t timing_start_ticks;
+    uint64_t timing_start_ns;
+
+    /* registered by the embedder, which can find its own state in user */
+    std::vector<prog_builtin_t> builtins;
+    prog_error_t error = nullptr;
+    void        *user  = nullptr;
 
     /* size_t ip; */
     qcint_t  entities;
     size_t entityfields;
-    bool   allowworldwrites;
+    bool   allowworldwrites = false;
 
     std::vector<qcint_t> localstack;
     std::vector<qc_exec_stack_t> stack;
+
+    /* the functions backing up their locals with VMXF_FRAMES, see prog_frames */
+    std::vector<uint8_t> reentrant;
+    size_t frames_builtins = 0; /* builtins running */
+    size_t frames_fast = 0;     /* calls which did not back up the locals */
+    size_t frames_saved = 0;    /* calls which did */
+
+    /* the ring of statements with VMXF_RECORD, its size a power of two */
+    std::vector<qc_record_t> records;
+    size_t records_at = 0;      /* statements recorded so far */
     size_t statement;
 
-    size_t xflags;
+    size_t xflags = VMXF_DEFAULT;
 
     int    argc; /* current arg count for debugging */
 
+    qc_jumps_t jumps;
+
+    qc_jit_t *jit = nullptr;
+    size_t    jit_threshold = 0;
+
+    /* the defs and fields by offset (their index + 1, 0 for none) and name */
+    std::vector<uint32_t> defs_at;
+    std::vector<uint32_t> fields_at;
+    hash_table_t *defs_named = nullptr;
+    hash_table_t *fields_named = nullptr;
+
     /* cached fields */
     struct {
         qcint_t frame;
@@ -723,24 +954,92 @@ struct qc_program {
         qcint_t time;
     } cached_globals;
 
-    bool supports_state; /* is INSTR_STATE supported? */
+    bool supports_state = false; /* is INSTR_STATE supported? */
+
+    /* whether the code passed the verifier in prog_load, or why not */
+    bool        verified = false;
+    std::string unverified;
 };
 
-qc_program_t*       prog_load      (const char *filename, bool ignoreversion);
+/* the lowest set bit of the bitmaps of entities, x is not 0 */
+static GMQCC_INLINE unsigned int prog_ctz64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(x);
+#else
+    unsigned int n = 0;
+    for (; !(x & 1); x >>= 1)
+        ++n;
+    return n;
+#endif
+}
+
+/* the word of a field of an entity, which has to exist */
+static GMQCC_INLINE qcint_t *prog_entityword(qc_program_t *prog, size_t e, size_t field) {
+    return prog->entitychunks[e / VM_ENTITY_CHUNK].get() +
+           (e % VM_ENTITY_CHUNK) * prog->entitystride + field * prog->fieldstride;
+}
+
+qc_program_t*       prog_load      (const char *filename, bool ignoreversion, prog_error_t error = nullptr, void *user = nullptr);
+void                prog_setbuiltin(qc_program_t *prog, size_t number, prog_builtin_t builtin);
+void                prog_error     (qc_program_t *prog, const char *fmt, ...);
+void                prog_message   (qc_program_t *prog, const char *fmt, ...);
+void                prog_predecode (qc_program_t *prog);
+void                prog_fuse      (qc_program_t *prog, size_t threshold);
+void                prog_frames    (qc_program_t *prog);
+void                prog_soa       (qc_program_t *prog);
+void                prog_record    (qc_program_t *prog, size_t size);
+bool                prog_record_write (qc_program_t *prog, const char *filename);
+bool                prog_record_decode(qc_program_t *prog, const char *filename, const char *lnofile);
+bool                prog_jit       (qc_program_t *prog, size_t threshold);
+qc_snapshot_t*      prog_snapshot  (qc_program_t *prog);
+bool                prog_restore   (qc_program_t *prog, qc_snapshot_t *snapshot);
+void                prog_snapshot_delete(qc_snapshot_t *snapshot);
 void                prog_delete    (qc_program_t *prog);
+qc_program_t*       prog_clone     (qc_program_t *prog);
 bool                prog_exec      (qc_program_t *prog, prog_section_function_t *func, size_t flags, long maxjumps);
 const char*         prog_getstring (qc_program_t *prog, qcint_t str);
-prog_section_def_t* prog_entfield  (qc_program_t *prog, qcint_t off);
-prog_section_def_t* prog_getdef    (qc_program_t *prog, qcint_t off);
+uint16_t            prog_fuse_pair (uint16_t first, uint16_t second);
+void                prog_disasm_function(qc_program_t *prog, size_t id);
+size_t              prog_print_string(const char *str, size_t maxlen);
+
+/* profile.cpp */
+bool prog_load_lno         (qc_program_t *prog, const char *lnofile, std::vector<int32_t> &lines);
+void prog_profile_enter    (qc_program_t *prog, qcint_t function, qcint_t statement);
+void prog_profile_leave    (qc_program_t *prog);
+void prog_profile_unwind   (qc_program_t *prog);
+bool prog_profile_report   (qc_program_t *prog, const char *filename, const char *lnofile);
+bool prog_profile_callgrind(qc_program_t *prog, const char *filename, const char *lnofile);
+bool prog_profile_folded   (qc_program_t *prog, const char *filename);
+void prog_timing_enter     (qc_program_t *prog, qcint_t function, qcint_t statement);
+void prog_timing_leave     (qc_program_t *prog, size_t depth);
+bool prog_timing_report    (qc_program_t *prog, const char *filename, const char *lnofile);
+const prog_section_def_t* prog_entfield (qc_program_t *prog, qcint_t off);
+const prog_section_def_t* prog_getdef   (qc_program_t *prog, qcint_t off);
+const prog_section_def_t* prog_findfield(qc_program_t *prog, const char *name);
+const prog_section_def_t* prog_finddef  (qc_program_t *prog, const char *name);
+prog_section_function_t*  prog_findfunction(qc_program_t *prog, const char *name);
+/*
+ * prog_getedict points at the fields of an entity one after another, which
+ * they no longer are after prog_soa: it then raises an error and returns
+ * nullptr. prog_getfield, prog_read_entity and prog_write_entity work in
+ * either layout.
+ */
 qcany_t*            prog_getedict  (qc_program_t *prog, qcint_t e);
+qcany_t*            prog_getfield  (qc_program_t *prog, qcint_t e, qcint_t field);
+void                prog_read_entity (qc_program_t *prog, qcint_t e, qcint_t *fields);
+void                prog_write_entity(qc_program_t *prog, qcint_t e, const qcint_t *fields);
+qcint_t             prog_spawn_entity(qc_program_t *prog);
+void                prog_free_entity (qc_program_t *prog, qcint_t e);
 qcint_t             prog_tempstring(qc_program_t *prog, const char *_str);
 
 
 /* parser.c */
 struct parser_t;
+struct lex_tokens;
 parser_t *parser_create(void);
 bool parser_compile_file(parser_t *parser, const char *);
 bool parser_compile_string(parser_t *parser, const char *, const char *, size_t);
+bool parser_compile_tokens(parser_t *parser, const char *, const lex_tokens *);
 bool parser_finish(parser_t *parser, const char *);
 
 /* ftepp.c */
@@ -750,6 +1049,7 @@ bool ftepp_preprocess_file  (ftepp_t *ftepp, const char *filename);
 bool ftepp_preprocess_string(ftepp_t *ftepp, const char *name, const char *str);
 void ftepp_finish(ftepp_t *ftepp);
 const char *ftepp_get(ftepp_t *ftepp);
+const lex_tokens *ftepp_tokens(ftepp_t *ftepp);
 void ftepp_flush(ftepp_t *ftepp);
 void ftepp_add_define(ftepp_t *ftepp, const char *source, const char *name);
 void ftepp_add_macro(ftepp_t *ftepp, const char *name,   const char *value);
@@ -2978,7 +2978,7 @@ qcint_t ir_builder::filestring(const char *filename)
 
     for (size_t i = 0; i != m_filenames.size(); ++i) {
         if (!strcmp(m_filenames[i], filename))
-            return i;
+            return m_filestrings[i];
     }
 
     str = code_genstring(m_code.get(), filename);
@@ -3818,6 +3818,14 @@ bool ir_builder::generate(const char *filename)
         memcpy(vec_add(lnofile, 5), ".lno", 5);
     }
 
+    /* before code_write, which leaves the code in little endian */
+    if (OPTS_OPTION_STR(OPTION_EMIT_C) &&
+        !code_write_c(m_code.get(), OPTS_OPTION_STR(OPTION_EMIT_C), filename))
+    {
+        vec_free(lnofile);
+        return false;
+    }
+
     if (!code_write(m_code.get(), filename, lnofile)) {
         vec_free(lnofile);
         return false;
@@ -0,0 +1,685 @@
+#include <string.h>
+
+#include "gmqcc.h"
+#include "jit.h"
+
+/*
+ * A small x86-64 code generator for the qcvm. Each function is compiled
+ * as a whole the first time it is called (or once it was called often
+ * enough, see prog_jit) as long as all of its statements are understood
+ * and every jump stays inside of it, otherwise it keeps running in the
+ * interpreter.
+ *
+ * The generated code keeps the globals in rbx, the program in r12 and the
+ * runaway jump counter in r14. Arithmetic and comparisons are done with
+ * the scalar SSE instructions the compiler uses for the interpreter, in
+ * the same order, so results are identical bit for bit. Entity access,
+ * strings and calls go through the jit_rt_* functions in exec.cpp.
+ *
+ * Every statement still stores its result to the globals, but within a
+ * straight run of statements the SSE registers remember which globals
+ * they hold so the following statements can skip reloading them.
+ */
+#if defined(__x86_64__) && !defined(_WIN32)
+#   define JIT_X86_64 1
+#   include <sys/mman.h>
+#else
+#   define JIT_X86_64 0
+#endif
+
+qc_jit_t *jit_create(qc_program_t *prog) {
+    qc_jit_t *jit = new qc_jit_t;
+    jit->native.resize(prog->functions.size(), nullptr);
+    jit->state.resize(prog->functions.size(), JIT_STATE_PENDING);
+    jit->compiled = 0;
+    jit->failed   = 0;
+    return jit;
+}
+
+#if JIT_X86_64
+
+/* where a rel32 in the code has to point once everything is emitted */
+enum {
+    JIT_TO_STATEMENT,
+    JIT_TO_RETURN,
+    JIT_TO_ERROR,
+    JIT_TO_RUNAWAY
+};
+
+struct jit_fixup {
+    size_t at;      /* offset of the rel32 */
+    int    kind;
+    size_t target;  /* statement for JIT_TO_STATEMENT */
+};
+
+#define JIT_XMM_COUNT 8
+#define JIT_NOTHING   (-1)
+
+struct jit_asm {
+    std::vector<uint8_t>   code;
+    std::vector<size_t>    statements; /* code offset of each statement */
+    std::vector<jit_fixup> fixups;
+
+    int64_t cached[JIT_XMM_COUNT];     /* global held by each register */
+    int     scratch;
+};
+
+enum {
+    JIT_ADDSS = 0x58,
+    JIT_MULSS = 0x59,
+    JIT_SUBSS = 0x5C,
+    JIT_DIVSS = 0x5E
+};
+
+enum {
+    JIT_SETA  = 0x97,
+    JIT_SETAE = 0x93,
+    JIT_SETE  = 0x94,
+    JIT_SETNE = 0x95,
+    JIT_SETP  = 0x9A,
+    JIT_SETNP = 0x9B
+};
+
+static void jit_byte(jit_asm &a, uint8_t b) {
+    a.code.push_back(b);
+}
+
+static void jit_bytes(jit_asm &a, std::initializer_list<uint8_t> bytes) {
+    a.code.insert(a.code.end(), bytes);
+}
+
+static void jit_imm32(jit_asm &a, uint32_t v) {
+    for (int i = 0; i < 4; ++i)
+        jit_byte(a, (v >> (i * 8)) & 0xFF);
+}
+
+static void jit_imm64(jit_asm &a, uint64_t v) {
+    for (int i = 0; i < 8; ++i)
+        jit_byte(a, (v >> (i * 8)) & 0xFF);
+}
+
+/* ModRM for [rbx + global*4] with `reg` in the reg field */
+static void jit_global(jit_asm &a, int reg, uint32_t global) {
+    jit_byte(a, 0x80 | (reg << 3) | 3);
+    jit_imm32(a, global * sizeof(qcint_t));
+}
+
+/* reg, [global] */
+static void jit_op_global(jit_asm &a, std::initializer_list<uint8_t> op, int reg, uint32_t global) {
+    jit_bytes(a, op);
+    jit_global(a, reg, global);
+}
+
+/*
+ * The register cache. It is dropped at jump targets and after calls into
+ * C, and an entry goes away whenever its register or global is written.
+ */
+static void jit_forget(jit_asm &a) {
+    for (auto &it : a.cached)
+        it = JIT_NOTHING;
+}
+
+static int jit_cached(jit_asm &a, uint32_t global) {
+    for (int i = 0; i < JIT_XMM_COUNT; ++i)
+        if (a.cached[i] == global)
+            return i;
+    return JIT_NOTHING;
+}
+
+static void jit_changed(jit_asm &a, uint32_t global) {
+    for (auto &it : a.cached)
+        if (it == global)
+            it = JIT_NOTHING;
+}
+
+/* xmm3 to xmm7 in turn, the low ones are used for fixed purposes */
+static int jit_scratch(jit_asm &a) {
+    a.scratch = (a.scratch + 1) % 5;
+    return 3 + a.scratch;
+}
+
+/* xmm = [global], copying from a register already holding it */
+static void jit_load_float(jit_asm &a, int xmm, uint32_t global) {
+    int from = jit_cached(a, global);
+    if (from == xmm)
+        return;
+    if (from != JIT_NOTHING)
+        jit_bytes(a, { 0x0F, 0x28, (uint8_t)(0xC0 | (xmm << 3) | from) }); /* movaps xmm, from */
+    else
+        jit_op_global(a, { 0xF3, 0x0F, 0x10 }, xmm, global);               /* movss xmm, [global] */
+    a.cached[xmm] = global;
+}
+
+/* [global] = xmm */
+static void jit_store_float(jit_asm &a, int xmm, uint32_t global) {
+    jit_op_global(a, { 0xF3, 0x0F, 0x11 }, xmm, global);
+    jit_changed(a, global);
+    a.cached[xmm] = global;
+}
+
+/* a scalar SSE operation xmm = xmm op [global] */
+static void jit_sse(jit_asm &a, uint8_t op, int xmm, uint32_t global) {
+    int from = jit_cached(a, global);
+    if (from != JIT_NOTHING)
+        jit_bytes(a, { 0xF3, 0x0F, op, (uint8_t)(0xC0 | (xmm << 3) | from) });
+    else
+        jit_op_global(a, { 0xF3, 0x0F, op }, xmm, global);
+    a.cached[xmm] = JIT_NOTHING;
+}
+
+static void jit_sse_reg(jit_asm &a, uint8_t op, int xmm, int from) {
+    jit_bytes(a, { 0xF3, 0x0F, op, (uint8_t)(0xC0 | (xmm << 3) | from) });
+    a.cached[xmm] = JIT_NOTHING;
+}
+
+/* ucomiss xmm, [global] */
+static void jit_ucomiss(jit_asm &a, int xmm, uint32_t global) {
+    int from = jit_cached(a, global);
+    if (from != JIT_NOTHING)
+        jit_bytes(a, { 0x0F, 0x2E, (uint8_t)(0xC0 | (xmm << 3) | from) });
+    else
+        jit_op_global(a, { 0x0F, 0x2E }, xmm, global);
+}
+
+/* xorps xmm, xmm */
+static void jit_zero(jit_asm &a, int xmm) {
+    jit_bytes(a, { 0x0F, 0x57, (uint8_t)(0xC0 | (xmm << 3) | xmm) });
+    a.cached[xmm] = JIT_NOTHING;
+}
+
+/* mov r32, [global] / mov [global], r32 */
+static void jit_load_int(jit_asm &a, int reg, uint32_t global) {
+    jit_op_global(a, { 0x8B }, reg, global);
+}
+
+static void jit_store_int(jit_asm &a, int reg, uint32_t global) {
+    jit_op_global(a, { 0x89 }, reg, global);
+    jit_changed(a, global);
+}
+
+/* test dword [global], 0x7FFFFFFF; the truth of a float in FLOAT_IS_TRUE_FOR_INT */
+static void jit_test_true(jit_asm &a, uint32_t global) {
+    jit_op_global(a, { 0xF7 }, 0, global);
+    jit_imm32(a, 0x7FFFFFFF);
+}
+
+/* setcc r8 for the low registers, cc being the second opcode byte */
+static void jit_setcc(jit_asm &a, uint8_t cc, int reg) {
+    jit_bytes(a, { 0x0F, cc, (uint8_t)(0xC0 | reg) });
+}
+
+/* al = xmm == [global] / al = xmm != [global] with C semantics for NaN */
+static void jit_float_eq(jit_asm &a, int xmm, uint32_t global, bool ne) {
+    jit_ucomiss(a, xmm, global);
+    if (!ne) {
+        jit_setcc(a, JIT_SETE, 0);
+        jit_setcc(a, JIT_SETNP, 1);
+        jit_bytes(a, { 0x20, 0xC8 });            /* and al, cl */
+    } else {
+        jit_setcc(a, JIT_SETNE, 0);
+        jit_setcc(a, JIT_SETP, 1);
+        jit_bytes(a, { 0x08, 0xC8 });            /* or al, cl */
+    }
+}
+
+/* [global] = al ? 1.0f : 0.0f */
+static void jit_store_bool(jit_asm &a, uint32_t global) {
+    jit_bytes(a, { 0x0F, 0xB6, 0xC0 });          /* movzx eax, al */
+    jit_bytes(a, { 0xF7, 0xD8 });                /* neg eax */
+    jit_byte(a, 0x25);                           /* and eax, 1.0f */
+    jit_imm32(a, 0x3F800000);
+    jit_store_int(a, 0, global);
+}
+
+/* a rel32 jump with the given opcode to somewhere fixed up later */
+static void jit_jump(jit_asm &a, std::initializer_list<uint8_t> op, int kind, size_t target) {
+    jit_bytes(a, op);
+    a.fixups.push_back({ a.code.size(), kind, target });
+    jit_imm32(a, 0);
+}
+
+/* a rel32 jump forward inside the current statement, patched by jit_here */
+static size_t jit_forward(jit_asm &a, std::initializer_list<uint8_t> op) {
+    jit_bytes(a, op);
+    jit_imm32(a, 0);
+    return a.code.size() - 4;
+}
+
+static void jit_here(jit_asm &a, size_t at) {
+    int32_t rel = (int32_t)(a.code.size() - (at + 4));
+    memcpy(&a.code[at], &rel, sizeof(rel));
+}
+
+/* calls a jit_rt_* function for a statement, leaving on errors */
+static void jit_runtime(jit_asm &a, int (*fn)(qc_program_t*, qcint_t), size_t statement) {
+    jit_bytes(a, { 0x4C, 0x89, 0xE7 });          /* mov rdi, r12 */
+    jit_byte(a, 0xBE);                           /* mov esi, statement */
+    jit_imm32(a, (uint32_t)statement);
+    jit_bytes(a, { 0x48, 0xB8 });                /* mov rax, fn */
+    jit_imm64(a, (uint64_t)(uintptr_t)fn);
+    jit_bytes(a, { 0xFF, 0xD0 });                /* call rax */
+    jit_bytes(a, { 0x85, 0xC0 });                /* test eax, eax */
+    jit_jump(a, { 0x0F, 0x85 }, JIT_TO_ERROR, 0); /* jnz error */
+    jit_forget(a);
+}
+
+/*
+ * A taken jump: counts it like the interpreter does, IF and IFNOT against
+ * the limit of the running prog_exec, GOTO against its fixed one.
+ */
+static void jit_branch(jit_asm &a, size_t target, bool isgoto) {
+    jit_bytes(a, { 0x49, 0xFF, 0x06 });          /* inc qword [r14] */
+    if (isgoto) {
+        jit_bytes(a, { 0x49, 0x81, 0x3E });      /* cmp qword [r14], 10000000 */
+        jit_imm32(a, 10000000);
+        jit_jump(a, { 0x0F, 0x84 }, JIT_TO_RUNAWAY, 0);
+    } else {
+        jit_bytes(a, { 0x49, 0x8B, 0x46, 0x08 }); /* mov rax, [r14+8] */
+        jit_bytes(a, { 0x49, 0x39, 0x06 });      /* cmp [r14], rax */
+        jit_jump(a, { 0x0F, 0x8D }, JIT_TO_RUNAWAY, 0);
+    }
+    jit_jump(a, { 0xE9 }, JIT_TO_STATEMENT, target);
+}
+
+/* [c] = [a] op [b] */
+static void jit_float_op(jit_asm &a, uint8_t op, uint32_t ga, uint32_t gb, uint32_t gc) {
+    int xmm = jit_scratch(a);
+    jit_load_float(a, xmm, ga);
+    jit_sse(a, op, xmm, gb);
+    jit_store_float(a, xmm, gc);
+}
+
+/* the extent of a function: up to the next function's entry */
+static size_t jit_function_end(qc_program_t *prog, prog_section_function_t *func) {
+    size_t end = prog->code.size();
+    for (auto &it : prog->functions)
+        if (it.entry > func->entry && (size_t)it.entry < end)
+            end = it.entry;
+    return end;
+}
+
+static bool jit_emit_statement(jit_asm &a, qc_program_t *prog, size_t at, size_t begin, size_t end) {
+    const prog_section_statement_t *st = &prog->code[at];
+    const uint32_t ga = st->o1.u1;
+    const uint32_t gb = st->o2.u1;
+    const uint32_t gc = st->o3.u1;
+    size_t skip, nonzero, done;
+    int x, y;
+
+    switch (st->opcode) {
+        case INSTR_DONE:
+        case INSTR_RETURN:
+            for (uint32_t i = 0; i < 3; ++i) {
+                jit_load_int(a, 0, ga + i);
+                jit_store_int(a, 0, OFS_RETURN + i);
+            }
+            jit_jump(a, { 0xE9 }, JIT_TO_RETURN, 0);
+            return true;
+
+        case INSTR_MUL_F: jit_float_op(a, JIT_MULSS, ga, gb, gc); return true;
+        case INSTR_ADD_F: jit_float_op(a, JIT_ADDSS, ga, gb, gc); return true;
+        case INSTR_SUB_F: jit_float_op(a, JIT_SUBSS, ga, gb, gc); return true;
+
+        case INSTR_DIV_F:
+            /* C = B != 0 ? A / B : 0, NaN counting as not zero */
+            jit_load_float(a, 1, gb);
+            jit_zero(a, 2);
+            jit_bytes(a, { 0x0F, 0x2E, 0xCA });          /* ucomiss xmm1, xmm2 */
+            skip = jit_forward(a, { 0x0F, 0x8A });       /* jp divide */
+            nonzero = jit_forward(a, { 0x0F, 0x85 });    /* jne divide */
+            jit_op_global(a, { 0xC7 }, 0, gc);           /* mov dword [c], 0 */
+            jit_imm32(a, 0);
+            done = jit_forward(a, { 0xE9 });
+            jit_here(a, skip);
+            jit_here(a, nonzero);
+            jit_load_float(a, 0, ga);
+            jit_sse_reg(a, JIT_DIVSS, 0, 1);
+            jit_store_float(a, 0, gc);
+            jit_here(a, done);
+            /* the two ways leave different registers behind */
+            jit_forget(a);
+            return true;
+
+        case INSTR_MUL_V:
+            x = jit_scratch(a);
+            y = jit_scratch(a);
+            jit_load_float(a, x, ga);
+            jit_sse(a, JIT_MULSS, x, gb);
+            jit_load_float(a, y, ga + 1);
+            jit_sse(a, JIT_MULSS, y, gb + 1);
+            jit_sse_reg(a, JIT_ADDSS, x, y);
+            jit_load_float(a, y, ga + 2);
+            jit_sse(a, JIT_MULSS, y, gb + 2);
+            jit_sse_reg(a, JIT_ADDSS, x, y);
+            jit_store_float(a, x, gc);
+            return true;
+
+        case INSTR_MUL_FV:
+        case INSTR_MUL_VF:
+            /* the scalar is read before any of the results are stored */
+            x = jit_scratch(a);
+            jit_load_float(a, x, st->opcode == INSTR_MUL_FV ? ga : gb);
+            for (uint32_t i = 0; i < 3; ++i) {
+                y = jit_scratch(a);
+                jit_load_float(a, y, (st->opcode == INSTR_MUL_FV ? gb : ga) + i);
+                jit_sse_reg(a, JIT_MULSS, y, x);
+                jit_store_float(a, y, gc + i);
+            }
+            return true;
+
+        case INSTR_ADD_V:
+        case INSTR_SUB_V:
+            for (uint32_t i = 0; i < 3; ++i)
+                jit_float_op(a, st->opcode == INSTR_ADD_V ? JIT_ADDSS : JIT_SUBSS, ga + i, gb + i, gc + i);
+            return true;
+
+        case INSTR_EQ_F:
+        case INSTR_NE_F:
+            jit_load_float(a, 0, ga);
+            jit_float_eq(a, 0, gb, st->opcode == INSTR_NE_F);
+            jit_store_bool(a, gc);
+            return true;
+
+        case INSTR_EQ_V:
+        case INSTR_NE_V:
+            for (uint32_t i = 0; i < 3; ++i) {
+                jit_load_float(a, 0, ga + i);
+                jit_float_eq(a, 0, gb + i, st->opcode == INSTR_NE_V);
+                if (!i)
+                    jit_bytes(a, { 0x88, 0xC2 });        /* mov dl, al */
+                else if (st->opcode == INSTR_EQ_V)
+                    jit_bytes(a, { 0x20, 0xC2 });        /* and dl, al */
+                else
+                    jit_bytes(a, { 0x08, 0xC2 });        /* or dl, al */
+            }
+            jit_bytes(a, { 0x88, 0xD0 });                /* mov al, dl */
+            jit_store_bool(a, gc);
+            return true;
+
+        case INSTR_EQ_E:
+        case INSTR_EQ_FNC:
+        case INSTR_NE_E:
+        case INSTR_NE_FNC:
+            jit_load_int(a, 0, ga);
+            jit_op_global(a, { 0x3B }, 0, gb);           /* cmp eax, [b] */
+            jit_setcc(a, (st->opcode == INSTR_EQ_E || st->opcode == INSTR_EQ_FNC) ? JIT_SETE : JIT_SETNE, 0);
+            jit_store_bool(a, gc);
+            return true;
+
+        /* ucomiss sets "above" for ordered greater, NaN fails all four */
+        case INSTR_LE:
+        case INSTR_LT:
+            jit_load_float(a, 0, gb);
+            jit_ucomiss(a, 0, ga);
+            jit_setcc(a, st->opcode == INSTR_LE ? JIT_SETAE : JIT_SETA, 0);
+            jit_store_bool(a, gc);
+            return true;
+        case INSTR_GE:
+        case INSTR_GT:
+            jit_load_float(a, 0, ga);
+            jit_ucomiss(a, 0, gb);
+            jit_setcc(a, st->opcode == INSTR_GE ? JIT_SETAE : JIT_SETA, 0);
+            jit_store_bool(a, gc);
+            return true;
+
+        case INSTR_LOAD_F:
+        case INSTR_LOAD_S:
+        case INSTR_LOAD_FLD:
+        case INSTR_LOAD_ENT:
+        case INSTR_LOAD_FNC:
+            jit_runtime(a, jit_rt_load, at);
+            return true;
+        case INSTR_LOAD_V:
+            jit_runtime(a, jit_rt_load_v, at);
+            return true;
+        case INSTR_ADDRESS:
+            jit_runtime(a, jit_rt_address, at);
+            return true;
+
+        /* moving through SSE registers copies the bits as they are */
+        case INSTR_STORE_F:
+        case INSTR_STORE_S:
+        case INSTR_STORE_ENT:
+        case INSTR_STORE_FLD:
+        case INSTR_STORE_FNC:
+            x = jit_scratch(a);
+            jit_load_float(a, x, ga);
+            jit_store_float(a, x, gb);
+            return true;
+        case INSTR_STORE_V:
+            for (uint32_t i = 0; i < 3; ++i) {
+                x = jit_scratch(a);
+                jit_load_float(a, x, ga + i);
+                jit_store_float(a, x, gb + i);
+            }
+            return true;
+
+        case INSTR_STOREP_F:
+        case INSTR_STOREP_S:
+        case INSTR_STOREP_ENT:
+        case INSTR_STOREP_FLD:
+        case INSTR_STOREP_FNC:
+            jit_runtime(a, jit_rt_storep, at);
+            return true;
+        case INSTR_STOREP_V:
+            jit_runtime(a, jit_rt_storep_v, at);
+            return true;
+
+        case INSTR_EQ_S:
+        case INSTR_NE_S:
+        case INSTR_NOT_S:
+            jit_runtime(a, jit_rt_strings, at);
+            return true;
+
+        case INSTR_NOT_F:
+            jit_test_true(a, ga);
+            jit_setcc(a, JIT_SETE, 0);
+            jit_store_bool(a, gc);
+            return true;
+        case INSTR_NOT_V:
+            jit_zero(a, 0);
+            for (uint32_t i = 0; i < 3; ++i) {
+                jit_float_eq(a, 0, ga + i, false);
+                jit_bytes(a, { (uint8_t)(i ? 0x20 : 0x88), 0xC2 }); /* mov/and dl, al */
+            }
+            jit_bytes(a, { 0x88, 0xD0 });                /* mov al, dl */
+            jit_store_bool(a, gc);
+            return true;
+        case INSTR_NOT_ENT:
+        case INSTR_NOT_FNC:
+            jit_op_global(a, { 0x83 }, 7, ga);           /* cmp dword [a], 0 */
+            jit_byte(a, 0);
+            jit_setcc(a, JIT_SETE, 0);
+            jit_store_bool(a, gc);
+            return true;
+
+        case INSTR_IF:
+        case INSTR_IFNOT:
+            if (at + st->o2.s1 < begin || at + st->o2.s1 >= end)
+                return false;
+            jit_test_true(a, ga);
+            skip = jit_forward(a, { 0x0F, (uint8_t)(st->opcode == INSTR_IF ? 0x84 : 0x85) });
+            jit_branch(a, at + st->o2.s1 - begin, false);
+            jit_here(a, skip);
+            return true;
+
+        case INSTR_GOTO:
+            if (at + st->o1.s1 < begin || at + st->o1.s1 >= end)
+                return false;
+            jit_branch(a, at + st->o1.s1 - begin, true);
+            return true;
+
+        case INSTR_CALL0:
+        case INSTR_CALL1:
+        case INSTR_CALL2:
+        case INSTR_CALL3:
+        case INSTR_CALL4:
+        case INSTR_CALL5:
+        case INSTR_CALL6:
+        case INSTR_CALL7:
+        case INSTR_CALL8:
+            jit_runtime(a, jit_rt_call, at);
+            return true;
+
+        case INSTR_AND:
+        case INSTR_OR:
+            jit_test_true(a, ga);
+            jit_setcc(a, JIT_SETNE, 0);
+            jit_test_true(a, gb);
+            jit_setcc(a, JIT_SETNE, 1);
+            jit_bytes(a, { (uint8_t)(st->opcode == INSTR_AND ? 0x20 : 0x08), 0xC8 }); /* and/or al, cl */
+            jit_store_bool(a, gc);
+            return true;
+
+        case INSTR_BITAND:
+        case INSTR_BITOR:
+            jit_op_global(a, { 0xF3, 0x0F, 0x2C }, 0, ga); /* cvttss2si eax, [a] */
+            jit_op_global(a, { 0xF3, 0x0F, 0x2C }, 1, gb); /* cvttss2si ecx, [b] */
+            jit_bytes(a, { (uint8_t)(st->opcode == INSTR_BITAND ? 0x21 : 0x09), 0xC8 }); /* and/or eax, ecx */
+            jit_zero(a, 0);                                /* cvtsi2ss only writes the low part */
+            jit_bytes(a, { 0xF3, 0x0F, 0x2A, 0xC0 });      /* cvtsi2ss xmm0, eax */
+            jit_store_float(a, 0, gc);
+            return true;
+
+        /* STATE and anything unknown stay with the interpreter */
+        default:
+            return false;
+    }
+}
+
+static jit_native_t jit_compile(qc_jit_t *jit, qc_program_t *prog, prog_section_function_t *func) {
+    const size_t begin = func->entry;
+    const size_t end   = jit_function_end(prog, func);
+    size_t ret, error, runaway;
+    std::vector<bool> targets;
+    jit_asm a;
+    void *map;
+
+    if (begin >= end)
+        return nullptr;
+
+    /* running off the end would continue in another function */
+    switch (prog->code[end - 1].opcode) {
+        case INSTR_DONE:
+        case INSTR_RETURN:
+        case INSTR_GOTO:
+            break;
+        default:
+            return nullptr;
+    }
+
+    /* jump offsets are checked when emitting the jumps */
+    targets.resize(end - begin, false);
+    for (size_t i = begin; i < end; ++i) {
+        const prog_section_statement_t &st = prog->code[i];
+        const bool jump = st.opcode == INSTR_IF || st.opcode == INSTR_IFNOT || st.opcode == INSTR_GOTO;
+        size_t to = i + (st.opcode == INSTR_GOTO ? st.o1.s1 : st.o2.s1);
+        if (st.opcode != INSTR_GOTO && st.o1.u1 >= prog->globals.size())
+            return nullptr;
+        if (!jump && (st.o2.u1 >= prog->globals.size() || st.o3.u1 >= prog->globals.size()))
+            return nullptr;
+        if (jump && to >= begin && to < end)
+            targets[to - begin] = true;
+    }
+
+    /* push rbx; push r12; push r14 keeps the stack aligned for calls */
+    jit_bytes(a, { 0x53, 0x41, 0x54, 0x41, 0x56 });
+    jit_bytes(a, { 0x49, 0x89, 0xFC });              /* mov r12, rdi */
+    jit_bytes(a, { 0x48, 0x89, 0xF3 });              /* mov rbx, rsi */
+    jit_bytes(a, { 0x49, 0x89, 0xD6 });              /* mov r14, rdx */
+
+    a.scratch = 0;
+    jit_forget(a);
+    for (size_t i = begin; i < end; ++i) {
+        if (targets[i - begin])
+            jit_forget(a);
+        a.statements.push_back(a.code.size());
+        if (!jit_emit_statement(a, prog, i, begin, end))
+            return nullptr;
+    }
+
+    ret = a.code.size();
+    jit_bytes(a, { 0x31, 0xC0 });                    /* xor eax, eax */
+    jit_bytes(a, { 0x41, 0x5E, 0x41, 0x5C, 0x5B, 0xC3 }); /* pop r14; pop r12; pop rbx; ret */
+    error = a.code.size();
+    jit_byte(a, 0xB8);                               /* mov eax, 1 */
+    jit_imm32(a, 1);
+    jit_bytes(a, { 0x41, 0x5E, 0x41, 0x5C, 0x5B, 0xC3 });
+    runaway = a.code.size();
+    jit_runtime(a, jit_rt_runaway, 0);
+    jit_jump(a, { 0xE9 }, JIT_TO_ERROR, 0);
+
+    for (auto &it : a.fixups) {
+        size_t to = 0;
+        int32_t rel;
+        switch (it.kind) {
+            case JIT_TO_STATEMENT: to = a.statements[it.target]; break;
+            case JIT_TO_RETURN:    to = ret;                     break;
+            case JIT_TO_ERROR:     to = error;                   break;
+            case JIT_TO_RUNAWAY:   to = runaway;                 break;
+        }
+        rel = (int32_t)(to - (it.at + 4));
+        memcpy(&a.code[it.at], &rel, sizeof(rel));
+    }
+
+    map = mmap(nullptr, a.code.size(), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        return nullptr;
+    memcpy(map, a.code.data(), a.code.size());
+    if (mprotect(map, a.code.size(), PROT_READ|PROT_EXEC)) {
+        munmap(map, a.code.size());
+        return nullptr;
+    }
+    jit->maps.push_back(map);
+    jit->sizes.push_back(a.code.size());
+    return (jit_native_t)map;
+}
+
+bool jit_supported() {
+    return true;
+}
+
+void jit_destroy(qc_jit_t *jit) {
+    for (size_t i = 0; i < jit->maps.size(); ++i)
+        munmap(jit->maps[i], jit->sizes[i]);
+    delete jit;
+}
+
+#else /* !JIT_X86_64 */
+
+static jit_native_t jit_compile(qc_jit_t *, qc_program_t *, prog_section_function_t *) {
+    return nullptr;
+}
+
+bool jit_supported() {
+    return false;
+}
+
+void jit_destroy(qc_jit_t *jit) {
+    delete jit;
+}
+
+#endif /* !JIT_X86_64 */
+
+jit_native_t jit_lookup(qc_program_t *prog, prog_section_function_t *func) {
+    qc_jit_t *jit = prog->jit;
+    size_t    id  = func - &prog->functions[0];
+
+    switch (jit->state[id]) {
+        case JIT_STATE_COMPILED:
+            return jit->native[id];
+        case JIT_STATE_FAILED:
+            return nullptr;
+    }
+    if (func->profile < prog->jit_threshold)
+        return nullptr;
+
+    if ((jit->native[id] = jit_compile(jit, prog, func))) {
+        jit->state[id] = JIT_STATE_COMPILED;
+        jit->compiled++;
+    } else {
+        jit->state[id] = JIT_STATE_FAILED;
+        jit->failed++;
+    }
+    return jit->native[id];
+}
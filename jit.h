@@ -0,0 +1,48 @@
+#ifndef GMQCC_JIT_HDR
+#define GMQCC_JIT_HDR
+#include "gmqcc.h"
+
+/*
+ * Native code for a function. It runs with the function already entered
+ * (locals backed up, parameters copied) and returns once it executed a
+ * RETURN or DONE, with a non-zero result when the program hit an error.
+ * `jumps` is the shared runaway loop counter of prog_exec.
+ */
+typedef int (*jit_native_t)(qc_program_t *prog, qcint_t *globals, qc_jumps_t *jumps);
+
+struct qc_jit_t {
+    std::vector<jit_native_t> native;  /* per function, nullptr until compiled */
+    std::vector<uint8_t>      state;   /* JIT_STATE_* per function           */
+    std::vector<void*>        maps;
+    std::vector<size_t>       sizes;
+    size_t                    compiled;
+    size_t                    failed;
+};
+
+enum {
+    JIT_STATE_PENDING,
+    JIT_STATE_COMPILED,
+    JIT_STATE_FAILED
+};
+
+/* jit.cpp */
+bool         jit_supported(void);
+qc_jit_t    *jit_create   (qc_program_t *prog);
+void         jit_destroy  (qc_jit_t *jit);
+jit_native_t jit_lookup   (qc_program_t *prog, prog_section_function_t *func);
+
+/*
+ * exec.cpp: the operations native code leaves to C. They take the index
+ * of the statement they execute and behave like the interpreter loop,
+ * returning non-zero where it would stop the program.
+ */
+int jit_rt_call    (qc_program_t *prog, qcint_t statement);
+int jit_rt_load    (qc_program_t *prog, qcint_t statement);
+int jit_rt_load_v  (qc_program_t *prog, qcint_t statement);
+int jit_rt_address (qc_program_t *prog, qcint_t statement);
+int jit_rt_storep  (qc_program_t *prog, qcint_t statement);
+int jit_rt_storep_v(qc_program_t *prog, qcint_t statement);
+int jit_rt_strings (qc_program_t *prog, qcint_t statement);
+int jit_rt_runaway (qc_program_t *prog, qcint_t statement);
+
+#endif
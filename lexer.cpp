@@ -4,29 +4,143 @@
 #include "gmqcc.h"
 #include "lexer.h"
 
+/*
+ * The scanners below look at 32 or 16 bytes at a time with AVX2 or SSE2,
+ * whichever the build targets. Define LEX_NO_SIMD to only build their
+ * scalar loops.
+ */
+#if defined(__AVX2__) && !defined(LEX_NO_SIMD)
+#   include <immintrin.h>
+#   define LEX_SIMD 32
+    typedef __m256i lex_vec_t;
+#   define lex_vec_load(p)   _mm256_loadu_si256((const __m256i*)(p))
+#   define lex_vec_set(c)    _mm256_set1_epi8(c)
+#   define lex_vec_eq(a, b)  _mm256_cmpeq_epi8((a), (b))
+#   define lex_vec_gt(a, b)  _mm256_cmpgt_epi8((a), (b))
+#   define lex_vec_or(a, b)  _mm256_or_si256((a), (b))
+#   define lex_vec_and(a, b) _mm256_and_si256((a), (b))
+#   define lex_vec_mask(a)   ((uint64_t)(uint32_t)_mm256_movemask_epi8(a))
+#elif (defined(__SSE2__) || defined(_M_X64)) && !defined(LEX_NO_SIMD)
+#   include <emmintrin.h>
+#   define LEX_SIMD 16
+    typedef __m128i lex_vec_t;
+#   define lex_vec_load(p)   _mm_loadu_si128((const __m128i*)(p))
+#   define lex_vec_set(c)    _mm_set1_epi8(c)
+#   define lex_vec_eq(a, b)  _mm_cmpeq_epi8((a), (b))
+#   define lex_vec_gt(a, b)  _mm_cmpgt_epi8((a), (b))
+#   define lex_vec_or(a, b)  _mm_or_si128((a), (b))
+#   define lex_vec_and(a, b) _mm_and_si128((a), (b))
+#   define lex_vec_mask(a)   ((uint64_t)(uint32_t)_mm_movemask_epi8(a))
+#else
+#   define LEX_SIMD 0
+#endif
+
+#if !defined(_WIN32)
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   define LEX_MMAP 1
+#else
+#   define LEX_MMAP 0
+#endif
+
 /*
  * List of Keywords
+ *
+ * Along with the typenames and _length they are found in a perfect hash
+ * of their length and first and last character, so an identifier costs
+ * one table lookup and at most one memcmp. The table is laid out at
+ * compile time; when a new keyword collides with another, the static
+ * assertion below fails and the factors of lex_keyword_hash need to be
+ * changed.
  */
+struct lex_keyword_t {
+    const char *name;
+    size_t      length;
+    int         ttype;
+    qc_type     type; /* of a typename */
+    bool        fg;   /* not a keyword with -std=qcc */
+};
 
-/* original */
-static const char *keywords_qc[] = {
-    "for", "do", "while",
-    "if", "else",
-    "local",
-    "return",
-    "const"
+#define LEX_KEYWORD(NAME, TTYPE, TYPE, FG) { NAME, sizeof(NAME) - 1, TTYPE, TYPE, FG }
+
+static constexpr lex_keyword_t lex_keywords[] = {
+    LEX_KEYWORD("void",     TOKEN_TYPENAME, TYPE_VOID,    false),
+    LEX_KEYWORD("int",      TOKEN_TYPENAME, TYPE_INTEGER, false),
+    LEX_KEYWORD("float",    TOKEN_TYPENAME, TYPE_FLOAT,   false),
+    LEX_KEYWORD("string",   TOKEN_TYPENAME, TYPE_STRING,  false),
+    LEX_KEYWORD("entity",   TOKEN_TYPENAME, TYPE_ENTITY,  false),
+    LEX_KEYWORD("vector",   TOKEN_TYPENAME, TYPE_VECTOR,  false),
+    LEX_KEYWORD("_length",  TOKEN_OPERATOR, TYPE_VOID,    false),
+
+    /* original */
+    LEX_KEYWORD("for",      TOKEN_KEYWORD,  TYPE_VOID,    false),
+    LEX_KEYWORD("do",       TOKEN_KEYWORD,  TYPE_VOID,    false),
+    LEX_KEYWORD("while",    TOKEN_KEYWORD,  TYPE_VOID,    false),
+    LEX_KEYWORD("if",       TOKEN_KEYWORD,  TYPE_VOID,    false),
+    LEX_KEYWORD("else",     TOKEN_KEYWORD,  TYPE_VOID,    false),
+    LEX_KEYWORD("local",    TOKEN_KEYWORD,  TYPE_VOID,    false),
+    LEX_KEYWORD("return",   TOKEN_KEYWORD,  TYPE_VOID,    false),
+    LEX_KEYWORD("const",    TOKEN_KEYWORD,  TYPE_VOID,    false),
+
+    /* For fte/gmgqcc */
+    LEX_KEYWORD("switch",   TOKEN_KEYWORD,  TYPE_VOID,    true),
+    LEX_KEYWORD("case",     TOKEN_KEYWORD,  TYPE_VOID,    true),
+    LEX_KEYWORD("default",  TOKEN_KEYWORD,  TYPE_VOID,    true),
+    LEX_KEYWORD("struct",   TOKEN_KEYWORD,  TYPE_VOID,    true),
+    LEX_KEYWORD("union",    TOKEN_KEYWORD,  TYPE_VOID,    true),
+    LEX_KEYWORD("break",    TOKEN_KEYWORD,  TYPE_VOID,    true),
+    LEX_KEYWORD("continue", TOKEN_KEYWORD,  TYPE_VOID,    true),
+    LEX_KEYWORD("typedef",  TOKEN_KEYWORD,  TYPE_VOID,    true),
+    LEX_KEYWORD("goto",     TOKEN_KEYWORD,  TYPE_VOID,    true),
+
+    LEX_KEYWORD("__builtin_debug_printtype", TOKEN_KEYWORD, TYPE_VOID, true)
 };
-/* For fte/gmgqcc */
-static const char *keywords_fg[] = {
-    "switch", "case", "default",
-    "struct", "union",
-    "break", "continue",
-    "typedef",
-    "goto",
-
-    "__builtin_debug_printtype"
+
+#define LEX_KEYWORD_SLOTS 64
+
+static constexpr size_t lex_keyword_hash(const char *v, size_t length)
+{
+    return (length * 2 + (unsigned char)v[0] * 10 + (unsigned char)v[length - 1] * 5) % LEX_KEYWORD_SLOTS;
+}
+
+/* the first keyword from the i-th on which hashes to slot, or -1 */
+static constexpr int lex_keyword_at(size_t slot, size_t i)
+{
+    return i == GMQCC_ARRAY_COUNT(lex_keywords) ? -1
+         : lex_keyword_hash(lex_keywords[i].name, lex_keywords[i].length) == slot ? (int)i
+         : lex_keyword_at(slot, i + 1);
+}
+
+/* every keyword from the i-th on is the first one in its slot */
+static constexpr bool lex_keywords_perfect(size_t i)
+{
+    return i == GMQCC_ARRAY_COUNT(lex_keywords) ||
+           (lex_keyword_at(lex_keyword_hash(lex_keywords[i].name, lex_keywords[i].length), 0) == (int)i &&
+            lex_keywords_perfect(i + 1));
+}
+
+static_assert(lex_keywords_perfect(0), "two keywords share a slot of lex_keyword_hash");
+
+#define LEX_SLOT4(N) lex_keyword_at(N, 0), lex_keyword_at(N + 1, 0), lex_keyword_at(N + 2, 0), lex_keyword_at(N + 3, 0)
+#define LEX_SLOT16(N) LEX_SLOT4(N), LEX_SLOT4(N + 4), LEX_SLOT4(N + 8), LEX_SLOT4(N + 12)
+
+static constexpr signed char lex_keyword_slots[LEX_KEYWORD_SLOTS] = {
+    LEX_SLOT16(0), LEX_SLOT16(16), LEX_SLOT16(32), LEX_SLOT16(48)
 };
 
+#undef LEX_SLOT16
+#undef LEX_SLOT4
+
+static const lex_keyword_t *lex_keyword(const char *v, size_t length)
+{
+    int kw = lex_keyword_slots[lex_keyword_hash(v, length)];
+    if (kw < 0 || lex_keywords[kw].length != length || memcmp(v, lex_keywords[kw].name, length))
+        return nullptr;
+    if (lex_keywords[kw].fg && OPTS_OPTION_U32(OPTION_STANDARD) == COMPILER_QCC)
+        return nullptr;
+    return &lex_keywords[kw];
+}
+
 /*
  * Lexer code
  */
@@ -74,11 +188,57 @@ static void lex_token_new(lex_file *lex)
 static void lex_ungetch(lex_file *lex, int ch);
 static int lex_getch(lex_file *lex);
 
+/*
+ * Brings the whole file into memory, mapping it where that is possible
+ * and reading it otherwise. The mapping outlives the file being closed.
+ */
+bool lex_file_load(lex_filedata *file, FILE *in)
+{
+    char   chunk[8192];
+    size_t read;
+
+    memset(file, 0, sizeof(*file));
+
+#if LEX_MMAP
+    struct stat st;
+    void       *map;
+
+    if (fstat(fileno(in), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fileno(in), 0);
+        if (map != MAP_FAILED) {
+            file->map    = map;
+            file->data   = (const char*)map;
+            file->length = st.st_size;
+            return true;
+        }
+    }
+#endif
+
+    while ((read = fread(chunk, 1, sizeof(chunk), in)))
+        memcpy(vec_add(file->buffer, read), chunk, read);
+    if (ferror(in)) {
+        vec_free(file->buffer);
+        return false;
+    }
+    file->data   = file->buffer;
+    file->length = vec_size(file->buffer);
+    return true;
+}
+
+void lex_file_free(lex_filedata *file)
+{
+#if LEX_MMAP
+    if (file->map)
+        munmap(file->map, file->length);
+#endif
+    vec_free(file->buffer);
+    memset(file, 0, sizeof(*file));
+}
+
 lex_file* lex_open(const char *file)
 {
     lex_file  *lex;
     FILE *in = fopen(file, "rb");
-    uint32_t   read;
 
     if (!in) {
         lexerror(nullptr, "open failed: '%s'\n", file);
@@ -94,25 +254,26 @@ lex_file* lex_open(const char *file)
 
     memset(lex, 0, sizeof(*lex));
 
-    lex->file    = in;
+    if (!lex_file_load(&lex->open_file, in)) {
+        fclose(in);
+        mem_d(lex);
+        lexerror(nullptr, "read failed: '%s'\n", file);
+        return nullptr;
+    }
+    fclose(in);
+
+    lex->open_string        = lex->open_file.data;
+    lex->open_string_length = lex->open_file.length;
+
     lex->name    = util_strdup(file);
     lex->line    = 1; /* we start counting at 1 */
     lex->column  = 0;
     lex->peekpos = 0;
     lex->eof     = false;
 
-    /* handle BOM */
-    if ((read = (lex_getch(lex) << 16) | (lex_getch(lex) << 8) | lex_getch(lex)) != 0xEFBBBF) {
-        lex_ungetch(lex, (read & 0x0000FF));
-        lex_ungetch(lex, (read & 0x00FF00) >> 8);
-        lex_ungetch(lex, (read & 0xFF0000) >> 16);
-    } else {
-        /*
-         * otherwise the lexer has advanced 3 bytes for the BOM, we need
-         * to set the column back to 0
-         */
-        lex->column = 0;
-    }
+    /* skip the BOM */
+    if (lex->open_string_length >= 3 && !memcmp(lex->open_string, "\xEF\xBB\xBF", 3))
+        lex->open_string_pos = 3;
 
     vec_push(lex_filenames, lex->name);
     return lex;
@@ -130,7 +291,6 @@ lex_file* lex_open_string(const char *str, size_t len, const char *name)
 
     memset(lex, 0, sizeof(*lex));
 
-    lex->file = nullptr;
     lex->open_string        = str;
     lex->open_string_length = len;
     lex->open_string_pos    = 0;
@@ -146,6 +306,42 @@ lex_file* lex_open_string(const char *str, size_t len, const char *name)
     return lex;
 }
 
+/*
+ * Reads the tokens the preprocessor made of a file, see lex_do_tokens.
+ * Where they come from another file, as #include and #pragma file would
+ * have it, the lexer takes that name.
+ */
+lex_file* lex_open_tokens(const lex_tokens *tokens, const char *name)
+{
+    lex_file *lex = lex_open_string("", 0, name);
+    if (lex)
+        lex->tokens = tokens;
+    return lex;
+}
+
+void lex_tokens_push(lex_tokens *tokens, int ttype, const char *spelling, size_t length,
+                     const lex_constval *constval, lex_ctx_t ctx)
+{
+    lex_token t;
+
+    t.ttype    = ttype;
+    t.spelling = tokens->spellings.size();
+    t.length   = length;
+    t.constval = *constval;
+    t.ctx      = ctx;
+    tokens->tokens.push_back(t);
+    tokens->spellings.insert(tokens->spellings.end(), spelling, spelling + length);
+    tokens->spellings.push_back(0);
+}
+
+/* a copy of a name which lives as long as the ones of the lexers do */
+const char *lex_filename(const char *name)
+{
+    char *copy = util_strdup(name);
+    vec_push(lex_filenames, copy);
+    return copy;
+}
+
 void lex_cleanup(void)
 {
     size_t i;
@@ -164,8 +360,7 @@ void lex_close(lex_file *lex)
     if (lex->modelname)
         vec_free(lex->modelname);
 
-    if (lex->file)
-        fclose(lex->file);
+    lex_file_free(&lex->open_file);
 
     vec_free(lex->tok.value);
 
@@ -175,19 +370,12 @@ void lex_close(lex_file *lex)
 
 
 
-static int lex_fgetc(lex_file *lex)
+static GMQCC_INLINE int lex_fgetc(lex_file *lex)
 {
-    if (lex->file) {
-        lex->column++;
-        return fgetc(lex->file);
-    }
-    if (lex->open_string) {
-        if (lex->open_string_pos >= lex->open_string_length)
-            return EOF;
-        lex->column++;
-        return lex->open_string[lex->open_string_pos++];
-    }
-    return EOF;
+    if (lex->open_string_pos >= lex->open_string_length)
+        return EOF;
+    lex->column++;
+    return (unsigned char)lex->open_string[lex->open_string_pos++];
 }
 
 /* Get or put-back data
@@ -319,6 +507,109 @@ static void lex_tokench(lex_file *lex, int ch)
     vec_push(lex->tok.value, ch);
 }
 
+/*
+ * Scanning in bulk. Where nothing was pushed back, the runs of characters
+ * lex_getch would hand out one by one without doing anything else with
+ * them are measured in the source and taken at once. Such runs hold no
+ * newline to count lines at and no character which could begin a
+ * trigraph or digraph, so taking them only moves the column, exactly as
+ * reading them one by one would.
+ */
+static GMQCC_INLINE size_t lex_ahead(lex_file *lex, const char **p)
+{
+    if (lex->peekpos)
+        return 0;
+    *p = lex->open_string + lex->open_string_pos;
+    return lex->open_string_length - lex->open_string_pos;
+}
+
+static GMQCC_INLINE void lex_take(lex_file *lex, size_t n)
+{
+    lex->open_string_pos += n;
+    lex->column          += n;
+}
+
+#if LEX_SIMD
+/* the bytes of v within lo and hi, which are ASCII */
+static GMQCC_INLINE lex_vec_t lex_vec_in(lex_vec_t v, char lo, char hi)
+{
+    return lex_vec_and(lex_vec_gt(v, lex_vec_set(lo - 1)), lex_vec_gt(lex_vec_set(hi + 1), v));
+}
+#endif
+
+/* the length of the identifier characters at p */
+static size_t lex_span_ident(const char *p, size_t n, bool allow_dot)
+{
+    size_t i = 0;
+#if LEX_SIMD
+    for (; i + LEX_SIMD <= n; i += LEX_SIMD) {
+        lex_vec_t v = lex_vec_load(p + i);
+        lex_vec_t m = lex_vec_in(lex_vec_or(v, lex_vec_set(0x20)), 'a', 'z');
+        uint64_t  stop;
+        m = lex_vec_or(m, lex_vec_in(v, '0', '9'));
+        m = lex_vec_or(m, lex_vec_eq(v, lex_vec_set('_')));
+        if (allow_dot)
+            m = lex_vec_or(m, lex_vec_eq(v, lex_vec_set('.')));
+        if ((stop = ~lex_vec_mask(m) & ((uint64_t(1) << LEX_SIMD) - 1)))
+            return i + prog_ctz64(stop);
+    }
+#endif
+    while (i < n && isident((unsigned char)p[i], allow_dot))
+        ++i;
+    return i;
+}
+
+/* the length of the whitespace at p up to a newline */
+static size_t lex_span_space(const char *p, size_t n)
+{
+    size_t i = 0;
+#if LEX_SIMD
+    for (; i + LEX_SIMD <= n; i += LEX_SIMD) {
+        lex_vec_t v = lex_vec_load(p + i);
+        lex_vec_t m = lex_vec_or(lex_vec_eq(v, lex_vec_set(' ')), lex_vec_eq(v, lex_vec_set('\t')));
+        uint64_t  stop;
+        m = lex_vec_or(m, lex_vec_in(v, '\v', '\r'));
+        if ((stop = ~lex_vec_mask(m) & ((uint64_t(1) << LEX_SIMD) - 1)))
+            return i + prog_ctz64(stop);
+    }
+#endif
+    while (i < n && p[i] != '\n' && util_isspace(p[i]))
+        ++i;
+    return i;
+}
+
+/*
+ * The length of the text at p up to a newline, a, b or a character
+ * lex_getch looks further at, for the bodies of comments and strings.
+ */
+static size_t lex_span_text(const char *p, size_t n, bool digraphs, char a, char b)
+{
+    size_t i = 0;
+#if LEX_SIMD
+    for (; i + LEX_SIMD <= n; i += LEX_SIMD) {
+        lex_vec_t v = lex_vec_load(p + i);
+        lex_vec_t m = lex_vec_or(lex_vec_eq(v, lex_vec_set('\n')), lex_vec_eq(v, lex_vec_set('?')));
+        uint64_t  stop;
+        m = lex_vec_or(m, lex_vec_or(lex_vec_eq(v, lex_vec_set(a)), lex_vec_eq(v, lex_vec_set(b))));
+        if (digraphs) {
+            m = lex_vec_or(m, lex_vec_eq(v, lex_vec_set('<')));
+            m = lex_vec_or(m, lex_vec_eq(v, lex_vec_set(':')));
+            m = lex_vec_or(m, lex_vec_eq(v, lex_vec_set('%')));
+        }
+        if ((stop = lex_vec_mask(m)))
+            return i + prog_ctz64(stop);
+    }
+#endif
+    for (; i < n; ++i) {
+        char ch = p[i];
+        if (ch == '\n' || ch == '?' || ch == a || ch == b)
+            break;
+        if (digraphs && (ch == '<' || ch == ':' || ch == '%'))
+            break;
+    }
+    return i;
+}
+
 /* Append a trailing null-byte */
 static void lex_endtoken(lex_file *lex)
 {
@@ -479,6 +770,8 @@ static int lex_skipwhite(lex_file *lex, bool hadwhite)
 {
     int ch = 0;
     bool haswhite = hadwhite;
+    const char *p;
+    size_t n;
 
     do
     {
@@ -503,6 +796,11 @@ static int lex_skipwhite(lex_file *lex, bool hadwhite)
                 haswhite = true;
                 lex_tokench(lex, ch);
             }
+            if ((n = lex_ahead(lex, &p)) && (n = lex_span_space(p, n))) {
+                if (lex->flags.preprocessing)
+                    vec_append(lex->tok.value, n, p);
+                lex_take(lex, n);
+            }
             ch = lex_getch(lex);
         }
 
@@ -522,6 +820,13 @@ static int lex_skipwhite(lex_file *lex, bool hadwhite)
                 while (ch != EOF && ch != '\n') {
                     if (lex->flags.preprocessing)
                         lex_tokench(lex, ' '); /* ch); */
+                    if ((n = lex_ahead(lex, &p)) &&
+                        (n = lex_span_text(p, n, !lex->flags.nodigraphs, '\n', '\n')))
+                    {
+                        if (lex->flags.preprocessing)
+                            memset(vec_add(lex->tok.value, n), ' ', n);
+                        lex_take(lex, n);
+                    }
                     ch = lex_getch(lex);
                 }
                 if (lex->flags.preprocessing) {
@@ -542,6 +847,13 @@ static int lex_skipwhite(lex_file *lex, bool hadwhite)
 
                 while (ch != EOF)
                 {
+                    if ((n = lex_ahead(lex, &p)) &&
+                        (n = lex_span_text(p, n, !lex->flags.nodigraphs, '*', '*')))
+                    {
+                        if (lex->flags.preprocessing)
+                            memset(vec_add(lex->tok.value, n), ' ', n);
+                        lex_take(lex, n);
+                    }
                     ch = lex_getch(lex);
                     if (ch == '*') {
                         ch = lex_getch(lex);
@@ -579,11 +891,94 @@ static int lex_skipwhite(lex_file *lex, bool hadwhite)
     return ch;
 }
 
+/*
+ * Reading the preprocessor's tokens, see lex_open_tokens. The position is
+ * a token and how much of it was taken already, which is only ever some
+ * of a token lex_do_tokens splits in two.
+ */
+static GMQCC_INLINE const lex_token *lex_tokens_at(const lex_file *lex, size_t ahead)
+{
+    if (lex->tokens_pos + ahead >= lex->tokens->tokens.size())
+        return nullptr;
+    return &lex->tokens->tokens[lex->tokens_pos + ahead];
+}
+
+static GMQCC_INLINE const char *lex_tokens_spelling(const lex_file *lex, const lex_token *t)
+{
+    return &lex->tokens->spellings[t->spelling];
+}
+
+/* whether a token ends a line, whitespace does when a comment had a newline */
+static bool lex_tokens_eol(const lex_file *lex, const lex_token *t)
+{
+    return t->ttype == TOKEN_EOL ||
+           (t->ttype == TOKEN_WHITE && memchr(lex_tokens_spelling(lex, t), '\n', t->length));
+}
+
+/* the column moves past the characters taken, as lex_getch moves it */
+static void lex_tokens_take(lex_file *lex, size_t n)
+{
+    const lex_token *t = lex_tokens_at(lex, 0);
+    const char      *s = lex_tokens_spelling(lex, t);
+    size_t           i;
+
+    lex->column = t->ctx.column + lex->tokens_taken + n;
+    for (i = lex->tokens_taken + n; i-- > lex->tokens_taken; ) {
+        if (s[i] == '\n') {
+            lex->column = lex->tokens_taken + n - i - 1;
+            break;
+        }
+    }
+
+    lex->tokens_taken += n;
+    if (lex->tokens_taken == t->length) {
+        lex->tokens_pos++;
+        lex->tokens_taken = 0;
+    }
+}
+
+static GMQCC_INLINE void lex_tokens_next(lex_file *lex)
+{
+    lex_tokens_take(lex, lex_tokens_at(lex, 0)->length - lex->tokens_taken);
+}
+
+/* skips whitespace up to the end of the line, which is left */
+static const lex_token *lex_tokens_skipspace(lex_file *lex)
+{
+    const lex_token *t;
+    while ((t = lex_tokens_at(lex, 0)) && t->ttype == TOKEN_WHITE && !lex_tokens_eol(lex, t))
+        lex_tokens_next(lex);
+    return t;
+}
+
+/* an ident with dots, which the preprocessor may have made several tokens */
+static void lex_tokens_ident(lex_file *lex)
+{
+    const lex_token *t;
+    const char      *s;
+    size_t           i;
+
+    while ((t = lex_tokens_at(lex, 0)) && !lex->tokens_taken) {
+        s = lex_tokens_spelling(lex, t);
+        for (i = 0; i < t->length && isident(s[i], true); ++i) {}
+        if (!t->length || i < t->length)
+            break;
+        vec_append(lex->tok.value, t->length, s);
+        lex_tokens_next(lex);
+    }
+}
+
 /* Get a token */
 static bool GMQCC_WARN lex_finish_ident(lex_file *lex, bool allow_dot)
 {
     int ch;
+    const char *p;
+    size_t n;
 
+    if ((n = lex_ahead(lex, &p)) && (n = lex_span_ident(p, n, allow_dot))) {
+        vec_append(lex->tok.value, n, p);
+        lex_take(lex, n);
+    }
     ch = lex_getch(lex);
     while (ch != EOF && isident(ch, allow_dot))
     {
@@ -604,6 +999,22 @@ static int lex_parse_frame(lex_file *lex)
 
     lex_token_new(lex);
 
+    if (lex->tokens) {
+        const lex_token *t = lex_tokens_skipspace(lex);
+        if (t && lex_tokens_eol(lex, t)) {
+            lex_tokens_next(lex);
+            return 1;
+        }
+        ch = t ? lex_tokens_spelling(lex, t)[lex->tokens_taken] : EOF;
+        if (!isident_start(ch)) {
+            lexerror(lex, "invalid framename, must start with one of a-z, or _, got %c", ch);
+            return -1;
+        }
+        lex_tokens_ident(lex);
+        lex_endtoken(lex);
+        return 0;
+    }
+
     ch = lex_getch(lex);
     while (ch != EOF && ch != '\n' && util_isspace(ch))
         ch = lex_getch(lex);
@@ -666,9 +1077,15 @@ static int GMQCC_WARN lex_finish_string(lex_file *lex, int quote)
     bool oct;
     char u8buf[8]; /* way more than enough */
     int  u8len, uc;
+    const char *p;
+    size_t n;
 
     while (ch != EOF)
     {
+        if ((n = lex_ahead(lex, &p)) && (n = lex_span_text(p, n, !lex->flags.nodigraphs, quote, '\\'))) {
+            vec_append(lex->tok.value, n, p);
+            lex_take(lex, n);
+        }
         ch = lex_getch(lex);
         if (ch == quote)
             return TOKEN_STRINGCONST;
@@ -921,6 +1338,243 @@ static int GMQCC_WARN lex_finish_digit(lex_file *lex, int lastch)
     return lex->tok.ttype;
 }
 
+/* the tokens lex_do and lex_do_tokens would rather not return */
+static GMQCC_INLINE int lex_again(lex_file *lex)
+{
+    return lex->tokens ? lex_do_tokens(lex) : lex_do(lex);
+}
+
+/* skip line (fteqcc does it too) */
+static void lex_skipline(lex_file *lex)
+{
+    const lex_token *t;
+    int ch;
+
+    if (lex->tokens) {
+        while ((t = lex_tokens_at(lex, 0))) {
+            lex_tokens_next(lex);
+            if (lex_tokens_eol(lex, t))
+                break;
+        }
+        return;
+    }
+
+    ch = lex_getch(lex);
+    while (ch != EOF && ch != '\n')
+        ch = lex_getch(lex);
+}
+
+/* the name after a $ */
+static bool lex_frame_command(lex_file *lex)
+{
+    const lex_token *t;
+    int ch;
+
+    if (lex->tokens) {
+        t = lex_tokens_at(lex, 0);
+        if (!t || !isident_start(lex_tokens_spelling(lex, t)[lex->tokens_taken]))
+            return false;
+        lex_tokens_ident(lex);
+        lex_endtoken(lex);
+        return true;
+    }
+
+    ch = lex_getch(lex);
+    if (!isident_start(ch))
+        return false;
+    lex_tokench(lex, ch);
+    if (!lex_finish_ident(lex, true))
+        return false;
+    lex_endtoken(lex);
+    return true;
+}
+
+/* the number after $framevalue, in a new token */
+static bool lex_frame_value(lex_file *lex)
+{
+    const lex_token *t;
+    int ch;
+
+    if (lex->tokens) {
+        t = lex_tokens_skipspace(lex);
+        if (!t || !util_isdigit(lex_tokens_spelling(lex, t)[lex->tokens_taken]))
+            return false;
+        lex_token_new(lex);
+        vec_append(lex->tok.value, t->length, lex_tokens_spelling(lex, t));
+        lex->tok.constval = t->constval;
+        lex->tok.ttype    = t->ttype;
+        lex_tokens_next(lex);
+        lex_endtoken(lex);
+        return true;
+    }
+
+    ch = lex_getch(lex);
+    while (ch != EOF && util_isspace(ch) && ch != '\n')
+        ch = lex_getch(lex);
+
+    if (!util_isdigit(ch))
+        return false;
+
+    lex_token_new(lex);
+    lex->tok.ttype = lex_finish_digit(lex, ch);
+    lex_endtoken(lex);
+    return true;
+}
+
+/* modelgen / spiritgen commands, after the $ */
+static int lex_do_frame(lex_file *lex)
+{
+    const char *v;
+    size_t frame;
+
+    if (!lex_frame_command(lex)) {
+        lexerror(lex, "hanging '$' modelgen/spritegen command line");
+        return lex_again(lex);
+    }
+    /* skip the known commands */
+    v = lex->tok.value;
+
+    if (!strcmp(v, "frame") || !strcmp(v, "framesave"))
+    {
+        /* frame/framesave command works like an enum
+         * similar to fteqcc we handle this in the lexer.
+         * The reason for this is that it is sensitive to newlines,
+         * which the parser is unaware of
+         */
+        if (!lex_finish_frames(lex))
+             return (lex->tok.ttype = TOKEN_ERROR);
+        return lex_again(lex);
+    }
+
+    if (!strcmp(v, "framevalue"))
+    {
+        if (!lex_frame_value(lex) || lex->tok.ttype != TOKEN_INTCONST) {
+            lexerror(lex, "$framevalue requires an integer parameter");
+            return lex_again(lex);
+        }
+        lex->framevalue = lex->tok.constval.i;
+        return lex_again(lex);
+    }
+
+    if (!strcmp(v, "framerestore"))
+    {
+        int rc;
+
+        lex_token_new(lex);
+
+        rc = lex_parse_frame(lex);
+
+        if (rc > 0) {
+            lexerror(lex, "$framerestore requires a framename parameter");
+            return lex_again(lex);
+        }
+        if (rc < 0)
+            return (lex->tok.ttype = TOKEN_FATAL);
+
+        v = lex->tok.value;
+        for (frame = 0; frame < vec_size(lex->frames); ++frame) {
+            if (!strcmp(v, lex->frames[frame].name)) {
+                lex->framevalue = lex->frames[frame].value;
+                return lex_again(lex);
+            }
+        }
+        lexerror(lex, "unknown framename `%s`", v);
+        return lex_again(lex);
+    }
+
+    if (!strcmp(v, "modelname"))
+    {
+        int rc;
+
+        lex_token_new(lex);
+
+        rc = lex_parse_frame(lex);
+
+        if (rc > 0) {
+            lexerror(lex, "$modelname requires a parameter");
+            return lex_again(lex);
+        }
+        if (rc < 0)
+            return (lex->tok.ttype = TOKEN_FATAL);
+
+        if (lex->modelname) {
+            frame_macro m;
+            m.value = lex->framevalue;
+            m.name = lex->modelname;
+            lex->modelname = nullptr;
+            vec_push(lex->frames, m);
+        }
+        lex->modelname = lex->tok.value;
+        lex->tok.value = nullptr;
+        return lex_again(lex);
+    }
+
+    if (!strcmp(v, "flush"))
+    {
+        size_t fi;
+        for (fi = 0; fi < vec_size(lex->frames); ++fi)
+            mem_d(lex->frames[fi].name);
+        vec_free(lex->frames);
+        lex_skipline(lex);
+        return lex_again(lex);
+    }
+
+    if (!strcmp(v, "cd") ||
+        !strcmp(v, "origin") ||
+        !strcmp(v, "base") ||
+        !strcmp(v, "flags") ||
+        !strcmp(v, "scale") ||
+        !strcmp(v, "skin"))
+    {
+        lex_skipline(lex);
+        return lex_again(lex);
+    }
+
+    for (frame = 0; frame < vec_size(lex->frames); ++frame) {
+        if (!strcmp(v, lex->frames[frame].name)) {
+            lex->tok.constval.i = lex->frames[frame].value;
+            return (lex->tok.ttype = TOKEN_INTCONST);
+        }
+    }
+
+    lexerror(lex, "invalid frame macro");
+    return lex_again(lex);
+}
+
+/* the rest of a 'character' constant, whose text is the token */
+static int lex_finish_charconst(lex_file *lex)
+{
+    lex->tok.ttype = TOKEN_CHARCONST;
+
+    /* It's a vector if we can successfully scan 3 floats */
+    if (util_sscanf(lex->tok.value, " %f %f %f ",
+               &lex->tok.constval.v.x, &lex->tok.constval.v.y, &lex->tok.constval.v.z) == 3)
+
+    {
+         lex->tok.ttype = TOKEN_VECTORCONST;
+    }
+    else
+    {
+        if (!lex->flags.preprocessing && strlen(lex->tok.value) > 1) {
+            utf8ch_t u8char;
+            /* check for a valid utf8 character */
+            if (!OPTS_FLAG(UTF8) || !utf8_to(&u8char, (const unsigned char *)lex->tok.value, 8)) {
+                if (lexwarn(lex, WARN_MULTIBYTE_CHARACTER,
+                            ( OPTS_FLAG(UTF8) ? "invalid multibyte character sequence `%s`"
+                                              : "multibyte character: `%s`" ),
+                            lex->tok.value))
+                    return (lex->tok.ttype = TOKEN_ERROR);
+            }
+            else
+                lex->tok.constval.i = u8char;
+        }
+        else
+            lex->tok.constval.i = lex->tok.value[0];
+    }
+
+    return lex->tok.ttype;
+}
+
 int lex_do(lex_file *lex)
 {
     int ch, nextch, thirdch;
@@ -963,146 +1617,8 @@ int lex_do(lex_file *lex)
     }
 
     /* modelgen / spiritgen commands */
-    if (ch == '$' && !lex->flags.preprocessing) {
-        const char *v;
-        size_t frame;
-
-        ch = lex_getch(lex);
-        if (!isident_start(ch)) {
-            lexerror(lex, "hanging '$' modelgen/spritegen command line");
-            return lex_do(lex);
-        }
-        lex_tokench(lex, ch);
-        if (!lex_finish_ident(lex, true))
-            return (lex->tok.ttype = TOKEN_ERROR);
-        lex_endtoken(lex);
-        /* skip the known commands */
-        v = lex->tok.value;
-
-        if (!strcmp(v, "frame") || !strcmp(v, "framesave"))
-        {
-            /* frame/framesave command works like an enum
-             * similar to fteqcc we handle this in the lexer.
-             * The reason for this is that it is sensitive to newlines,
-             * which the parser is unaware of
-             */
-            if (!lex_finish_frames(lex))
-                 return (lex->tok.ttype = TOKEN_ERROR);
-            return lex_do(lex);
-        }
-
-        if (!strcmp(v, "framevalue"))
-        {
-            ch = lex_getch(lex);
-            while (ch != EOF && util_isspace(ch) && ch != '\n')
-                ch = lex_getch(lex);
-
-            if (!util_isdigit(ch)) {
-                lexerror(lex, "$framevalue requires an integer parameter");
-                return lex_do(lex);
-            }
-
-            lex_token_new(lex);
-            lex->tok.ttype = lex_finish_digit(lex, ch);
-            lex_endtoken(lex);
-            if (lex->tok.ttype != TOKEN_INTCONST) {
-                lexerror(lex, "$framevalue requires an integer parameter");
-                return lex_do(lex);
-            }
-            lex->framevalue = lex->tok.constval.i;
-            return lex_do(lex);
-        }
-
-        if (!strcmp(v, "framerestore"))
-        {
-            int rc;
-
-            lex_token_new(lex);
-
-            rc = lex_parse_frame(lex);
-
-            if (rc > 0) {
-                lexerror(lex, "$framerestore requires a framename parameter");
-                return lex_do(lex);
-            }
-            if (rc < 0)
-                return (lex->tok.ttype = TOKEN_FATAL);
-
-            v = lex->tok.value;
-            for (frame = 0; frame < vec_size(lex->frames); ++frame) {
-                if (!strcmp(v, lex->frames[frame].name)) {
-                    lex->framevalue = lex->frames[frame].value;
-                    return lex_do(lex);
-                }
-            }
-            lexerror(lex, "unknown framename `%s`", v);
-            return lex_do(lex);
-        }
-
-        if (!strcmp(v, "modelname"))
-        {
-            int rc;
-
-            lex_token_new(lex);
-
-            rc = lex_parse_frame(lex);
-
-            if (rc > 0) {
-                lexerror(lex, "$modelname requires a parameter");
-                return lex_do(lex);
-            }
-            if (rc < 0)
-                return (lex->tok.ttype = TOKEN_FATAL);
-
-            if (lex->modelname) {
-                frame_macro m;
-                m.value = lex->framevalue;
-                m.name = lex->modelname;
-                lex->modelname = nullptr;
-                vec_push(lex->frames, m);
-            }
-            lex->modelname = lex->tok.value;
-            lex->tok.value = nullptr;
-            return lex_do(lex);
-        }
-
-        if (!strcmp(v, "flush"))
-        {
-            size_t fi;
-            for (fi = 0; fi < vec_size(lex->frames); ++fi)
-                mem_d(lex->frames[fi].name);
-            vec_free(lex->frames);
-            /* skip line (fteqcc does it too) */
-            ch = lex_getch(lex);
-            while (ch != EOF && ch != '\n')
-                ch = lex_getch(lex);
-            return lex_do(lex);
-        }
-
-        if (!strcmp(v, "cd") ||
-            !strcmp(v, "origin") ||
-            !strcmp(v, "base") ||
-            !strcmp(v, "flags") ||
-            !strcmp(v, "scale") ||
-            !strcmp(v, "skin"))
-        {
-            /* skip line */
-            ch = lex_getch(lex);
-            while (ch != EOF && ch != '\n')
-                ch = lex_getch(lex);
-            return lex_do(lex);
-        }
-
-        for (frame = 0; frame < vec_size(lex->frames); ++frame) {
-            if (!strcmp(v, lex->frames[frame].name)) {
-                lex->tok.constval.i = lex->frames[frame].value;
-                return (lex->tok.ttype = TOKEN_INTCONST);
-            }
-        }
-
-        lexerror(lex, "invalid frame macro");
-        return lex_do(lex);
-    }
+    if (ch == '$' && !lex->flags.preprocessing)
+        return lex_do_frame(lex);
 
     /* single-character tokens */
     switch (ch)
@@ -1304,7 +1820,7 @@ int lex_do(lex_file *lex)
 
     if (isident_start(ch))
     {
-        const char *v;
+        const lex_keyword_t *kw;
 
         lex_tokench(lex, ch);
         if (!lex_finish_ident(lex, false)) {
@@ -1314,39 +1830,10 @@ int lex_do(lex_file *lex)
         lex_endtoken(lex);
         lex->tok.ttype = TOKEN_IDENT;
 
-        v = lex->tok.value;
-        if (!strcmp(v, "void")) {
-            lex->tok.ttype = TOKEN_TYPENAME;
-            lex->tok.constval.t = TYPE_VOID;
-        } else if (!strcmp(v, "int")) {
-            lex->tok.ttype = TOKEN_TYPENAME;
-            lex->tok.constval.t = TYPE_INTEGER;
-        } else if (!strcmp(v, "float")) {
-            lex->tok.ttype = TOKEN_TYPENAME;
-            lex->tok.constval.t = TYPE_FLOAT;
-        } else if (!strcmp(v, "string")) {
-            lex->tok.ttype = TOKEN_TYPENAME;
-            lex->tok.constval.t = TYPE_STRING;
-        } else if (!strcmp(v, "entity")) {
-            lex->tok.ttype = TOKEN_TYPENAME;
-            lex->tok.constval.t = TYPE_ENTITY;
-        } else if (!strcmp(v, "vector")) {
-            lex->tok.ttype = TOKEN_TYPENAME;
-            lex->tok.constval.t = TYPE_VECTOR;
-        } else if (!strcmp(v, "_length")) {
-            lex->tok.ttype = TOKEN_OPERATOR;
-        } else {
-            size_t kw;
-            for (kw = 0; kw < GMQCC_ARRAY_COUNT(keywords_qc); ++kw) {
-                if (!strcmp(v, keywords_qc[kw]))
-                    return (lex->tok.ttype = TOKEN_KEYWORD);
-            }
-            if (OPTS_OPTION_U32(OPTION_STANDARD) != COMPILER_QCC) {
-                for (kw = 0; kw < GMQCC_ARRAY_COUNT(keywords_fg); ++kw) {
-                    if (!strcmp(v, keywords_fg[kw]))
-                        return (lex->tok.ttype = TOKEN_KEYWORD);
-                }
-            }
+        if ((kw = lex_keyword(lex->tok.value, vec_size(lex->tok.value)))) {
+            lex->tok.ttype = kw->ttype;
+            if (kw->ttype == TOKEN_TYPENAME)
+                lex->tok.constval.t = kw->type;
         }
 
         return lex->tok.ttype;
@@ -1389,36 +1876,7 @@ int lex_do(lex_file *lex)
         if (lex->flags.preprocessing)
             lex_tokench(lex, ch);
         lex_endtoken(lex);
-
-        lex->tok.ttype = TOKEN_CHARCONST;
-
-        /* It's a vector if we can successfully scan 3 floats */
-        if (util_sscanf(lex->tok.value, " %f %f %f ",
-                   &lex->tok.constval.v.x, &lex->tok.constval.v.y, &lex->tok.constval.v.z) == 3)
-
-        {
-             lex->tok.ttype = TOKEN_VECTORCONST;
-        }
-        else
-        {
-            if (!lex->flags.preprocessing && strlen(lex->tok.value) > 1) {
-                utf8ch_t u8char;
-                /* check for a valid utf8 character */
-                if (!OPTS_FLAG(UTF8) || !utf8_to(&u8char, (const unsigned char *)lex->tok.value, 8)) {
-                    if (lexwarn(lex, WARN_MULTIBYTE_CHARACTER,
-                                ( OPTS_FLAG(UTF8) ? "invalid multibyte character sequence `%s`"
-                                                  : "multibyte character: `%s`" ),
-                                lex->tok.value))
-                        return (lex->tok.ttype = TOKEN_ERROR);
-                }
-                else
-                    lex->tok.constval.i = u8char;
-            }
-            else
-                lex->tok.constval.i = lex->tok.value[0];
-        }
-
-        return lex->tok.ttype;
+        return lex_finish_charconst(lex);
     }
 
     if (util_isdigit(ch))
@@ -1437,3 +1895,238 @@ int lex_do(lex_file *lex)
     lexerror(lex, "unknown token: `%c`", ch);
     return (lex->tok.ttype = TOKEN_ERROR);
 }
+
+/*
+ * The characters the preprocessor keeps apart where there are no operators
+ * are joined as lex_do joins them, one character token after another.
+ */
+static int lex_tokens_ch(const lex_file *lex, size_t ahead)
+{
+    const lex_token *t = lex_tokens_at(lex, ahead);
+    return (t && t->length == 1 && t->ttype < TOKEN_START) ? lex_tokens_spelling(lex, t)[0] : EOF;
+}
+
+static int lex_tokens_operator(lex_file *lex)
+{
+    int    ch     = lex_tokens_ch(lex, 0);
+    int    nextch = lex_tokens_ch(lex, 1);
+    size_t n      = 1;
+
+    if (ch == '*' || ch == '/') { /* *=, /= */
+        if (nextch == '=' || nextch == '*')
+            n = 2;
+    }
+    else if ((nextch == '=' && ch != '<') || (nextch == '<' && ch == '>'))
+        n = 2;
+    else if (nextch == ch && ch != '!')
+        n = (lex_tokens_ch(lex, 2) == '=') ? 3 : 2;
+    else if (ch == '<' && nextch == '=')
+        n = (lex_tokens_ch(lex, 2) == '>') ? 3 : 2;
+    else if (ch == '&' && nextch == '~' && lex_tokens_ch(lex, 2) == '=')
+        n = 3;
+
+    while (n--) {
+        lex_tokench(lex, lex_tokens_ch(lex, 0));
+        lex_tokens_next(lex);
+    }
+    lex_endtoken(lex);
+    return (lex->tok.ttype = TOKEN_OPERATOR);
+}
+
+/* a string or character constant is unescaped from its spelling */
+static int lex_tokens_unquote(lex_file *lex, int quote)
+{
+    const lex_token *t = lex_tokens_at(lex, 0);
+    int              ttype;
+
+    lex->open_string        = lex_tokens_spelling(lex, t) + 1;
+    lex->open_string_length = t->length - 1;
+    lex->open_string_pos    = 0;
+    lex->peekpos            = 0;
+    lex->line               = t->ctx.line;
+    lex->column             = t->ctx.column + 1;
+
+    ttype = lex_finish_string(lex, quote);
+    lex_tokens_next(lex);
+    return ttype;
+}
+
+/* the backslash and newline of a linemerge, as many tokens as they are */
+static size_t lex_tokens_linemerge(const lex_file *lex)
+{
+    const lex_token *t = lex_tokens_at(lex, 1);
+    size_t           n = 2;
+
+    if (t && t->ttype == TOKEN_WHITE && t->length == 1 && lex_tokens_spelling(lex, t)[0] == '\r')
+        t = lex_tokens_at(lex, n++);
+    return (t && t->ttype == TOKEN_EOL) ? n : 0;
+}
+
+/*
+ * lex_do for the tokens of the preprocessor. Those it would lex otherwise
+ * in parsing are made over here: operators are joined, a number loses its
+ * sign, ]] is two brackets, strings are unescaped and joined and $ commands
+ * are read off the tokens of their line.
+ */
+int lex_do_tokens(lex_file *lex)
+{
+    const lex_token *t;
+    const char      *s;
+    size_t           n;
+    bool             white = false;
+
+    lex_token_new(lex);
+
+    while ((t = lex_tokens_at(lex, 0))) {
+        if (t->ttype == TOKEN_WHITE && lex->flags.preprocessing) {
+            vec_append(lex->tok.value, t->length, lex_tokens_spelling(lex, t));
+            lex_tokens_next(lex);
+        }
+        else if (t->ttype == '\\' && lex->flags.preprocessing && lex->flags.mergelines &&
+                 (n = lex_tokens_linemerge(lex)))
+        {
+            /* we reached a linemerge */
+            lex_tokench(lex, '\n');
+            while (n--)
+                lex_tokens_next(lex);
+        }
+        else if (t->ttype == TOKEN_EOL && lex->flags.preprocessing && !white) {
+            lex_tokens_next(lex);
+            lex_endtoken(lex);
+            return (lex->tok.ttype = TOKEN_EOL);
+        }
+        else if ((t->ttype == TOKEN_WHITE || t->ttype == TOKEN_EOL) && !lex->flags.preprocessing)
+            lex_tokens_next(lex);
+        else
+            break;
+        white = true;
+    }
+
+    if (lex->flags.preprocessing && white) {
+        lex_endtoken(lex);
+        return (lex->tok.ttype = TOKEN_WHITE);
+    }
+
+    /* a #pragma file in the text this was */
+    if (t && t->ctx.file != lex->name) {
+        lex->name       = (char*)t->ctx.file;
+        lex->framevalue = 0;
+    }
+
+    if (t)
+        lex->sline = t->ctx.line;
+    lex->line         = lex->sline;
+    lex->tok.ctx.line = lex->sline;
+    lex->tok.ctx.file = lex->name;
+
+    if (lex->eof)
+        return (lex->tok.ttype = TOKEN_FATAL);
+
+    if (!t) {
+        lex->eof = true;
+        return (lex->tok.ttype = TOKEN_EOF);
+    }
+
+    s = lex_tokens_spelling(lex, t) + lex->tokens_taken;
+    n = t->length - lex->tokens_taken;
+
+    if (!lex->flags.preprocessing) {
+        switch (t->ttype) {
+            case '$':
+                lex_tokens_next(lex);
+                return lex_do_frame(lex);
+
+            case '[':
+            case '(':
+            case ':':
+            case '?':
+            case '.':
+            case ',':
+                if (lex->flags.noops)
+                    break;
+                lex_tokench(lex, *s);
+                lex_tokens_next(lex);
+                lex_endtoken(lex);
+                return (lex->tok.ttype = TOKEN_OPERATOR);
+
+            case '*':
+            case '/':
+            case '<':
+            case '>':
+            case '=':
+            case '&':
+            case '|':
+            case '^':
+            case '~':
+            case '!':
+                if (lex->flags.noops)
+                    break;
+                return lex_tokens_operator(lex);
+
+            case TOKEN_ATTRIBUTE_CLOSE:
+                if (lex->flags.noops)
+                    break;
+                lex_tokench(lex, ']');
+                lex_tokens_take(lex, 1);
+                lex_endtoken(lex);
+                return (lex->tok.ttype = ']');
+
+            case TOKEN_INTCONST:
+            case TOKEN_FLOATCONST:
+                if (*s != '-')
+                    break;
+                lex_tokench(lex, '-');
+                lex_tokens_take(lex, 1);
+                lex_endtoken(lex);
+                return (lex->tok.ttype = TOKEN_OPERATOR);
+
+            case TOKEN_STRINGCONST:
+                lex->flags.nodigraphs = true;
+                lex->tok.ttype = lex_tokens_unquote(lex, '"');
+                while (lex->tok.ttype == TOKEN_STRINGCONST)
+                {
+                    /* Allow c style "string" "continuation" */
+                    while ((t = lex_tokens_at(lex, 0)) && (t->ttype == TOKEN_WHITE || t->ttype == TOKEN_EOL))
+                        lex_tokens_next(lex);
+                    if (!t || t->ttype != TOKEN_STRINGCONST)
+                        break;
+                    lex->tok.ttype = lex_tokens_unquote(lex, '"');
+                }
+                lex->flags.nodigraphs = false;
+                lex_endtoken(lex);
+                return lex->tok.ttype;
+
+            case TOKEN_CHARCONST:
+                lex->tok.ttype = lex_tokens_unquote(lex, '\'');
+                lex_endtoken(lex);
+                return lex_finish_charconst(lex);
+
+            case ')':
+            case ';':
+            case '{':
+            case '}':
+            case ']':
+            case '#':
+                break;
+
+            default:
+                if (t->ttype >= TOKEN_START)
+                    break;
+                lex_tokens_next(lex);
+                lexerror(lex, "unknown token: `%c`", t->ttype);
+                return (lex->tok.ttype = TOKEN_ERROR);
+        }
+    }
+
+    vec_append(lex->tok.value, n, s);
+    lex->tok.constval = t->constval;
+    lex->tok.ttype    = t->ttype;
+    /* numbers are read again without the sign the preprocessor gives them */
+    if (!lex->flags.preprocessing && t->ttype == TOKEN_FLOATCONST)
+        lex->tok.constval.f = strtod(s, nullptr);
+    else if (!lex->flags.preprocessing && t->ttype == TOKEN_INTCONST)
+        lex->tok.constval.i = strtol(s, nullptr, (s[0] != '0') ? 10 : (s[1] == 'x') ? 16 : 8);
+    lex_tokens_next(lex);
+    lex_endtoken(lex);
+    return lex->tok.ttype;
+}
@@ -2,15 +2,17 @@
 #define GMQCC_LEXER_HDR
 #include "gmqcc.h"
 
+union lex_constval {
+    vec3_t v;
+    int i;
+    qcfloat_t f;
+    qc_type t; /* type */
+};
+
 struct token {
     int ttype;
     char *value;
-    union {
-        vec3_t v;
-        int i;
-        qcfloat_t f;
-        qc_type t; /* type */
-    } constval;
+    lex_constval constval;
     lex_ctx_t ctx;
 };
 
@@ -66,11 +68,46 @@ struct frame_macro {
     int value;
 };
 
+/*
+ * The whole contents of a file, mapped where that is possible and read
+ * otherwise, see lex_file_load.
+ */
+struct lex_filedata {
+    const char *data;
+    size_t      length;
+    char       *buffer; /* vector, when it was read */
+    void       *map;    /* when it was mapped */
+};
+
+/*
+ * The preprocessor's output as tokens, each where its source put it. They
+ * are lexed in preprocessing mode: whitespace and newlines are tokens, the
+ * characters which can begin a longer operator are on their own and
+ * strings keep their quotes and escapes. lex_do_tokens makes the parser's
+ * tokens of them. The spellings put together are what -E writes.
+ */
+struct lex_token {
+    int          ttype;
+    size_t       spelling; /* its offset in lex_tokens::spellings */
+    size_t       length;
+    lex_constval constval;
+    lex_ctx_t    ctx;
+};
+
+struct lex_tokens {
+    std::vector<lex_token> tokens;
+    std::vector<char>      spellings; /* each followed by a 0 */
+};
+
 struct lex_file {
-    FILE  *file;
-    const char *open_string;
-    size_t      open_string_length;
-    size_t      open_string_pos;
+    /*
+     * Files are mapped or read whole when opened, so strings and files
+     * are both read through open_string.
+     */
+    const char  *open_string;
+    size_t       open_string_length;
+    size_t       open_string_pos;
+    lex_filedata open_file;
 
     char   *name;
     size_t  line;
@@ -96,12 +133,24 @@ struct lex_file {
     char *modelname;
 
     size_t push_line;
+
+    /* the preprocessed tokens read instead of open_string, see lex_open_tokens */
+    const lex_tokens *tokens;
+    size_t            tokens_pos;   /* the next one */
+    size_t            tokens_taken; /* of its characters, when it is split in two */
 };
 
+bool      lex_file_load(lex_filedata *file, FILE *in);
+void      lex_file_free(lex_filedata *file);
 lex_file* lex_open (const char *file);
 lex_file* lex_open_string(const char *str, size_t len, const char *name);
+lex_file* lex_open_tokens(const lex_tokens *tokens, const char *name);
 void      lex_close(lex_file   *lex);
 int       lex_do   (lex_file   *lex);
+int       lex_do_tokens(lex_file *lex);
+void      lex_tokens_push(lex_tokens *tokens, int ttype, const char *spelling, size_t length,
+                          const lex_constval *constval, lex_ctx_t ctx);
+const char *lex_filename(const char *name);
 void      lex_cleanup(void);
 
 /* Parser
@@ -135,7 +184,52 @@ struct oper_info {
 #define opid2(a,b)   (((uint8_t)a<<8) |(uint8_t)b)
 #define opid3(a,b,c) (((uint8_t)a<<16)|((uint8_t)b<<8)|(uint8_t)c)
 
-static const oper_info c_operators[] = {
+/*
+ * Operators are looked up by a perfect hash of their first three
+ * characters and length, see parser_find_operator. No two operators of a
+ * table may share a slot, which each table asserts below.
+ */
+#define OPER_SLOTS 128
+
+static constexpr uint32_t oper_key(const char *op, size_t length) {
+    return (uint32_t)(unsigned char)op[0] |
+           (length > 1 ? (uint32_t)(unsigned char)op[1] << 8  : 0) |
+           (length > 2 ? (uint32_t)(unsigned char)op[2] << 16 : 0) |
+           (uint32_t)(length < 4 ? length : 4) << 24;
+}
+
+static constexpr unsigned oper_log2(size_t n) {
+    return n > 1 ? 1 + oper_log2(n / 2) : 0;
+}
+static_assert(OPER_SLOTS == (size_t)1 << oper_log2(OPER_SLOTS), "OPER_SLOTS is not a power of two");
+
+/* the top bits of the product, as many as it takes to number the slots */
+static constexpr size_t oper_hash(uint32_t key) {
+    return (uint32_t)(key * 0x9E377A69u) >> (32 - oper_log2(OPER_SLOTS));
+}
+
+static constexpr size_t oper_length(const char *op) {
+    return *op ? 1 + oper_length(op + 1) : 0;
+}
+
+static constexpr bool oper_same(const char *a, const char *b) {
+    return *a == *b && (!*a || oper_same(a + 1, b + 1));
+}
+
+/* the j-th and later operators share no slot with the i-th unless they are the same */
+static constexpr bool oper_apart(const struct oper_info *table, size_t count, size_t i, size_t j) {
+    return j == count ||
+           ((oper_hash(oper_key(table[i].op, oper_length(table[i].op))) !=
+             oper_hash(oper_key(table[j].op, oper_length(table[j].op))) ||
+             oper_same(table[i].op, table[j].op)) &&
+            oper_apart(table, count, i, j + 1));
+}
+
+static constexpr bool oper_perfect(const struct oper_info *table, size_t count, size_t i) {
+    return i == count || (oper_apart(table, count, i, i + 1) && oper_perfect(table, count, i + 1));
+}
+
+static constexpr oper_info c_operators[] = {
     { "(",       0, opid1('('),         ASSOC_LEFT,  99, OP_PREFIX, false}, /* paren expression - non function call */
     { "_length", 1, opid3('l','e','n'), ASSOC_RIGHT, 98, OP_PREFIX, true},
 
@@ -204,7 +298,7 @@ static const oper_info c_operators[] = {
     { ",",      2, opid1(','),         ASSOC_LEFT,  0,  0,         false}
 };
 
-static const oper_info fte_operators[] = {
+static constexpr oper_info fte_operators[] = {
     { "(",   0, opid1('('),         ASSOC_LEFT,  99, OP_PREFIX, false}, /* paren expression - non function call */
 
     { "++",  1, opid3('S','+','+'), ASSOC_LEFT,  15, OP_SUFFIX, false},
@@ -257,7 +351,7 @@ static const oper_info fte_operators[] = {
     { ":",   0, opid2(':','?'),     ASSOC_RIGHT, 1,  0,         false}
 };
 
-static const oper_info qcc_operators[] = {
+static constexpr oper_info qcc_operators[] = {
     { "(",   0, opid1('('),         ASSOC_LEFT,  99, OP_PREFIX, false}, /* paren expression - non function call */
 
     { ".",   2, opid1('.'),         ASSOC_LEFT,  15, 0,         false},
@@ -297,6 +391,14 @@ static const oper_info qcc_operators[] = {
 
     { ",",   2, opid1(','),         ASSOC_LEFT,  2,  0,         false},
 };
+/* parser_t::operator_slots keeps 1 + the index of an operator in a byte */
+static_assert(GMQCC_ARRAY_COUNT(c_operators)   < 255, "too many operators for operator_slots");
+static_assert(GMQCC_ARRAY_COUNT(fte_operators) < 255, "too many operators for operator_slots");
+static_assert(GMQCC_ARRAY_COUNT(qcc_operators) < 255, "too many operators for operator_slots");
+static_assert(oper_perfect(c_operators,   GMQCC_ARRAY_COUNT(c_operators),   0), "operators share a slot of oper_hash");
+static_assert(oper_perfect(fte_operators, GMQCC_ARRAY_COUNT(fte_operators), 0), "operators share a slot of oper_hash");
+static_assert(oper_perfect(qcc_operators, GMQCC_ARRAY_COUNT(qcc_operators), 0), "operators share a slot of oper_hash");
+
 extern const oper_info *operators;
 extern size_t           operator_count;
 
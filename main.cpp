@@ -63,6 +63,7 @@ static int usage(void) {
     con_out("  -force-crc=num         force a specific checksum into the header\n");
     con_out("  -state-fps=num         emulate OP_STATE with the specified FPS\n");
     con_out("  -coverage              add coverage support\n");
+    con_out("  -emit-c=file           also write the program as C source\n");
     return -1;
 }
 
@@ -196,6 +197,10 @@ static bool options_parse(int argc, char **argv, bool *has_progs_src) {
                 opts_set(opts.flags, EMULATE_STATE, true);
                 continue;
             }
+            if (options_long_gcc("emit-c", &argc, &argv, &argarg)) {
+                OPTS_OPTION_STR(OPTION_EMIT_C) = argarg;
+                continue;
+            }
             if (options_long_gcc("config", &argc, &argv, &argarg)) {
                 config = argarg;
                 continue;
@@ -708,14 +713,14 @@ int main(int argc, char **argv) {
             }
             else {
                 if (OPTS_FLAG(FTEPP)) {
-                    const char *data;
+                    const lex_tokens *tokens;
                     if (!ftepp_preprocess_file(ftepp, items[itr].filename)) {
                         retval = 1;
                         goto cleanup;
                     }
-                    data = ftepp_get(ftepp);
-                    if (vec_size(data)) {
-                        if (!parser_compile_string(parser, items[itr].filename, data, vec_size(data))) {
+                    tokens = ftepp_tokens(ftepp);
+                    if (!tokens->tokens.empty()) {
+                        if (!parser_compile_tokens(parser, items[itr].filename, tokens)) {
                             retval = 1;
                             goto cleanup;
                         }
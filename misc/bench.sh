@@ -0,0 +1,46 @@
+#!/bin/sh
+# Runs every program in tests/bench against the given executors and prints
+# the wall clock time and statement throughput of each.
+#
+# usage: misc/bench.sh qcvm [qcvm...]
+#
+# An executor may carry options, eg. "./qcvm -predecode".
+prog=$0
+
+die() {
+	echo "$@"
+	exit 1
+}
+
+test -e tests/bench || die "$prog: run this script from the top of a gmqcc source tree"
+test $# -ge 1 || die "usage: $prog qcvm [qcvm...]"
+
+tmp=$(mktemp -d) || die "$prog: failed to create a temporary directory"
+trap 'rm -rf "$tmp"' EXIT
+
+now() {
+	date +%s%N
+}
+
+printf "%-16s %-24s %12s %10s %14s\n" benchmark executor statements ms stmts/s
+for src in tests/bench/*.qc
+do
+	name=$(basename "$src" .qc)
+	./gmqcc -std=gmqcc "$src" -o "$tmp/$name.dat" >/dev/null 2>&1 \
+		|| die "$prog: failed to compile $src"
+
+	# the statement count comes from a profiled run of the first executor
+	stmts=$($1 -profile -v "$tmp/$name.dat" | sed -ne 's/^executed \([0-9]*\) statements$/\1/p')
+	test -n "$stmts" || die "$prog: failed to count the statements of $src"
+
+	for vm in "$@"
+	do
+		start=$(now)
+		$vm "$tmp/$name.dat" >/dev/null || die "$prog: $vm failed on $src"
+		end=$(now)
+		ms=$(( (end - start) / 1000000 ))
+		test $ms -gt 0 || ms=1
+		printf "%-16s %-24s %12s %10s %14s\n" "$name" "${vm#./}" \
+			"$stmts" "$ms" "$(( stmts * 1000 / ms ))"
+	done
+done
@@ -0,0 +1,49 @@
+#!/bin/sh
+# Measures the throughput of the lexer: the QC sources of tests/ are put
+# together into one large file, which each given gmqcc preprocesses with
+# -E. Every character goes through the lexer of the preprocessor once.
+# Prints the best of RUNS runs in MB/s.
+#
+# usage: misc/lexbench.sh gmqcc [gmqcc...]
+#
+# SIZE is the size of the source in MB, 16 by default.
+prog=$0
+
+die() {
+	echo "$@"
+	exit 1
+}
+
+test -e tests/bench || die "$prog: run this script from the top of a gmqcc source tree"
+test $# -ge 1 || die "usage: $prog gmqcc [gmqcc...]"
+
+tmp=$(mktemp -d) || die "$prog: failed to create a temporary directory"
+trap 'rm -rf "$tmp"' EXIT
+
+now() {
+	date +%s%N
+}
+
+# directives are left out, the tests include some failing on purpose
+cat tests/*.qc tests/bench/*.qc | grep -v '^[[:space:]]*#' >"$tmp/part.qc"
+: >"$tmp/source.qc"
+while test $(wc -c <"$tmp/source.qc") -lt $((${SIZE:-16} * 1048576))
+do
+	cat "$tmp/part.qc" >>"$tmp/source.qc"
+done
+bytes=$(wc -c <"$tmp/source.qc")
+
+printf "%-24s %10s %10s\n" compiler ms MB/s
+for cc in "$@"
+do
+	best=
+	for run in $(seq ${RUNS:-3})
+	do
+		start=$(now)
+		$cc -E "$tmp/source.qc" >/dev/null 2>&1 || die "$prog: $cc failed to preprocess"
+		ns=$(($(now) - start))
+		test -z "$best" -o "$ns" -lt "${best:-0}" && best=$ns
+	done
+	printf "%-24s %10d %10s\n" "${cc#./}" $((best / 1000000)) \
+		"$(echo "$bytes $best" | awk '{ printf "%.1f", $1 / 1048576 / ($2 / 1e9) }')"
+done
@@ -0,0 +1,46 @@
+#!/bin/sh
+# Times the bench function of every program in tests/bench defining one
+# with qcvm -bench against the given executors, and prints the times of a
+# single call in microseconds, the statement throughput and allocations.
+#
+# usage: misc/microbench.sh qcvm [qcvm...]
+#
+# An executor may carry options, eg. "./qcvm -predecode". ITERATIONS and
+# WARMUP are passed on to -iterations and -warmup.
+prog=$0
+
+die() {
+	echo "$@"
+	exit 1
+}
+
+test -e tests/bench || die "$prog: run this script from the top of a gmqcc source tree"
+test $# -ge 1 || die "usage: $prog qcvm [qcvm...]"
+
+tmp=$(mktemp -d) || die "$prog: failed to create a temporary directory"
+trap 'rm -rf "$tmp"' EXIT
+
+field() {
+	sed -ne "s/^  $1: *\([0-9.]*\).*$/\1/p" "$tmp/out"
+}
+
+printf "%-12s %-24s %10s %10s %10s %14s %8s %8s\n" \
+	benchmark executor "min us" "median us" "p99 us" stmts/s strings entities
+for src in tests/bench/*.qc
+do
+	grep -q '^void() bench' "$src" || continue
+	name=$(basename "$src" .qc)
+	./gmqcc -std=gmqcc "$src" -o "$tmp/$name.dat" >/dev/null 2>&1 \
+		|| die "$prog: failed to compile $src"
+
+	for vm in "$@"
+	do
+		$vm -bench bench -iterations "${ITERATIONS:-1000}" -warmup "${WARMUP:-100}" \
+			"$tmp/$name.dat" >"$tmp/out" || die "$prog: $vm failed on $src"
+		printf "%-12s %-24s %10s %10s %10s %14s %8s %8s\n" "$name" "${vm#./}" \
+			"$(field min)" "$(field median)" "$(field p99)" \
+			"$(sed -ne 's/^  statements: .*, \([0-9]*\) per second$/\1/p' "$tmp/out")" \
+			"$(sed -ne 's/^  allocated: *\([0-9.e+]*\) strings.*$/\1/p' "$tmp/out")" \
+			"$(sed -ne 's/^  allocated: .*, \([0-9.e+]*\) entities.*$/\1/p' "$tmp/out")"
+	done
+done
@@ -63,7 +63,7 @@ static inline bool GMQCC_WARN parsewarning(parser_t *parser, int warntype, const
 static bool parser_next(parser_t *parser)
 {
     /* lex_do kills the previous token */
-    parser->tok = lex_do(parser->lex);
+    parser->tok = parser->lex->tokens ? lex_do_tokens(parser->lex) : lex_do(parser->lex);
     if (parser->tok == TOKEN_EOF)
         return true;
     if (parser->tok >= TOKEN_ERROR) {
@@ -1427,17 +1427,31 @@ static bool parser_close_paren(parser_t *parser, shunt *sy)
     return true;
 }
 
+/* the operator named by the token, a prefix one or not, or nullptr */
+static const oper_info *parser_find_operator(parser_t *parser, bool prefix)
+{
+    const char *v      = parser_tokval(parser);
+    size_t      length = vec_size(v);
+    uint32_t    key;
+    size_t      slot;
+
+    if (!length)
+        return nullptr;
+    key  = oper_key(v, length);
+    slot = oper_hash(key);
+    if (!parser->operator_slots[slot][prefix] || parser->operator_keys[slot] != key)
+        return nullptr;
+    if (length > 3 && strcmp(v, operators[parser->operator_slots[slot][prefix] - 1].op))
+        return nullptr;
+    return &operators[parser->operator_slots[slot][prefix] - 1];
+}
+
 static void parser_reclassify_token(parser_t *parser)
 {
-    size_t i;
     if (parser->tok >= TOKEN_START)
         return;
-    for (i = 0; i < operator_count; ++i) {
-        if (!strcmp(parser_tokval(parser), operators[i].op)) {
-            parser->tok = TOKEN_OPERATOR;
-            return;
-        }
-    }
+    if (parser_find_operator(parser, false) || parser_find_operator(parser, true))
+        parser->tok = TOKEN_OPERATOR;
 }
 
 static ast_expression* parse_vararg_do(parser_t *parser)
@@ -1726,21 +1740,11 @@ static ast_expression* parse_expression_leave(parser_t *parser, bool stopatcomma
             /* classify the operator */
             const oper_info *op;
             const oper_info *olast = nullptr;
-            size_t o;
-            for (o = 0; o < operator_count; ++o) {
-                if (((!(operators[o].flags & OP_PREFIX) == !!wantop)) &&
-                    /* !(operators[o].flags & OP_SUFFIX) && / * remove this */
-                    !strcmp(parser_tokval(parser), operators[o].op))
-                {
-                    break;
-                }
-            }
-            if (o == operator_count) {
+            if (!(op = parser_find_operator(parser, !wantop))) {
                 compile_error(parser_ctx(parser), "unexpected operator: %s", parser_tokval(parser));
                 goto onerr;
             }
             /* found an operator */
-            op = &operators[o];
 
             /* when declaring variables, a comma starts a new variable */
             if (op->id == opid1(',') && sy.paren.empty() && stopatcomma) {
@@ -6100,6 +6104,15 @@ parser_t *parser_create()
     if (!parser)
         return nullptr;
 
+    memset(parser->operator_slots, 0, sizeof(parser->operator_slots));
+    memset(parser->operator_keys, 0, sizeof(parser->operator_keys));
+    for (i = operator_count; i-- > 0;) {
+        uint32_t key  = oper_key(operators[i].op, strlen(operators[i].op));
+        size_t   slot = oper_hash(key);
+        parser->operator_slots[slot][!!(operators[i].flags & OP_PREFIX)] = i + 1;
+        parser->operator_keys[slot] = key;
+    }
+
     for (i = 0; i < operator_count; ++i) {
         if (operators[i].id == opid1('=')) {
             parser->assign_op = operators+i;
@@ -6167,6 +6180,16 @@ bool parser_compile_string(parser_t *parser, const char *name, const char *str,
     return parser_compile(parser);
 }
 
+bool parser_compile_tokens(parser_t *parser, const char *name, const lex_tokens *tokens)
+{
+    parser->lex = lex_open_tokens(tokens, name);
+    if (!parser->lex) {
+        con_err("failed to create lexer for the tokens of \"%s\"\n", name);
+        return false;
+    }
+    return parser_compile(parser);
+}
+
 void parser_t::remove_ast()
 {
     if (ast_cleaned)
@@ -63,6 +63,14 @@ struct parser_t {
     /* we store the '=' operator info */
     const oper_info *assign_op;
 
+    /*
+     * The operators by oper_hash of their name, 1 + the index of the first
+     * one which is not a prefix operator and of the first one which is,
+     * and the oper_key of the name.
+     */
+    uint8_t  operator_slots[OPER_SLOTS][2];
+    uint32_t operator_keys[OPER_SLOTS];
+
     /* magic values */
     ast_value *const_vec[3];
 
@@ -0,0 +1,490 @@
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#   include <intrin.h>
+#   define PROFILE_RDTSC 1
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#   include <x86intrin.h>
+#   define PROFILE_RDTSC 1
+#endif
+
+#include "gmqcc.h"
+
+/*
+ * The reports of qcvm -profile. The statement counters give the cost of
+ * every function and line, the calling contexts recorded on the way in
+ * and out of functions give the inclusive costs and the call graph.
+ *
+ * With -timing the calls of functions and builtins are timed instead,
+ * summed up for each call site as they return.
+ */
+
+static void profile_settle(qc_program_t *prog) {
+    prog->callpaths[prog->callpath].self += prog->executed - prog->executed_mark;
+    prog->executed_mark = prog->executed;
+}
+
+void prog_profile_enter(qc_program_t *prog, qcint_t function, qcint_t statement) {
+    size_t child = 0;
+
+    if (prog->callpaths.empty())
+        prog->callpaths.push_back({ 0, -1, -1, 0, 0, {} });
+
+    profile_settle(prog);
+
+    for (auto &it : prog->callpaths[prog->callpath].children) {
+        if (prog->callpaths[it].function == function && prog->callpaths[it].statement == statement) {
+            child = it;
+            break;
+        }
+    }
+    if (!child) {
+        child = prog->callpaths.size();
+        prog->callpaths[prog->callpath].children.push_back(child);
+        prog->callpaths.push_back({ prog->callpath, function, statement, 0, 0, {} });
+    }
+
+    prog->callpaths[child].calls++;
+    prog->callpath = child;
+}
+
+void prog_profile_leave(qc_program_t *prog) {
+    profile_settle(prog);
+    prog->callpath = prog->callpaths[prog->callpath].parent;
+}
+
+/* for when the program stopped without leaving its functions */
+void prog_profile_unwind(qc_program_t *prog) {
+    if (prog->callpaths.empty())
+        return;
+    profile_settle(prog);
+    prog->callpath = 0;
+}
+
+static FILE *profile_open(qc_program_t *prog, const char *filename) {
+    FILE *fp;
+    if (!strcmp(filename, "-"))
+        return stdout;
+    if (!(fp = fopen(filename, "w")))
+        prog_message(prog, "failed to open `%s` for writing", filename);
+    return fp;
+}
+
+static bool profile_close(qc_program_t *prog, FILE *fp, const char *filename) {
+    bool failed = ferror(fp);
+    if (fp == stdout)
+        fflush(fp);
+    else if (fclose(fp))
+        failed = true;
+    if (failed)
+        prog_message(prog, "failed to write `%s`", filename);
+    return !failed;
+}
+
+/*
+ * Reads the line of every statement from the .lno file gmqcc writes with
+ * -flno. Without an explicit file the one next to the program is tried,
+ * which may well not exist.
+ */
+bool prog_load_lno(qc_program_t *prog, const char *lnofile, std::vector<int32_t> &lines) {
+    std::string name;
+    uint32_t header[5]; /* version, defs, globals, fields, statements */
+    char magic[4];
+    FILE *fp;
+
+    if (!lnofile) {
+        size_t dot = prog->filename.rfind('.');
+        size_t sep = prog->filename.find_last_of("/\\");
+        name = prog->filename.substr(0, dot != std::string::npos && (sep == std::string::npos || dot > sep) ? dot : std::string::npos);
+        name += ".lno";
+    } else {
+        name = lnofile;
+    }
+
+    if (!(fp = fopen(name.c_str(), "rb"))) {
+        if (lnofile)
+            prog_message(prog, "failed to open `%s`", lnofile);
+        return false;
+    }
+
+    if (fread(magic, sizeof(magic), 1, fp) != 1 || memcmp(magic, "LNOF", 4) ||
+        fread(header, sizeof(header), 1, fp) != 1)
+        goto invalid;
+
+    util_endianswap(header, 5, sizeof(header[0]));
+    if (header[0] != 1                                   ||
+        header[1] != prog->defs.size()                   ||
+        header[2] != prog->globals.size() - 2            ||
+        header[3] != prog->fields.size()                 ||
+        header[4] != prog->code.size())
+        goto invalid;
+
+    lines.resize(header[4]);
+    if (header[4] && fread(&lines[0], sizeof(lines[0]), lines.size(), fp) != lines.size())
+        goto invalid;
+    util_endianswap(lines.data(), lines.size(), sizeof(lines[0]));
+
+    fclose(fp);
+    return true;
+
+invalid:
+    prog_message(prog, "`%s` does not belong to `%s`, ignoring it", name.c_str(), prog->filename.c_str());
+    lines.clear();
+    fclose(fp);
+    return false;
+}
+
+/* the function each statement belongs to, 0 for none */
+static std::vector<qcint_t> profile_owners(qc_program_t *prog) {
+    std::vector<qcint_t> owner(prog->code.size(), 0);
+    std::vector<std::pair<qcint_t, qcint_t>> entries;
+
+    for (size_t i = 1; i < prog->functions.size(); ++i)
+        if (prog->functions[i].entry >= 0 && (size_t)prog->functions[i].entry < prog->code.size())
+            entries.push_back({ prog->functions[i].entry, (qcint_t)i });
+    std::sort(entries.begin(), entries.end());
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        size_t end = i + 1 < entries.size() ? entries[i+1].first : prog->code.size();
+        for (size_t s = entries[i].first; s < end; ++s)
+            owner[s] = entries[i].second;
+    }
+    return owner;
+}
+
+/* the statements executed below every calling context */
+static std::vector<size_t> profile_inclusive(qc_program_t *prog) {
+    std::vector<size_t> inclusive(prog->callpaths.size());
+    for (size_t i = prog->callpaths.size(); i--; ) {
+        inclusive[i] += prog->callpaths[i].self;
+        if (i)
+            inclusive[prog->callpaths[i].parent] += inclusive[i];
+    }
+    return inclusive;
+}
+
+static const char *profile_name(qc_program_t *prog, qcint_t function) {
+    return prog_getstring(prog, prog->functions[function].name);
+}
+
+static const char *profile_file(qc_program_t *prog, qcint_t function) {
+    return prog_getstring(prog, prog->functions[function].file);
+}
+
+bool prog_profile_report(qc_program_t *prog, const char *filename, const char *lnofile) {
+    const size_t count = prog->functions.size();
+    std::vector<size_t> self(count), inclusive(count), calls(count);
+    std::vector<qcint_t> owner = profile_owners(prog);
+    std::vector<size_t> paths = profile_inclusive(prog);
+    std::vector<qcint_t> order;
+    std::vector<int32_t> lines;
+    size_t total = 0;
+    FILE *fp;
+
+    if (!(fp = profile_open(prog, filename)))
+        return false;
+
+    for (size_t i = 0; i < prog->code.size(); ++i) {
+        self[owner[i]] += prog->profile[i];
+        total += prog->profile[i];
+    }
+
+    /* recursion would count the same statements again */
+    for (size_t i = 1; i < prog->callpaths.size(); ++i) {
+        const qc_callpath_t &path = prog->callpaths[i];
+        size_t up = path.parent;
+        calls[path.function] += path.calls;
+        while (up && prog->callpaths[up].function != path.function)
+            up = prog->callpaths[up].parent;
+        if (!up)
+            inclusive[path.function] += paths[i];
+    }
+
+    for (size_t i = 1; i < count; ++i) {
+        if (prog->functions[i].entry < 0)
+            calls[i] = prog->functions[i].profile;
+        if (self[i] || calls[i])
+            order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](qcint_t a, qcint_t b) {
+        if (self[a] != self[b])
+            return self[a] > self[b];
+        return calls[a] > calls[b];
+    });
+
+    fprintf(fp, "%12s %7s %12s %10s  %s\n", "self", "self%", "inclusive", "calls", "function");
+    for (auto &it : order) {
+        if (prog->functions[it].entry < 0)
+            fprintf(fp, "%12s %7s %12s %10zu  %s (builtin #%d)\n", "-", "-", "-",
+                    calls[it], profile_name(prog, it), (int)-prog->functions[it].entry);
+        else
+            fprintf(fp, "%12zu %6.2f%% %12zu %10zu  %s\n",
+                    self[it], total ? 100.0 * self[it] / total : 0.0, inclusive[it],
+                    calls[it], profile_name(prog, it));
+    }
+    fprintf(fp, "%12zu statements executed\n", total);
+
+    if (prog_load_lno(prog, lnofile, lines)) {
+        /* a line may hold statements of more than one function */
+        std::map<std::pair<qcint_t, int32_t>, size_t> perline;
+        std::vector<std::pair<std::pair<qcint_t, int32_t>, size_t>> sorted;
+
+        for (size_t i = 0; i < prog->code.size(); ++i)
+            if (prog->profile[i] && owner[i])
+                perline[{ owner[i], lines[i] }] += prog->profile[i];
+        sorted.assign(perline.begin(), perline.end());
+        std::stable_sort(sorted.begin(), sorted.end(), [](const std::pair<std::pair<qcint_t, int32_t>, size_t> &a,
+                                                          const std::pair<std::pair<qcint_t, int32_t>, size_t> &b) {
+            return a.second > b.second;
+        });
+
+        fprintf(fp, "%12s %7s  %s\n", "statements", "%", "line");
+        for (auto &it : sorted)
+            fprintf(fp, "%12zu %6.2f%%  %s:%d (%s)\n", it.second, 100.0 * it.second / total,
+                    profile_file(prog, it.first.first), (int)it.first.second,
+                    profile_name(prog, it.first.first));
+    }
+
+    return profile_close(prog, fp, filename);
+}
+
+/*
+ * In the format of valgrind's callgrind, for kcachegrind and friends. The
+ * statement numbers take the place of lines when there is no .lno file.
+ */
+bool prog_profile_callgrind(qc_program_t *prog, const char *filename, const char *lnofile) {
+    struct callsite {
+        size_t calls;
+        size_t inclusive;
+    };
+    std::vector<qcint_t> owner = profile_owners(prog);
+    std::vector<size_t> paths = profile_inclusive(prog);
+    std::vector<int32_t> lines;
+    /* caller, callee, call statement */
+    std::map<std::pair<qcint_t, std::pair<qcint_t, qcint_t>>, callsite> edges;
+    size_t total = 0;
+    FILE *fp;
+
+    if (!(fp = profile_open(prog, filename)))
+        return false;
+
+    if (!prog_load_lno(prog, lnofile, lines)) {
+        lines.resize(prog->code.size());
+        for (size_t i = 0; i < lines.size(); ++i)
+            lines[i] = i;
+    }
+
+    for (size_t i = 1; i < prog->callpaths.size(); ++i) {
+        const qc_callpath_t &path = prog->callpaths[i];
+        if (!path.parent)
+            continue;
+        callsite &site = edges[{ prog->callpaths[path.parent].function, { path.function, path.statement } }];
+        site.calls     += path.calls;
+        site.inclusive += paths[i];
+    }
+
+    fprintf(fp, "# callgrind format\n"
+                "version: 1\n"
+                "creator: qcvm\n"
+                "cmd: %s\n"
+                "positions: line\n"
+                "events: Statements\n",
+                prog->filename.c_str());
+
+    for (size_t f = 1; f < prog->functions.size(); ++f) {
+        auto edge = edges.lower_bound({ (qcint_t)f, { 0, INT32_MIN } });
+        std::map<int32_t, size_t> perline;
+        bool any = false;
+
+        for (size_t i = 0; i < prog->code.size(); ++i)
+            if (owner[i] == (qcint_t)f && prog->profile[i])
+                perline[lines[i]] += prog->profile[i];
+
+        for (auto &it : perline) {
+            if (!any)
+                fprintf(fp, "\nfl=%s\nfn=%s\n", profile_file(prog, f), profile_name(prog, f));
+            fprintf(fp, "%d %zu\n", (int)it.first, it.second);
+            total += it.second;
+            any = true;
+        }
+
+        for (; edge != edges.end() && edge->first.first == (qcint_t)f; ++edge) {
+            qcint_t callee = edge->first.second.first;
+            qcint_t stmt   = edge->first.second.second;
+            if (!any)
+                fprintf(fp, "\nfl=%s\nfn=%s\n", profile_file(prog, f), profile_name(prog, f));
+            fprintf(fp, "cfi=%s\ncfn=%s\ncalls=%zu %d\n%d %zu\n",
+                    profile_file(prog, callee), profile_name(prog, callee),
+                    edge->second.calls, (int)lines[prog->functions[callee].entry],
+                    stmt >= 0 ? (int)lines[stmt] : 0, edge->second.inclusive);
+            any = true;
+        }
+    }
+
+    fprintf(fp, "\ntotals: %zu\n", total);
+    return profile_close(prog, fp, filename);
+}
+
+/* one line per calling context, as flamegraph.pl and speedscope read them */
+bool prog_profile_folded(qc_program_t *prog, const char *filename) {
+    /* the call sites are not part of the stacks, which merges some */
+    std::map<std::string, size_t> stacks;
+    std::vector<qcint_t> stack;
+    FILE *fp;
+
+    if (!(fp = profile_open(prog, filename)))
+        return false;
+
+    for (size_t i = 1; i < prog->callpaths.size(); ++i) {
+        std::string folded;
+        if (!prog->callpaths[i].self)
+            continue;
+        stack.clear();
+        for (size_t at = i; at; at = prog->callpaths[at].parent)
+            stack.push_back(prog->callpaths[at].function);
+        for (size_t k = stack.size(); k--; ) {
+            folded += profile_name(prog, stack[k]);
+            if (k)
+                folded += ';';
+        }
+        stacks[folded] += prog->callpaths[i].self;
+    }
+
+    for (auto &it : stacks)
+        fprintf(fp, "%s %zu\n", it.first.c_str(), it.second);
+
+    return profile_close(prog, fp, filename);
+}
+
+static uint64_t timing_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* the time stamp counter where there is one, it is calibrated in the report */
+static inline uint64_t timing_ticks() {
+#if PROFILE_RDTSC
+    return __rdtsc();
+#else
+    return timing_ns();
+#endif
+}
+
+void prog_timing_enter(qc_program_t *prog, qcint_t function, qcint_t statement) {
+    size_t site;
+
+    if (prog->callsite_of.empty()) {
+        prog->callsite_of.resize(prog->code.size() + 1);
+        prog->callsites.resize(1);
+        prog->timing_inclusive.resize(prog->functions.size());
+        prog->timing_depth.resize(prog->functions.size());
+        prog->timing_start_ns    = timing_ns();
+        prog->timing_start_ticks = timing_ticks();
+    }
+
+    for (site = prog->callsite_of[statement + 1]; site; site = prog->callsites[site].next)
+        if (prog->callsites[site].callee == function)
+            break;
+    if (!site) {
+        qcint_t caller = prog->timing_stack.empty()
+            ? 0
+            : prog->callsites[prog->timing_stack.back().site].callee;
+        site = prog->callsites.size();
+        prog->callsites.push_back({ caller, statement, function, prog->callsite_of[statement + 1], 0, 0, 0 });
+        prog->callsite_of[statement + 1] = site;
+    }
+
+    prog->callsites[site].calls++;
+    prog->timing_depth[function]++;
+    prog->timing_stack.push_back({ site, 0, 0 });
+    prog->timing_stack.back().start = timing_ticks();
+}
+
+/* returns from the calls until depth of them are left */
+void prog_timing_leave(qc_program_t *prog, size_t depth) {
+    const uint64_t now = timing_ticks();
+
+    while (prog->timing_stack.size() > depth) {
+        qc_timing_frame_t frame = prog->timing_stack.back();
+        qc_callsite_t    &site  = prog->callsites[frame.site];
+        uint64_t       elapsed  = now - frame.start;
+
+        prog->timing_stack.pop_back();
+        site.inclusive += elapsed;
+        site.exclusive += elapsed - std::min(elapsed, frame.children);
+        if (!--prog->timing_depth[site.callee])
+            prog->timing_inclusive[site.callee] += elapsed;
+        if (!prog->timing_stack.empty())
+            prog->timing_stack.back().children += elapsed;
+    }
+}
+
+bool prog_timing_report(qc_program_t *prog, const char *filename, const char *lnofile) {
+    const size_t count = prog->functions.size();
+    std::vector<uint64_t> self(count);
+    std::vector<size_t> calls(count);
+    std::vector<size_t> order, sites;
+    std::vector<int32_t> lines;
+    uint64_t total = 0;
+    double scale = 1.0; /* microseconds per tick */
+    FILE *fp;
+
+    if (!(fp = profile_open(prog, filename)))
+        return false;
+
+    if (!prog->callsites.empty()) {
+        uint64_t ns    = timing_ns()    - prog->timing_start_ns;
+        uint64_t ticks = timing_ticks() - prog->timing_start_ticks;
+        scale = ticks ? (double)ns / ticks / 1000.0 : 0.0;
+    }
+
+    for (size_t i = 1; i < prog->callsites.size(); ++i) {
+        const qc_callsite_t &site = prog->callsites[i];
+        self[site.callee]  += site.exclusive;
+        calls[site.callee] += site.calls;
+        total              += site.exclusive;
+        sites.push_back(i);
+    }
+
+    for (size_t i = 1; i < count; ++i)
+        if (calls[i])
+            order.push_back(i);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return self[a] > self[b];
+    });
+
+    fprintf(fp, "%12s %7s %12s %10s %10s  %s\n", "self us", "self%", "inclusive us", "calls", "us/call", "function");
+    for (auto &it : order) {
+        fprintf(fp, "%12.3f %6.2f%% %12.3f %10zu %10.3f  %s",
+                self[it] * scale, total ? 100.0 * self[it] / total : 0.0,
+                prog->timing_inclusive[it] * scale, calls[it],
+                prog->timing_inclusive[it] * scale / calls[it], profile_name(prog, it));
+        if (prog->functions[it].entry < 0)
+            fprintf(fp, " (builtin #%d)", (int)-prog->functions[it].entry);
+        fprintf(fp, "\n");
+    }
+    fprintf(fp, "%12.3f us in the program\n", total * scale);
+
+    std::stable_sort(sites.begin(), sites.end(), [&](size_t a, size_t b) {
+        return prog->callsites[a].inclusive > prog->callsites[b].inclusive;
+    });
+    prog_load_lno(prog, lnofile, lines);
+
+    fprintf(fp, "%12s %12s %10s  %s\n", "inclusive us", "self us", "calls", "call site");
+    for (auto &it : sites) {
+        const qc_callsite_t &site = prog->callsites[it];
+        fprintf(fp, "%12.3f %12.3f %10zu  ", site.inclusive * scale, site.exclusive * scale, site.calls);
+        if (site.statement < 0)
+            fprintf(fp, "(entry)");
+        else if (!lines.empty())
+            fprintf(fp, "%s:%d (%s)", profile_file(prog, site.caller), (int)lines[site.statement],
+                    profile_name(prog, site.caller));
+        else
+            fprintf(fp, "statement %d (%s)", (int)site.statement, profile_name(prog, site.caller));
+        fprintf(fp, " -> %s\n", profile_name(prog, site.callee));
+    }
+
+    return profile_close(prog, fp, filename);
+}
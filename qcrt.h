@@ -0,0 +1,715 @@
+#ifndef GMQCC_QCRT_HDR
+#define GMQCC_QCRT_HDR
+
+/*
+ * Runtime for the C source gmqcc writes with -emit-c.  Every QC function
+ * of the program becomes a C function working on the globals array and
+ * the entity data held here, and this mirrors what prog_exec does around
+ * them: locals are backed up on calls, entity accesses are bounds checked,
+ * tempstrings are recycled and the same runaway loop counter applies.
+ *
+ * The header is plain C99, needing only qcvmopts.h next to it, and meant
+ * to be included by exactly one translation unit, the generated one.
+ * Unless QCRT_NO_MAIN is defined that also gets a main() behaving like
+ * qcvm, with the same builtins and the -float, -vector and -string
+ * parameters to main().
+ */
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "qcvmopts.h"
+
+typedef union {
+    int32_t i;
+    float   f;
+} qcrt_slot_t;
+
+typedef struct qcrt_s qcrt_t;
+typedef int (*qcrt_native_t)(qcrt_t *vm);
+typedef int (*qcrt_builtin_t)(qcrt_t *vm);
+
+typedef struct {
+    const char   *name;
+    int32_t       entry;      /* negative for builtins */
+    uint32_t      firstlocal;
+    uint32_t      locals;
+    int32_t       nargs;
+    uint8_t       argsize[8];
+    qcrt_native_t native;
+} qcrt_function_t;
+
+typedef struct {
+    int32_t     offset;
+    const char *name;
+} qcrt_field_t;
+
+typedef struct {
+    const char            *filename;
+    qcrt_slot_t           *globals;
+    const char            *strings;
+    size_t                 stringsize;
+    const qcrt_function_t *functions;
+    size_t                 functioncount;
+    const qcrt_field_t    *fields;
+    size_t                 fieldcount;
+    size_t                 entityfields;
+
+    /* what INSTR_STATE needs, -1 where the program lacks the def */
+    int32_t                self;
+    int32_t                time;
+    int32_t                think;
+    int32_t                nextthink;
+    int32_t                frame;
+} qcrt_program_t;
+
+/* a block of the tempstring arena, laid out like the one of qcvm */
+typedef struct {
+    char  *data;
+    size_t size;
+} qcrt_tempblock_t;
+
+struct qcrt_s {
+    const qcrt_program_t *prog;
+    qcrt_slot_t          *globals;
+
+    const char           *strings;
+    size_t                stringsize;
+    qcrt_tempblock_t     *tempstrings;
+    size_t                tempblocks;
+    size_t                tempstring_start;
+    size_t                tempstring_at;
+    int                   tempstring_expired;
+
+    qcrt_slot_t          *entitydata;
+    unsigned char        *entitypool;
+    int32_t               entities;
+    size_t                entitycapacity;
+    size_t                entityfields;
+    int                   allowworldwrites;
+
+    int32_t              *localstack;
+    size_t                localsp;
+    size_t                localcapacity;
+
+    const qcrt_builtin_t *builtins;
+    size_t                builtins_count;
+
+    int                   argc;
+    int                   vmerror;
+    long                  jumps;
+    long                  maxjumps;
+};
+
+#define QCRT_OFS_RETURN   1
+#define QCRT_OFS_PARM0    4
+#define QCRT_JUMPS        1000000
+#define QCRT_GOTO_JUMPS   10000000
+#define QCRT_TEMPSTRING_BLOCK (16*1024)
+
+#define QCRT_IS_TRUE(x)   ((x) & 0x7FFFFFFF)
+
+static inline void qcrt_error(qcrt_t *vm, const char *fmt, ...) {
+    va_list ap;
+
+    vm->vmerror++;
+
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    putchar('\n');
+}
+
+static inline void *qcrt_grow(void *data, size_t *capacity, size_t need, size_t size) {
+    size_t cap = *capacity ? *capacity : 64;
+    while (cap < need)
+        cap *= 2;
+    if (cap != *capacity) {
+        if (!(data = realloc(data, cap * size))) {
+            fprintf(stderr, "out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        *capacity = cap;
+    }
+    return data;
+}
+
+static inline const char *qcrt_getstring(qcrt_t *vm, int32_t str) {
+    if (str >= 0 && (size_t)str < vm->stringsize)
+        return vm->strings + str;
+    if (str >= 0 && (size_t)str - vm->tempstring_start < vm->tempstring_at) {
+        size_t                  at    = (size_t)str - vm->tempstring_start;
+        const qcrt_tempblock_t *block = &vm->tempstrings[at / QCRT_TEMPSTRING_BLOCK];
+        if (at % QCRT_TEMPSTRING_BLOCK < block->size)
+            return block->data + at % QCRT_TEMPSTRING_BLOCK;
+    }
+    return "<<<invalid string>>>";
+}
+
+/* strings never move once made, the arena is emptied after qcrt_exec */
+static inline int32_t qcrt_tempstring(qcrt_t *vm, const char *str) {
+    size_t            len = strlen(str) + 1;
+    size_t            at, index, offset, span;
+    qcrt_tempblock_t *block;
+
+    if (vm->tempstring_expired) {
+        vm->tempstring_at      = 0;
+        vm->tempstring_expired = 0;
+    }
+
+    /* a string does not cross blocks, it starts the next one instead */
+    at     = vm->tempstring_at;
+    offset = at % QCRT_TEMPSTRING_BLOCK;
+    if (offset && offset + len > QCRT_TEMPSTRING_BLOCK) {
+        at    += QCRT_TEMPSTRING_BLOCK - offset;
+        offset = 0;
+    }
+    index = at / QCRT_TEMPSTRING_BLOCK;
+    span  = (offset + len + QCRT_TEMPSTRING_BLOCK - 1) / QCRT_TEMPSTRING_BLOCK;
+
+    if (vm->tempblocks < index + span) {
+        if (!(vm->tempstrings = (qcrt_tempblock_t*)realloc(vm->tempstrings, (index + span) * sizeof(*vm->tempstrings)))) {
+            fprintf(stderr, "out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(vm->tempstrings + vm->tempblocks, 0, (index + span - vm->tempblocks) * sizeof(*vm->tempstrings));
+        vm->tempblocks = index + span;
+    }
+    block = &vm->tempstrings[index];
+    if (block->size < offset + len) {
+        free(block->data);
+        block->size = span * QCRT_TEMPSTRING_BLOCK;
+        if (!(block->data = (char*)malloc(block->size))) {
+            fprintf(stderr, "out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(block->data + offset, str, len);
+
+    vm->tempstring_at = span > 1 ? (index + span) * QCRT_TEMPSTRING_BLOCK : at + len;
+    return (int32_t)(vm->tempstring_start + at);
+}
+
+static inline const char *qcrt_fieldname(qcrt_t *vm, int32_t offset) {
+    size_t i;
+    for (i = 0; i < vm->prog->fieldcount; ++i)
+        if (vm->prog->fields[i].offset == offset)
+            return vm->prog->fields[i].name;
+    return "<<<invalid field>>>";
+}
+
+static inline int32_t qcrt_spawn(qcrt_t *vm) {
+    int32_t e;
+    for (e = 0; e < vm->entities; ++e) {
+        if (!vm->entitypool[e]) {
+            vm->entitypool[e] = 1;
+            memset(vm->entitydata + vm->entityfields * e, 0, vm->entityfields * sizeof(qcrt_slot_t));
+            return e;
+        }
+    }
+    if ((size_t)e >= vm->entitycapacity) {
+        size_t capacity = vm->entitycapacity;
+        vm->entitypool = (unsigned char*)qcrt_grow(vm->entitypool, &capacity, e + 1, 1);
+        capacity = vm->entitycapacity;
+        vm->entitydata = (qcrt_slot_t*)qcrt_grow(vm->entitydata, &capacity, e + 1,
+                                                  vm->entityfields * sizeof(qcrt_slot_t) + !vm->entityfields);
+        vm->entitycapacity = capacity;
+    }
+    vm->entitypool[e] = 1;
+    vm->entities++;
+    memset(vm->entitydata + vm->entityfields * e, 0, vm->entityfields * sizeof(qcrt_slot_t));
+    return e;
+}
+
+static inline void qcrt_free(qcrt_t *vm, int32_t e) {
+    if (!e) {
+        vm->vmerror++;
+        fprintf(stderr, "Trying to free world entity\n");
+        return;
+    }
+    if (e < 0 || e >= vm->entities) {
+        vm->vmerror++;
+        fprintf(stderr, "Trying to free out of bounds entity\n");
+        return;
+    }
+    if (!vm->entitypool[e]) {
+        vm->vmerror++;
+        fprintf(stderr, "Double free on entity\n");
+        return;
+    }
+    vm->entitypool[e] = 0;
+}
+
+/* the entity operations, they return non-zero where prog_exec stops */
+static inline int qcrt_load(qcrt_t *vm, int32_t e, int32_t field, qcrt_slot_t *out) {
+    if (e < 0 || e >= vm->entities) {
+        qcrt_error(vm, "progs `%s` attempted to read an out of bounds entity", vm->prog->filename);
+        return 1;
+    }
+    if ((uint32_t)field >= (uint32_t)vm->entityfields) {
+        qcrt_error(vm, "prog `%s` attempted to read an invalid field from entity (%i)", vm->prog->filename, (int)field);
+        return 1;
+    }
+    out->i = vm->entitydata[vm->entityfields * e + field].i;
+    return 0;
+}
+
+static inline int qcrt_load_v(qcrt_t *vm, int32_t e, int32_t field, qcrt_slot_t *out) {
+    const qcrt_slot_t *in;
+    if (e < 0 || e >= vm->entities) {
+        qcrt_error(vm, "progs `%s` attempted to read an out of bounds entity", vm->prog->filename);
+        return 1;
+    }
+    if (field < 0 || (size_t)field + 3 > vm->entityfields) {
+        qcrt_error(vm, "prog `%s` attempted to read an invalid field from entity (%i)", vm->prog->filename, (int)field + 2);
+        return 1;
+    }
+    in = vm->entitydata + vm->entityfields * e + field;
+    out[0].i = in[0].i;
+    out[1].i = in[1].i;
+    out[2].i = in[2].i;
+    return 0;
+}
+
+static inline int qcrt_address(qcrt_t *vm, int32_t e, int32_t field, qcrt_slot_t *out) {
+    if (e < 0 || e >= vm->entities) {
+        qcrt_error(vm, "prog `%s` attempted to address an out of bounds entity %i", vm->prog->filename, (int)e);
+        return 1;
+    }
+    if ((uint32_t)field >= (uint32_t)vm->entityfields) {
+        qcrt_error(vm, "prog `%s` attempted to read an invalid field from entity (%i)", vm->prog->filename, (int)field);
+        return 1;
+    }
+    out->i = (int32_t)(vm->entityfields * e) + field;
+    return 0;
+}
+
+static inline int qcrt_storep(qcrt_t *vm, int32_t ptr, const qcrt_slot_t *in) {
+    if (ptr < 0 || (size_t)ptr >= vm->entityfields * vm->entities) {
+        qcrt_error(vm, "`%s` attempted to write to an out of bounds edict (%i)", vm->prog->filename, (int)ptr);
+        return 1;
+    }
+    if ((size_t)ptr < vm->entityfields && !vm->allowworldwrites)
+        qcrt_error(vm, "`%s` tried to assign to world.%s (field %i)\n", vm->prog->filename,
+                   qcrt_fieldname(vm, ptr), (int)ptr);
+    vm->entitydata[ptr].i = in->i;
+    return vm->vmerror != 0;
+}
+
+static inline int qcrt_storep_v(qcrt_t *vm, int32_t ptr, const qcrt_slot_t *in) {
+    if (ptr < 0 || (size_t)ptr + 2 >= vm->entityfields * vm->entities) {
+        qcrt_error(vm, "`%s` attempted to write to an out of bounds edict (%i)", vm->prog->filename, (int)ptr);
+        return 1;
+    }
+    if ((size_t)ptr < vm->entityfields && !vm->allowworldwrites)
+        qcrt_error(vm, "`%s` tried to assign to world.%s (field %i)\n", vm->prog->filename,
+                   qcrt_fieldname(vm, ptr), (int)ptr);
+    vm->entitydata[ptr].i   = in[0].i;
+    vm->entitydata[ptr+1].i = in[1].i;
+    vm->entitydata[ptr+2].i = in[2].i;
+    return vm->vmerror != 0;
+}
+
+static inline int qcrt_state(qcrt_t *vm, float frame, int32_t think) {
+    const qcrt_program_t *prog = vm->prog;
+    qcrt_slot_t *ed;
+    int32_t      self;
+    if (prog->self < 0 || prog->time < 0 || prog->think < 0 || prog->nextthink < 0 || prog->frame < 0) {
+        qcrt_error(vm, "`%s` tried to execute a STATE operation but misses its defs!", prog->filename);
+        return 1;
+    }
+    self = vm->globals[prog->self].i;
+    if (self < 0 || self >= vm->entities) {
+        vm->vmerror++;
+        fprintf(stderr, "Accessing out of bounds edict %i\n", (int)self);
+        self = 0;
+    }
+    ed = vm->entitydata + vm->entityfields * self;
+    ed[prog->think].i     = think;
+    ed[prog->frame].f     = frame;
+    ed[prog->nextthink].f = vm->globals[prog->time].f + 0.1;
+    return vm->vmerror != 0;
+}
+
+static inline int qcrt_runaway(qcrt_t *vm) {
+    qcrt_error(vm, "`%s` hit the runaway loop counter limit of %li jumps", vm->prog->filename, vm->jumps);
+    return 1;
+}
+
+static inline int qcrt_call(qcrt_t *vm, int32_t fn, int argc) {
+    const qcrt_function_t *func;
+    qcrt_slot_t           *globals = vm->globals;
+    size_t                 localsp;
+    size_t                 parampos;
+    int32_t                p;
+    uint8_t                s;
+
+    if (!fn)
+        qcrt_error(vm, "nullptr function in `%s`", vm->prog->filename);
+    if (!fn || fn < 0 || (size_t)fn >= vm->prog->functioncount) {
+        qcrt_error(vm, "CALL outside the program in `%s`", vm->prog->filename);
+        return 1;
+    }
+
+    func     = &vm->prog->functions[fn];
+    vm->argc = argc;
+
+    if (func->entry < 0) {
+        /* negative statements are built in functions */
+        int32_t builtinnumber = -func->entry;
+        if ((size_t)builtinnumber < vm->builtins_count && vm->builtins[builtinnumber])
+            vm->builtins[builtinnumber](vm);
+        else
+            qcrt_error(vm, "No such builtin #%i in %s! Try updating your gmqcc sources",
+                       (int)builtinnumber, vm->prog->filename);
+        return vm->vmerror != 0;
+    }
+
+    /* back up locals */
+    localsp = vm->localsp;
+    if (func->locals) {
+        vm->localstack = (int32_t*)qcrt_grow(vm->localstack, &vm->localcapacity,
+                                             localsp + func->locals, sizeof(int32_t));
+        memcpy(vm->localstack + localsp, globals + func->firstlocal, func->locals * sizeof(int32_t));
+        vm->localsp += func->locals;
+    }
+
+    /* copy parameters */
+    parampos = func->firstlocal;
+    for (p = 0; p < func->nargs; ++p)
+        for (s = 0; s < func->argsize[p]; ++s)
+            globals[parampos++].i = globals[QCRT_OFS_PARM0 + 3*p + s].i;
+
+    if (func->native(vm))
+        return 1;
+
+    if (func->locals)
+        memcpy(globals + func->firstlocal, vm->localstack + localsp, func->locals * sizeof(int32_t));
+    vm->localsp = localsp;
+    return 0;
+}
+
+static inline void qcrt_init(qcrt_t *vm, const qcrt_program_t *prog) {
+    memset(vm, 0, sizeof(*vm));
+    vm->prog         = prog;
+    vm->globals      = prog->globals;
+    vm->entityfields = prog->entityfields;
+    vm->maxjumps     = QCRT_JUMPS;
+
+    /* the tempstrings are numbered after the others */
+    vm->strings          = prog->strings;
+    vm->stringsize       = prog->stringsize;
+    vm->tempstring_start = prog->stringsize;
+
+    /* spawn the world entity */
+    qcrt_spawn(vm);
+}
+
+static inline void qcrt_destroy(qcrt_t *vm) {
+    size_t i;
+    for (i = 0; i < vm->tempblocks; ++i)
+        free(vm->tempstrings[i].data);
+    free(vm->tempstrings);
+    free(vm->entitydata);
+    free(vm->entitypool);
+    free(vm->localstack);
+}
+
+/* runs a function of the program from the outside, like prog_exec */
+static inline int qcrt_exec(qcrt_t *vm, int32_t fn) {
+    int failed;
+    vm->jumps   = 0;
+    failed      = qcrt_call(vm, fn, vm->argc);
+    vm->localsp = 0;
+    vm->tempstring_expired = 1;
+    return failed || vm->vmerror;
+}
+
+#ifndef QCRT_NO_MAIN
+/* the builtins of qcvm */
+#define QCRT_ARG(num) (vm->globals + QCRT_OFS_PARM0 + 3*(num))
+#define QCRT_RET      (vm->globals + QCRT_OFS_RETURN)
+#define QCRT_CHECKARGS(num, name) do {                                          \
+    if (vm->argc != (num)) {                                                    \
+        vm->vmerror++;                                                          \
+        fprintf(stderr, "ERROR: invalid number of arguments for %s: %i, expected %i\n", \
+                (name), vm->argc, (num));                                       \
+        return -1;                                                              \
+    }                                                                           \
+} while (0)
+
+static int qcrt_qc_print(qcrt_t *vm) {
+    int i;
+    for (i = 0; i < vm->argc; ++i)
+        printf("%s", qcrt_getstring(vm, QCRT_ARG(i)->i));
+    return 0;
+}
+
+static int qcrt_qc_error(qcrt_t *vm) {
+    fprintf(stderr, "*** VM raised an error:\n");
+    qcrt_qc_print(vm);
+    vm->vmerror++;
+    return -1;
+}
+
+static int qcrt_qc_ftos(qcrt_t *vm) {
+    char buffer[512];
+    QCRT_CHECKARGS(1, "qc_ftos");
+    snprintf(buffer, sizeof(buffer), "%g", QCRT_ARG(0)->f);
+    QCRT_RET->i = qcrt_tempstring(vm, buffer);
+    return 0;
+}
+
+static int qcrt_qc_stof(qcrt_t *vm) {
+    QCRT_CHECKARGS(1, "qc_stof");
+    QCRT_RET->f = (float)strtod(qcrt_getstring(vm, QCRT_ARG(0)->i), NULL);
+    return 0;
+}
+
+static int qcrt_qc_stov(qcrt_t *vm) {
+    float v[3];
+    QCRT_CHECKARGS(1, "qc_stov");
+    (void)sscanf(qcrt_getstring(vm, QCRT_ARG(0)->i), " ' %f %f %f ' ", &v[0], &v[1], &v[2]);
+    QCRT_RET[0].f = v[0];
+    QCRT_RET[1].f = v[1];
+    QCRT_RET[2].f = v[2];
+    return 0;
+}
+
+static int qcrt_qc_vtos(qcrt_t *vm) {
+    char buffer[512];
+    QCRT_CHECKARGS(1, "qc_vtos");
+    snprintf(buffer, sizeof(buffer), "'%g %g %g'", QCRT_ARG(0)[0].f, QCRT_ARG(0)[1].f, QCRT_ARG(0)[2].f);
+    QCRT_RET->i = qcrt_tempstring(vm, buffer);
+    return 0;
+}
+
+static int qcrt_qc_etos(qcrt_t *vm) {
+    char buffer[512];
+    QCRT_CHECKARGS(1, "qc_etos");
+    snprintf(buffer, sizeof(buffer), "%i", (int)QCRT_ARG(0)->i);
+    QCRT_RET->i = qcrt_tempstring(vm, buffer);
+    return 0;
+}
+
+static int qcrt_qc_spawn(qcrt_t *vm) {
+    QCRT_CHECKARGS(0, "qc_spawn");
+    QCRT_RET->i = qcrt_spawn(vm);
+    return QCRT_RET->i ? 0 : -1;
+}
+
+static int qcrt_qc_kill(qcrt_t *vm) {
+    QCRT_CHECKARGS(1, "qc_kill");
+    qcrt_free(vm, QCRT_ARG(0)->i);
+    return 0;
+}
+
+static int qcrt_qc_sqrt(qcrt_t *vm) {
+    QCRT_CHECKARGS(1, "qc_sqrt");
+    QCRT_RET->f = sqrt(QCRT_ARG(0)->f);
+    return 0;
+}
+
+static int qcrt_qc_vlen(qcrt_t *vm) {
+    qcrt_slot_t *v = QCRT_ARG(0);
+    QCRT_CHECKARGS(1, "qc_vlen");
+    QCRT_RET->f = sqrt(v[0].f * v[0].f + v[1].f * v[1].f + v[2].f * v[2].f);
+    return 0;
+}
+
+static int qcrt_qc_normalize(qcrt_t *vm) {
+    qcrt_slot_t *v = QCRT_ARG(0);
+    float        out[3];
+    double       len;
+    QCRT_CHECKARGS(1, "qc_normalize");
+    len = sqrt(v[0].f * v[0].f + v[1].f * v[1].f + v[2].f * v[2].f);
+    if (len)
+        len = 1.0 / len;
+    else
+        len = 0;
+    out[0] = len * v[0].f;
+    out[1] = len * v[1].f;
+    out[2] = len * v[2].f;
+    QCRT_RET[0].f = out[0];
+    QCRT_RET[1].f = out[1];
+    QCRT_RET[2].f = out[2];
+    return 0;
+}
+
+static int qcrt_qc_strcat(qcrt_t *vm) {
+    const char *cstr1, *cstr2;
+    size_t      len1,   len2;
+    char       *buffer;
+    QCRT_CHECKARGS(2, "qc_strcat");
+    cstr1 = qcrt_getstring(vm, QCRT_ARG(0)->i);
+    cstr2 = qcrt_getstring(vm, QCRT_ARG(1)->i);
+    len1  = strlen(cstr1);
+    len2  = strlen(cstr2);
+    if (!(buffer = (char*)malloc(len1 + len2 + 1))) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(buffer, cstr1, len1);
+    memcpy(buffer+len1, cstr2, len2+1);
+    QCRT_RET->i = qcrt_tempstring(vm, buffer);
+    free(buffer);
+    return 0;
+}
+
+static int qcrt_qc_strcmp(qcrt_t *vm) {
+    const char *cstr1, *cstr2;
+    if (vm->argc != 2 && vm->argc != 3) {
+        fprintf(stderr, "ERROR: invalid number of arguments for strcmp/strncmp: %i, expected 2 or 3\n",
+                vm->argc);
+        return -1;
+    }
+    cstr1 = qcrt_getstring(vm, QCRT_ARG(0)->i);
+    cstr2 = qcrt_getstring(vm, QCRT_ARG(1)->i);
+    if (vm->argc == 3)
+        QCRT_RET->f = strncmp(cstr1, cstr2, QCRT_ARG(2)->f);
+    else
+        QCRT_RET->f = strcmp(cstr1, cstr2);
+    return 0;
+}
+
+static int qcrt_qc_floor(qcrt_t *vm) {
+    QCRT_CHECKARGS(1, "qc_floor");
+    QCRT_RET->f = floor(QCRT_ARG(0)->f);
+    return 0;
+}
+
+static int qcrt_qc_pow(qcrt_t *vm) {
+    QCRT_CHECKARGS(2, "qc_pow");
+    QCRT_RET->f = powf(QCRT_ARG(0)->f, QCRT_ARG(1)->f);
+    return 0;
+}
+
+static int qcrt_qc_findfloat(qcrt_t *vm) {
+    int32_t e, field;
+    QCRT_CHECKARGS(3, "qc_findfloat");
+    field = QCRT_ARG(1)->i;
+    if (field < 0 || (size_t)field >= vm->entityfields) {
+        fprintf(stderr, "findfloat: field %i out of bounds\n", (int)field);
+        vm->vmerror++;
+        return -1;
+    }
+    QCRT_RET->i = 0;
+    for (e = (QCRT_ARG(0)->i > 0 ? QCRT_ARG(0)->i : 0) + 1; e < vm->entities; ++e) {
+        if (vm->entitypool[e] && vm->entitydata[vm->entityfields * e + field].f == QCRT_ARG(2)->f) {
+            QCRT_RET->i = e;
+            break;
+        }
+    }
+    return 0;
+}
+
+static const qcrt_builtin_t qcrt_builtins[] = {
+    NULL,
+    &qcrt_qc_print,     /*   1   */
+    &qcrt_qc_ftos,      /*   2   */
+    &qcrt_qc_spawn,     /*   3   */
+    &qcrt_qc_kill,      /*   4   */
+    &qcrt_qc_vtos,      /*   5   */
+    &qcrt_qc_error,     /*   6   */
+    &qcrt_qc_vlen,      /*   7   */
+    &qcrt_qc_etos,      /*   8   */
+    &qcrt_qc_stof,      /*   9   */
+    &qcrt_qc_strcat,    /*   10  */
+    &qcrt_qc_strcmp,    /*   11  */
+    &qcrt_qc_normalize, /*   12  */
+    &qcrt_qc_sqrt,      /*   13  */
+    &qcrt_qc_floor,     /*   14  */
+    &qcrt_qc_pow,       /*   15  */
+    &qcrt_qc_stov,      /*   16  */
+    &qcrt_qc_findfloat  /*   17  */
+};
+
+static inline void qcrt_usage(const char *arg0) {
+    printf("usage: %s [options] [parameters]\n", arg0);
+    printf("options:\n");
+    printf("  -h, --help    print this message\n"
+           "  execution options and the program file of qcvm are accepted\n"
+           "  and ignored\n");
+    printf("parameters:\n");
+    printf("  -vector <V>   pass a vector parameter to main()\n"
+           "  -float  <f>   pass a float parameter to main()\n"
+           "  -string <s>   pass a string parameter to main() \n");
+}
+
+static int qcrt_main(const qcrt_program_t *prog, int argc, char **argv) {
+    qcrt_t  vm;
+    char  **params  = (char**)calloc(argc + 1, sizeof(char*)); /* option, value pairs */
+    int     nparams = 0;
+    int32_t fnmain  = -1;
+    size_t  i;
+    int     a;
+
+    for (a = 1; a < argc; ++a) {
+        const char *arg = argv[a];
+        if (!strcmp(arg, "-h") || !strcmp(arg, "-help") || !strcmp(arg, "--help")) {
+            qcrt_usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        }
+        if (!strcmp(arg, "-vector") || !strcmp(arg, "-string") || !strcmp(arg, "-float")) {
+            if (a + 1 >= argc) {
+                qcrt_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            params[2*nparams]   = argv[a];
+            params[2*nparams+1] = argv[++a];
+            nparams++;
+            continue;
+        }
+        if (arg[0] != '-')
+            continue; /* the program is built in */
+        /* the options of qcvm, with their values */
+        if (qcvm_option_has_value(arg) && ++a >= argc) {
+            qcrt_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    qcrt_init(&vm, prog);
+    vm.builtins       = qcrt_builtins;
+    vm.builtins_count = sizeof(qcrt_builtins) / sizeof(*qcrt_builtins);
+
+    for (i = 1; i < prog->functioncount; ++i)
+        if (!strcmp(prog->functions[i].name, "main"))
+            fnmain = (int32_t)i;
+
+    if (fnmain > 0) {
+        for (a = 0; a < nparams; ++a) {
+            qcrt_slot_t *arg   = vm.globals + QCRT_OFS_PARM0 + 3*a;
+            const char  *value = params[2*a+1];
+            float        v[3]  = { 0, 0, 0 };
+            arg[0].f = arg[1].f = arg[2].f = 0;
+            switch (params[2*a][1]) {
+                case 'v':
+                    (void)sscanf(value, " %f %f %f ", &v[0], &v[1], &v[2]);
+                    arg[0].f = v[0];
+                    arg[1].f = v[1];
+                    arg[2].f = v[2];
+                    break;
+                case 'f':
+                    arg->f = atof(value);
+                    break;
+                case 's':
+                    arg->i = qcrt_tempstring(&vm, value);
+                    break;
+            }
+        }
+        qcrt_exec(&vm, fnmain);
+    }
+    else
+        fprintf(stderr, "No main function found\n");
+
+    qcrt_destroy(&vm);
+    free(params);
+    return 0;
+}
+#endif /* !QCRT_NO_MAIN */
+
+#endif
@@ -0,0 +1,1227 @@
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <thread>
+
+#include "gmqcc.h"
+#include "jit.h"
+#include "qcvmopts.h"
+#include "think.h"
+#include "vecmath.h"
+
+/***********************************************************************
+ * The standalone executor, on top of the VM in exec.cpp
+ */
+
+const char *type_name[TYPE_COUNT] = {
+    "void",
+    "string",
+    "float",
+    "vector",
+    "entity",
+    "field",
+    "function",
+    "pointer",
+    "integer",
+
+    "variant",
+
+    "struct",
+    "union",
+    "array",
+
+    "nil",
+    "noexpr"
+};
+
+struct qcvm_parameter {
+    int         vtype;
+    const char *value;
+};
+
+static std::vector<qcvm_parameter> main_params;
+
+#define CheckArgs(num) do {                                                    \
+    if (prog->argc != (num)) {                                                 \
+        prog_error(prog, "ERROR: invalid number of arguments for %s: %i, expected %i", \
+                   __func__, prog->argc, (num));                               \
+        return -1;                                                             \
+    }                                                                          \
+} while (0)
+
+#define GetGlobal(idx) ((qcany_t*)(&prog->globals[0] + (idx)))
+#define GetArg(num) GetGlobal(OFS_PARM0 + 3*(num))
+#define Return(any) *(GetGlobal(OFS_RETURN)) = (any)
+
+static int qc_print(qc_program_t *prog) {
+    size_t i;
+    const char *laststr = nullptr;
+    for (i = 0; i < (size_t)prog->argc; ++i) {
+        qcany_t *str = (qcany_t*)(&prog->globals[0] + OFS_PARM0 + 3*i);
+        laststr = prog_getstring(prog, str->string);
+        printf("%s", laststr);
+    }
+    if (laststr && (prog->xflags & VMXF_TRACE)) {
+        size_t len = strlen(laststr);
+        if (!len || laststr[len-1] != '\n')
+            printf("\n");
+    }
+    return 0;
+}
+
+static int qc_error(qc_program_t *prog) {
+    fprintf(stderr, "*** VM raised an error:\n");
+    qc_print(prog);
+    prog->vmerror++;
+    return -1;
+}
+
+static int qc_ftos(qc_program_t *prog) {
+    char buffer[512];
+    qcany_t *num;
+    qcany_t str;
+    CheckArgs(1);
+    num = GetArg(0);
+    util_snprintf(buffer, sizeof(buffer), "%g", num->_float);
+    str.string = prog_tempstring(prog, buffer);
+    Return(str);
+    return 0;
+}
+
+static int qc_stof(qc_program_t *prog) {
+    qcany_t *str;
+    qcany_t num;
+    CheckArgs(1);
+    str = GetArg(0);
+    num._float = (float)strtod(prog_getstring(prog, str->string), nullptr);
+    Return(num);
+    return 0;
+}
+
+static int qc_stov(qc_program_t *prog) {
+    qcany_t *str;
+    qcany_t num;
+    CheckArgs(1);
+    str = GetArg(0);
+    (void)util_sscanf(prog_getstring(prog, str->string), " ' %f %f %f ' ",
+                      &num.vector[0],
+                      &num.vector[1],
+                      &num.vector[2]);
+    Return(num);
+    return 0;
+}
+
+static int qc_vtos(qc_program_t *prog) {
+    char buffer[512];
+    qcany_t *num;
+    qcany_t str;
+    CheckArgs(1);
+    num = GetArg(0);
+    util_snprintf(buffer, sizeof(buffer), "'%g %g %g'", num->vector[0], num->vector[1], num->vector[2]);
+    str.string = prog_tempstring(prog, buffer);
+    Return(str);
+    return 0;
+}
+
+static int qc_etos(qc_program_t *prog) {
+    char buffer[512];
+    qcany_t *num;
+    qcany_t str;
+    CheckArgs(1);
+    num = GetArg(0);
+    util_snprintf(buffer, sizeof(buffer), "%i", num->_int);
+    str.string = prog_tempstring(prog, buffer);
+    Return(str);
+    return 0;
+}
+
+static int qc_spawn(qc_program_t *prog) {
+    qcany_t ent;
+    CheckArgs(0);
+    ent.edict = prog_spawn_entity(prog);
+    Return(ent);
+    return (ent.edict ? 0 : -1);
+}
+
+static int qc_kill(qc_program_t *prog) {
+    qcany_t *ent;
+    CheckArgs(1);
+    ent = GetArg(0);
+    prog_free_entity(prog, ent->edict);
+    return 0;
+}
+
+static int qc_sqrt(qc_program_t *prog) {
+    qcany_t *num, out;
+    CheckArgs(1);
+    num = GetArg(0);
+    out._float = sqrt(num->_float);
+    Return(out);
+    return 0;
+}
+
+static int qc_vlen(qc_program_t *prog) {
+    qcany_t *vec, len;
+    CheckArgs(1);
+    vec = GetArg(0);
+    len._float = sqrt(qcvec_dot(vec, vec));
+    Return(len);
+    return 0;
+}
+
+static int qc_normalize(qc_program_t *prog) {
+    double len;
+    qcany_t *vec;
+    qcany_t out;
+    CheckArgs(1);
+    vec = GetArg(0);
+    len = sqrt(qcvec_dot(vec, vec));
+    if (len)
+        len = 1.0 / len;
+    else
+        len = 0;
+    /* scaled in double precision, which SIMD in single would round differently */
+    out.vector[0] = len * vec->vector[0];
+    out.vector[1] = len * vec->vector[1];
+    out.vector[2] = len * vec->vector[2];
+    Return(out);
+    return 0;
+}
+
+static int qc_strcat(qc_program_t *prog) {
+    char  *buffer;
+    size_t len1,   len2;
+    qcany_t *str1,  *str2;
+    qcany_t  out;
+
+    const char *cstr1;
+    const char *cstr2;
+
+    CheckArgs(2);
+    str1 = GetArg(0);
+    str2 = GetArg(1);
+    cstr1 = prog_getstring(prog, str1->string);
+    cstr2 = prog_getstring(prog, str2->string);
+    len1 = strlen(cstr1);
+    len2 = strlen(cstr2);
+    buffer = (char*)mem_a(len1 + len2 + 1);
+    memcpy(buffer, cstr1, len1);
+    memcpy(buffer+len1, cstr2, len2+1);
+    out.string = prog_tempstring(prog, buffer);
+    mem_d(buffer);
+    Return(out);
+    return 0;
+}
+
+static int qc_strcmp(qc_program_t *prog) {
+    qcany_t *str1,  *str2;
+    qcany_t out;
+
+    const char *cstr1;
+    const char *cstr2;
+
+    if (prog->argc != 2 && prog->argc != 3) {
+        prog_message(prog, "ERROR: invalid number of arguments for strcmp/strncmp: %i, expected 2 or 3",
+                     prog->argc);
+        return -1;
+    }
+
+    str1 = GetArg(0);
+    str2 = GetArg(1);
+    cstr1 = prog_getstring(prog, str1->string);
+    cstr2 = prog_getstring(prog, str2->string);
+    if (prog->argc == 3)
+        out._float = strncmp(cstr1, cstr2, GetArg(2)->_float);
+    else
+        out._float = strcmp(cstr1, cstr2);
+    Return(out);
+    return 0;
+}
+
+static int qc_floor(qc_program_t *prog) {
+    qcany_t *num, out;
+    CheckArgs(1);
+    num = GetArg(0);
+    out._float = floor(num->_float);
+    Return(out);
+    return 0;
+}
+
+static int qc_pow(qc_program_t *prog) {
+    qcany_t *base, *exp, out;
+    CheckArgs(2);
+    base = GetArg(0);
+    exp = GetArg(1);
+    out._float = powf(base->_float, exp->_float);
+    Return(out);
+    return 0;
+}
+
+/* the next entity after start whose field equals match, or world */
+static int qc_findfloat(qc_program_t *prog) {
+    qcany_t *start, *field, *match, out;
+    CheckArgs(3);
+    start = GetArg(0);
+    field = GetArg(1);
+    match = GetArg(2);
+    out.edict = 0;
+    if (field->_int < 0 || (size_t)field->_int >= prog->entityfields) {
+        prog_error(prog, "findfloat: field %i out of bounds", field->_int);
+        return -1;
+    }
+    for (qcint_t e = std::max(start->edict, 0) + 1; e < prog->entities; ++e) {
+        if (prog->entityfree[e / 64] & (uint64_t(1) << (e % 64)))
+            continue;
+        if (((qcany_t*)prog_entityword(prog, e, field->_int))->_float == match->_float) {
+            out.edict = e;
+            break;
+        }
+    }
+    Return(out);
+    return 0;
+}
+
+static prog_builtin_t qc_builtins[] = {
+    nullptr,
+    &qc_print,       /*   1   */
+    &qc_ftos,        /*   2   */
+    &qc_spawn,       /*   3   */
+    &qc_kill,        /*   4   */
+    &qc_vtos,        /*   5   */
+    &qc_error,       /*   6   */
+    &qc_vlen,        /*   7   */
+    &qc_etos,        /*   8   */
+    &qc_stof,        /*   9   */
+    &qc_strcat,      /*   10  */
+    &qc_strcmp,      /*   11  */
+    &qc_normalize,   /*   12  */
+    &qc_sqrt,        /*   13  */
+    &qc_floor,       /*   14  */
+    &qc_pow,         /*   15  */
+    &qc_stov,        /*   16  */
+    &qc_findfloat    /*   17  */
+};
+
+static const char *arg0 = nullptr;
+
+static void version(void) {
+    printf("GMQCC-QCVM %d.%d.%d Built %s %s\n",
+           GMQCC_VERSION_MAJOR,
+           GMQCC_VERSION_MINOR,
+           GMQCC_VERSION_PATCH,
+           __DATE__,
+           __TIME__
+    );
+}
+
+static void usage(void) {
+    printf("usage: %s [options] [parameters] file\n", arg0);
+    printf("options:\n");
+    printf("  -h, --help         print this message\n"
+           "  -trace             trace the execution\n"
+           "  -profile           perform profiling during execution\n"
+           "                     (with -v the executed statements are counted)\n"
+           "  -predecode         execute the predecoded form of the statements\n"
+           "  -fuse              fuse common pairs of statements, implies -predecode\n"
+           "  -profile-pairs     report the most executed pairs of statements\n"
+           "  -profile-report f  write the functions and lines by cost to f,\n"
+           "                     - for stdout, implies -profile\n"
+           "  -profile-callgrind f\n"
+           "                     write the profile in callgrind format to f\n"
+           "  -profile-folded f  write the folded call stacks for flame graphs to f\n"
+           "  -timing f          time the calls of functions and builtins, write\n"
+           "                     the times to f, - for stdout\n"
+           "  -lno file          read the line numbers for the reports from file\n"
+           "  -record f          keep the last statements executed in memory,\n"
+           "                     write them to f at exit, - to print them\n"
+           "  -record-size n     keep the last n statements, 4096 by default\n"
+           "  -decode-trace f    print the statements recorded in f and exit\n"
+           "  -bench func        call func instead of main and report the times\n"
+           "  -iterations n      time n calls of func, 1000 by default\n"
+           "  -warmup n          make n calls before timing them, 100 by default\n"
+           "  -snapshot-bench func\n"
+           "                     run main, then time snapshots of the program and\n"
+           "                     restoring them after each call of func\n"
+           "  -think-bench       run main, then time thinking the entities with a\n"
+           "                     think function on one thread and on worker threads\n"
+           "  -threads n         the worker threads for -think-bench, one per core\n"
+           "                     by default\n"
+           "  -verified          leave out the checks the verifier made at load\n"
+           "                     time, if the program passed it, implies -predecode\n"
+           "  -soa               lay the entities out by field instead of by entity\n"
+           "  -frames            back up the locals of re-entrant functions only\n"
+           "                     (with -v the calls doing so are counted)\n"
+           "  -jit               run functions as native code where possible\n"
+           "  -jit-threshold n   compile a function on its n-th call, implies -jit\n"
+           "  -info              print information from the prog's header\n"
+           "  -disasm            disassemble and exit\n"
+           "  -disasm-func func  disassemble and exit\n"
+           "  -printdefs         list the defs section\n"
+           "  -printfields       list the field section\n"
+           "  -printfuns         list functions information\n"
+           "  -v                 be verbose\n"
+           "  -vv                be even more verbose\n");
+    printf("parameters:\n");
+    printf("  -vector <V>   pass a vector parameter to main()\n"
+           "  -float  <f>   pass a float parameter to main()\n"
+           "  -string <s>   pass a string parameter to main() \n");
+}
+
+static void prog_main_setparams(qc_program_t *prog) {
+    size_t i;
+    qcany_t *arg;
+
+    for (i = 0; i < main_params.size(); ++i) {
+        arg = GetGlobal(OFS_PARM0 + 3*i);
+        arg->vector[0] = 0;
+        arg->vector[1] = 0;
+        arg->vector[2] = 0;
+        switch (main_params[i].vtype) {
+            case TYPE_VECTOR:
+                (void)util_sscanf(main_params[i].value, " %f %f %f ",
+                                       &arg->vector[0],
+                                       &arg->vector[1],
+                                       &arg->vector[2]);
+                break;
+            case TYPE_FLOAT:
+                arg->_float = atof(main_params[i].value);
+                break;
+            case TYPE_STRING:
+                arg->string = prog_tempstring(prog, main_params[i].value);
+                break;
+            default:
+                fprintf(stderr, "error: unhandled parameter type: %i\n", main_params[i].vtype);
+                break;
+        }
+    }
+}
+
+/* the median of some times, which are sorted for it */
+static double prog_median(std::vector<double> &times) {
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+/*
+ * Calls a function with the parameters given for main over and over,
+ * after some calls to warm up the caches and the JIT, and reports the
+ * distribution of the times. The statements are counted by one more
+ * profiled call, so they do not slow down the timed ones.
+ */
+static bool prog_bench(qc_program_t *prog, const char *name, size_t xflags,
+                       size_t iterations, size_t warmup)
+{
+    typedef std::chrono::steady_clock clock;
+    prog_section_function_t *func = prog_findfunction(prog, name);
+    std::vector<double> times;
+    size_t strings, bytes, entities, executed;
+    double median;
+
+    if (!func) {
+        fprintf(stderr, "-bench: no function named `%s`\n", name);
+        return false;
+    }
+    if (!iterations)
+        iterations = 1;
+
+    for (size_t i = 0; i < warmup; ++i) {
+        prog_main_setparams(prog);
+        if (!prog_exec(prog, func, xflags, VM_JUMPS_DEFAULT))
+            return false;
+    }
+
+    strings  = prog->tempstrings_made;
+    bytes    = prog->tempstring_bytes;
+    entities = prog->entities_spawned;
+    prog->tempstring_peak = 0;
+    times.reserve(iterations);
+    for (size_t i = 0; i < iterations; ++i) {
+        clock::time_point start;
+        size_t            passed = prog->tempstrings_made;
+        size_t            passed_bytes = prog->tempstring_bytes;
+        bool              ok;
+
+        /* strings passed in are not the function's allocations */
+        prog_main_setparams(prog);
+        strings += prog->tempstrings_made - passed;
+        bytes   += prog->tempstring_bytes - passed_bytes;
+        start = clock::now();
+        ok = prog_exec(prog, func, xflags, VM_JUMPS_DEFAULT);
+        times.push_back(std::chrono::duration<double, std::micro>(clock::now() - start).count());
+        if (!ok)
+            return false;
+    }
+    strings  = prog->tempstrings_made - strings;
+    bytes    = prog->tempstring_bytes - bytes;
+    entities = prog->entities_spawned - entities;
+
+    executed = prog->executed;
+    prog_main_setparams(prog);
+    if (!prog_exec(prog, func, (xflags & ~VMXF_JIT) | VMXF_PROFILE, VM_JUMPS_DEFAULT))
+        return false;
+    executed = prog->executed - executed;
+
+    median = prog_median(times);
+    printf("bench: %zu calls of `%s` after %zu to warm up\n", iterations, name, warmup);
+    printf("  min:        %.3f us\n", times.front());
+    printf("  median:     %.3f us\n", median);
+    printf("  p99:        %.3f us\n", times[std::min(times.size() - 1, times.size() * 99 / 100)]);
+    printf("  statements: %zu per call, %.0f per second\n",
+           executed, median > 0 ? executed / median * 1e6 : 0.0);
+    printf("  allocated:  %g strings, %g entities per call\n",
+           (double)strings / iterations, (double)entities / iterations);
+    printf("  strings:    %g bytes per call, at most %zu bytes in use\n",
+           (double)bytes / iterations, prog->tempstring_peak);
+    return true;
+}
+
+/*
+ * Times taking snapshots of the program, and restoring one after each call
+ * of a function: first with a snapshot taken in between, which makes the
+ * restore copy everything, then right after the call, which only copies
+ * back the entities it wrote to.
+ */
+static bool prog_snapshot_bench(qc_program_t *prog, const char *name, size_t xflags,
+                                size_t iterations, size_t warmup)
+{
+    typedef std::chrono::steady_clock clock;
+    prog_section_function_t *func = prog_findfunction(prog, name);
+    std::vector<double> taken, full, dirty;
+    qc_snapshot_t *snapshot, *check;
+    size_t restored = 0;
+    bool ok = true;
+
+    if (!func) {
+        fprintf(stderr, "-snapshot-bench: no function named `%s`\n", name);
+        return false;
+    }
+    if (!iterations)
+        iterations = 1;
+
+    snapshot = prog_snapshot(prog);
+    for (size_t i = 0; ok && i < warmup + 2 * iterations; ++i) {
+        clock::time_point start;
+
+        prog_main_setparams(prog);
+        if (!(ok = prog_exec(prog, func, xflags, VM_JUMPS_DEFAULT)))
+            break;
+
+        if (i >= warmup && i < warmup + iterations) {
+            start = clock::now();
+            prog_snapshot_delete(prog_snapshot(prog));
+            taken.push_back(std::chrono::duration<double, std::micro>(clock::now() - start).count());
+        }
+        if (i == warmup + iterations)
+            restored = prog->restored_entities;
+
+        start = clock::now();
+        ok = prog_restore(prog, snapshot);
+        if (i >= warmup)
+            (i < warmup + iterations ? full : dirty).push_back(
+                std::chrono::duration<double, std::micro>(clock::now() - start).count());
+    }
+    if (!ok) {
+        prog_snapshot_delete(snapshot);
+        return false;
+    }
+    restored = prog->restored_entities - restored;
+
+    /* whatever was copied back, the program has to be as it was */
+    check = prog_snapshot(prog);
+    ok = check->globals == snapshot->globals && check->entitydata == snapshot->entitydata;
+    prog_snapshot_delete(check);
+    prog_snapshot_delete(snapshot);
+    if (!ok) {
+        fprintf(stderr, "-snapshot-bench: restoring did not bring back the snapshot\n");
+        return false;
+    }
+
+    printf("snapshot-bench: %zu calls of `%s` after %zu to warm up\n", iterations, name, warmup);
+    printf("  state:      %zu globals, %i entities of %zu fields\n",
+           prog->globals.size(), (int)prog->entities, prog->entityfields);
+    printf("  snapshot:   %.3f us\n", prog_median(taken));
+    printf("  restore:    %.3f us copying everything\n", prog_median(full));
+    printf("  restore:    %.3f us copying what changed, %g entities per call\n",
+           prog_median(dirty), (double)restored / iterations);
+    return true;
+}
+
+/* the builtins which only read their parameters and the strings */
+static const size_t qc_builtins_safe[] = { 7, 9, 11, 12, 13, 14, 15, 16, 17 };
+
+/* the entities with a think function, which are not killed */
+static std::vector<qcint_t> prog_thinking(qc_program_t *prog) {
+    std::vector<qcint_t> entities;
+    for (qcint_t e = 1; e < prog->entities; ++e) {
+        if (prog->entityfree[e / 64] & (uint64_t(1) << (e % 64)))
+            continue;
+        if (*prog_entityword(prog, e, prog->cached_fields.think))
+            entities.push_back(e);
+    }
+    return entities;
+}
+
+/* thinks one after another, as an engine would */
+static bool prog_think_serial(qc_program_t *prog, const std::vector<qcint_t> &entities, size_t xflags) {
+    for (auto &it : entities) {
+        qcint_t function = *prog_entityword(prog, it, prog->cached_fields.think);
+        if (function <= 0 || (size_t)function >= prog->functions.size())
+            continue;
+        prog->globals[prog->cached_globals.self] = it;
+        if (!prog_exec(prog, &prog->functions[function], xflags, VM_JUMPS_DEFAULT))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Times frames thinking every entity with a think function, first one
+ * after another and then with prog_think_run, each from the state main
+ * left. A frame of both is compared beforehand, their entities have to
+ * come out the same.
+ */
+static bool prog_think_bench(qc_program_t *prog, size_t xflags, size_t threads,
+                             size_t iterations, size_t warmup)
+{
+    typedef std::chrono::steady_clock clock;
+    std::vector<qcint_t> entities = prog_thinking(prog);
+    std::vector<double>  serial, parallel;
+    qc_snapshot_t *start, *expect, *check;
+    qc_think_t *think;
+    size_t done, rerun;
+    bool ok;
+
+    if (!(think = prog_think_create(prog, threads)))
+        return false;
+    for (auto &it : qc_builtins_safe)
+        prog_think_safe(think, it);
+
+    start = prog_snapshot(prog);
+    ok = prog_think_serial(prog, entities, xflags);
+    expect = prog_snapshot(prog);
+    ok = ok && prog_restore(prog, start) && prog_think_run(think, entities.data(), entities.size(), xflags);
+    check = prog_snapshot(prog);
+    if (ok && check->entitydata != expect->entitydata) {
+        fprintf(stderr, "-think-bench: the entities differ from thinking one after another\n");
+        ok = false;
+    }
+    prog_snapshot_delete(check);
+    prog_snapshot_delete(expect);
+
+    for (size_t i = 0; ok && i < warmup + iterations; ++i) {
+        clock::time_point begin = clock::now();
+        ok = prog_think_serial(prog, entities, xflags);
+        if (i >= warmup)
+            serial.push_back(std::chrono::duration<double, std::micro>(clock::now() - begin).count());
+    }
+    ok = ok && prog_restore(prog, start);
+    done  = think->parallel;
+    rerun = think->serial;
+    for (size_t i = 0; ok && i < warmup + iterations; ++i) {
+        clock::time_point begin = clock::now();
+        ok = prog_think_run(think, entities.data(), entities.size(), xflags);
+        if (i >= warmup)
+            parallel.push_back(std::chrono::duration<double, std::micro>(clock::now() - begin).count());
+        if (i + 1 == warmup) {
+            done  = think->parallel;
+            rerun = think->serial;
+        }
+    }
+    done  = think->parallel - done;
+    rerun = think->serial - rerun;
+    prog_snapshot_delete(start);
+    prog_think_delete(think);
+    if (!ok || !iterations)
+        return ok;
+
+    printf("think-bench: %zu frames of %zu entities after %zu to warm up\n", iterations, entities.size(), warmup);
+    printf("  serial:     %.3f us per frame\n", prog_median(serial));
+    printf("  %zu threads:  %.3f us per frame, %g thinks on workers and %g run again per frame\n",
+           threads, prog_median(parallel), (double)done / iterations, (double)rerun / iterations);
+    return true;
+}
+
+struct qcvm_pair {
+    uint16_t first;
+    uint16_t second;
+    size_t   count;
+};
+
+/*
+ * Reports how often each pair of adjacent statements was executed, using
+ * the profile counters. Only statements which always fall through to the
+ * next one are considered, the counter of the first is exact for those.
+ */
+static void prog_print_pairs(qc_program_t *prog, size_t limit) {
+    std::map<uint32_t, size_t> counts;
+    std::vector<qcvm_pair> pairs;
+
+    for (size_t i = 0; i + 1 < prog->code.size(); ++i) {
+        uint16_t first  = prog->code[i].opcode;
+        uint16_t second = prog->code[i+1].opcode;
+        if (!prog->profile[i] || first >= VINSTR_END || second >= VINSTR_END)
+            continue;
+        if (first == INSTR_DONE || first == INSTR_RETURN || first == INSTR_GOTO ||
+            first == INSTR_IF   || first == INSTR_IFNOT)
+            continue;
+        counts[((uint32_t)first << 16) | second] += prog->profile[i];
+    }
+
+    for (auto &it : counts)
+        pairs.push_back({ (uint16_t)(it.first >> 16), (uint16_t)(it.first & 0xFFFF), it.second });
+    std::sort(pairs.begin(), pairs.end(), [](const qcvm_pair &a, const qcvm_pair &b) {
+        return a.count > b.count;
+    });
+
+    printf("%-12s %-12s %14s  %s\n", "first", "second", "count", "fused");
+    for (size_t i = 0; i < pairs.size() && (!limit || i < limit); ++i) {
+        printf("%-12s %-12s %14zu  %s\n",
+               util_instr_str[pairs[i].first],
+               util_instr_str[pairs[i].second],
+               pairs[i].count,
+               prog_fuse_pair(pairs[i].first, pairs[i].second) ? "yes" : "no");
+    }
+}
+
+int main(int argc, char **argv) {
+    size_t      i;
+    qcint_t       fnmain = -1;
+    qc_program_t *prog;
+    size_t      xflags = VMXF_DEFAULT;
+    bool        opts_printfields = false;
+    bool        opts_printdefs   = false;
+    bool        opts_printfuns   = false;
+    bool        opts_disasm      = false;
+    bool        opts_info        = false;
+    bool        opts_fuse        = false;
+    bool        opts_pairs       = false;
+    size_t      opts_jit_threshold = 0;
+    const char *opts_report      = nullptr;
+    const char *opts_callgrind   = nullptr;
+    const char *opts_folded      = nullptr;
+    const char *opts_lno         = nullptr;
+    const char *opts_timing      = nullptr;
+    const char *opts_record      = nullptr;
+    const char *opts_decode      = nullptr;
+    size_t      opts_record_size = VM_RECORD_DEFAULT;
+    const char *opts_bench       = nullptr;
+    size_t      opts_iterations  = 1000;
+    size_t      opts_warmup      = 100;
+    const char *opts_snapshot    = nullptr;
+    bool        opts_think       = false;
+    bool        opts_soa         = false;
+    size_t      opts_threads     = std::max(std::thread::hardware_concurrency(), 1u);
+    bool        noexec           = false;
+    const char *progsfile        = nullptr;
+    int         opts_v           = 0;
+    std::vector<const char*> dis_list;
+
+    arg0 = argv[0];
+
+    if (argc < 2) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+
+    while (argc > 1) {
+        if (qcvm_option_has_value(argv[1]) && argc <= 2) {
+            usage();
+            exit(EXIT_FAILURE);
+        }
+        if (!strcmp(argv[1], "-h") ||
+            !strcmp(argv[1], "-help") ||
+            !strcmp(argv[1], "--help"))
+        {
+            usage();
+            exit(EXIT_SUCCESS);
+        }
+        else if (!strcmp(argv[1], "-v")) {
+            ++opts_v;
+            --argc;
+            ++argv;
+        }
+        else if (!strncmp(argv[1], "-vv", 3)) {
+            const char *av = argv[1]+1;
+            for (; *av; ++av) {
+                if (*av == 'v')
+                    ++opts_v;
+                else {
+                    usage();
+                    exit(EXIT_FAILURE);
+                }
+            }
+            --argc;
+            ++argv;
+        }
+        else if (!strcmp(argv[1], "-version") ||
+                 !strcmp(argv[1], "--version"))
+        {
+            version();
+            exit(EXIT_SUCCESS);
+        }
+        else if (!strcmp(argv[1], "-trace")) {
+            --argc;
+            ++argv;
+            xflags |= VMXF_TRACE;
+        }
+        else if (!strcmp(argv[1], "-profile")) {
+            --argc;
+            ++argv;
+            xflags |= VMXF_PROFILE;
+        }
+        else if (!strcmp(argv[1], "-predecode")) {
+            --argc;
+            ++argv;
+            xflags |= VMXF_PREDECODE;
+        }
+        else if (!strcmp(argv[1], "-fuse")) {
+            --argc;
+            ++argv;
+            xflags |= VMXF_PREDECODE;
+            opts_fuse = true;
+        }
+        else if (!strcmp(argv[1], "-profile-pairs")) {
+            --argc;
+            ++argv;
+            xflags |= VMXF_PROFILE;
+            opts_pairs = true;
+        }
+        else if (!strcmp(argv[1], "-profile-report")) {
+            --argc;
+            ++argv;
+            xflags |= VMXF_PROFILE;
+            opts_report = argv[1];
+            --argc;
+            ++argv;
+        }
+        else if (!strcmp(argv[1], "-profile-callgrind")) {
+            --argc;
+            ++argv;
+            xflags |= VMXF_PROFILE;
+            opts_callgrind = argv[1];
+            --argc;
+            ++argv;
+        }
+        else if (!strcmp(argv[1], "-profile-folded")) {
+            --argc;
+            ++argv;
+            xflags |= VMXF_PROFILE;
+            opts_folded = argv[1];
+            --argc;
+            ++argv;
+        }
+        else if (!strcmp(argv[1], "-timing")) {
+            --argc;
+            ++argv;
+            xflags |= VMXF_TIMING;
+            opts_timing = argv[1];
+            --argc;
+            ++argv;
+        }
+        else if (!strcmp(argv[1], "-lno")) {
+            --argc;
+            ++argv;
+            opts_lno = argv[1];
+            --argc;
+            ++argv;
+        }
+        else if (!strcmp(argv[1], "-record")) {
+            --argc;
+            ++argv;
+            opts_record = argv[1];
+            xflags |= VMXF_RECORD;
+            --argc;
+            ++argv;
+        }
+        else if (!strcmp(argv[1], "-record-size")) {
+            --argc;
+            ++argv;
+            opts_record_size = strtoul(argv[1], nullptr, 10);
+            --argc;
+            ++argv;
+        }
+        else if (!strcmp(argv[1], "-decode-trace")) {
+            --argc;
+            ++argv;
+            opts_decode = argv[1];
+            --argc;
+            ++argv;
+        }
+        else if (!strcmp(argv[1], "-bench")) {
+            --argc;
+            ++argv;
+            opts_bench = argv[1];
+            --argc;
+            ++argv;
+        }
+        else if (!strcmp(argv[1], "-iterations")) {
+            --argc;
+            ++argv;
+            opts_iterations = strtoul(argv[1], nullptr, 10);
+            --argc;
+            ++argv;
+        }
+        else if (!strcmp(argv[1], "-warmup")) {
+            --argc;
+            ++argv;
+            opts_warmup = strtoul(argv[1], nullptr, 10);
+            --argc;
+            ++argv;
+        }
+        else if (!strcmp(argv[1], "-snapshot-bench")) {
+            --argc;
+            ++argv;
+            opts_snapshot = argv[1];
+            --argc;
+            ++argv;
+        }
+        else if (!strcmp(argv[1], "-think-bench")) {
+            --argc;
+            ++argv;
+            opts_think = true;
+        }
+        else if (!strcmp(argv[1], "-threads")) {
+            --argc;
+            ++argv;
+            opts_threads = strtoul(argv[1], nullptr, 10);
+            --argc;
+            ++argv;
+        }
+        else if (!strcmp(argv[1], "-soa")) {
+            --argc;
+            ++argv;
+            opts_soa = true;
+        }
+        else if (!strcmp(argv[1], "-verified")) {
+            --argc;
+            ++argv;
+            xflags |= VMXF_VERIFIED;
+        }
+        else if (!strcmp(argv[1], "-frames")) {
+            --argc;
+            ++argv;
+            xflags |= VMXF_FRAMES;
+        }
+        else if (!strcmp(argv[1], "-jit")) {
+            --argc;
+            ++argv;
+            xflags |= VMXF_JIT;
+        }
+        else if (!strcmp(argv[1], "-jit-threshold")) {
+            --argc;
+            ++argv;
+            xflags |= VMXF_JIT;
+            opts_jit_threshold = strtoul(argv[1], nullptr, 10);
+            --argc;
+            ++argv;
+        }
+        else if (!strcmp(argv[1], "-info")) {
+            --argc;
+            ++argv;
+            opts_info = true;
+            noexec = true;
+        }
+        else if (!strcmp(argv[1], "-disasm")) {
+            --argc;
+            ++argv;
+            opts_disasm = true;
+            noexec = true;
+        }
+        else if (!strcmp(argv[1], "-disasm-func")) {
+            --argc;
+            ++argv;
+            dis_list.emplace_back(argv[1]);
+            --argc;
+            ++argv;
+            noexec = true;
+        }
+        else if (!strcmp(argv[1], "-printdefs")) {
+            --argc;
+            ++argv;
+            opts_printdefs = true;
+            noexec = true;
+        }
+        else if (!strcmp(argv[1], "-printfuns")) {
+            --argc;
+            ++argv;
+            opts_printfuns = true;
+            noexec = true;
+        }
+        else if (!strcmp(argv[1], "-printfields")) {
+            --argc;
+            ++argv;
+            opts_printfields = true;
+            noexec = true;
+        }
+        else if (!strcmp(argv[1], "-vector") ||
+                 !strcmp(argv[1], "-string") ||
+                 !strcmp(argv[1], "-float") )
+        {
+            qcvm_parameter p;
+            if (argv[1][1] == 'f')
+                p.vtype = TYPE_FLOAT;
+            else if (argv[1][1] == 's')
+                p.vtype = TYPE_STRING;
+            else if (argv[1][1] == 'v')
+                p.vtype = TYPE_VECTOR;
+            else
+                p.vtype = TYPE_VOID;
+
+            --argc;
+            ++argv;
+            p.value = argv[1];
+
+            main_params.emplace_back(p);
+            --argc;
+            ++argv;
+        }
+        else if (!strcmp(argv[1], "--")) {
+            --argc;
+            ++argv;
+            break;
+        }
+        else if (argv[1][0] != '-') {
+            if (progsfile) {
+                fprintf(stderr, "only 1 program file may be specified\n");
+                usage();
+                exit(EXIT_FAILURE);
+            }
+            progsfile = argv[1];
+            --argc;
+            ++argv;
+        }
+        else
+        {
+            fprintf(stderr, "unknown parameter: %s\n", argv[1]);
+            usage();
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (argc == 2 && !progsfile) {
+        progsfile = argv[1];
+        --argc;
+        ++argv;
+    }
+
+    if (!progsfile) {
+        fprintf(stderr, "must specify a program to execute\n");
+        usage();
+        exit(EXIT_FAILURE);
+    }
+
+    prog = prog_load(progsfile, noexec);
+    if (!prog) {
+        fprintf(stderr, "failed to load program '%s'\n", progsfile);
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 1; i < GMQCC_ARRAY_COUNT(qc_builtins); ++i)
+        prog_setbuiltin(prog, i, qc_builtins[i]);
+
+    if (opts_info) {
+        printf("Program's system-checksum = 0x%04x\n", (unsigned int)prog->crc16);
+        printf("Entity field space: %u\n", (unsigned int)prog->entityfields);
+        printf("Globals: %zu\n", prog->globals.size());
+        printf("Counts:\n"
+               "      code: %zu\n"
+               "      defs: %zu\n"
+               "    fields: %zu\n"
+               " functions: %zu\n"
+               "   strings: %zu\n",
+               prog->code.size(),
+               prog->defs.size(),
+               prog->fields.size(),
+               prog->functions.size(),
+               prog->strings.size());
+    }
+
+    if (opts_info) {
+        prog_delete(prog);
+        return 0;
+    }
+    for (i = 0; i < dis_list.size(); ++i) {
+        size_t k;
+        printf("Looking for `%s`\n", dis_list[i]);
+        for (k = 1; k < prog->functions.size(); ++k) {
+            const char *name = prog_getstring(prog, prog->functions[k].name);
+            if (!strcmp(name, dis_list[i])) {
+                prog_disasm_function(prog, k);
+                break;
+            }
+        }
+    }
+    if (opts_disasm) {
+        for (i = 1; i < prog->functions.size(); ++i)
+            prog_disasm_function(prog, i);
+        return 0;
+    }
+    if (opts_decode) {
+        bool decoded = prog_record_decode(prog, opts_decode, opts_lno);
+        prog_delete(prog);
+        return decoded ? 0 : 1;
+    }
+    if (opts_printdefs) {
+        const char *getstring = nullptr;
+        for (auto &it : prog->defs) {
+            printf("Global: %8s %-16s at %u%s",
+                   type_name[it.type & DEF_TYPEMASK],
+                   prog_getstring(prog, it.name),
+                   (unsigned int)it.offset,
+                   ((it.type & DEF_SAVEGLOBAL) ? " [SAVE]" : ""));
+            if (opts_v) {
+                switch (it.type & DEF_TYPEMASK) {
+                    case TYPE_FLOAT:
+                        printf(" [init: %g]", ((qcany_t*)(&prog->globals[0] + it.offset))->_float);
+                        break;
+                    case TYPE_INTEGER:
+                        printf(" [init: %i]", (int)( ((qcany_t*)(&prog->globals[0] + it.offset))->_int ));
+                        break;
+                    case TYPE_ENTITY:
+                    case TYPE_FUNCTION:
+                    case TYPE_FIELD:
+                    case TYPE_POINTER:
+                        printf(" [init: %u]", (unsigned)( ((qcany_t*)(&prog->globals[0] + it.offset))->_int ));
+                        break;
+                    case TYPE_STRING:
+                        getstring = prog_getstring(prog, ((qcany_t*)(&prog->globals[0] + it.offset))->string);
+                        printf(" [init: `");
+                        prog_print_string(getstring, strlen(getstring));
+                        printf("`]\n");
+                        break;
+                    default:
+                        break;
+                }
+            }
+            printf("\n");
+        }
+    }
+    if (opts_printfields) {
+        for (auto &it : prog->fields) {
+            printf("Field: %8s %-16s at %d%s\n",
+                   type_name[it.type],
+                   prog_getstring(prog, it.name),
+                   it.offset,
+                   ((it.type & DEF_SAVEGLOBAL) ? " [SAVE]" : ""));
+        }
+    }
+    if (opts_printfuns) {
+        for (auto &it : prog->functions) {
+            int32_t a;
+            printf("Function: %-16s taking %u parameters:(",
+                   prog_getstring(prog, it.name),
+                   (unsigned int)it.nargs);
+            for (a = 0; a < it.nargs; ++a) {
+                printf(" %i", it.argsize[a]);
+            }
+            if (opts_v > 1) {
+                int32_t start = it.entry;
+                if (start < 0)
+                    printf(") builtin %i\n", (int)-start);
+                else {
+                    size_t funsize = 0;
+                    const prog_section_statement_t *st = &prog->code[0] + start;
+                    for (;st->opcode != INSTR_DONE; ++st)
+                        ++funsize;
+                    printf(") - %zu instructions", funsize);
+                    if (opts_v > 2) {
+                        printf(" - locals: %i + %i\n",
+                               it.firstlocal,
+                               it.locals);
+                    }
+                    else
+                        printf("\n");
+                }
+            }
+            else if (opts_v) {
+                printf(") locals: %i + %i\n",
+                       it.firstlocal,
+                       it.locals);
+            }
+            else
+                printf(")\n");
+        }
+    }
+    if (!noexec) {
+        for (i = 1; i < prog->functions.size(); ++i) {
+            const char *name = prog_getstring(prog, prog->functions[i].name);
+            if (!strcmp(name, "main"))
+                fnmain = (qcint_t)i;
+        }
+        if (fnmain > 0 || opts_bench)
+        {
+            if (xflags & VMXF_PREDECODE)
+                prog_predecode(prog);
+            if (opts_fuse)
+                prog_fuse(prog, 0);
+            if (opts_soa)
+                prog_soa(prog);
+            if ((xflags & VMXF_VERIFIED) && !prog->verified) {
+                fprintf(stderr, "-verified: %s\n", prog->unverified.c_str());
+                prog_delete(prog);
+                return EXIT_FAILURE;
+            }
+            if ((xflags & VMXF_JIT) && !prog_jit(prog, opts_jit_threshold)) {
+                fprintf(stderr, "-jit is not supported on this platform, interpreting\n");
+                xflags &= ~VMXF_JIT;
+            }
+            if (xflags & VMXF_RECORD)
+                prog_record(prog, opts_record_size);
+            if (opts_bench) {
+                if (!prog_bench(prog, opts_bench, xflags, opts_iterations, opts_warmup)) {
+                    prog_delete(prog);
+                    return EXIT_FAILURE;
+                }
+            } else {
+                prog_main_setparams(prog);
+                prog_exec(prog, &prog->functions[fnmain], xflags, VM_JUMPS_DEFAULT);
+            }
+            if (opts_snapshot && !prog_snapshot_bench(prog, opts_snapshot, xflags, opts_iterations, opts_warmup)) {
+                prog_delete(prog);
+                return EXIT_FAILURE;
+            }
+            if (opts_think && !prog_think_bench(prog, xflags, opts_threads, opts_iterations, opts_warmup)) {
+                prog_delete(prog);
+                return EXIT_FAILURE;
+            }
+            if (opts_record)
+                prog_record_write(prog, opts_record);
+            if ((xflags & VMXF_PROFILE) && opts_v) {
+                size_t executed = 0;
+                for (auto &it : prog->profile)
+                    executed += it;
+                printf("executed %zu statements\n", executed);
+            }
+            if (opts_report)
+                prog_profile_report(prog, opts_report, opts_lno);
+            if (opts_callgrind)
+                prog_profile_callgrind(prog, opts_callgrind, opts_lno);
+            if (opts_folded)
+                prog_profile_folded(prog, opts_folded);
+            if (opts_timing)
+                prog_timing_report(prog, opts_timing, opts_lno);
+            if (opts_pairs)
+                prog_print_pairs(prog, opts_v ? 0 : 32);
+            if ((xflags & VMXF_FRAMES) && opts_v)
+                printf("frames: %zu calls without backing up the locals, %zu with\n",
+                       prog->frames_fast, prog->frames_saved);
+            if (opts_v > 1)
+                printf("tempstrings: %zu made, %zu bytes, at most %zu bytes in use\n",
+                       prog->tempstrings_made, prog->tempstring_bytes, prog->tempstring_peak);
+            if (prog->jit && opts_v)
+                printf("jit: %zu functions compiled, %zu interpreted\n",
+                       prog->jit->compiled, prog->jit->failed);
+        }
+        else
+            fprintf(stderr, "No main function found\n");
+    }
+
+    prog_delete(prog);
+    return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef GMQCC_QCVMOPTS_HDR
+#define GMQCC_QCVMOPTS_HDR
+#include <string.h>
+
+/*
+ * The options of qcvm taking a value. qcvm checks that the value is there
+ * by this list, and the main() of qcrt.h, which accepts every option of
+ * qcvm and ignores it, skips over the value of these. It is plain C for
+ * qcrt.h.
+ */
+static const char *const qcvm_value_options[] = {
+    "-profile-report", "-profile-callgrind", "-profile-folded", "-timing",
+    "-lno", "-record", "-record-size", "-decode-trace", "-bench",
+    "-iterations", "-warmup", "-snapshot-bench", "-threads",
+    "-jit-threshold", "-disasm-func", "-vector", "-float", "-string"
+};
+
+static inline int qcvm_option_has_value(const char *arg) {
+    size_t i;
+    for (i = 0; i < sizeof(qcvm_value_options) / sizeof(*qcvm_value_options); ++i)
+        if (!strcmp(arg, qcvm_value_options[i]))
+            return 1;
+    return 0;
+}
+
+#endif
@@ -18,6 +18,12 @@ static const char *task_bins[] = {
     "./qcvm"
 };
 
+/*
+ * With -aot the programs of execution tests are also written as C with
+ * -emit-c, which is built against qcrt.h and run in place of the QCVM.
+ */
+static bool task_aot = false;
+
 struct popen_t {
     FILE *handles[3];
     int pipes[3];
@@ -153,8 +159,9 @@ static int task_pclose(FILE **handles) {
  *          Used to set the compilation flags for the given task, this
  *          must be provided, this tag is NOT optional.
  *
- *      F:  Used to set some test suite flags, currently the only option
- *          is -no-defs (to including of defs.qh)
+ *      F:  Used to set some test suite flags, currently the options are
+ *          -no-defs (to including of defs.qh) and -no-aot (to run the
+ *          test on the QCVM even with -aot, for what only the QCVM does)
  *
  *      E:
  *          Used to set the execution flags for the given task. This tag
@@ -573,6 +580,13 @@ struct task_t {
 
 static std::vector<task_t> task_tasks;
 
+/* whether the test runs as C written with -emit-c rather than on the QCVM */
+static bool task_aot_runs(const task_template_t *tmpl) {
+    if (!task_aot || strcmp(tmpl->proceduretype, "-execute"))
+        return false;
+    return !tmpl->testflags || strcmp(tmpl->testflags, "-no-aot");
+}
+
 /*
  * Read a directory and searches for all template files in it
  * which is later used to run all tests.
@@ -732,6 +746,11 @@ static bool task_propagate(const char *curdir, size_t *pad, const char *defs) {
                     }
                 }
 
+                if (task_aot_runs(tmpl)) {
+                    size_t len = strlen(buf);
+                    util_snprintf(buf + len, sizeof(buf) - len, " -emit-c=%s.c", tmpl->tempfilename);
+                }
+
                 /*
                  * The task template was compiled, now lets create a task from
                  * the template data which has now been propagated.
@@ -821,6 +840,20 @@ static void task_destroy(void) {
                 con_err("error removing stderr log file: %s\n", it.stderrlogfile);
 
             (void)!remove(it.tmpl->tempfilename);
+            if (!strcmp(it.tmpl->proceduretype, "-execute")) {
+                /* the line numbers of tests compiled with -flno */
+                char buffer[4096];
+                util_snprintf(buffer, sizeof(buffer), "%.*s.lno",
+                    (int)(strlen(it.tmpl->tempfilename) - 4), it.tmpl->tempfilename);
+                (void)!remove(buffer);
+            }
+            if (task_aot_runs(it.tmpl)) {
+                char buffer[4096];
+                util_snprintf(buffer, sizeof(buffer), "%s.c", it.tmpl->tempfilename);
+                (void)!remove(buffer);
+                util_snprintf(buffer, sizeof(buffer), "%s.bin", it.tmpl->tempfilename);
+                (void)!remove(buffer);
+            }
         }
 
         /* free util_strdup data for log files */
@@ -844,22 +877,62 @@ static bool task_trymatch(task_t &task, std::vector<char *> &line) {
     FILE *execute;
     char buffer[4096];
     task_template_t *tmpl = task.tmpl;
+    const char *qcvmflags;
 
     memset(buffer,0,sizeof(buffer));
 
-    if (!strcmp(tmpl->proceduretype, "-execute")) {
+    if (task_aot_runs(tmpl)) {
+        /*
+         * Build the C written by the compiler, the binary takes the
+         * same parameters as the QCVM and ignores its execution modes.
+         */
+        const char *cc;
+        if (!(cc = getenv("CC")))
+            cc = "cc";
+
+        util_snprintf(buffer, sizeof(buffer), "%s -std=c99 -O1 -ffp-contract=off -I. -o %s.bin %s.c -lm",
+            cc,
+            tmpl->tempfilename,
+            tmpl->tempfilename
+        );
+        if (system(buffer) != EXIT_SUCCESS) {
+            con_err("test failure: `%s` (failed to build the C program) [%s]\n",
+                tmpl->description,
+                tmpl->rulesfile
+            );
+            return false;
+        }
+
+        util_snprintf(buffer, sizeof(buffer), "%s.bin %s",
+            tmpl->tempfilename,
+            strcmp(tmpl->executeflags, "$null") ? tmpl->executeflags : ""
+        );
+
+        execute = popen(buffer, "r");
+        if (!execute)
+            return false;
+    } else if (!strcmp(tmpl->proceduretype, "-execute")) {
+        /*
+         * Additional QCVMFLAGS enviroment variable may be used to
+         * run all tests with some execution mode of the QCVM.
+         */
+        if (!(qcvmflags = getenv("QCVMFLAGS")))
+            qcvmflags = "";
+
         /*
          * Drop the execution flags for the QCVM if none where
          * actually specified.
          */
         if (!strcmp(tmpl->executeflags, "$null")) {
-            util_snprintf(buffer,  sizeof(buffer), "%s %s",
+            util_snprintf(buffer,  sizeof(buffer), "%s %s %s",
                 task_bins[TASK_EXECUTE],
+                qcvmflags,
                 tmpl->tempfilename
             );
         } else {
-            util_snprintf(buffer,  sizeof(buffer), "%s %s %s",
+            util_snprintf(buffer,  sizeof(buffer), "%s %s %s %s",
                 task_bins[TASK_EXECUTE],
+                qcvmflags,
                 tmpl->executeflags,
                 tmpl->tempfilename
             );
@@ -1271,6 +1344,7 @@ static bool parsecmd(const char *optname, int *argc_, char ***argv_, char **out,
 int main(int argc, char **argv) {
     bool succeed  = false;
     char *defs = nullptr;
+    char *bin  = nullptr;
 
     con_init();
 
@@ -1286,6 +1360,16 @@ int main(int argc, char **argv) {
             if (parsecmd("defs", &argc, &argv, &defs, 1, false))
                 continue;
 
+            /* other builds of the compiler and the QCVM to test */
+            if (parsecmd("gmqcc", &argc, &argv, &bin, 1, false)) {
+                task_bins[TASK_COMPILE] = bin;
+                continue;
+            }
+            if (parsecmd("qcvm", &argc, &argv, &bin, 1, false)) {
+                task_bins[TASK_EXECUTE] = bin;
+                continue;
+            }
+
             if (!strcmp(argv[0]+1, "debug")) {
                 OPTS_OPTION_BOOL(OPTION_DEBUG) = true;
                 continue;
@@ -1294,6 +1378,10 @@ int main(int argc, char **argv) {
                 con_color(0);
                 continue;
             }
+            if (!strcmp(argv[0]+1, "aot")) {
+                task_aot = true;
+                continue;
+            }
 
             con_err("invalid argument %s\n", argv[0]+1);
             return -1;
@@ -0,0 +1,400 @@
+/*
+ * Checks what libqcvm gives a program embedding it, on the programs of
+ * the testsuite: the reports it writes and the state it keeps.
+ *
+ * usage: qcvm-embed <gmqcc> <tests>
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "gmqcc.h"
+#include "think.h"
+
+static const char *embed_dat    = "qcvm-embed.dat";
+static const char *embed_report = "qcvm-embed.report";
+
+/* what a program printed and raised, reached through prog->user */
+struct embed_vm {
+    std::string output;
+    std::string errors;
+    float       factor = 10;
+};
+
+static void embed_error(qc_program_t *, const char *message, void *user) {
+    embed_vm *vm = (embed_vm*)user;
+    vm->errors += message;
+    vm->errors += '\n';
+}
+
+static int embed_print(qc_program_t *prog) {
+    embed_vm *vm = (embed_vm*)prog->user;
+    for (int i = 0; i < prog->argc; ++i)
+        vm->output += prog_getstring(prog, prog->globals[OFS_PARM0 + 3*i]);
+    return 0;
+}
+
+static int embed_ftos(qc_program_t *prog) {
+    char buffer[64];
+    util_snprintf(buffer, sizeof(buffer), "%g", ((qcany_t*)&prog->globals[OFS_PARM0])->_float);
+    prog->globals[OFS_RETURN] = prog_tempstring(prog, buffer);
+    return 0;
+}
+
+static int embed_spawn(qc_program_t *prog) {
+    prog->globals[OFS_RETURN] = prog_spawn_entity(prog);
+    return 0;
+}
+
+static int embed_kill(qc_program_t *prog) {
+    prog_free_entity(prog, prog->globals[OFS_PARM0]);
+    return 0;
+}
+
+/* reads prog->user on the workers of the think executor too */
+static int embed_factor(qc_program_t *prog) {
+    ((qcany_t*)&prog->globals[OFS_RETURN])->_float = ((embed_vm*)prog->user)->factor;
+    return 0;
+}
+
+/* compiles a program of the testsuite with defs.qh and loads it */
+static qc_program_t *embed_load(const char *gmqcc, const char *tests, const char *file, embed_vm *vm) {
+    std::string   compile;
+    qc_program_t *prog;
+
+    compile = std::string(gmqcc) + " -q -std=gmqcc " + tests + "/defs.qh " + tests + "/" + file + " -o " + embed_dat;
+    if (system(compile.c_str())) {
+        fprintf(stderr, "failed to compile `%s`\n", file);
+        return nullptr;
+    }
+    prog = prog_load(embed_dat, false, &embed_error, vm);
+    remove(embed_dat);
+    if (!prog) {
+        fprintf(stderr, "failed to load `%s`: %s", file, vm->errors.c_str());
+        return nullptr;
+    }
+    prog_setbuiltin(prog, 1, &embed_print);
+    prog_setbuiltin(prog, 2, &embed_ftos);
+    prog_setbuiltin(prog, 3, &embed_spawn);
+    prog_setbuiltin(prog, 4, &embed_kill);
+    prog_setbuiltin(prog, 20, &embed_factor);
+    return prog;
+}
+
+static bool embed_call(qc_program_t *prog, const char *name, size_t flags) {
+    prog_section_function_t *func = prog_findfunction(prog, name);
+    if (!func) {
+        fprintf(stderr, "no function `%s`\n", name);
+        return false;
+    }
+    return prog_exec(prog, func, flags, VM_JUMPS_DEFAULT);
+}
+
+/* the timing report has a row for every function called, with its calls */
+static bool embed_timing(const char *gmqcc, const char *tests) {
+    std::map<std::string, size_t> expect = {
+        { "main", 1 }, { "square", 4 }, { "fib", 25 }, { "ftos", 2 }, { "print", 1 }
+    };
+    std::map<std::string, size_t> rows;
+    char         *line = nullptr;
+    size_t        size = 0;
+    bool          ok;
+    embed_vm      vm;
+    FILE         *fp;
+    qc_program_t *prog = embed_load(gmqcc, tests, "profile.qc", &vm);
+
+    if (!prog)
+        return false;
+    ok = embed_call(prog, "main", VMXF_TIMING) && prog_timing_report(prog, embed_report, nullptr);
+    prog_delete(prog);
+    if (!ok || vm.output != "14 8\n") {
+        fprintf(stderr, "timing: the program printed `%s`: %s", vm.output.c_str(), vm.errors.c_str());
+        return false;
+    }
+
+    if (!(fp = fopen(embed_report, "r")))
+        return false;
+    ok = util_getline(&line, &size, fp) != EOF && strstr(line, "self us") && strstr(line, "function");
+    while (ok && util_getline(&line, &size, fp) != EOF && !strstr(line, "us in the program")) {
+        char   name[64];
+        size_t calls;
+        if (sscanf(line, "%*f %*f%% %*f %zu %*f %63s", &calls, name) != 2) {
+            ok = false;
+            break;
+        }
+        rows[name] = calls;
+    }
+    fclose(fp);
+    mem_d(line);
+    remove(embed_report);
+
+    if (!ok || rows != expect) {
+        fprintf(stderr, "timing: the report lacks its header or has other rows\n");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * fusing with a threshold after a profiled run touches only the pairs run
+ * that often: the comparison in fib runs 25 times, the one of the loop in
+ * main 5 times.
+ */
+static bool embed_fuse(const char *gmqcc, const char *tests) {
+    static const size_t threshold = 10;
+    size_t        hot  = 0;
+    size_t        cold = 0;
+    bool          ok;
+    embed_vm      vm;
+    qc_program_t *prog = embed_load(gmqcc, tests, "profile.qc", &vm);
+
+    if (!prog)
+        return false;
+    ok = embed_call(prog, "main", VMXF_PROFILE);
+    if (ok) {
+        prog_fuse(prog, threshold);
+        for (size_t i = 0; ok && i + 1 < prog->code.size(); ++i) {
+            uint16_t fused  = prog_fuse_pair(prog->code[i].opcode, prog->code[i+1].opcode);
+            uint16_t expect = prog->code[i].opcode;
+            if (fused && prog->profile[i] >= threshold) {
+                expect = fused;
+                ++hot;
+            } else if (fused && prog->profile[i]) {
+                ++cold;
+            }
+            if (prog->decoded[i].opcode != expect) {
+                fprintf(stderr, "fuse: statement %zu run %zu times has opcode %u instead of %u\n",
+                        i, prog->profile[i], (unsigned)prog->decoded[i].opcode, (unsigned)expect);
+                ok = false;
+            }
+        }
+    }
+    if (ok && (!hot || !cold)) {
+        fprintf(stderr, "fuse: found %zu hot and %zu cold pairs\n", hot, cold);
+        ok = false;
+    }
+    ok = ok && embed_call(prog, "main", VMXF_PREDECODE);
+    prog_delete(prog);
+    if (!ok || vm.output != "14 8\n14 8\n") {
+        fprintf(stderr, "fuse: the program printed `%s`: %s", vm.output.c_str(), vm.errors.c_str());
+        return false;
+    }
+    return true;
+}
+
+/* an entity spawned again after a restore starts out empty, in either layout */
+static bool embed_spawn_restore(const char *gmqcc, const char *tests) {
+    for (int soa = 0; soa < 2; ++soa) {
+        std::vector<qcint_t> fields;
+        qc_snapshot_t       *snapshot;
+        qcint_t              e;
+        bool                 ok;
+        embed_vm             vm;
+        qc_program_t        *prog = embed_load(gmqcc, tests, "embed.qc", &vm);
+
+        if (!prog)
+            return false;
+        if (soa)
+            prog_soa(prog);
+        snapshot = prog_snapshot(prog);
+        ok = embed_call(prog, "mark_one", 0) && prog_restore(prog, snapshot) && vm.errors.empty();
+        e = prog_spawn_entity(prog);
+        fields.resize(prog->entityfields);
+        prog_read_entity(prog, e, fields.data());
+        for (auto &it : fields)
+            ok = ok && !it;
+        prog_snapshot_delete(snapshot);
+        prog_delete(prog);
+        if (!ok) {
+            fprintf(stderr, "spawn after restore: entity %d keeps the fields it had before%s\n%s",
+                    (int)e, soa ? " with prog_soa" : "", vm.errors.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+/* what a restore has to bring back */
+struct embed_state {
+    qcint_t               entities;
+    std::vector<uint64_t> entityfree;
+    std::vector<qcint_t>  globals;
+    std::vector<qcint_t>  fields;
+    std::string           label;
+
+    bool operator==(const embed_state &other) const {
+        return entities   == other.entities   &&
+               entityfree == other.entityfree &&
+               globals    == other.globals    &&
+               fields     == other.fields     &&
+               label      == other.label;
+    }
+};
+
+static embed_state embed_capture(qc_program_t *prog) {
+    embed_state state;
+    qcint_t     c     = prog->globals[prog_finddef(prog, "c")->offset];
+    qcint_t     label = prog_findfield(prog, "label")->offset;
+
+    state.entities   = prog->entities;
+    state.entityfree = prog->entityfree;
+    state.globals    = prog->globals;
+    state.fields.resize(prog->entities * prog->entityfields);
+    for (qcint_t e = 0; e < prog->entities; ++e)
+        prog_read_entity(prog, e, &state.fields[e * prog->entityfields]);
+    state.label = prog_getstring(prog, state.fields[c * prog->entityfields + label]);
+    return state;
+}
+
+static bool embed_same(qc_program_t *prog, const embed_state &state, const char *step) {
+    embed_state now = embed_capture(prog);
+    if (now == state)
+        return true;
+    fprintf(stderr, "snapshot: %s: %d entities, %s, c.label `%s`\n", step, (int)now.entities,
+            now.entityfree != state.entityfree ? "other entities killed" :
+            now.fields     != state.fields     ? "other fields" :
+            now.globals    != state.globals    ? "other globals" : "the same fields",
+            now.label.c_str());
+    return false;
+}
+
+/* a spawned entity has no fields set */
+static bool embed_spawn_empty(qc_program_t *prog, qcint_t expect, const char *step) {
+    std::vector<qcint_t> fields(prog->entityfields);
+    qcint_t              e = prog_spawn_entity(prog);
+
+    prog_read_entity(prog, e, fields.data());
+    for (auto &it : fields) {
+        if (it || e != expect) {
+            fprintf(stderr, "snapshot: %s: spawned entity %d, not an empty %d\n", step, (int)e, (int)expect);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Restoring the latest snapshot copies back what was written since,
+ * restoring an older one copies everything: either brings back the
+ * entities, which of them were killed, their fields and the globals, and
+ * the tempstrings after their numbers were taken again.
+ */
+static bool embed_snapshot(const char *gmqcc, const char *tests) {
+    for (int soa = 0; soa < 2; ++soa) {
+        qc_snapshot_t *first, *second;
+        embed_state    state;
+        bool           ok;
+        embed_vm       vm;
+        qc_program_t  *prog = embed_load(gmqcc, tests, "embed.qc", &vm);
+
+        if (!prog)
+            return false;
+        if (soa)
+            prog_soa(prog);
+        if (!embed_call(prog, "setup", 0)) {
+            prog_delete(prog);
+            return false;
+        }
+        prog_getfield(prog, prog->globals[prog_finddef(prog, "c")->offset],
+                      prog_findfield(prog, "label")->offset)->string = prog_tempstring(prog, "alpha");
+        state = embed_capture(prog);
+        first = prog_snapshot(prog);
+
+        /* the latest snapshot, after the number of "alpha" was taken again */
+        ok = embed_call(prog, "change", 0) && prog_tempstring(prog, "omega") &&
+             prog_restore(prog, first) && embed_same(prog, state, "restoring the latest") &&
+             embed_spawn_empty(prog, 2, "spawning a killed entity") &&
+             embed_spawn_empty(prog, 4, "spawning past the end") &&
+             prog_restore(prog, first) && embed_same(prog, state, "restoring it again");
+
+        /* and an older one */
+        second = prog_snapshot(prog);
+        ok = ok && embed_call(prog, "change", 0) && prog_restore(prog, second) &&
+             embed_call(prog, "change", 0) && prog_restore(prog, first) &&
+             embed_same(prog, state, "restoring an older one") && vm.errors.empty();
+
+        prog_snapshot_delete(first);
+        prog_snapshot_delete(second);
+        prog_delete(prog);
+        if (!ok) {
+            fprintf(stderr, "snapshot: failed%s\n%s", soa ? " with prog_soa" : "", vm.errors.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * The thinks of thinkers in embed.qc on workers: the one reading what
+ * another one writes and the two writing the same entity are run again,
+ * which leaves what running them one after another would.
+ */
+static bool embed_think(const char *gmqcc, const char *tests) {
+    static const qcint_t entities[] = { 1, 2, 3, 4, 5 };
+    static const float   expect[]   = { 2, 20, 5, 0, 70 };
+    static const size_t  threads[]  = { 1, 3 };
+
+    for (auto &it : threads) {
+        qc_think_t   *think = nullptr;
+        qcint_t       mark;
+        bool          ok;
+        embed_vm      vm;
+        qc_program_t *prog = embed_load(gmqcc, tests, "embed.qc", &vm);
+
+        if (!prog)
+            return false;
+        ok = embed_call(prog, "thinkers", 0) && (think = prog_think_create(prog, it));
+        if (ok) {
+            prog_think_safe(think, 20);
+            ok = prog_think_run(think, entities, GMQCC_ARRAY_COUNT(entities), 0) &&
+                 think->parallel == 2 && think->serial == 3;
+        }
+        mark = prog_findfield(prog, "mark")->offset;
+        for (size_t i = 0; ok && i < GMQCC_ARRAY_COUNT(entities); ++i)
+            ok = prog_getfield(prog, entities[i], mark)->_float == expect[i];
+        if (!ok) {
+            fprintf(stderr, "think: on %zu threads %zu thinks ran in parallel and %zu again, marks",
+                    it, think ? think->parallel : 0, think ? think->serial : 0);
+            for (size_t i = 0; i < GMQCC_ARRAY_COUNT(entities) && entities[i] < prog->entities; ++i)
+                fprintf(stderr, " %g", prog_getfield(prog, entities[i], mark)->_float);
+            fprintf(stderr, "\n%s", vm.errors.c_str());
+        }
+        if (think)
+            prog_think_delete(think);
+        prog_delete(prog);
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    static bool (*const checks[])(const char*, const char*) = {
+        &embed_timing,
+        &embed_fuse,
+        &embed_spawn_restore,
+        &embed_snapshot,
+        &embed_think
+    };
+    size_t failed = 0;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <gmqcc> <tests>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (auto &it : checks)
+        if (!it(argv[1], argv[2]))
+            ++failed;
+
+    if (failed) {
+        printf("embed: %zu of %zu checks failed\n", failed, GMQCC_ARRAY_COUNT(checks));
+        return EXIT_FAILURE;
+    }
+    printf("embed: %zu checks succeeded\n", GMQCC_ARRAY_COUNT(checks));
+    return EXIT_SUCCESS;
+}
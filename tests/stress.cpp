@@ -0,0 +1,165 @@
+/*
+ * Runs many programs on libqcvm at once.  Every thread loads its own
+ * programs with their own builtins and error callback, and checks that
+ * nothing ends up in another program's output.
+ *
+ * usage: qcvm-stress <gmqcc> <stress.qc>
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gmqcc.h"
+
+#define STRESS_THREADS 8
+#define STRESS_ROUNDS  32
+#define STRESS_RUNS    4
+
+static const char *stress_dat = "qcvm-stress.dat";
+
+/* what a program printed and raised, reached through prog->user */
+struct stress_vm {
+    std::string output;
+    std::string errors;
+};
+
+static void stress_error(qc_program_t *, const char *message, void *user) {
+    stress_vm *vm = (stress_vm*)user;
+    vm->errors += message;
+    vm->errors += '\n';
+}
+
+static int stress_print(qc_program_t *prog) {
+    stress_vm *vm = (stress_vm*)prog->user;
+    for (int i = 0; i < prog->argc; ++i)
+        vm->output += prog_getstring(prog, prog->globals[OFS_PARM0 + 3*i]);
+    return 0;
+}
+
+static int stress_ftos(qc_program_t *prog) {
+    char buffer[64];
+    util_snprintf(buffer, sizeof(buffer), "%g", ((qcany_t*)&prog->globals[OFS_PARM0])->_float);
+    prog->globals[OFS_RETURN] = prog_tempstring(prog, buffer);
+    return 0;
+}
+
+static int stress_spawn(qc_program_t *prog) {
+    prog->globals[OFS_RETURN] = prog_spawn_entity(prog);
+    return 0;
+}
+
+static int stress_kill(qc_program_t *prog) {
+    prog_free_entity(prog, prog->globals[OFS_PARM0]);
+    return 0;
+}
+
+static qc_program_t *stress_load(stress_vm *vm) {
+    qc_program_t *prog = prog_load(stress_dat, false, &stress_error, vm);
+    if (!prog)
+        return nullptr;
+    prog_setbuiltin(prog, 1, &stress_print);
+    prog_setbuiltin(prog, 2, &stress_ftos);
+    prog_setbuiltin(prog, 3, &stress_spawn);
+    prog_setbuiltin(prog, 4, &stress_kill);
+    return prog;
+}
+
+static bool stress_run(qc_program_t *prog, size_t flags, float seed) {
+    ((qcany_t*)&prog->globals[OFS_PARM0])->_float = seed;
+    return prog_exec(prog, prog_findfunction(prog, "main"), flags, VM_JUMPS_DEFAULT);
+}
+
+/* each round runs a program with other execution flags, one of them failing */
+static void stress_thread(int thread, size_t *failed) {
+    static const uint16_t fib[] = { 144, 233, 377, 610 };
+
+    for (int round = 0; round < STRESS_ROUNDS; ++round) {
+        stress_vm     vm;
+        std::string   expect;
+        size_t        flags = VMXF_DEFAULT;
+        qc_program_t *prog  = stress_load(&vm);
+
+        if (!prog) {
+            fprintf(stderr, "thread %d: failed to load `%s`: %s", thread, stress_dat, vm.errors.c_str());
+            ++*failed;
+            return;
+        }
+
+        switch ((thread + round) % 4) {
+            case 1: prog_predecode(prog); flags = VMXF_PREDECODE; break;
+            case 2: prog_fuse(prog, 0);   flags = VMXF_PREDECODE; break;
+            case 3: flags = prog_jit(prog, 0) ? VMXF_JIT : VMXF_DEFAULT; break;
+        }
+
+        if (thread == round) {
+            if (stress_run(prog, flags, -1) || vm.errors != "Trying to free world entity\n") {
+                fprintf(stderr, "thread %d round %d: expected the error, got `%s`\n",
+                        thread, round, vm.errors.c_str());
+                ++*failed;
+            }
+            prog_delete(prog);
+            continue;
+        }
+
+        for (int run = 0; run < STRESS_RUNS; ++run) {
+            char  line[128];
+            int   seed = (thread * STRESS_ROUNDS + round) * STRESS_RUNS + run;
+            util_snprintf(line, sizeof(line), "%d %d %d\n", seed, 200 * seed + 19900, fib[seed & 3]);
+            expect += line;
+            if (!stress_run(prog, flags, seed))
+                break;
+        }
+
+        if (vm.output != expect || !vm.errors.empty()) {
+            fprintf(stderr, "thread %d round %d: expected\n%sgot\n%serrors\n%s",
+                    thread, round, expect.c_str(), vm.output.c_str(), vm.errors.c_str());
+            ++*failed;
+        }
+        prog_delete(prog);
+    }
+}
+
+int main(int argc, char **argv) {
+    std::vector<std::thread> threads;
+    size_t                   failed[STRESS_THREADS] = { 0 };
+    size_t                   total = 0;
+    std::string              compile;
+    stress_vm                vm;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <gmqcc> <stress.qc>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    compile = std::string(argv[1]) + " -q -std=gmqcc " + argv[2] + " -o " + stress_dat;
+    if (system(compile.c_str())) {
+        fprintf(stderr, "failed to compile `%s`\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    /* errors while loading come without a program */
+    if (prog_load("qcvm-stress.missing", false, &stress_error, &vm) || vm.errors.empty()) {
+        fprintf(stderr, "loading a missing file did not report an error\n");
+        ++total;
+    }
+
+    for (int i = 0; i < STRESS_THREADS; ++i)
+        threads.emplace_back(stress_thread, i, &failed[i]);
+    for (auto &it : threads)
+        it.join();
+    for (auto &it : failed)
+        total += it;
+
+    remove(stress_dat);
+
+    if (total) {
+        printf("stress: %zu of %d programs failed\n", total, STRESS_THREADS * STRESS_ROUNDS);
+        return EXIT_FAILURE;
+    }
+    printf("stress: %d programs on %d threads succeeded\n", STRESS_THREADS * STRESS_ROUNDS, STRESS_THREADS);
+    return EXIT_SUCCESS;
+}
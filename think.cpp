@@ -0,0 +1,272 @@
+#include <string.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "think.h"
+
+/* an entity a think wrote to, with its fields afterwards at data */
+struct qc_think_write_t {
+    qcint_t entity;
+    size_t  think;
+    size_t  data;
+};
+
+/* an entity a think read from */
+struct qc_think_read_t {
+    qcint_t entity;
+    size_t  think;
+};
+
+struct qc_think_worker_t {
+    qc_program_t                 *prog;
+    std::vector<qc_think_write_t> writes;
+    std::vector<qc_think_read_t>  reads;
+    std::vector<qcint_t>          data;
+    std::vector<size_t>           conflicts; /* the thinks to run again */
+    std::vector<qcint_t>          entity;
+    size_t                        ran;
+};
+
+/* the errors of a worker only mean the think is run again */
+static void think_error(qc_program_t *, const char *, void *) {
+}
+
+static int think_unsafe(qc_program_t *prog) {
+    prog_error(prog, "builtin not safe on a worker");
+    return 0;
+}
+
+qc_think_t *prog_think_create(qc_program_t *prog, size_t threads) {
+    qc_think_t *think;
+    std::vector<uint8_t> local;
+
+    if (!prog_finddef(prog, "self") || !prog_findfield(prog, "think")) {
+        prog_error(prog, "`%s` has no self and think to run", prog->filename.c_str());
+        return nullptr;
+    }
+
+    think = new qc_think_t;
+    think->prog = prog;
+    think->parallel = 0;
+    think->serial = 0;
+    for (size_t i = 0; i < std::max(threads, (size_t)1); ++i) {
+        qc_think_worker_t *worker = new qc_think_worker_t;
+        worker->prog = prog_clone(prog);
+        worker->prog->error = &think_error;
+        think->workers.push_back(worker);
+    }
+
+    /* the locals and parameters of functions are dead after a think */
+    local.assign(prog->globals.size(), 0);
+    for (size_t i = 0; i <= OFS_PARM7 + 2 && i < local.size(); ++i)
+        local[i] = 1;
+    for (auto &it : prog->functions)
+        for (size_t i = it.firstlocal; i < (size_t)it.firstlocal + it.locals && i < local.size(); ++i)
+            local[i] = 1;
+    local[prog->cached_globals.self] = 1;
+    for (size_t i = 0; i < local.size(); ++i)
+        if (!local[i])
+            think->shared.push_back(i);
+    return think;
+}
+
+void prog_think_safe(qc_think_t *think, size_t builtin) {
+    if (builtin >= think->safe.size())
+        think->safe.resize(builtin + 1, 0);
+    think->safe[builtin] = 1;
+}
+
+void prog_think_delete(qc_think_t *think) {
+    for (auto &it : think->workers) {
+        prog_delete(it->prog);
+        delete it;
+    }
+    delete think;
+}
+
+/* brings a worker's copy of the program up to what it is now */
+static void think_sync(qc_think_t *think, qc_think_worker_t *worker) {
+    qc_program_t *prog  = think->prog;
+    qc_program_t *clone = worker->prog;
+    size_t fields = prog->entityfields;
+
+    std::copy(prog->globals.begin(), prog->globals.end(), clone->globals.begin());
+
+    clone->entitychunks.resize(prog->entitychunks.size());
+    for (size_t i = 0; i < prog->entitychunks.size(); ++i) {
+        if (!clone->entitychunks[i])
+            clone->entitychunks[i].reset(new qcint_t[VM_ENTITY_CHUNK * fields]);
+        memcpy(clone->entitychunks[i].get(), prog->entitychunks[i].get(), VM_ENTITY_CHUNK * fields * sizeof(qcint_t));
+    }
+    clone->entitystride = prog->entitystride;
+    clone->fieldstride = prog->fieldstride;
+    clone->entities = prog->entities;
+    clone->entityfree = prog->entityfree;
+    clone->entityfree_from = prog->entityfree_from;
+    clone->entitydirty.assign(prog->entityfree.size(), 0);
+    clone->entityread.assign(prog->entityfree.size(), 0);
+
+    clone->builtins = prog->builtins;
+    for (size_t i = 0; i < clone->builtins.size(); ++i)
+        if (clone->builtins[i] && (i >= think->safe.size() || !think->safe[i]))
+            clone->builtins[i] = &think_unsafe;
+    clone->allowworldwrites = prog->allowworldwrites;
+}
+
+/* the function in the think field of an entity, if there is one */
+static prog_section_function_t *think_function(qc_program_t *prog, qcint_t e) {
+    qcint_t function;
+
+    if (e <= 0 || e >= prog->entities)
+        return nullptr;
+    function = *prog_entityword(prog, e, prog->cached_fields.think);
+    if (function <= 0 || (size_t)function >= prog->functions.size())
+        return nullptr;
+    return &prog->functions[function];
+}
+
+static void think_worker(qc_think_t *think, qc_think_worker_t *worker,
+                         const qcint_t *entities, size_t begin, size_t end, size_t flags)
+{
+    qc_program_t *prog  = think->prog;
+    qc_program_t *clone = worker->prog;
+    size_t fields = prog->entityfields;
+
+    worker->entity.resize(fields);
+    worker->writes.clear();
+    worker->reads.clear();
+    worker->data.clear();
+    worker->conflicts.clear();
+    worker->ran = 0;
+    think_sync(think, worker);
+
+    for (size_t i = begin; i < end; ++i) {
+        prog_section_function_t *func = think_function(prog, entities[i]);
+        size_t made = clone->tempstrings_made;
+        size_t spawned = clone->entities_spawned;
+        bool conflict;
+
+        if (!func)
+            continue;
+
+        worker->ran++;
+        clone->globals[prog->cached_globals.self] = entities[i];
+        conflict = !prog_exec(clone, &clone->functions[func - &prog->functions[0]], flags, VM_JUMPS_DEFAULT) ||
+                   clone->tempstrings_made != made ||
+                   clone->entities_spawned != spawned;
+
+        for (auto &it : think->shared) {
+            if (clone->globals[it] != prog->globals[it]) {
+                clone->globals[it] = prog->globals[it];
+                conflict = true;
+            }
+        }
+
+        /*
+         * A think run again still counts as writing what it wrote here, the
+         * thinks after it which read or wrote the same have to see that.
+         */
+        for (size_t word = 0; word < clone->entityread.size(); ++word) {
+            for (uint64_t read = clone->entityread[word]; read; read &= read - 1) {
+                qcint_t e = word * 64 + prog_ctz64(read);
+                if (e < prog->entities)
+                    worker->reads.push_back({ e, i });
+            }
+        }
+
+        /* take out what it wrote and put the entities back, drop the spawned ones */
+        for (size_t word = 0; word < clone->entitydirty.size(); ++word) {
+            for (uint64_t dirty = clone->entitydirty[word]; dirty; dirty &= dirty - 1) {
+                qcint_t e = word * 64 + prog_ctz64(dirty);
+                if (e >= prog->entities)
+                    continue;
+                worker->writes.push_back({ e, i, worker->data.size() });
+                worker->data.resize(worker->data.size() + fields);
+                prog_read_entity(clone, e, &worker->data[worker->writes.back().data]);
+                prog_read_entity(prog, e, worker->entity.data());
+                prog_write_entity(clone, e, worker->entity.data());
+            }
+            clone->entitydirty[word] = 0;
+        }
+        if (clone->entities_spawned != spawned) {
+            clone->entities = prog->entities;
+            clone->entityfree = prog->entityfree;
+            clone->entityfree_from = prog->entityfree_from;
+            clone->entitydirty.resize(prog->entityfree.size());
+            clone->entityread.resize(prog->entityfree.size());
+        }
+        std::fill(clone->entityread.begin(), clone->entityread.end(), 0);
+        if (conflict)
+            worker->conflicts.push_back(i);
+    }
+}
+
+/*
+ * Runs the think function of each of the entities, the ones a worker could
+ * not run as described in think.h in their order afterwards. Entities
+ * without a think function are left out. Returns false when one of the
+ * thinks run on the program itself failed.
+ */
+bool prog_think_run(qc_think_t *think, const qcint_t *entities, size_t count, size_t flags) {
+    qc_program_t *prog = think->prog;
+    size_t workers = std::min(think->workers.size(), std::max(count, (size_t)1));
+    size_t worker_flags = flags & (VMXF_PREDECODE|VMXF_FRAMES|VMXF_VERIFIED);
+    std::vector<std::thread> threads;
+    bool ok = true;
+
+    for (size_t i = 1; i < workers; ++i)
+        threads.emplace_back(think_worker, think, think->workers[i], entities,
+                             count * i / workers, count * (i + 1) / workers, worker_flags);
+    think_worker(think, think->workers[0], entities, 0, count / workers, worker_flags);
+    for (auto &it : threads)
+        it.join();
+
+    /* thinks writing an entity another think wrote to are run again */
+    think->writer.assign(prog->entities, 0);
+    think->rerun.assign(count, 0);
+    for (size_t i = 0; i < workers; ++i) {
+        for (auto &it : think->workers[i]->conflicts)
+            think->rerun[it] = 1;
+        for (auto &it : think->workers[i]->writes) {
+            size_t &writer = think->writer[it.entity];
+            if (writer && writer != it.think + 1) {
+                think->rerun[writer - 1] = 1;
+                think->rerun[it.think] = 1;
+            }
+            writer = it.think + 1;
+        }
+    }
+
+    /* and so are the ones reading an entity another think wrote to */
+    for (size_t i = 0; i < workers; ++i) {
+        for (auto &it : think->workers[i]->reads) {
+            size_t writer = think->writer[it.entity];
+            if (writer && writer != it.think + 1)
+                think->rerun[it.think] = 1;
+        }
+    }
+
+    for (size_t i = 0; i < workers; ++i) {
+        qc_think_worker_t *worker = think->workers[i];
+        for (auto &it : worker->writes)
+            if (!think->rerun[it.think])
+                prog_write_entity(prog, it.entity, &worker->data[it.data]);
+    }
+
+    for (size_t i = 0; i < workers; ++i)
+        think->parallel += think->workers[i]->ran;
+    for (size_t i = 0; i < count; ++i) {
+        prog_section_function_t *func;
+        if (!think->rerun[i])
+            continue;
+        think->parallel--;
+        think->serial++;
+        if (!(func = think_function(prog, entities[i])))
+            continue;
+        prog->globals[prog->cached_globals.self] = entities[i];
+        if (!prog_exec(prog, func, flags, VM_JUMPS_DEFAULT))
+            ok = false;
+    }
+    return ok;
+}
@@ -0,0 +1,47 @@
+#ifndef GMQCC_THINK_HDR
+#define GMQCC_THINK_HDR
+#include "gmqcc.h"
+
+/*
+ * Runs the think functions of entities on worker threads. Each worker is
+ * a clone of the program sharing its code, defs and strings, with its own
+ * globals, entities, stack of locals and tempstrings, brought up to date
+ * at the start of every run.
+ *
+ * Every think on a worker sees the program as it was when the run began:
+ * the entities it wrote to are taken out and the worker's copies put back
+ * after it. A think is run again on the program itself, after the others
+ * were merged into it, when it
+ *
+ *  - wrote to an entity another think wrote to as well,
+ *  - read from an entity another think wrote to, as it saw the entity from
+ *    before the run,
+ *  - wrote to a global which is not a local of some function,
+ *  - made a tempstring, which only exists on the worker,
+ *  - spawned an entity, called a builtin not marked with prog_think_safe
+ *    or failed.
+ *
+ * Builtins marked safe get the user of the program on every worker, they
+ * may run on several threads at once. The entities they read have to go
+ * through prog_getfield or prog_read_entity to be noticed.
+ */
+struct qc_think_worker_t;
+
+struct qc_think_t {
+    qc_program_t                    *prog;
+    std::vector<qc_think_worker_t*>  workers;
+    std::vector<uint8_t>             safe;     /* per builtin */
+    std::vector<uint32_t>            shared;   /* the globals no think may write */
+    std::vector<size_t>              writer;   /* per entity, while merging */
+    std::vector<uint8_t>             rerun;    /* per think, while merging */
+    size_t                           parallel; /* thinks merged so far */
+    size_t                           serial;   /* and run again */
+};
+
+/* think.cpp */
+qc_think_t *prog_think_create(qc_program_t *prog, size_t threads);
+void        prog_think_safe  (qc_think_t *think, size_t builtin);
+bool        prog_think_run   (qc_think_t *think, const qcint_t *entities, size_t count, size_t flags);
+void        prog_think_delete(qc_think_t *think);
+
+#endif